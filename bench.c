@@ -0,0 +1,1277 @@
+// clang-format off
+#include <SDL3/SDL_log.h>
+#include <SDL3/SDL_stdinc.h>
+#include <SDL3/SDL_timer.h>
+// clang-format on
+
+#include <stdio.h>
+
+#include "integrator.h"
+#include "particle_system.h"
+#include "player.h"
+#include "quantize.h"
+#include "recorder.h"
+#include "spatial_hash.h"
+#include "thread_pool.h"
+
+#define BENCH_MAX_COUNTS (32)
+#define BENCH_DEFAULT_STEPS (100)
+#define BENCH_DT (0.0333333333333f)
+#define BENCH_VERIFY_COUNT (4099)
+#define BENCH_MAX_THETAS (8)
+#define BENCH_OCTREE_SAMPLES (64)
+#define BENCH_NEIGHBORS_SAMPLES (256)
+
+// Benchmark configuration read from the command line
+typedef struct {
+  Uint64 counts[BENCH_MAX_COUNTS];
+  Uint32 counts_count;
+  Uint32 steps;
+  Uint32 workers_count;
+  bool pin_workers;
+  const char* isa;
+  float thetas[BENCH_MAX_THETAS];
+  Uint32 thetas_count;
+  float radius;
+  bool collisions;
+  bool sph;
+  Uint32 terrain;
+  float churn;
+  bool snapshot;
+  const char* state_path;
+  const char* record_path;
+  Uint32 reorder_interval;
+  bool scatter;
+} BenchOptions;
+
+// Octree traversal over the whole store, one chunk per task
+typedef struct {
+  SPS_ParticleSystem* ps;
+  SPS_OctreeGravity gravity;
+  float* force[3];
+} OctreeBenchContext;
+
+bool bench_parse_args(BenchOptions* options, int argc, char** argv);
+bool bench_parse_counts(BenchOptions* options, const char* list);
+bool bench_parse_thetas(BenchOptions* options, const char* list);
+void bench_print_usage(const char* program);
+void bench_verify_kernels(void);
+bool bench_run_update(const BenchOptions* options,
+                      SPS_ThreadPool* pool,
+                      Uint64 count,
+                      bool last);
+bool bench_run_octree(const BenchOptions* options,
+                      SPS_ThreadPool* pool,
+                      Uint64 count,
+                      bool last);
+float bench_octree_error(OctreeBenchContext* context);
+void bench_octree_task(void* userdata,
+                       Uint64 first,
+                       Uint64 last,
+                       Uint32 worker);
+bool bench_run_neighbors(const BenchOptions* options,
+                         SPS_ThreadPool* pool,
+                         Uint64 count,
+                         bool last);
+void bench_neighbors_func(void* userdata,
+                          const SPS_Neighbors* neighbors,
+                          Uint32 worker);
+bool bench_run_collisions(const BenchOptions* options,
+                          SPS_ThreadPool* pool,
+                          Uint64 count,
+                          bool last);
+bool bench_run_sph(const BenchOptions* options,
+                   SPS_ThreadPool* pool,
+                   Uint64 count,
+                   bool last);
+bool bench_run_colliders(const BenchOptions* options,
+                         SPS_ThreadPool* pool,
+                         Uint64 count,
+                         bool last);
+float bench_terrain_height(float x, float z);
+bool bench_run_emitters(const BenchOptions* options,
+                        SPS_ThreadPool* pool,
+                        Uint64 count,
+                        bool last);
+bool bench_run_snapshot(const BenchOptions* options,
+                        SPS_ThreadPool* pool,
+                        Uint64 count,
+                        bool last);
+bool bench_run_state(const BenchOptions* options,
+                     SPS_ThreadPool* pool,
+                     Uint64 count,
+                     bool last);
+bool bench_run_record(const BenchOptions* options,
+                      SPS_ThreadPool* pool,
+                      Uint64 count,
+                      bool last);
+bool bench_replay_trajectory(const char* path,
+                             SPS_ThreadPool* pool,
+                             const SPS_Particles* particles,
+                             Uint64* frames_count,
+                             float* max_error,
+                             double* seconds);
+bool bench_run_scatter(SPS_ThreadPool* pool, Uint64 count, bool last);
+double bench_seconds_since(Uint64 start);
+
+int main(int argc, char** argv) {
+  BenchOptions options = {
+      .counts = {1000, 10000, 100000, 1000000},
+      .counts_count = 4,
+      .steps = BENCH_DEFAULT_STEPS,
+  };
+  if (!bench_parse_args(&options, argc, argv)) {
+    bench_print_usage(argv[0]);
+    return 1;
+  }
+
+  SPS_IntegratorInit();
+  if (options.isa != NULL) {
+    bool found = false;
+    for (int isa = 0; isa < SPS_ISA_COUNT && !found; isa++) {
+      if (SDL_strcmp(options.isa, SPS_IsaName((SPS_Isa)isa)) == 0) {
+        found = SPS_IntegratorSetIsa((SPS_Isa)isa);
+      }
+    }
+
+    if (!found) {
+      SDL_Log("Kernel %s is not supported by this CPU", options.isa);
+      return 1;
+    }
+  }
+
+  SPS_ThreadPool pool;
+  if (!SPS_ThreadPoolLoad(&pool, options.workers_count, options.pin_workers)) {
+    return 1;
+  }
+
+  // Results go to stdout as JSON, SDL_Log output goes to stderr
+  printf("{\n");
+  printf("  \"isa\": \"%s\",\n", SPS_IsaName(SPS_IntegratorGetIsa()));
+  printf("  \"workers\": %u,\n", SPS_ThreadPoolWorkers(&pool));
+  printf("  \"steps\": %u,\n", options.steps);
+  printf("  \"reorder_interval\": %u,\n", options.reorder_interval);
+  bench_verify_kernels();
+  printf("  \"update\": [\n");
+  for (Uint32 i = 0; i < options.counts_count; i++) {
+    bool last = i + 1 == options.counts_count;
+    if (!bench_run_update(&options, &pool, options.counts[i], last)) {
+      SPS_ThreadPoolDestroy(&pool);
+      return 1;
+    }
+  }
+  bool more = options.thetas_count > 0 || options.radius > 0.0f ||
+              options.collisions || options.sph || options.terrain > 0 ||
+              options.churn > 0.0f || options.snapshot ||
+              options.state_path != NULL || options.record_path != NULL ||
+              options.scatter;
+  printf("  ]%s\n", more ? "," : "");
+
+  // Barnes-Hut build and traversal for every count and opening angle
+  if (options.thetas_count > 0) {
+    printf("  \"octree\": [\n");
+    for (Uint32 i = 0; i < options.counts_count; i++) {
+      bool last = i + 1 == options.counts_count;
+      if (!bench_run_octree(&options, &pool, options.counts[i], last)) {
+        SPS_ThreadPoolDestroy(&pool);
+        return 1;
+      }
+    }
+    bool more = options.radius > 0.0f || options.collisions || options.sph ||
+                options.terrain > 0 || options.churn > 0.0f ||
+                options.snapshot || options.state_path != NULL ||
+                options.record_path != NULL || options.scatter;
+    printf("  ]%s\n", more ? "," : "");
+  }
+
+  // Fixed radius neighbor search for every count
+  if (options.radius > 0.0f) {
+    printf("  \"neighbors\": [\n");
+    for (Uint32 i = 0; i < options.counts_count; i++) {
+      bool last = i + 1 == options.counts_count;
+      if (!bench_run_neighbors(&options, &pool, options.counts[i], last)) {
+        SPS_ThreadPoolDestroy(&pool);
+        return 1;
+      }
+    }
+    bool more = options.collisions || options.sph || options.terrain > 0 ||
+                options.churn > 0.0f || options.snapshot ||
+                options.state_path != NULL || options.record_path != NULL ||
+                options.scatter;
+    printf("  ]%s\n", more ? "," : "");
+  }
+
+  // Updates with sphere collisions resolved after every step
+  if (options.collisions) {
+    printf("  \"collisions\": [\n");
+    for (Uint32 i = 0; i < options.counts_count; i++) {
+      bool last = i + 1 == options.counts_count;
+      if (!bench_run_collisions(&options, &pool, options.counts[i], last)) {
+        SPS_ThreadPoolDestroy(&pool);
+        return 1;
+      }
+    }
+    bool more = options.sph || options.terrain > 0 || options.churn > 0.0f ||
+                options.snapshot || options.state_path != NULL ||
+                options.record_path != NULL || options.scatter;
+    printf("  ]%s\n", more ? "," : "");
+  }
+
+  // Fluid steps, every update split into the substeps the solver needs
+  if (options.sph) {
+    printf("  \"sph\": [\n");
+    for (Uint32 i = 0; i < options.counts_count; i++) {
+      bool last = i + 1 == options.counts_count;
+      if (!bench_run_sph(&options, &pool, options.counts[i], last)) {
+        SPS_ThreadPoolDestroy(&pool);
+        return 1;
+      }
+    }
+    bool more = options.terrain > 0 || options.churn > 0.0f ||
+                options.snapshot || options.state_path != NULL ||
+                options.record_path != NULL || options.scatter;
+    printf("  ]%s\n", more ? "," : "");
+  }
+
+  // Updates over a triangulated height field on top of the ground plane
+  if (options.terrain > 0) {
+    printf("  \"colliders\": [\n");
+    for (Uint32 i = 0; i < options.counts_count; i++) {
+      bool last = i + 1 == options.counts_count;
+      if (!bench_run_colliders(&options, &pool, options.counts[i], last)) {
+        SPS_ThreadPoolDestroy(&pool);
+        return 1;
+      }
+    }
+    bool more = options.churn > 0.0f || options.snapshot ||
+                options.state_path != NULL || options.record_path != NULL ||
+                options.scatter;
+    printf("  ]%s\n", more ? "," : "");
+  }
+
+  // Emitter fed populations settling below the initial capacity, colliding
+  // with --collisions
+  if (options.churn > 0.0f) {
+    printf("  \"emitters\": [\n");
+    for (Uint32 i = 0; i < options.counts_count; i++) {
+      bool last = i + 1 == options.counts_count;
+      if (!bench_run_emitters(&options, &pool, options.counts[i], last)) {
+        SPS_ThreadPoolDestroy(&pool);
+        return 1;
+      }
+    }
+    bool more = options.snapshot || options.state_path != NULL ||
+                options.record_path != NULL || options.scatter;
+    printf("  ]%s\n", more ? "," : "");
+  }
+
+  // Quantized render snapshots of a moving and then of a still state
+  if (options.snapshot) {
+    printf("  \"snapshot\": [\n");
+    for (Uint32 i = 0; i < options.counts_count; i++) {
+      bool last = i + 1 == options.counts_count;
+      if (!bench_run_snapshot(&options, &pool, options.counts[i], last)) {
+        SPS_ThreadPoolDestroy(&pool);
+        return 1;
+      }
+    }
+    bool more = options.state_path != NULL || options.record_path != NULL ||
+                options.scatter;
+    printf("  ]%s\n", more ? "," : "");
+  }
+
+  // State files written then restored through a mapping
+  if (options.state_path != NULL) {
+    printf("  \"state\": [\n");
+    for (Uint32 i = 0; i < options.counts_count; i++) {
+      bool last = i + 1 == options.counts_count;
+      if (!bench_run_state(&options, &pool, options.counts[i], last)) {
+        SPS_ThreadPoolDestroy(&pool);
+        return 1;
+      }
+    }
+    bool more = options.record_path != NULL || options.scatter;
+    printf("  ]%s\n", more ? "," : "");
+  }
+
+  // Trajectories recorded in the background while the update runs
+  if (options.record_path != NULL) {
+    printf("  \"record\": [\n");
+    for (Uint32 i = 0; i < options.counts_count; i++) {
+      bool last = i + 1 == options.counts_count;
+      if (!bench_run_record(&options, &pool, options.counts[i], last)) {
+        SPS_ThreadPoolDestroy(&pool);
+        return 1;
+      }
+    }
+    printf("  ]%s\n", options.scatter ? "," : "");
+  }
+
+  // Shaped initial positions, in parallel and again serially to compare
+  if (options.scatter) {
+    printf("  \"scatter\": [\n");
+    for (Uint32 i = 0; i < options.counts_count; i++) {
+      bool last = i + 1 == options.counts_count;
+      if (!bench_run_scatter(&pool, options.counts[i], last)) {
+        SPS_ThreadPoolDestroy(&pool);
+        return 1;
+      }
+    }
+    printf("  ]\n");
+  }
+  printf("}\n");
+
+  SPS_ThreadPoolDestroy(&pool);
+  return 0;
+}
+
+bool bench_parse_args(BenchOptions* options, int argc, char** argv) {
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+    if (SDL_strcmp(arg, "--pin") == 0) {
+      options->pin_workers = true;
+      continue;
+    }
+
+    if (SDL_strcmp(arg, "--collisions") == 0) {
+      options->collisions = true;
+      continue;
+    }
+
+    if (SDL_strcmp(arg, "--sph") == 0) {
+      options->sph = true;
+      continue;
+    }
+
+    if (SDL_strcmp(arg, "--snapshot") == 0) {
+      options->snapshot = true;
+      continue;
+    }
+
+    if (SDL_strcmp(arg, "--scatter") == 0) {
+      options->scatter = true;
+      continue;
+    }
+
+    if (value == NULL) {
+      return false;
+    }
+
+    if (SDL_strcmp(arg, "--steps") == 0) {
+      options->steps = (Uint32)SDL_strtoul(value, NULL, 10);
+    } else if (SDL_strcmp(arg, "--workers") == 0) {
+      options->workers_count = (Uint32)SDL_strtoul(value, NULL, 10);
+    } else if (SDL_strcmp(arg, "--isa") == 0) {
+      options->isa = value;
+    } else if (SDL_strcmp(arg, "--thetas") == 0) {
+      if (!bench_parse_thetas(options, value)) {
+        return false;
+      }
+    } else if (SDL_strcmp(arg, "--state") == 0) {
+      options->state_path = value;
+    } else if (SDL_strcmp(arg, "--record") == 0) {
+      options->record_path = value;
+    } else if (SDL_strcmp(arg, "--reorder") == 0) {
+      options->reorder_interval = (Uint32)SDL_strtoul(value, NULL, 10);
+    } else if (SDL_strcmp(arg, "--churn") == 0) {
+      options->churn = SDL_strtod(value, NULL);
+    } else if (SDL_strcmp(arg, "--terrain") == 0) {
+      options->terrain = (Uint32)SDL_strtoul(value, NULL, 10);
+    } else if (SDL_strcmp(arg, "--radius") == 0) {
+      options->radius = (float)SDL_strtod(value, NULL);
+    } else if (SDL_strcmp(arg, "--counts") == 0) {
+      if (!bench_parse_counts(options, value)) {
+        return false;
+      }
+    } else {
+      return false;
+    }
+    i++;
+  }
+
+  return options->steps > 0 && options->counts_count > 0;
+}
+
+bool bench_parse_counts(BenchOptions* options, const char* list) {
+  options->counts_count = 0;
+  const char* cursor = list;
+  while (*cursor != '\0') {
+    char* end = NULL;
+    Uint64 count = SDL_strtoull(cursor, &end, 10);
+    if (end == cursor || count == 0 ||
+        options->counts_count >= BENCH_MAX_COUNTS) {
+      return false;
+    }
+
+    options->counts[options->counts_count++] = count;
+    cursor = *end == ',' ? end + 1 : end;
+  }
+
+  return options->counts_count > 0;
+}
+
+bool bench_parse_thetas(BenchOptions* options, const char* list) {
+  options->thetas_count = 0;
+  const char* cursor = list;
+  while (*cursor != '\0') {
+    char* end = NULL;
+    double theta = SDL_strtod(cursor, &end);
+    if (end == cursor || theta <= 0.0 ||
+        options->thetas_count >= BENCH_MAX_THETAS) {
+      return false;
+    }
+
+    options->thetas[options->thetas_count++] = (float)theta;
+    cursor = *end == ',' ? end + 1 : end;
+  }
+
+  return options->thetas_count > 0;
+}
+
+void bench_print_usage(const char* program) {
+  SDL_Log(
+      "usage: %s [--steps N] [--counts N,N,...] [--workers N] [--pin] "
+      "[--isa scalar|sse4.2|avx2|avx512] [--thetas T,T,...] [--radius R] "
+      "[--collisions] [--sph] [--terrain CELLS] [--churn RATE] [--snapshot] "
+      "[--state PATH] [--record PATH] [--reorder STEPS] [--scatter]",
+      program);
+}
+
+void bench_verify_kernels(void) {
+  // Every supported kernel against the scalar reference on the same state
+  int last_isa = SPS_ISA_SCALAR;
+  for (int isa = 0; isa < SPS_ISA_COUNT; isa++) {
+    if (SPS_IntegratorGetKernel((SPS_Isa)isa) != NULL) {
+      last_isa = isa;
+    }
+  }
+
+  printf("  \"kernels\": [\n");
+  for (int isa = 0; isa < SPS_ISA_COUNT; isa++) {
+    SPS_IntegrateFunc kernel = SPS_IntegratorGetKernel((SPS_Isa)isa);
+    if (kernel == NULL) {
+      continue;
+    }
+
+    SPS_ParticleSystem systems[2] = {0};
+    SPS_IntegrateBatch batches[2];
+    float* force[2][3];
+    for (int s = 0; s < 2; s++) {
+      if (!SPS_ParticleSystemInit(&systems[s], BENCH_VERIFY_COUNT)) {
+        return;
+      }
+
+      SPS_Particles* p = &systems[s].particles;
+      for (int c = 0; c < 3; c++) {
+        force[s][c] = SPS_PARTICLES_CHANNEL(p, systems[s].force_channels[c]);
+      }
+
+      batches[s] = (SPS_IntegrateBatch){
+          .position = {SPS_PARTICLES_CHANNEL(p, SPS_CHANNEL_POSITION_X),
+                       SPS_PARTICLES_CHANNEL(p, SPS_CHANNEL_POSITION_Y),
+                       SPS_PARTICLES_CHANNEL(p, SPS_CHANNEL_POSITION_Z)},
+          .velocity = {SPS_PARTICLES_CHANNEL(p, SPS_CHANNEL_VELOCITY_X),
+                       SPS_PARTICLES_CHANNEL(p, SPS_CHANNEL_VELOCITY_Y),
+                       SPS_PARTICLES_CHANNEL(p, SPS_CHANNEL_VELOCITY_Z)},
+          .force = {force[s][0], force[s][1], force[s][2]},
+          .mass = SPS_PARTICLES_CHANNEL(p, SPS_CHANNEL_MASS),
+          .dt = BENCH_DT,
+      };
+    }
+
+    SPS_IntegrateFunc scalar = SPS_IntegratorGetKernel(SPS_ISA_SCALAR);
+    for (Uint32 step = 0; step < 10; step++) {
+      for (int s = 0; s < 2; s++) {
+        SPS_ForcePipelineApply(&systems[s].forces, &systems[s].particles,
+                               force[s], 0, BENCH_VERIFY_COUNT);
+      }
+      scalar(&batches[0], 0, BENCH_VERIFY_COUNT);
+      kernel(&batches[1], 0, BENCH_VERIFY_COUNT);
+    }
+
+    float max_error = 0.0f;
+    for (Uint32 c = 0; c < SPS_CHANNEL_BUILTIN_COUNT; c++) {
+      const float* a = systems[0].particles.channels[c].data;
+      const float* b = systems[1].particles.channels[c].data;
+      for (Uint64 i = 0; i < BENCH_VERIFY_COUNT; i++) {
+        max_error = SDL_max(max_error, SDL_fabsf(a[i] - b[i]));
+      }
+    }
+
+    printf("    {\"isa\": \"%s\", \"max_abs_error\": %g}%s\n",
+           SPS_IsaName((SPS_Isa)isa), max_error,
+           isa == last_isa ? "" : ",");
+    SPS_ParticleSystemQuit(&systems[0]);
+    SPS_ParticleSystemQuit(&systems[1]);
+  }
+  printf("  ],\n");
+}
+
+bool bench_run_update(const BenchOptions* options,
+                      SPS_ThreadPool* pool,
+                      Uint64 count,
+                      bool last) {
+  SPS_ParticleSystem ps = {0};
+  if (!SPS_ParticleSystemInit(&ps, count)) {
+    SDL_Log("Couldn't initialize %" SDL_PRIu64 " particles", count);
+    return false;
+  }
+  ps.pool = pool;
+  ps.reorder_interval = options->reorder_interval;
+
+  // One untimed step to fault in every page
+  SPS_ParticleSystemUpdate(&ps, BENCH_DT);
+
+  Uint64 start = SDL_GetPerformanceCounter();
+  for (Uint32 step = 0; step < options->steps; step++) {
+    SPS_ParticleSystemUpdate(&ps, BENCH_DT);
+  }
+  double seconds = bench_seconds_since(start);
+
+  double particle_steps = (double)count * options->steps;
+  printf(
+      "    {\"particles\": %" SDL_PRIu64
+      ", \"ns_per_particle_step\": %.4f, \"steps_per_sec\": %.2f, "
+      "\"memory_bytes\": %" SDL_PRIu64 "}%s\n",
+      count, seconds * 1e9 / particle_steps, options->steps / seconds,
+      SPS_ParticleSystemMemorySize(&ps), last ? "" : ",");
+
+  SPS_ParticleSystemQuit(&ps);
+  return true;
+}
+
+bool bench_run_octree(const BenchOptions* options,
+                      SPS_ThreadPool* pool,
+                      Uint64 count,
+                      bool last) {
+  SPS_ParticleSystem ps = {0};
+  if (!SPS_ParticleSystemInit(&ps, count)) {
+    SDL_Log("Couldn't initialize %" SDL_PRIu64 " particles", count);
+    return false;
+  }
+  ps.pool = pool;
+
+  OctreeBenchContext context = {
+      .ps = &ps,
+      .gravity = {.gravity_constant = 1.0f, .softening = 0.01f},
+  };
+  for (int c = 0; c < 3; c++) {
+    context.force[c] =
+        SPS_PARTICLES_CHANNEL(&ps.particles, ps.force_channels[c]);
+  }
+
+  // Building does not depend on theta, it is timed once per count
+  bool built = SPS_OctreeBuild(&ps.octree, &ps.particles, pool);
+  Uint64 start = SDL_GetPerformanceCounter();
+  for (Uint32 step = 0; step < options->steps && built; step++) {
+    built = SPS_OctreeBuild(&ps.octree, &ps.particles, pool);
+  }
+  double build_seconds = bench_seconds_since(start) / options->steps;
+  if (!built) {
+    SPS_ParticleSystemQuit(&ps);
+    return false;
+  }
+
+  for (Uint32 t = 0; t < options->thetas_count; t++) {
+    context.gravity.theta = options->thetas[t];
+    start = SDL_GetPerformanceCounter();
+    for (Uint32 step = 0; step < options->steps; step++) {
+      SPS_ThreadPoolParallelFor(pool, 0, count, SPS_PARTICLES_CHUNK_SIZE,
+                                bench_octree_task, &context);
+    }
+    double traverse_seconds = bench_seconds_since(start) / options->steps;
+
+    bool last_row = last && t + 1 == options->thetas_count;
+    printf(
+        "    {\"particles\": %" SDL_PRIu64
+        ", \"theta\": %.3f, \"nodes\": %" SDL_PRIu64
+        ", \"build_ms\": %.4f, \"traverse_ms\": %.4f, "
+        "\"max_rel_error\": %g}%s\n",
+        count, context.gravity.theta, ps.octree.nodes_count,
+        build_seconds * 1e3, traverse_seconds * 1e3,
+        bench_octree_error(&context), last_row ? "" : ",");
+  }
+
+  SPS_ParticleSystemQuit(&ps);
+  return true;
+}
+
+float bench_octree_error(OctreeBenchContext* context) {
+  // Direct summation on a few particles as the reference
+  const SPS_Particles* particles = &context->ps->particles;
+  const float* px = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_X);
+  const float* py = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_Y);
+  const float* pz = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_Z);
+  const float* mass = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_MASS);
+  const double eps2 =
+      (double)context->gravity.softening * context->gravity.softening;
+  Uint64 samples = SDL_min(particles->count, BENCH_OCTREE_SAMPLES);
+  float max_error = 0.0f;
+  for (Uint64 i = 0; i < samples; i++) {
+    double f[3] = {0.0, 0.0, 0.0};
+    for (Uint64 j = 0; j < particles->count; j++) {
+      double d[3] = {px[j] - px[i], py[j] - py[i], pz[j] - pz[i]};
+      double r2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2] + eps2;
+      double k = j == i ? 0.0 : mass[i] * mass[j] / (r2 * SDL_sqrt(r2));
+      for (int c = 0; c < 3; c++) {
+        f[c] += k * d[c];
+      }
+    }
+
+    double error = 0.0;
+    double norm = 0.0;
+    for (int c = 0; c < 3; c++) {
+      f[c] *= context->gravity.gravity_constant;
+      error += (context->force[c][i] - f[c]) * (context->force[c][i] - f[c]);
+      norm += f[c] * f[c];
+    }
+    if (norm > 0.0) {
+      max_error = SDL_max(max_error, (float)SDL_sqrt(error / norm));
+    }
+  }
+
+  return max_error;
+}
+
+void bench_octree_task(void* userdata,
+                       Uint64 first,
+                       Uint64 last,
+                       Uint32 worker) {
+  (void)worker;
+  OctreeBenchContext* context = userdata;
+  for (int c = 0; c < 3; c++) {
+    SDL_memset(context->force[c] + first, 0, sizeof(float) * (last - first));
+  }
+  SPS_OctreeForces(&context->ps->octree, &context->gravity,
+                   &context->ps->particles, context->force, first, last);
+}
+
+bool bench_run_neighbors(const BenchOptions* options,
+                         SPS_ThreadPool* pool,
+                         Uint64 count,
+                         bool last) {
+  SPS_ParticleSystem ps = {0};
+  SPS_SpatialHash hash;
+  SPS_SpatialHashLoad(&hash);
+  Uint32* found = SDL_calloc(count, sizeof(Uint32));
+  if (found == NULL || !SPS_ParticleSystemInit(&ps, count)) {
+    SDL_Log("Couldn't initialize %" SDL_PRIu64 " particles", count);
+    SDL_free(found);
+    return false;
+  }
+
+  bool built = true;
+  Uint64 start = SDL_GetPerformanceCounter();
+  for (Uint32 step = 0; step < options->steps && built; step++) {
+    built = SPS_SpatialHashBuild(&hash, &ps.particles, pool, options->radius);
+  }
+  double build_seconds = bench_seconds_since(start) / options->steps;
+
+  start = SDL_GetPerformanceCounter();
+  for (Uint32 step = 0; step < options->steps && built; step++) {
+    SDL_memset(found, 0, sizeof(Uint32) * count);
+    built = SPS_SpatialHashForEach(&hash, pool, options->radius,
+                                   bench_neighbors_func, found);
+  }
+  double query_seconds = bench_seconds_since(start) / options->steps;
+  if (!built) {
+    SPS_SpatialHashDestroy(&hash);
+    SPS_ParticleSystemQuit(&ps);
+    SDL_free(found);
+    return false;
+  }
+
+  // Brute force counts on a few particles as the reference
+  const SPS_Particles* p = &ps.particles;
+  const float* px = SPS_PARTICLES_CHANNEL(p, SPS_CHANNEL_POSITION_X);
+  const float* py = SPS_PARTICLES_CHANNEL(p, SPS_CHANNEL_POSITION_Y);
+  const float* pz = SPS_PARTICLES_CHANNEL(p, SPS_CHANNEL_POSITION_Z);
+  Uint64 mismatches = 0;
+  Uint64 total = 0;
+  for (Uint64 i = 0; i < count; i++) {
+    total += found[i];
+    if (i >= BENCH_NEIGHBORS_SAMPLES) {
+      continue;
+    }
+
+    Uint32 expected = 0;
+    for (Uint64 j = 0; j < count; j++) {
+      float dx = px[j] - px[i];
+      float dy = py[j] - py[i];
+      float dz = pz[j] - pz[i];
+      float r2 = dx * dx + dy * dy + dz * dz;
+      expected += j != i && r2 < options->radius * options->radius;
+    }
+    mismatches += expected != found[i];
+  }
+
+  printf(
+      "    {\"particles\": %" SDL_PRIu64
+      ", \"radius\": %.3f, \"build_ms\": %.4f, \"query_ms\": %.4f, "
+      "\"neighbors_per_particle\": %.2f, \"mismatches\": %" SDL_PRIu64
+      ", \"memory_bytes\": %" SDL_PRIu64 "}%s\n",
+      count, options->radius, build_seconds * 1e3, query_seconds * 1e3,
+      (double)total / count, mismatches, SPS_SpatialHashMemorySize(&hash),
+      last ? "" : ",");
+
+  SPS_SpatialHashDestroy(&hash);
+  SPS_ParticleSystemQuit(&ps);
+  SDL_free(found);
+  return true;
+}
+
+void bench_neighbors_func(void* userdata,
+                          const SPS_Neighbors* neighbors,
+                          Uint32 worker) {
+  (void)worker;
+  Uint32* found = userdata;
+  found[neighbors->particle] += neighbors->count;
+}
+
+bool bench_run_collisions(const BenchOptions* options,
+                          SPS_ThreadPool* pool,
+                          Uint64 count,
+                          bool last) {
+  SPS_ParticleSystem ps = {0};
+  if (!SPS_ParticleSystemInit(&ps, count)) {
+    SDL_Log("Couldn't initialize %" SDL_PRIu64 " particles", count);
+    return false;
+  }
+  ps.pool = pool;
+  ps.reorder_interval = options->reorder_interval;
+  SPS_ParticleSystemEnableCollisions(&ps, ps.collisions.params);
+
+  // The first step always sorts from scratch, it is not timed
+  SPS_ParticleSystemUpdate(&ps, BENCH_DT);
+
+  Uint64 pairs = 0;
+  Uint64 moves = 0;
+  Uint32 full_sorts = 0;
+  Uint64 start = SDL_GetPerformanceCounter();
+  for (Uint32 step = 0; step < options->steps; step++) {
+    SPS_ParticleSystemUpdate(&ps, BENCH_DT);
+    pairs += ps.collisions.pairs_count;
+    moves += ps.collisions.sort_moves;
+    full_sorts += ps.collisions.full_sort;
+  }
+  double seconds = bench_seconds_since(start);
+
+  double particle_steps = (double)count * options->steps;
+  printf(
+      "    {\"particles\": %" SDL_PRIu64
+      ", \"ns_per_particle_step\": %.4f, \"pairs_per_step\": %.1f, "
+      "\"sort_moves_per_step\": %.1f, \"full_sorts\": %u, "
+      "\"memory_bytes\": %" SDL_PRIu64 "}%s\n",
+      count, seconds * 1e9 / particle_steps, (double)pairs / options->steps,
+      (double)moves / options->steps, full_sorts,
+      SPS_ParticleSystemMemorySize(&ps), last ? "" : ",");
+
+  SPS_ParticleSystemQuit(&ps);
+  return true;
+}
+
+bool bench_run_sph(const BenchOptions* options,
+                   SPS_ThreadPool* pool,
+                   Uint64 count,
+                   bool last) {
+  SPS_ParticleSystem ps = {0};
+  if (!SPS_ParticleSystemInit(&ps, count)) {
+    SDL_Log("Couldn't initialize %" SDL_PRIu64 " particles", count);
+    return false;
+  }
+  ps.pool = pool;
+  if (!SPS_ParticleSystemEnableSph(&ps, ps.sph.params)) {
+    SPS_ParticleSystemQuit(&ps);
+    return false;
+  }
+
+  Uint32 substeps = (Uint32)SDL_ceilf(BENCH_DT / ps.max_timestep);
+  Uint64 start = SDL_GetPerformanceCounter();
+  for (Uint32 step = 0; step < options->steps; step++) {
+    SPS_ParticleSystemUpdate(&ps, BENCH_DT);
+  }
+  double seconds = bench_seconds_since(start);
+
+  // Compression of the fluid after the last step
+  const float* density =
+      SPS_PARTICLES_CHANNEL(&ps.particles, ps.sph.density_channel);
+  double mean_density = 0.0;
+  float max_density = 0.0f;
+  for (Uint64 i = 0; i < count; i++) {
+    mean_density += density[i];
+    max_density = SDL_max(max_density, density[i]);
+  }
+  mean_density /= count;
+
+  double particle_substeps = (double)count * options->steps * substeps;
+  printf(
+      "    {\"particles\": %" SDL_PRIu64
+      ", \"substeps\": %u, \"ns_per_particle_substep\": %.4f, "
+      "\"mean_density_ratio\": %.4f, \"max_density_ratio\": %.4f, "
+      "\"memory_bytes\": %" SDL_PRIu64 "}%s\n",
+      count, substeps, seconds * 1e9 / particle_substeps,
+      mean_density / ps.sph.params.rest_density,
+      max_density / ps.sph.params.rest_density,
+      SPS_ParticleSystemMemorySize(&ps), last ? "" : ",");
+
+  SPS_ParticleSystemQuit(&ps);
+  return true;
+}
+
+bool bench_run_colliders(const BenchOptions* options,
+                         SPS_ThreadPool* pool,
+                         Uint64 count,
+                         bool last) {
+  SPS_ParticleSystem ps = {0};
+  if (!SPS_ParticleSystemInit(&ps, count)) {
+    SDL_Log("Couldn't initialize %" SDL_PRIu64 " particles", count);
+    return false;
+  }
+  ps.pool = pool;
+
+  // Height field over the spawn area, two triangles per cell
+  const Uint32 cells = options->terrain;
+  const float cell_size = 20.0f / cells;
+  for (Uint32 z = 0; z < cells; z++) {
+    for (Uint32 x = 0; x < cells; x++) {
+      SPS_Vec3 corners[4];
+      for (int c = 0; c < 4; c++) {
+        float cx = -10.0f + (x + (c & 1)) * cell_size;
+        float cz = -10.0f + (z + (c >> 1)) * cell_size;
+        SPS_Vec3Make(cx, bench_terrain_height(cx, cz), cz, corners[c]);
+      }
+      SPS_CollidersAddTriangle(&ps.colliders, corners[0], corners[2],
+                               corners[1]);
+      SPS_CollidersAddTriangle(&ps.colliders, corners[1], corners[2],
+                               corners[3]);
+    }
+  }
+
+  // Spawn everything above the surface so only tunneling ends up under it
+  float* spawn_y = SPS_PARTICLES_CHANNEL(&ps.particles, SPS_CHANNEL_POSITION_Y);
+  for (Uint64 i = 0; i < count; i++) {
+    spawn_y[i] += 4.0f;
+  }
+
+  Uint64 start = SDL_GetPerformanceCounter();
+  bool built = SPS_CollidersBuild(&ps.colliders);
+  double build_seconds = bench_seconds_since(start);
+  if (!built) {
+    SPS_ParticleSystemQuit(&ps);
+    return false;
+  }
+
+  start = SDL_GetPerformanceCounter();
+  for (Uint32 step = 0; step < options->steps; step++) {
+    SPS_ParticleSystemUpdate(&ps, BENCH_DT);
+  }
+  double seconds = bench_seconds_since(start);
+
+  // Particles that ended well below the surface tunneled through it
+  const float* px =
+      SPS_PARTICLES_CHANNEL(&ps.particles, SPS_CHANNEL_POSITION_X);
+  const float* py =
+      SPS_PARTICLES_CHANNEL(&ps.particles, SPS_CHANNEL_POSITION_Y);
+  const float* pz =
+      SPS_PARTICLES_CHANNEL(&ps.particles, SPS_CHANNEL_POSITION_Z);
+  Uint64 tunneled = 0;
+  for (Uint64 i = 0; i < count; i++) {
+    bool inside = px[i] > -10.0f && px[i] < 10.0f && pz[i] > -10.0f &&
+                  pz[i] < 10.0f;
+    tunneled += inside && py[i] < bench_terrain_height(px[i], pz[i]) - 0.25f;
+  }
+
+  double particle_steps = (double)count * options->steps;
+  printf(
+      "    {\"particles\": %" SDL_PRIu64
+      ", \"triangles\": %u, \"nodes\": %u, \"build_ms\": %.4f, "
+      "\"ns_per_particle_step\": %.4f, \"tunneled\": %" SDL_PRIu64 "}%s\n",
+      count, ps.colliders.shapes_count, ps.colliders.nodes_count,
+      build_seconds * 1e3, seconds * 1e9 / particle_steps, tunneled,
+      last ? "" : ",");
+
+  SPS_ParticleSystemQuit(&ps);
+  return true;
+}
+
+float bench_terrain_height(float x, float z) {
+  return 2.0f + SDL_sinf(x) * SDL_cosf(z);
+}
+
+bool bench_run_emitters(const BenchOptions* options,
+                        SPS_ThreadPool* pool,
+                        Uint64 count,
+                        bool last) {
+  SPS_ParticleSystem ps = {0};
+  if (!SPS_ParticleSystemInit(&ps, count)) {
+    SDL_Log("Couldn't initialize %" SDL_PRIu64 " particles", count);
+    return false;
+  }
+  ps.pool = pool;
+  if (options->collisions) {
+    SPS_ParticleSystemEnableCollisions(&ps, ps.collisions.params);
+  }
+
+  // Lifetimes settle the population at three quarters of the capacity
+  SPS_Emitter emitter;
+  SPS_EmitterLoad(&emitter);
+  emitter.shape = SPS_EMITTER_SPHERE;
+  emitter.extent[0] = 1.0f;
+  emitter.rate = options->churn;
+  emitter.lifetime = 0.75f * count / options->churn;
+  emitter.lifetime_jitter = 0.0f;
+  SPS_ParticleSystemClear(&ps);
+  if (!SPS_ParticleSystemAddEmitter(&ps, emitter)) {
+    SPS_ParticleSystemQuit(&ps);
+    return false;
+  }
+
+  Uint64 live_steps = 0;
+  Uint64 spawned = 0;
+  Uint64 expired = 0;
+  Uint32 full_sorts = 0;
+  Uint64 start = SDL_GetPerformanceCounter();
+  for (Uint32 step = 0; step < options->steps; step++) {
+    SPS_ParticleSystemUpdate(&ps, BENCH_DT);
+    live_steps += ps.particles.count;
+    spawned += ps.emitters.spawned;
+    expired += ps.emitters.expired;
+    full_sorts += ps.collisions.full_sort;
+  }
+  double seconds = bench_seconds_since(start);
+
+  // The live range must be dense, nothing expired may be left in it
+  const float* age = SPS_PARTICLES_CHANNEL(&ps.particles, SPS_CHANNEL_AGE);
+  const float* lifetime =
+      SPS_PARTICLES_CHANNEL(&ps.particles, SPS_CHANNEL_LIFETIME);
+  Uint64 stale = 0;
+  for (Uint64 i = 0; i < ps.particles.count; i++) {
+    stale += lifetime[i] <= 0.0f || age[i] >= lifetime[i];
+  }
+
+  printf("    {\"capacity\": %" SDL_PRIu64 ", \"live\": %" SDL_PRIu64
+         ", \"spawned\": %" SDL_PRIu64 ", \"expired\": %" SDL_PRIu64
+         ", \"ns_per_live_particle_step\": %.4f, \"stale\": %" SDL_PRIu64
+         ", \"full_sorts\": %u}%s\n",
+         count, ps.particles.count, spawned, expired,
+         live_steps > 0 ? seconds * 1e9 / live_steps : 0.0, stale, full_sorts,
+         last ? "" : ",");
+
+  SPS_ParticleSystemQuit(&ps);
+  return true;
+}
+
+bool bench_run_snapshot(const BenchOptions* options,
+                        SPS_ThreadPool* pool,
+                        Uint64 count,
+                        bool last) {
+  SPS_ParticleSystem ps = {0};
+  if (!SPS_ParticleSystemInit(&ps, count)) {
+    SDL_Log("Couldn't initialize %" SDL_PRIu64 " particles", count);
+    return false;
+  }
+  ps.pool = pool;
+
+  // Every step moves the particles, each snapshot compares to the last one
+  SPS_ParticleSnapshot snapshots[2] = {0};
+  bool ok = SPS_ParticleSystemSnapshot(&ps, &snapshots[0], NULL);
+  double seconds = 0.0;
+  for (Uint32 step = 0; step < options->steps && ok; step++) {
+    SPS_ParticleSystemUpdate(&ps, BENCH_DT);
+    Uint64 start = SDL_GetPerformanceCounter();
+    ok = SPS_ParticleSystemSnapshot(&ps, &snapshots[(step + 1) % 2],
+                                    &snapshots[step % 2]);
+    seconds += bench_seconds_since(start);
+  }
+
+  // A state that didn't move must not leave any chunk to upload
+  const SPS_ParticleSnapshot* moved = &snapshots[options->steps % 2];
+  SPS_ParticleSnapshot* still = &snapshots[(options->steps + 1) % 2];
+  ps.steps++;
+  ok = ok && SPS_ParticleSystemSnapshot(&ps, still, moved);
+  Uint64 changed_chunks = 0;
+  const Uint64 chunks =
+      (count + SPS_PARTICLES_CHUNK_SIZE - 1) / SPS_PARTICLES_CHUNK_SIZE;
+  for (Uint64 chunk = 0; chunk < chunks && ok; chunk++) {
+    changed_chunks += still->chunk_steps[chunk] > moved->step;
+  }
+
+  // Decoded against the float positions, and the selected kernel against
+  // the scalar one
+  const SPS_Particles* particles = &ps.particles;
+  const float* const position[3] = {
+      SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_X),
+      SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_Y),
+      SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_Z),
+  };
+  const float* scale = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_SCALE);
+  float max_error = 0.0f;
+  float max_scale_error = 0.0f;
+  for (Uint64 i = 0; i < count && ok; i++) {
+    const SPS_QuantizedInstance* instance = &still->instances[i];
+    for (int c = 0; c < 3; c++) {
+      float decoded = still->bounds.origin[c] +
+                      instance->position[c] * still->bounds.step[c];
+      max_error = SDL_max(max_error, SDL_fabsf(decoded - position[c][i]));
+    }
+    float error = SDL_fabsf(SPS_HalfToFloat(instance->scale) - scale[i]);
+    max_scale_error = SDL_max(max_scale_error, error / scale[i]);
+  }
+  SPS_QuantizedInstance* reference =
+      SDL_malloc(sizeof(SPS_QuantizedInstance) * SDL_max(count, 1));
+  ok = ok && reference != NULL;
+  if (ok) {
+    SPS_QuantizeGetKernel(SPS_ISA_SCALAR)(&still->bounds, position, scale, 0,
+                                          count, reference);
+  }
+  bool kernels_match =
+      ok && SDL_memcmp(reference, still->instances,
+                       sizeof(SPS_QuantizedInstance) * count) == 0;
+
+  if (ok) {
+    printf("    {\"particles\": %" SDL_PRIu64
+           ", \"ns_per_particle\": %.4f, \"bytes_per_particle\": %u"
+           ", \"max_position_error\": %g, \"max_scale_error\": %g"
+           ", \"kernels_match\": %s, \"still_changed_chunks\": %" SDL_PRIu64
+           "}%s\n",
+           count, seconds * 1e9 / ((double)count * options->steps),
+           (unsigned)sizeof(SPS_QuantizedInstance), max_error,
+           max_scale_error, kernels_match ? "true" : "false", changed_chunks,
+           last ? "" : ",");
+  }
+
+  SDL_free(reference);
+  SPS_ParticleSnapshotDestroy(&snapshots[0]);
+  SPS_ParticleSnapshotDestroy(&snapshots[1]);
+  SPS_ParticleSystemQuit(&ps);
+  return ok;
+}
+
+bool bench_run_state(const BenchOptions* options,
+                     SPS_ThreadPool* pool,
+                     Uint64 count,
+                     bool last) {
+  SPS_ParticleSystem saved = {0};
+  SPS_ParticleSystem restored = {0};
+  if (!SPS_ParticleSystemInit(&saved, count) ||
+      !SPS_ParticleSystemInit(&restored, 1)) {
+    SDL_Log("Couldn't initialize %" SDL_PRIu64 " particles", count);
+    SPS_ParticleSystemQuit(&saved);
+    return false;
+  }
+  saved.pool = pool;
+  restored.pool = pool;
+  for (Uint32 step = 0; step < options->steps; step++) {
+    SPS_ParticleSystemUpdate(&saved, BENCH_DT);
+  }
+
+  Uint64 start = SDL_GetPerformanceCounter();
+  bool ok = SPS_ParticleSystemSave(&saved, options->state_path);
+  double write_seconds = bench_seconds_since(start);
+  start = SDL_GetPerformanceCounter();
+  ok = ok && SPS_ParticleSystemRestore(&restored, options->state_path);
+  double restore_seconds = bench_seconds_since(start);
+
+  // The restored state must carry on exactly where the saved one was
+  bool matches = ok && restored.particles.count == count &&
+                 restored.steps == saved.steps;
+  for (Uint32 c = 0; c < saved.particles.channels_count && matches; c++) {
+    matches = SDL_memcmp(saved.particles.channels[c].data,
+                         restored.particles.channels[c].data,
+                         sizeof(float) * count) == 0;
+  }
+  SPS_ParticleSystemUpdate(&saved, BENCH_DT);
+  SPS_ParticleSystemUpdate(&restored, BENCH_DT);
+  for (int c = 0; c < 3 && matches; c++) {
+    matches = SDL_memcmp(SPS_PARTICLES_CHANNEL(&saved.particles, c),
+                         SPS_PARTICLES_CHANNEL(&restored.particles, c),
+                         sizeof(float) * count) == 0;
+  }
+
+  if (ok) {
+    printf("    {\"particles\": %" SDL_PRIu64 ", \"bytes\": %" SDL_PRIu64
+           ", \"write_ms\": %.3f, \"restore_ms\": %.3f, \"matches\": %s}%s\n",
+           count,
+           (Uint64)sizeof(float) * count * saved.particles.channels_count,
+           write_seconds * 1e3, restore_seconds * 1e3,
+           matches ? "true" : "false", last ? "" : ",");
+  }
+
+  SPS_ParticleSystemQuit(&saved);
+  SPS_ParticleSystemQuit(&restored);
+  return ok;
+}
+
+bool bench_run_record(const BenchOptions* options,
+                      SPS_ThreadPool* pool,
+                      Uint64 count,
+                      bool last) {
+  SPS_ParticleSystem ps = {0};
+  if (!SPS_ParticleSystemInit(&ps, count)) {
+    SDL_Log("Couldn't initialize %" SDL_PRIu64 " particles", count);
+    return false;
+  }
+  ps.pool = pool;
+  ps.reorder_interval = options->reorder_interval;
+
+  SPS_Recorder recorder;
+  SPS_RecorderLoad(&recorder);
+  if (!SPS_RecorderStart(&recorder, options->record_path)) {
+    SPS_ParticleSystemQuit(&ps);
+    return false;
+  }
+
+  // Updates run flat out, faster than the writer drains them a capture
+  // drops its step rather than waiting
+  double capture_seconds = 0.0;
+  double capture_max_seconds = 0.0;
+  bool captured = false;
+  Uint64 start = SDL_GetPerformanceCounter();
+  for (Uint32 step = 0; step < options->steps; step++) {
+    SPS_ParticleSystemUpdate(&ps, BENCH_DT);
+    Uint64 capture_start = SDL_GetPerformanceCounter();
+    captured = SPS_RecorderCapture(&recorder, &ps.particles, pool, ps.steps);
+    double seconds = bench_seconds_since(capture_start);
+    capture_seconds += seconds;
+    capture_max_seconds = SDL_max(capture_max_seconds, seconds);
+  }
+  double seconds = bench_seconds_since(start);
+
+  // Only the bench waits, the file has to end on the final state
+  const Uint64 dropped = recorder.stats.dropped;
+  while (!captured) {
+    SDL_Delay(1);
+    captured = SPS_RecorderCapture(&recorder, &ps.particles, pool, ps.steps);
+  }
+  SPS_RecorderStop(&recorder);
+
+  const SPS_RecorderStats* stats = &recorder.stats;
+  Uint64 frames_count = 0;
+  float max_error = 0.0f;
+  double replay_seconds = 0.0;
+  bool readable =
+      bench_replay_trajectory(options->record_path, pool, &ps.particles,
+                              &frames_count, &max_error, &replay_seconds);
+  readable = readable && frames_count == stats->written;
+  printf(
+      "    {\"particles\": %" SDL_PRIu64
+      ", \"steps_per_sec\": %.2f, \"capture_ms\": %.3f, "
+      "\"capture_max_ms\": %.3f, \"written\": %" SDL_PRIu64
+      ", \"dropped\": %" SDL_PRIu64
+      ", \"bytes_per_particle_step\": %.3f, \"writer_steps_per_sec\": "
+      "%.2f, \"replay_ms_per_frame\": %.3f, \"max_error\": %g, "
+      "\"readable\": %s}%s\n",
+      count, options->steps / seconds,
+      capture_seconds * 1e3 / options->steps, capture_max_seconds * 1e3,
+      stats->written, dropped, (double)stats->bytes / SDL_max(stats->values, 1),
+      stats->written / SDL_max(stats->busy_seconds, 1e-9),
+      replay_seconds * 1e3 / SDL_max(frames_count, 1), max_error,
+      readable ? "true" : "false", last ? "" : ",");
+
+  SPS_ParticleSystemQuit(&ps);
+  return true;
+}
+
+bool bench_replay_trajectory(const char* path,
+                             SPS_ThreadPool* pool,
+                             const SPS_Particles* particles,
+                             Uint64* frames_count,
+                             float* max_error,
+                             double* seconds) {
+  SPS_Particles replayed;
+  SPS_Player player;
+  if (!SPS_ParticlesLoad(&replayed, 1)) {
+    return false;
+  }
+  if (!SPS_PlayerOpen(&player, path)) {
+    SPS_ParticlesDestroy(&replayed);
+    return false;
+  }
+
+  // Every frame is played in order through the decoder thread, the last one
+  // against the state
+  bool ok = true;
+  Uint64 start = SDL_GetPerformanceCounter();
+  *frames_count = 0;
+  for (Uint64 f = 0; f < player.file.frames_count && ok; f++) {
+    SPS_PlayerSeek(&player, (double)player.file.frames[f].step);
+    while (ok && !SPS_PlayerAdvance(&player, 0.0, &replayed, pool)) {
+      SDL_Delay(1);
+      SDL_LockMutex(player.mutex);
+      ok = !player.failed;
+      SDL_UnlockMutex(player.mutex);
+    }
+    *frames_count += ok;
+  }
+  *seconds = bench_seconds_since(start);
+
+  // Ids come back exactly, positions and velocities within the precisions
+  *max_error = 0.0f;
+  ok = ok && replayed.count == particles->count &&
+       SDL_memcmp(SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_ID),
+                  SPS_PARTICLES_CHANNEL(&replayed, SPS_CHANNEL_ID),
+                  sizeof(float) * replayed.count) == 0;
+  for (Uint32 s = 0; s < SPS_TRAJECTORY_ID_STREAM && ok; s++) {
+    const float* expected =
+        SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_X + s);
+    const float* channel =
+        SPS_PARTICLES_CHANNEL(&replayed, SPS_CHANNEL_POSITION_X + s);
+    for (Uint64 i = 0; i < replayed.count; i++) {
+      *max_error = SDL_max(*max_error, SDL_fabsf(channel[i] - expected[i]));
+    }
+  }
+
+  SPS_PlayerClose(&player);
+  SPS_ParticlesDestroy(&replayed);
+  return ok;
+}
+
+bool bench_run_scatter(SPS_ThreadPool* pool, Uint64 count, bool last) {
+  SPS_Particles parallel;
+  SPS_Particles serial;
+  if (!SPS_ParticlesLoad(&parallel, count)) {
+    return false;
+  }
+  if (!SPS_ParticlesLoad(&serial, count)) {
+    SPS_ParticlesDestroy(&parallel);
+    return false;
+  }
+
+  // Every shape from the same seed, the serial pass must give the same bits
+  for (int shape = 0; shape < SPS_SCATTER_COUNT; shape++) {
+    SPS_Scatter scatter;
+    SPS_ScatterLoad(&scatter, (SPS_ScatterShape)shape);
+    scatter.seed = 1;
+    Uint64 start = SDL_GetPerformanceCounter();
+    SPS_ScatterParticles(&scatter, &parallel, pool, 0, count, 0);
+    double parallel_seconds = bench_seconds_since(start);
+    start = SDL_GetPerformanceCounter();
+    SPS_ScatterParticles(&scatter, &serial, NULL, 0, count, 0);
+    double serial_seconds = bench_seconds_since(start);
+
+    bool identical = true;
+    for (int c = SPS_CHANNEL_POSITION_X; c <= SPS_CHANNEL_POSITION_Z; c++) {
+      identical = identical &&
+                  SDL_memcmp(SPS_PARTICLES_CHANNEL(&parallel, c),
+                             SPS_PARTICLES_CHANNEL(&serial, c),
+                             sizeof(float) * count) == 0;
+    }
+    bool last_row = last && shape + 1 == SPS_SCATTER_COUNT;
+    printf("    {\"particles\": %" SDL_PRIu64
+           ", \"shape\": \"%s\", \"ns_per_particle\": %.3f, "
+           "\"serial_ns_per_particle\": %.3f, \"identical\": %s}%s\n",
+           count, SPS_ScatterShapeName((SPS_ScatterShape)shape),
+           parallel_seconds * 1e9 / count, serial_seconds * 1e9 / count,
+           identical ? "true" : "false", last_row ? "" : ",");
+  }
+
+  SPS_ParticlesDestroy(&parallel);
+  SPS_ParticlesDestroy(&serial);
+  return true;
+}
+
+double bench_seconds_since(Uint64 start) {
+  return (double)(SDL_GetPerformanceCounter() - start) /
+         (double)SDL_GetPerformanceFrequency();
+}
@@ -0,0 +1,949 @@
+#include "colliders.h"
+
+#include <SDL3/SDL_iostream.h>
+#include <SDL3/SDL_log.h>
+#include <SDL3/SDL_stdinc.h>
+
+#define COLLIDERS_BINS (12)
+#define COLLIDERS_MAX_LEAF (4)
+#define COLLIDERS_STACK_SIZE (64)
+#define COLLIDERS_BATCH (64)
+#define COLLIDERS_MAX_CANDIDATES (256)
+
+// Particles are left this far outside the surface they hit
+#define COLLIDERS_SKIN (0.0001f)
+
+// Shape bounds and the permutation being partitioned by the build
+typedef struct {
+  SPS_Colliders* colliders;
+  float (*bounds)[6];
+  float (*centroids)[3];
+  Uint32* indices;
+} BuildContext;
+
+// A particle moving from p0 to p1 during the step
+typedef struct {
+  float p0[3];
+  float p1[3];
+  float v[3];
+  float radius;
+  float restitution;
+  float friction;
+  float hit_t;
+  float hit_normal[3];
+  bool hit;
+} ParticleSweep;
+
+typedef void (*ShapeVisitFunc)(const SPS_ColliderShape* shape,
+                               ParticleSweep* sweep);
+
+bool colliders_grow(void** data, Uint32* capacity, Uint32 count, size_t size);
+void shape_bounds(const SPS_ColliderShape* shape, float bounds[6]);
+float bounds_area(const float bounds[6]);
+void bounds_grow(float bounds[6], const float other[6]);
+void build_node(BuildContext* context,
+                Uint32 node_index,
+                Uint32 first,
+                Uint32 count);
+Uint32 colliders_query(const SPS_Colliders* colliders,
+                       const float bounds[6],
+                       Uint32* candidates,
+                       Uint32 candidates_capacity,
+                       ShapeVisitFunc visit,
+                       ParticleSweep* sweep);
+void sweep_plane(const SPS_ColliderPlane* plane, ParticleSweep* sweep);
+void sweep_shape(const SPS_ColliderShape* shape, ParticleSweep* sweep);
+void push_plane(const SPS_ColliderPlane* plane, ParticleSweep* sweep);
+void push_shape(const SPS_ColliderShape* shape, ParticleSweep* sweep);
+void push_out(ParticleSweep* sweep,
+              const float surface[3],
+              const float normal[3]);
+void reflect_velocity(float v[3],
+                      const float normal[3],
+                      float restitution,
+                      float friction);
+void closest_on_triangle(const float p[3],
+                         const float vertices[3][3],
+                         float closest[3]);
+
+void SPS_CollidersLoad(SPS_Colliders* colliders) {
+  SDL_memset(colliders, 0, sizeof(SPS_Colliders));
+  colliders->restitution = 0.3f;
+  colliders->friction = 0.1f;
+}
+
+bool SPS_CollidersAddPlane(SPS_Colliders* colliders,
+                           const SPS_Vec3 normal,
+                           float offset) {
+  float length = SPS_Vec3Len(normal);
+  if (length <= 0.0f ||
+      !colliders_grow((void**)&colliders->planes,
+                      &colliders->planes_capacity, colliders->planes_count + 1,
+                      sizeof(SPS_ColliderPlane))) {
+    SDL_Log("Couldn't add collider plane");
+    return false;
+  }
+
+  SPS_ColliderPlane* plane = &colliders->planes[colliders->planes_count++];
+  SPS_Vec3Scale(normal, 1.0f / length, plane->normal);
+  plane->offset = offset / length;
+  return true;
+}
+
+bool SPS_CollidersAddShape(SPS_Colliders* colliders, SPS_ColliderShape shape) {
+  if (!colliders_grow((void**)&colliders->shapes,
+                      &colliders->shapes_capacity, colliders->shapes_count + 1,
+                      sizeof(SPS_ColliderShape))) {
+    SDL_Log("Couldn't add collider shape");
+    return false;
+  }
+
+  colliders->shapes[colliders->shapes_count++] = shape;
+  return true;
+}
+
+bool SPS_CollidersAddTriangle(SPS_Colliders* colliders,
+                              const SPS_Vec3 a,
+                              const SPS_Vec3 b,
+                              const SPS_Vec3 c) {
+  SPS_ColliderShape shape = {.type = SPS_COLLIDER_TRIANGLE};
+  SPS_Vec3Copy(a, shape.triangle.vertices[0]);
+  SPS_Vec3Copy(b, shape.triangle.vertices[1]);
+  SPS_Vec3Copy(c, shape.triangle.vertices[2]);
+
+  // Degenerate triangles can't be hit, they are dropped
+  SPS_Vec3 ab;
+  SPS_Vec3 ac;
+  SPS_Vec3 normal;
+  SPS_Vec3Sub(b, a, ab);
+  SPS_Vec3Sub(c, a, ac);
+  SPS_Vec3Cross(ab, ac, normal);
+  if (SPS_Vec3Len(normal) <= 0.0f) {
+    return true;
+  }
+
+  SPS_Vec3Normalize(normal, shape.triangle.normal);
+  return SPS_CollidersAddShape(colliders, shape);
+}
+
+bool SPS_CollidersLoadFile(SPS_Colliders* colliders, const char* path) {
+  size_t size = 0;
+  char* text = SDL_LoadFile(path, &size);
+  if (text == NULL) {
+    SDL_Log("Couldn't load colliders %s: %s", path, SDL_GetError());
+    return false;
+  }
+
+  float (*vertices)[3] = NULL;
+  Uint32 vertices_count = 0;
+  Uint32 vertices_capacity = 0;
+  bool ok = true;
+  Uint32 line_number = 0;
+  char* state = NULL;
+  for (char* line = SDL_strtok_r(text, "\n", &state); line != NULL && ok;
+       line = SDL_strtok_r(NULL, "\n", &state)) {
+    line_number++;
+    while (*line == ' ' || *line == '\t') {
+      line++;
+    }
+
+    float v[6];
+    if (*line == '\0' || *line == '#' || *line == '\r') {
+      continue;
+    } else if (SDL_strncmp(line, "plane ", 6) == 0) {
+      ok = SDL_sscanf(line + 6, "%f %f %f %f", &v[0], &v[1], &v[2],
+                      &v[3]) == 4 &&
+           SPS_CollidersAddPlane(colliders, v, v[3]);
+    } else if (SDL_strncmp(line, "sphere ", 7) == 0) {
+      SPS_ColliderShape shape = {.type = SPS_COLLIDER_SPHERE};
+      ok = SDL_sscanf(line + 7, "%f %f %f %f", &shape.sphere.center[0],
+                      &shape.sphere.center[1], &shape.sphere.center[2],
+                      &shape.sphere.radius) == 4 &&
+           SPS_CollidersAddShape(colliders, shape);
+    } else if (SDL_strncmp(line, "box ", 4) == 0) {
+      ok = SDL_sscanf(line + 4, "%f %f %f %f %f %f", &v[0], &v[1], &v[2],
+                      &v[3], &v[4], &v[5]) == 6;
+      SPS_ColliderShape shape = {.type = SPS_COLLIDER_BOX};
+      for (int a = 0; a < 3 && ok; a++) {
+        shape.box.min[a] = SDL_min(v[a], v[3 + a]);
+        shape.box.max[a] = SDL_max(v[a], v[3 + a]);
+      }
+      ok = ok && SPS_CollidersAddShape(colliders, shape);
+    } else if (SDL_strncmp(line, "v ", 2) == 0) {
+      ok = SDL_sscanf(line + 2, "%f %f %f", &v[0], &v[1], &v[2]) == 3 &&
+           colliders_grow((void**)&vertices, &vertices_capacity,
+                          vertices_count + 1, sizeof(float[3]));
+      if (ok) {
+        SPS_Vec3Copy(v, vertices[vertices_count++]);
+      }
+    } else if (SDL_strncmp(line, "f ", 2) == 0) {
+      // OBJ faces, v/vt/vn references keep only v, negatives are relative
+      Uint32 face[3];
+      Uint32 face_count = 0;
+      char* cursor = line + 2;
+      while (ok) {
+        char* end = NULL;
+        long index = SDL_strtol(cursor, &end, 10);
+        if (end == cursor) {
+          break;
+        }
+
+        index = index < 0 ? (long)vertices_count + index : index - 1;
+        ok = index >= 0 && index < (long)vertices_count;
+        cursor = end;
+        while (*cursor != '\0' && *cursor != ' ' && *cursor != '\t') {
+          cursor++;
+        }
+
+        face[SDL_min(face_count, 2)] = (Uint32)index;
+        if (ok && ++face_count >= 3) {
+          ok = SPS_CollidersAddTriangle(colliders, vertices[face[0]],
+                                        vertices[face[1]], vertices[face[2]]);
+          face[1] = face[2];
+        }
+      }
+      ok = ok && face_count >= 3;
+    }
+
+    if (!ok) {
+      SDL_Log("Couldn't parse colliders %s line %u", path, line_number);
+    }
+  }
+
+  SDL_free(vertices);
+  SDL_free(text);
+  return ok;
+}
+
+bool SPS_CollidersBuild(SPS_Colliders* colliders) {
+  SDL_free(colliders->nodes);
+  colliders->nodes = NULL;
+  colliders->nodes_count = 0;
+  Uint32 count = colliders->shapes_count;
+  if (count == 0) {
+    return true;
+  }
+
+  BuildContext context = {
+      .colliders = colliders,
+      .bounds = SDL_malloc(sizeof(float[6]) * count),
+      .centroids = SDL_malloc(sizeof(float[3]) * count),
+      .indices = SDL_malloc(sizeof(Uint32) * count),
+  };
+  colliders->nodes = SDL_malloc(sizeof(SPS_ColliderNode) * (2 * count - 1));
+  SPS_ColliderShape* shapes = SDL_malloc(sizeof(SPS_ColliderShape) * count);
+  if (context.bounds == NULL || context.centroids == NULL ||
+      context.indices == NULL || colliders->nodes == NULL || shapes == NULL) {
+    SDL_Log("Couldn't allocate collider BVH");
+    SDL_free(context.bounds);
+    SDL_free(context.centroids);
+    SDL_free(context.indices);
+    SDL_free(shapes);
+    SDL_free(colliders->nodes);
+    colliders->nodes = NULL;
+    return false;
+  }
+
+  for (Uint32 s = 0; s < count; s++) {
+    shape_bounds(&colliders->shapes[s], context.bounds[s]);
+    for (int a = 0; a < 3; a++) {
+      context.centroids[s][a] =
+          0.5f * (context.bounds[s][a] + context.bounds[s][3 + a]);
+    }
+    context.indices[s] = s;
+  }
+
+  colliders->nodes_count = 1;
+  build_node(&context, 0, 0, count);
+
+  // Leaves reference contiguous shapes once they follow the BVH order
+  for (Uint32 s = 0; s < count; s++) {
+    shapes[s] = colliders->shapes[context.indices[s]];
+  }
+  SDL_memcpy(colliders->shapes, shapes, sizeof(SPS_ColliderShape) * count);
+
+  SDL_free(shapes);
+  SDL_free(context.bounds);
+  SDL_free(context.centroids);
+  SDL_free(context.indices);
+  return true;
+}
+
+void SPS_CollidersResolve(const SPS_Colliders* colliders,
+                          SPS_Particles* particles,
+                          float dt,
+                          Uint64 first,
+                          Uint64 last) {
+  if (colliders->planes_count == 0 && colliders->nodes_count == 0) {
+    return;
+  }
+
+  float* p[3] = {SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_X),
+                 SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_Y),
+                 SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_Z)};
+  float* v[3] = {SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_VELOCITY_X),
+                 SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_VELOCITY_Y),
+                 SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_VELOCITY_Z)};
+  const float* scale = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_SCALE);
+
+  Uint32 candidates[COLLIDERS_MAX_CANDIDATES];
+  ParticleSweep sweeps[COLLIDERS_BATCH];
+  float bounds[COLLIDERS_BATCH][6];
+  for (Uint64 batch = first; batch < last; batch += COLLIDERS_BATCH) {
+    Uint32 batch_count = (Uint32)SDL_min(COLLIDERS_BATCH, last - batch);
+
+    // The start of the step is recovered from the integrated velocity
+    float batch_bounds[6];
+    for (Uint32 k = 0; k < batch_count; k++) {
+      Uint64 i = batch + k;
+      ParticleSweep* sweep = &sweeps[k];
+      *sweep = (ParticleSweep){
+          .radius = scale[i],
+          .restitution = colliders->restitution,
+          .friction = colliders->friction,
+          .hit_t = 1.0f,
+      };
+      for (int a = 0; a < 3; a++) {
+        sweep->p1[a] = p[a][i];
+        sweep->v[a] = v[a][i];
+        sweep->p0[a] = p[a][i] - v[a][i] * dt;
+        bounds[k][a] = SDL_min(sweep->p0[a], sweep->p1[a]) - sweep->radius;
+        bounds[k][3 + a] = SDL_max(sweep->p0[a], sweep->p1[a]) + sweep->radius;
+      }
+
+      if (k == 0) {
+        SDL_memcpy(batch_bounds, bounds[k], sizeof(batch_bounds));
+      } else {
+        bounds_grow(batch_bounds, bounds[k]);
+      }
+    }
+
+    // One BVH walk for the whole batch unless it touches too many shapes
+    Uint32 candidates_count =
+        colliders_query(colliders, batch_bounds, candidates,
+                        COLLIDERS_MAX_CANDIDATES, NULL, NULL);
+    bool shared = candidates_count <= COLLIDERS_MAX_CANDIDATES;
+
+    for (Uint32 k = 0; k < batch_count; k++) {
+      ParticleSweep* sweep = &sweeps[k];
+
+      // Earliest surface crossed on the way, stop there and bounce
+      for (Uint32 c = 0; c < colliders->planes_count; c++) {
+        sweep_plane(&colliders->planes[c], sweep);
+      }
+      if (shared) {
+        for (Uint32 c = 0; c < candidates_count; c++) {
+          sweep_shape(&colliders->shapes[candidates[c]], sweep);
+        }
+      } else {
+        colliders_query(colliders, bounds[k], NULL, 0, sweep_shape, sweep);
+      }
+
+      if (sweep->hit) {
+        for (int a = 0; a < 3; a++) {
+          sweep->p1[a] = sweep->p0[a] +
+                         (sweep->p1[a] - sweep->p0[a]) * sweep->hit_t +
+                         sweep->hit_normal[a] * COLLIDERS_SKIN;
+        }
+        reflect_velocity(sweep->v, sweep->hit_normal, colliders->restitution,
+                         colliders->friction);
+      }
+
+      // Then push out of whatever the particle still overlaps
+      for (Uint32 c = 0; c < colliders->planes_count; c++) {
+        push_plane(&colliders->planes[c], sweep);
+      }
+      if (shared) {
+        for (Uint32 c = 0; c < candidates_count; c++) {
+          push_shape(&colliders->shapes[candidates[c]], sweep);
+        }
+      } else {
+        colliders_query(colliders, bounds[k], NULL, 0, push_shape, sweep);
+      }
+
+      for (int a = 0; a < 3; a++) {
+        p[a][batch + k] = sweep->p1[a];
+        v[a][batch + k] = sweep->v[a];
+      }
+    }
+  }
+}
+
+Uint64 SPS_CollidersMemorySize(const SPS_Colliders* colliders) {
+  return sizeof(SPS_ColliderPlane) * colliders->planes_capacity +
+         sizeof(SPS_ColliderShape) * colliders->shapes_capacity +
+         sizeof(SPS_ColliderNode) * colliders->nodes_count;
+}
+
+void SPS_CollidersDestroy(SPS_Colliders* colliders) {
+  SDL_free(colliders->planes);
+  SDL_free(colliders->shapes);
+  SDL_free(colliders->nodes);
+
+  float restitution = colliders->restitution;
+  float friction = colliders->friction;
+  SPS_CollidersLoad(colliders);
+  colliders->restitution = restitution;
+  colliders->friction = friction;
+}
+
+bool colliders_grow(void** data, Uint32* capacity, Uint32 count, size_t size) {
+  if (count <= *capacity) {
+    return true;
+  }
+
+  Uint32 new_capacity = SDL_max(count, SDL_max(16, *capacity * 2));
+  void* new_data = SDL_realloc(*data, size * new_capacity);
+  if (new_data == NULL) {
+    return false;
+  }
+
+  *data = new_data;
+  *capacity = new_capacity;
+  return true;
+}
+
+void shape_bounds(const SPS_ColliderShape* shape, float bounds[6]) {
+  for (int a = 0; a < 3; a++) {
+    switch (shape->type) {
+      case SPS_COLLIDER_SPHERE:
+        bounds[a] = shape->sphere.center[a] - shape->sphere.radius;
+        bounds[3 + a] = shape->sphere.center[a] + shape->sphere.radius;
+        break;
+      case SPS_COLLIDER_BOX:
+        bounds[a] = shape->box.min[a];
+        bounds[3 + a] = shape->box.max[a];
+        break;
+      case SPS_COLLIDER_TRIANGLE:
+        bounds[a] = SDL_min(shape->triangle.vertices[0][a],
+                            SDL_min(shape->triangle.vertices[1][a],
+                                    shape->triangle.vertices[2][a]));
+        bounds[3 + a] = SDL_max(shape->triangle.vertices[0][a],
+                                SDL_max(shape->triangle.vertices[1][a],
+                                        shape->triangle.vertices[2][a]));
+        break;
+    }
+  }
+}
+
+float bounds_area(const float bounds[6]) {
+  float x = SDL_max(bounds[3] - bounds[0], 0.0f);
+  float y = SDL_max(bounds[4] - bounds[1], 0.0f);
+  float z = SDL_max(bounds[5] - bounds[2], 0.0f);
+  return 2.0f * (x * y + y * z + z * x);
+}
+
+void bounds_grow(float bounds[6], const float other[6]) {
+  for (int a = 0; a < 3; a++) {
+    bounds[a] = SDL_min(bounds[a], other[a]);
+    bounds[3 + a] = SDL_max(bounds[3 + a], other[3 + a]);
+  }
+}
+
+void build_node(BuildContext* context,
+                Uint32 node_index,
+                Uint32 first,
+                Uint32 count) {
+  SPS_ColliderNode* nodes = context->colliders->nodes;
+  Uint32* indices = context->indices;
+  float bounds[6];
+  float centroid_bounds[6];
+  SDL_memcpy(bounds, context->bounds[indices[first]], sizeof(bounds));
+  for (int a = 0; a < 3; a++) {
+    centroid_bounds[a] = context->centroids[indices[first]][a];
+    centroid_bounds[3 + a] = centroid_bounds[a];
+  }
+  for (Uint32 s = first + 1; s < first + count; s++) {
+    bounds_grow(bounds, context->bounds[indices[s]]);
+    for (int a = 0; a < 3; a++) {
+      centroid_bounds[a] =
+          SDL_min(centroid_bounds[a], context->centroids[indices[s]][a]);
+      centroid_bounds[3 + a] =
+          SDL_max(centroid_bounds[3 + a], context->centroids[indices[s]][a]);
+    }
+  }
+
+  SPS_ColliderNode* node = &nodes[node_index];
+  SDL_memcpy(node->min, bounds, sizeof(node->min));
+  SDL_memcpy(node->max, bounds + 3, sizeof(node->max));
+  node->first = first;
+  node->count = count;
+  if (count <= COLLIDERS_MAX_LEAF) {
+    return;
+  }
+
+  // Binned SAH over the centroids, cost counted in shapes tested
+  float best_cost = (float)count;
+  int best_axis = -1;
+  int best_split = 0;
+  float node_area = SDL_max(bounds_area(bounds), 1e-12f);
+  for (int a = 0; a < 3; a++) {
+    float extent = centroid_bounds[3 + a] - centroid_bounds[a];
+    if (extent <= 0.0f) {
+      continue;
+    }
+
+    Uint32 bin_counts[COLLIDERS_BINS] = {0};
+    float bin_bounds[COLLIDERS_BINS][6];
+    float scale = COLLIDERS_BINS / extent;
+    for (Uint32 s = first; s < first + count; s++) {
+      int b = (int)((context->centroids[indices[s]][a] - centroid_bounds[a]) *
+                    scale);
+      b = SDL_min(b, COLLIDERS_BINS - 1);
+      if (bin_counts[b]++ == 0) {
+        SDL_memcpy(bin_bounds[b], context->bounds[indices[s]],
+                   sizeof(bin_bounds[b]));
+      } else {
+        bounds_grow(bin_bounds[b], context->bounds[indices[s]]);
+      }
+    }
+
+    // Right to left sweep first so the left to right one can price splits
+    float right_area[COLLIDERS_BINS];
+    Uint32 right_count[COLLIDERS_BINS];
+    float grown[6];
+    Uint32 grown_count = 0;
+    for (int b = COLLIDERS_BINS - 1; b > 0; b--) {
+      if (bin_counts[b] > 0) {
+        if (grown_count == 0) {
+          SDL_memcpy(grown, bin_bounds[b], sizeof(grown));
+        } else {
+          bounds_grow(grown, bin_bounds[b]);
+        }
+        grown_count += bin_counts[b];
+      }
+      right_area[b] = grown_count > 0 ? bounds_area(grown) : 0.0f;
+      right_count[b] = grown_count;
+    }
+
+    grown_count = 0;
+    for (int b = 0; b < COLLIDERS_BINS - 1; b++) {
+      if (bin_counts[b] > 0) {
+        if (grown_count == 0) {
+          SDL_memcpy(grown, bin_bounds[b], sizeof(grown));
+        } else {
+          bounds_grow(grown, bin_bounds[b]);
+        }
+        grown_count += bin_counts[b];
+      }
+
+      if (grown_count == 0 || right_count[b + 1] == 0) {
+        continue;
+      }
+
+      float cost = 1.0f + (bounds_area(grown) * grown_count +
+                           right_area[b + 1] * right_count[b + 1]) /
+                              node_area;
+      if (cost < best_cost) {
+        best_cost = cost;
+        best_axis = a;
+        best_split = b + 1;
+      }
+    }
+  }
+
+  Uint32 middle = first;
+  if (best_axis >= 0) {
+    float extent =
+        centroid_bounds[3 + best_axis] - centroid_bounds[best_axis];
+    float scale = COLLIDERS_BINS / extent;
+    Uint32 end = first + count;
+    while (middle < end) {
+      int b = (int)((context->centroids[indices[middle]][best_axis] -
+                     centroid_bounds[best_axis]) *
+                    scale);
+      if (SDL_min(b, COLLIDERS_BINS - 1) < best_split) {
+        middle++;
+      } else {
+        Uint32 swap = indices[middle];
+        indices[middle] = indices[--end];
+        indices[end] = swap;
+      }
+    }
+  } else if (count > 4 * COLLIDERS_MAX_LEAF) {
+    // No split pays off but the leaf would be too large, halve it
+    middle = first + count / 2;
+  }
+
+  if (middle == first || middle == first + count) {
+    return;
+  }
+
+  // The left child always directly follows its parent
+  Uint32 left = context->colliders->nodes_count++;
+  build_node(context, left, first, middle - first);
+  Uint32 right = context->colliders->nodes_count++;
+  build_node(context, right, middle, first + count - middle);
+  node = &nodes[node_index];
+  node->first = right;
+  node->count = 0;
+}
+
+Uint32 colliders_query(const SPS_Colliders* colliders,
+                       const float bounds[6],
+                       Uint32* candidates,
+                       Uint32 candidates_capacity,
+                       ShapeVisitFunc visit,
+                       ParticleSweep* sweep) {
+  if (colliders->nodes_count == 0) {
+    return 0;
+  }
+
+  // Returns the overlapping shapes count, more than capacity when truncated
+  Uint32 found = 0;
+  Uint32 stack[COLLIDERS_STACK_SIZE];
+  Uint32 stack_size = 0;
+  stack[stack_size++] = 0;
+  while (stack_size > 0) {
+    const SPS_ColliderNode* node = &colliders->nodes[stack[--stack_size]];
+    if (node->min[0] > bounds[3] || node->max[0] < bounds[0] ||
+        node->min[1] > bounds[4] || node->max[1] < bounds[1] ||
+        node->min[2] > bounds[5] || node->max[2] < bounds[2]) {
+      continue;
+    }
+
+    if (node->count > 0) {
+      for (Uint32 s = node->first; s < node->first + node->count; s++) {
+        if (visit != NULL) {
+          visit(&colliders->shapes[s], sweep);
+        } else if (found < candidates_capacity) {
+          candidates[found] = s;
+        }
+        found++;
+      }
+    } else if (stack_size + 2 <= COLLIDERS_STACK_SIZE) {
+      stack[stack_size++] = node->first;
+      stack[stack_size++] = (Uint32)(node - colliders->nodes) + 1;
+    }
+  }
+
+  return found;
+}
+
+void sweep_plane(const SPS_ColliderPlane* plane, ParticleSweep* sweep) {
+  float s0 = SPS_Vec3Dot(plane->normal, sweep->p0) - plane->offset -
+             sweep->radius;
+  float s1 = SPS_Vec3Dot(plane->normal, sweep->p1) - plane->offset -
+             sweep->radius;
+  if (s0 < 0.0f || s1 >= 0.0f) {
+    return;
+  }
+
+  float t = s0 / (s0 - s1);
+  if (t < sweep->hit_t) {
+    sweep->hit = true;
+    sweep->hit_t = t;
+    SPS_Vec3Copy(plane->normal, sweep->hit_normal);
+  }
+}
+
+void sweep_shape(const SPS_ColliderShape* shape, ParticleSweep* sweep) {
+  // Tests the center path against the shape grown by the particle radius,
+  // particles starting inside are left to the push out pass
+  float d[3];
+  SPS_Vec3Sub(sweep->p1, sweep->p0, d);
+  float t = 2.0f;
+  float normal[3] = {0.0f, 1.0f, 0.0f};
+
+  switch (shape->type) {
+    case SPS_COLLIDER_SPHERE: {
+      float m[3];
+      SPS_Vec3Sub(sweep->p0, shape->sphere.center, m);
+      float reach = shape->sphere.radius + sweep->radius;
+      float a = SPS_Vec3Dot(d, d);
+      float b = SPS_Vec3Dot(m, d);
+      float c = SPS_Vec3Dot(m, m) - reach * reach;
+      float disc = b * b - a * c;
+      if (c <= 0.0f || b >= 0.0f || a <= 0.0f || disc < 0.0f) {
+        return;
+      }
+
+      t = (-b - SDL_sqrtf(disc)) / a;
+      for (int i = 0; i < 3; i++) {
+        normal[i] = (m[i] + d[i] * t) / reach;
+      }
+    } break;
+    case SPS_COLLIDER_BOX: {
+      float enter = -1.0f;
+      float exit = 2.0f;
+      int axis = -1;
+      for (int i = 0; i < 3; i++) {
+        float lo = shape->box.min[i] - sweep->radius;
+        float hi = shape->box.max[i] + sweep->radius;
+        if (d[i] == 0.0f) {
+          if (sweep->p0[i] < lo || sweep->p0[i] > hi) {
+            return;
+          }
+          continue;
+        }
+
+        float t0 = (lo - sweep->p0[i]) / d[i];
+        float t1 = (hi - sweep->p0[i]) / d[i];
+        float sign = -1.0f;
+        if (t0 > t1) {
+          float swap = t0;
+          t0 = t1;
+          t1 = swap;
+          sign = 1.0f;
+        }
+        if (t0 > enter) {
+          enter = t0;
+          axis = i;
+          normal[0] = normal[1] = normal[2] = 0.0f;
+          normal[i] = sign;
+        }
+        exit = SDL_min(exit, t1);
+      }
+
+      if (axis < 0 || enter < 0.0f || enter > exit) {
+        return;
+      }
+      t = enter;
+    } break;
+    case SPS_COLLIDER_TRIANGLE: {
+      // Plane of the triangle moved towards the start side by the radius
+      const float(*vertices)[3] = shape->triangle.vertices;
+      float rel[3];
+      SPS_Vec3Sub(sweep->p0, vertices[0], rel);
+      SPS_Vec3Copy(shape->triangle.normal, normal);
+      float s0 = SPS_Vec3Dot(normal, rel);
+      if (s0 < 0.0f) {
+        SPS_Vec3Negate(normal, normal);
+        s0 = -s0;
+      }
+      s0 -= sweep->radius;
+      float s1 = s0 + SPS_Vec3Dot(normal, d);
+      if (s0 < 0.0f || s1 >= 0.0f) {
+        return;
+      }
+
+      // The offset plane leaves gaps around convex edges, a center path
+      // going through one is stopped where it crosses the triangle itself
+      // and the push out moves it back above
+      bool inside = false;
+      for (int pass = 0; pass < 2 && !inside; pass++) {
+        float lift = pass == 0 ? 0.0f : sweep->radius;
+        if (s1 + lift >= 0.0f) {
+          break;
+        }
+
+        t = (s0 + lift) / (s0 - s1);
+        float q[3];
+        for (int i = 0; i < 3; i++) {
+          q[i] = sweep->p0[i] + d[i] * t - normal[i] * (sweep->radius - lift);
+        }
+
+        inside = true;
+        for (int e = 0; e < 3 && inside; e++) {
+          float edge[3];
+          float to_q[3];
+          float cross[3];
+          SPS_Vec3Sub(vertices[(e + 1) % 3], vertices[e], edge);
+          SPS_Vec3Sub(q, vertices[e], to_q);
+          SPS_Vec3Cross(edge, to_q, cross);
+          inside = SPS_Vec3Dot(cross, shape->triangle.normal) >= 0.0f;
+        }
+      }
+      if (!inside) {
+        return;
+      }
+    } break;
+  }
+
+  if (t >= 0.0f && t < sweep->hit_t) {
+    sweep->hit = true;
+    sweep->hit_t = t;
+    SPS_Vec3Copy(normal, sweep->hit_normal);
+  }
+}
+
+void push_plane(const SPS_ColliderPlane* plane, ParticleSweep* sweep) {
+  float s = SPS_Vec3Dot(plane->normal, sweep->p1) - plane->offset;
+  if (s >= sweep->radius) {
+    return;
+  }
+
+  float surface[3];
+  for (int a = 0; a < 3; a++) {
+    surface[a] = sweep->p1[a] - plane->normal[a] * s;
+  }
+  push_out(sweep, surface, plane->normal);
+}
+
+void push_shape(const SPS_ColliderShape* shape, ParticleSweep* sweep) {
+  float surface[3];
+  float normal[3];
+  float d[3];
+
+  switch (shape->type) {
+    case SPS_COLLIDER_SPHERE: {
+      SPS_Vec3Sub(sweep->p1, shape->sphere.center, d);
+      float distance = SPS_Vec3Len(d);
+      if (distance >= shape->sphere.radius + sweep->radius) {
+        return;
+      }
+
+      SPS_Vec3Make(0.0f, 1.0f, 0.0f, normal);
+      if (distance > 0.0f) {
+        SPS_Vec3Scale(d, 1.0f / distance, normal);
+      }
+      for (int a = 0; a < 3; a++) {
+        surface[a] = shape->sphere.center[a] + normal[a] * shape->sphere.radius;
+      }
+    } break;
+    case SPS_COLLIDER_BOX: {
+      bool inside = true;
+      for (int a = 0; a < 3; a++) {
+        surface[a] =
+            SDL_clamp(sweep->p1[a], shape->box.min[a], shape->box.max[a]);
+        inside = inside && surface[a] == sweep->p1[a];
+      }
+
+      if (inside) {
+        // Out through the nearest face
+        float nearest = -1.0f;
+        for (int a = 0; a < 3; a++) {
+          float below = sweep->p1[a] - shape->box.min[a];
+          float above = shape->box.max[a] - sweep->p1[a];
+          if (nearest < 0.0f || SDL_min(below, above) < nearest) {
+            nearest = SDL_min(below, above);
+            SPS_Vec3Copy(sweep->p1, surface);
+            SPS_Vec3Make(0.0f, 0.0f, 0.0f, normal);
+            normal[a] = below < above ? -1.0f : 1.0f;
+            surface[a] = below < above ? shape->box.min[a] : shape->box.max[a];
+          }
+        }
+        break;
+      }
+
+      SPS_Vec3Sub(sweep->p1, surface, d);
+      float distance = SPS_Vec3Len(d);
+      if (distance >= sweep->radius) {
+        return;
+      }
+      SPS_Vec3Scale(d, 1.0f / distance, normal);
+    } break;
+    case SPS_COLLIDER_TRIANGLE: {
+      closest_on_triangle(sweep->p1, shape->triangle.vertices, surface);
+      SPS_Vec3Sub(sweep->p1, surface, d);
+      float distance = SPS_Vec3Len(d);
+      if (distance >= sweep->radius) {
+        return;
+      }
+
+      // A center on or past the triangle leaves through the side it came
+      // from rather than the nearest one
+      float rel[3];
+      SPS_Vec3Sub(sweep->p0, shape->triangle.vertices[0], rel);
+      float side = SPS_Vec3Dot(rel, shape->triangle.normal);
+      float along = SPS_Vec3Dot(d, shape->triangle.normal);
+      if (distance > 0.0f && along * side >= 0.0f) {
+        SPS_Vec3Scale(d, 1.0f / distance, normal);
+      } else {
+        SPS_Vec3Copy(shape->triangle.normal, normal);
+        if (side < 0.0f) {
+          SPS_Vec3Negate(normal, normal);
+        }
+      }
+    } break;
+  }
+
+  push_out(sweep, surface, normal);
+}
+
+void push_out(ParticleSweep* sweep,
+              const float surface[3],
+              const float normal[3]) {
+  for (int a = 0; a < 3; a++) {
+    sweep->p1[a] = surface[a] + normal[a] * (sweep->radius + COLLIDERS_SKIN);
+  }
+  reflect_velocity(sweep->v, normal, sweep->restitution, sweep->friction);
+}
+
+void reflect_velocity(float v[3],
+                      const float normal[3],
+                      float restitution,
+                      float friction) {
+  float vn = SPS_Vec3Dot(v, normal);
+  if (vn >= 0.0f) {
+    return;
+  }
+
+  for (int a = 0; a < 3; a++) {
+    float tangent = v[a] - vn * normal[a];
+    v[a] = tangent * (1.0f - friction) - restitution * vn * normal[a];
+  }
+}
+
+void closest_on_triangle(const float p[3],
+                         const float vertices[3][3],
+                         float closest[3]) {
+  // Voronoi regions of the vertices, edges and face
+  const float* a = vertices[0];
+  const float* b = vertices[1];
+  const float* c = vertices[2];
+  float ab[3];
+  float ac[3];
+  float ap[3];
+  SPS_Vec3Sub(b, a, ab);
+  SPS_Vec3Sub(c, a, ac);
+  SPS_Vec3Sub(p, a, ap);
+  float d1 = SPS_Vec3Dot(ab, ap);
+  float d2 = SPS_Vec3Dot(ac, ap);
+  if (d1 <= 0.0f && d2 <= 0.0f) {
+    SPS_Vec3Copy(a, closest);
+    return;
+  }
+
+  float bp[3];
+  SPS_Vec3Sub(p, b, bp);
+  float d3 = SPS_Vec3Dot(ab, bp);
+  float d4 = SPS_Vec3Dot(ac, bp);
+  if (d3 >= 0.0f && d4 <= d3) {
+    SPS_Vec3Copy(b, closest);
+    return;
+  }
+
+  float vc = d1 * d4 - d3 * d2;
+  if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) {
+    float t = d1 / (d1 - d3);
+    for (int i = 0; i < 3; i++) {
+      closest[i] = a[i] + ab[i] * t;
+    }
+    return;
+  }
+
+  float cp[3];
+  SPS_Vec3Sub(p, c, cp);
+  float d5 = SPS_Vec3Dot(ab, cp);
+  float d6 = SPS_Vec3Dot(ac, cp);
+  if (d6 >= 0.0f && d5 <= d6) {
+    SPS_Vec3Copy(c, closest);
+    return;
+  }
+
+  float vb = d5 * d2 - d1 * d6;
+  if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) {
+    float t = d2 / (d2 - d6);
+    for (int i = 0; i < 3; i++) {
+      closest[i] = a[i] + ac[i] * t;
+    }
+    return;
+  }
+
+  float va = d3 * d6 - d5 * d4;
+  if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) {
+    float t = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+    for (int i = 0; i < 3; i++) {
+      closest[i] = b[i] + (c[i] - b[i]) * t;
+    }
+    return;
+  }
+
+  float denom = 1.0f / (va + vb + vc);
+  float v = vb * denom;
+  float w = vc * denom;
+  for (int i = 0; i < 3; i++) {
+    closest[i] = a[i] + ab[i] * v + ac[i] * w;
+  }
+}
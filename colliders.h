@@ -0,0 +1,105 @@
+#ifndef SPS_COLLIDERS_H
+#define SPS_COLLIDERS_H
+
+#include <SDL3/SDL_stdinc.h>
+#include "particles.h"
+#include "xmath.h"
+
+// Kinds of bounded collider shapes stored in the BVH.
+typedef enum {
+  SPS_COLLIDER_SPHERE,
+  SPS_COLLIDER_BOX,
+  SPS_COLLIDER_TRIANGLE,
+} SPS_ColliderType;
+
+// A static shape particles bounce off, boxes are axis aligned.
+typedef struct {
+  SPS_ColliderType type;
+  union {
+    struct {
+      float center[3];
+      float radius;
+    } sphere;
+    struct {
+      float min[3];
+      float max[3];
+    } box;
+    struct {
+      float vertices[3][3];
+      float normal[3];
+    } triangle;
+  };
+} SPS_ColliderShape;
+
+// Infinite plane n.p = offset, particles are kept on the side of normal.
+typedef struct {
+  float normal[3];
+  float offset;
+} SPS_ColliderPlane;
+
+// BVH node, leaves have a count and internal nodes a right child, the left
+// child always follows its parent.
+typedef struct {
+  float min[3];
+  Uint32 first;  // first shape of a leaf or right child of an internal node
+  float max[3];
+  Uint32 count;  // 0 for internal nodes
+} SPS_ColliderNode;
+
+// Static collider set, unbounded planes are tested directly and every other
+// shape through a SAH built BVH.
+typedef struct {
+  SPS_ColliderPlane* planes;
+  Uint32 planes_count;
+  Uint32 planes_capacity;
+  SPS_ColliderShape* shapes;
+  Uint32 shapes_count;
+  Uint32 shapes_capacity;
+  SPS_ColliderNode* nodes;
+  Uint32 nodes_count;
+  float restitution;
+  float friction;  // fraction of tangential velocity lost on contact
+} SPS_Colliders;
+
+// Initializes an empty collider set.
+void SPS_CollidersLoad(SPS_Colliders* colliders);
+
+// Appends colliders, the BVH must be rebuilt before the next resolve.
+bool SPS_CollidersAddPlane(SPS_Colliders* colliders,
+                           const SPS_Vec3 normal,
+                           float offset);
+bool SPS_CollidersAddShape(SPS_Colliders* colliders, SPS_ColliderShape shape);
+bool SPS_CollidersAddTriangle(SPS_Colliders* colliders,
+                              const SPS_Vec3 a,
+                              const SPS_Vec3 b,
+                              const SPS_Vec3 c);
+
+// Appends the colliders of a text file, one per line:
+//   plane nx ny nz offset
+//   sphere cx cy cz radius
+//   box minx miny minz maxx maxy maxz
+//   v x y z
+//   f a b c
+// v and f lines form a triangle mesh with OBJ style 1-based indices, faces
+// with more vertices are fanned. Lines starting with # are ignored.
+bool SPS_CollidersLoadFile(SPS_Colliders* colliders, const char* path);
+
+// Builds the BVH of the shapes with the surface area heuristic.
+bool SPS_CollidersBuild(SPS_Colliders* colliders);
+
+// Moves the particles of [first, last) that crossed or entered a collider
+// during the step of length dt back outside and reflects their velocity.
+// Expects positions and velocities right after the integration.
+void SPS_CollidersResolve(const SPS_Colliders* colliders,
+                          SPS_Particles* particles,
+                          float dt,
+                          Uint64 first,
+                          Uint64 last);
+
+// Bytes allocated by the colliders.
+Uint64 SPS_CollidersMemorySize(const SPS_Colliders* colliders);
+
+// Releases the colliders.
+void SPS_CollidersDestroy(SPS_Colliders* colliders);
+
+#endif /* SPS_COLLIDERS_H */
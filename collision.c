@@ -0,0 +1,518 @@
+#include "collision.h"
+#include "radix_sort.h"
+
+#include <SDL3/SDL_log.h>
+#include <SDL3/SDL_stdinc.h>
+
+#define MIN_MASS (0.00001f)
+
+// Insertion sort moves allowed per particle before falling back to a full sort
+#define COLLISION_MOVES_PER_PARTICLE (8)
+
+// A new axis must spread the particles this much more to trigger a re-sort
+#define COLLISION_AXIS_HYSTERESIS (1.25)
+
+// State shared by the parallel passes of a step
+typedef struct {
+  SPS_Collisions* collisions;
+  const SPS_Particles* particles;
+  double* chunk_moments;
+} CollisionContext;
+
+bool collisions_reserve(SPS_Collisions* collisions, Uint64 count);
+Uint32 collision_float_key(float value);
+bool collisions_merge_appended(SPS_Collisions* collisions,
+                               SPS_ThreadPool* pool,
+                               CollisionContext* context,
+                               Uint64 kept);
+bool collisions_insertion_sort(SPS_Collisions* collisions);
+void collisions_narrowphase(SPS_Collisions* collisions,
+                            SPS_Particles* particles);
+void collision_moments_task(void* userdata,
+                            Uint64 first,
+                            Uint64 last,
+                            Uint32 worker);
+void collision_lower_task(void* userdata,
+                          Uint64 first,
+                          Uint64 last,
+                          Uint32 worker);
+void collision_radix_keys_task(void* userdata,
+                               Uint64 first,
+                               Uint64 last,
+                               Uint32 worker);
+void collision_gather_task(void* userdata,
+                           Uint64 first,
+                           Uint64 last,
+                           Uint32 worker);
+void collision_sweep_task(void* userdata,
+                          Uint64 first,
+                          Uint64 last,
+                          Uint32 worker);
+
+void SPS_CollisionsLoad(SPS_Collisions* collisions) {
+  SDL_memset(collisions, 0, sizeof(SPS_Collisions));
+  collisions->params = (SPS_CollisionParams){
+      .restitution = 0.5f,
+      .iterations = 4,
+  };
+  collisions->axis = -1;
+}
+
+bool SPS_CollisionsResolve(SPS_Collisions* collisions,
+                           SPS_Particles* particles,
+                           SPS_ThreadPool* pool) {
+  collisions->pairs_count = 0;
+  collisions->sort_moves = 0;
+  collisions->full_sort = false;
+  Uint64 count = particles->count;
+  if (count < 2) {
+    return true;
+  }
+
+  if (count > SDL_MAX_UINT32 || !collisions_reserve(collisions, count)) {
+    SDL_Log("Couldn't reserve collisions for %" SDL_PRIu64 " particles",
+            count);
+    return false;
+  }
+
+  Uint64 chunks_count =
+      (count + SPS_PARTICLES_CHUNK_SIZE - 1) / SPS_PARTICLES_CHUNK_SIZE;
+  CollisionContext context = {
+      .collisions = collisions,
+      .particles = particles,
+      .chunk_moments = SDL_malloc(sizeof(double) * 6 * chunks_count),
+  };
+  if (context.chunk_moments == NULL) {
+    SDL_Log("Couldn't allocate collision moments");
+    return false;
+  }
+
+  // Sweep along the axis the particles spread the most over
+  SPS_ThreadPoolParallelFor(pool, 0, count, SPS_PARTICLES_CHUNK_SIZE,
+                            collision_moments_task, &context);
+  double variance[3];
+  for (int a = 0; a < 3; a++) {
+    double sum = 0.0;
+    double sum2 = 0.0;
+    for (Uint64 c = 0; c < chunks_count; c++) {
+      sum += context.chunk_moments[c * 6 + a];
+      sum2 += context.chunk_moments[c * 6 + 3 + a];
+    }
+    double mean = sum / count;
+    variance[a] = sum2 / count - mean * mean;
+  }
+  SDL_free(context.chunk_moments);
+
+  Sint32 axis = collisions->axis >= 0 ? collisions->axis : 0;
+  double hysteresis =
+      collisions->axis >= 0 ? COLLISION_AXIS_HYSTERESIS : 1.0;
+  for (int a = 0; a < 3; a++) {
+    if (variance[a] > variance[axis] * hysteresis) {
+      axis = a;
+    }
+  }
+
+  // A new axis or a population that shrank without a remap invalidates the
+  // order kept from the last step, particles appended since go at its end
+  bool reset = axis != collisions->axis || collisions->count == 0 ||
+               count < collisions->count;
+  const Uint64 kept = reset ? 0 : collisions->count;
+  collisions->axis = axis;
+  collisions->count = count;
+  for (Uint64 s = kept; s < count; s++) {
+    collisions->order[s] = (Uint32)s;
+  }
+
+  SPS_ThreadPoolParallelFor(pool, 0, count, SPS_PARTICLES_CHUNK_SIZE,
+                            collision_lower_task, &context);
+  if (!reset && kept < count &&
+      !collisions_merge_appended(collisions, pool, &context, kept)) {
+    return false;
+  }
+  if (reset || !collisions_insertion_sort(collisions)) {
+    collisions->full_sort = true;
+    SPS_ThreadPoolParallelFor(pool, 0, count, SPS_PARTICLES_CHUNK_SIZE,
+                              collision_radix_keys_task, &context);
+    if (!SPS_RadixSort(pool, collisions->radix_keys, collisions->order,
+                       collisions->radix_keys_tmp, collisions->radix_order_tmp,
+                       count, 32)) {
+      return false;
+    }
+  }
+
+  SPS_ThreadPoolParallelFor(pool, 0, count, SPS_PARTICLES_CHUNK_SIZE,
+                            collision_gather_task, &context);
+  SPS_ThreadPoolParallelFor(pool, 0, count, SPS_PARTICLES_CHUNK_SIZE,
+                            collision_sweep_task, &context);
+
+  for (Uint64 c = 0; c < chunks_count; c++) {
+    collisions->pairs_count += collisions->chunks[c].count;
+  }
+
+  // Contacts share particles, they are solved one after another
+  collisions_narrowphase(collisions, particles);
+  return true;
+}
+
+void SPS_CollisionsRemap(SPS_Collisions* collisions,
+                         const Uint32* index,
+                         Uint64 count) {
+  // Another population resets the order anyway
+  if (collisions->axis < 0 || collisions->count != count) {
+    return;
+  }
+
+  // Removed particles leave, the survivors keep their relative order
+  Uint64 kept = 0;
+  for (Uint64 s = 0; s < count; s++) {
+    Uint32 i = index[collisions->order[s]];
+    if (i != SPS_PARTICLES_REMOVED) {
+      collisions->order[kept++] = i;
+    }
+  }
+  collisions->count = kept;
+}
+
+Uint64 SPS_CollisionsMemorySize(const SPS_Collisions* collisions) {
+  Uint64 size =
+      (sizeof(Uint32) * 4 + sizeof(float) * 5) * collisions->capacity;
+  size += sizeof(SPS_CollisionPairs) * collisions->chunks_count;
+  for (Uint64 c = 0; c < collisions->chunks_count; c++) {
+    size += sizeof(Uint32) * 2 * collisions->chunks[c].capacity;
+  }
+  return size;
+}
+
+void SPS_CollisionsDestroy(SPS_Collisions* collisions) {
+  for (Uint64 c = 0; c < collisions->chunks_count; c++) {
+    SDL_free(collisions->chunks[c].pairs);
+  }
+  SDL_free(collisions->chunks);
+  SDL_free(collisions->order);
+  SDL_free(collisions->lower);
+  SDL_free(collisions->x);
+  SDL_free(collisions->y);
+  SDL_free(collisions->z);
+  SDL_free(collisions->radius);
+  SDL_free(collisions->radix_keys);
+  SDL_free(collisions->radix_keys_tmp);
+  SDL_free(collisions->radix_order_tmp);
+
+  SPS_CollisionParams params = collisions->params;
+  bool enabled = collisions->enabled;
+  SPS_CollisionsLoad(collisions);
+  collisions->params = params;
+  collisions->enabled = enabled;
+}
+
+bool collisions_reserve(SPS_Collisions* collisions, Uint64 count) {
+  Uint64 chunks_count =
+      (count + SPS_PARTICLES_CHUNK_SIZE - 1) / SPS_PARTICLES_CHUNK_SIZE;
+  if (chunks_count > collisions->chunks_count) {
+    SPS_CollisionPairs* chunks = SDL_realloc(
+        collisions->chunks, sizeof(SPS_CollisionPairs) * chunks_count);
+    if (chunks == NULL) {
+      return false;
+    }
+
+    SDL_memset(chunks + collisions->chunks_count, 0,
+               sizeof(SPS_CollisionPairs) *
+                   (chunks_count - collisions->chunks_count));
+    collisions->chunks = chunks;
+    collisions->chunks_count = chunks_count;
+  }
+
+  if (count <= collisions->capacity) {
+    return true;
+  }
+
+  Uint64 capacity =
+      SDL_max(count, collisions->capacity + collisions->capacity / 2);
+  Uint32** indices[] = {&collisions->order, &collisions->radix_keys,
+                        &collisions->radix_keys_tmp,
+                        &collisions->radix_order_tmp};
+  for (size_t i = 0; i < SDL_arraysize(indices); i++) {
+    Uint32* data = SDL_realloc(*indices[i], sizeof(Uint32) * capacity);
+    if (data == NULL) {
+      return false;
+    }
+    *indices[i] = data;
+  }
+
+  float** values[] = {&collisions->lower, &collisions->x, &collisions->y,
+                      &collisions->z, &collisions->radius};
+  for (size_t i = 0; i < SDL_arraysize(values); i++) {
+    float* data = SDL_realloc(*values[i], sizeof(float) * capacity);
+    if (data == NULL) {
+      return false;
+    }
+    *values[i] = data;
+  }
+
+  collisions->capacity = capacity;
+  return true;
+}
+
+Uint32 collision_float_key(float value) {
+  // Flips the sign bit of positives and every bit of negatives so the
+  // unsigned order matches the float order
+  Uint32 bits;
+  SDL_memcpy(&bits, &value, sizeof(bits));
+  return (bits & 0x80000000u) ? ~bits : bits | 0x80000000u;
+}
+
+bool collisions_merge_appended(SPS_Collisions* collisions,
+                               SPS_ThreadPool* pool,
+                               CollisionContext* context,
+                               Uint64 kept) {
+  // New particles are sorted apart, the insertion sort would carry every
+  // one of them across much of the order
+  const Uint64 count = collisions->count;
+  Uint32* order = collisions->order;
+  Uint32* keys = collisions->radix_keys;
+  SPS_ThreadPoolParallelFor(pool, kept, count, SPS_PARTICLES_CHUNK_SIZE,
+                            collision_radix_keys_task, context);
+  if (!SPS_RadixSort(pool, keys + kept, order + kept,
+                     collisions->radix_keys_tmp, collisions->radix_order_tmp,
+                     count - kept, 32)) {
+    return false;
+  }
+
+  // Merging into the nearly sorted kept part leaves it nearly sorted
+  Uint32* merged = collisions->radix_order_tmp;
+  Uint64 a = 0;
+  Uint64 b = kept;
+  Uint64 m = 0;
+  while (a < kept && b < count) {
+    bool head = collision_float_key(collisions->lower[a]) <= keys[b];
+    merged[m++] = head ? order[a++] : order[b++];
+  }
+  while (a < kept) {
+    merged[m++] = order[a++];
+  }
+  while (b < count) {
+    merged[m++] = order[b++];
+  }
+  SDL_memcpy(order, merged, sizeof(Uint32) * count);
+
+  SPS_ThreadPoolParallelFor(pool, 0, count, SPS_PARTICLES_CHUNK_SIZE,
+                            collision_lower_task, context);
+  return true;
+}
+
+bool collisions_insertion_sort(SPS_Collisions* collisions) {
+  Uint32* order = collisions->order;
+  float* lower = collisions->lower;
+  Uint64 budget = collisions->count * COLLISION_MOVES_PER_PARTICLE;
+  Uint64 moves = 0;
+  for (Uint64 s = 1; s < collisions->count; s++) {
+    float key = lower[s];
+    Uint32 index = order[s];
+    Uint64 t = s;
+    for (; t > 0 && lower[t - 1] > key; t--) {
+      lower[t] = lower[t - 1];
+      order[t] = order[t - 1];
+    }
+    lower[t] = key;
+    order[t] = index;
+
+    // Too far from sorted, the caller does a full sort from this order
+    moves += s - t;
+    if (moves > budget) {
+      collisions->sort_moves = moves;
+      return false;
+    }
+  }
+
+  collisions->sort_moves = moves;
+  return true;
+}
+
+void collisions_narrowphase(SPS_Collisions* collisions,
+                            SPS_Particles* particles) {
+  float* px = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_X);
+  float* py = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_Y);
+  float* pz = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_Z);
+  float* vx = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_VELOCITY_X);
+  float* vy = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_VELOCITY_Y);
+  float* vz = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_VELOCITY_Z);
+  const float* mass = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_MASS);
+  const float* scale = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_SCALE);
+  const float bounce = 1.0f + collisions->params.restitution;
+  const Uint64 chunks_count =
+      (collisions->count + SPS_PARTICLES_CHUNK_SIZE - 1) /
+      SPS_PARTICLES_CHUNK_SIZE;
+
+  for (Uint32 it = 0; it < collisions->params.iterations; it++) {
+    for (Uint64 c = 0; c < chunks_count; c++) {
+      const SPS_CollisionPairs* chunk = &collisions->chunks[c];
+      for (Uint64 p = 0; p < chunk->count; p++) {
+        Uint32 i = chunk->pairs[p * 2];
+        Uint32 j = chunk->pairs[p * 2 + 1];
+        float dx = px[j] - px[i];
+        float dy = py[j] - py[i];
+        float dz = pz[j] - pz[i];
+        float d2 = dx * dx + dy * dy + dz * dz;
+        float reach = scale[i] + scale[j];
+        if (d2 >= reach * reach) {
+          continue;
+        }
+
+        // Coincident centers get pushed apart vertically
+        float d = SDL_sqrtf(d2);
+        float nx = 0.0f;
+        float ny = 1.0f;
+        float nz = 0.0f;
+        if (d > 0.0f) {
+          nx = dx / d;
+          ny = dy / d;
+          nz = dz / d;
+        }
+
+        float inv_mi = 1.0f / SDL_max(mass[i], MIN_MASS);
+        float inv_mj = 1.0f / SDL_max(mass[j], MIN_MASS);
+        float inv_sum = inv_mi + inv_mj;
+
+        // Split the overlap so the heavier particle moves less
+        float push = (reach - d) / inv_sum;
+        px[i] -= push * inv_mi * nx;
+        py[i] -= push * inv_mi * ny;
+        pz[i] -= push * inv_mi * nz;
+        px[j] += push * inv_mj * nx;
+        py[j] += push * inv_mj * ny;
+        pz[j] += push * inv_mj * nz;
+
+        float vn = (vx[j] - vx[i]) * nx + (vy[j] - vy[i]) * ny +
+                   (vz[j] - vz[i]) * nz;
+        if (vn >= 0.0f) {
+          continue;
+        }
+
+        float impulse = -bounce * vn / inv_sum;
+        vx[i] -= impulse * inv_mi * nx;
+        vy[i] -= impulse * inv_mi * ny;
+        vz[i] -= impulse * inv_mi * nz;
+        vx[j] += impulse * inv_mj * nx;
+        vy[j] += impulse * inv_mj * ny;
+        vz[j] += impulse * inv_mj * nz;
+      }
+    }
+  }
+}
+
+void collision_moments_task(void* userdata,
+                            Uint64 first,
+                            Uint64 last,
+                            Uint32 worker) {
+  (void)worker;
+  CollisionContext* context = userdata;
+  double* moments =
+      context->chunk_moments + (first / SPS_PARTICLES_CHUNK_SIZE) * 6;
+  for (int a = 0; a < 3; a++) {
+    const float* p =
+        SPS_PARTICLES_CHANNEL(context->particles, SPS_CHANNEL_POSITION_X + a);
+    double sum = 0.0;
+    double sum2 = 0.0;
+    for (Uint64 i = first; i < last; i++) {
+      sum += p[i];
+      sum2 += (double)p[i] * p[i];
+    }
+    moments[a] = sum;
+    moments[3 + a] = sum2;
+  }
+}
+
+void collision_lower_task(void* userdata,
+                          Uint64 first,
+                          Uint64 last,
+                          Uint32 worker) {
+  (void)worker;
+  CollisionContext* context = userdata;
+  SPS_Collisions* collisions = context->collisions;
+  const float* p = SPS_PARTICLES_CHANNEL(
+      context->particles, SPS_CHANNEL_POSITION_X + collisions->axis);
+  const float* scale =
+      SPS_PARTICLES_CHANNEL(context->particles, SPS_CHANNEL_SCALE);
+  for (Uint64 s = first; s < last; s++) {
+    Uint32 i = collisions->order[s];
+    collisions->lower[s] = p[i] - scale[i];
+  }
+}
+
+void collision_radix_keys_task(void* userdata,
+                               Uint64 first,
+                               Uint64 last,
+                               Uint32 worker) {
+  (void)worker;
+  CollisionContext* context = userdata;
+  SPS_Collisions* collisions = context->collisions;
+  for (Uint64 s = first; s < last; s++) {
+    collisions->radix_keys[s] = collision_float_key(collisions->lower[s]);
+  }
+}
+
+void collision_gather_task(void* userdata,
+                           Uint64 first,
+                           Uint64 last,
+                           Uint32 worker) {
+  (void)worker;
+  CollisionContext* context = userdata;
+  SPS_Collisions* collisions = context->collisions;
+  const SPS_Particles* particles = context->particles;
+  const float* px = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_X);
+  const float* py = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_Y);
+  const float* pz = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_Z);
+  const float* scale = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_SCALE);
+  const float* p[3] = {px, py, pz};
+  const float* axis = p[collisions->axis];
+  for (Uint64 s = first; s < last; s++) {
+    Uint32 i = collisions->order[s];
+    collisions->x[s] = px[i];
+    collisions->y[s] = py[i];
+    collisions->z[s] = pz[i];
+    collisions->radius[s] = scale[i];
+    collisions->lower[s] = axis[i] - scale[i];
+  }
+}
+
+void collision_sweep_task(void* userdata,
+                          Uint64 first,
+                          Uint64 last,
+                          Uint32 worker) {
+  (void)worker;
+  CollisionContext* context = userdata;
+  SPS_Collisions* collisions = context->collisions;
+  SPS_CollisionPairs* chunk =
+      &collisions->chunks[first / SPS_PARTICLES_CHUNK_SIZE];
+  chunk->count = 0;
+
+  for (Uint64 s = first; s < last; s++) {
+    const float upper = collisions->lower[s] + 2.0f * collisions->radius[s];
+    for (Uint64 t = s + 1;
+         t < collisions->count && collisions->lower[t] <= upper; t++) {
+      float dx = collisions->x[t] - collisions->x[s];
+      float dy = collisions->y[t] - collisions->y[s];
+      float dz = collisions->z[t] - collisions->z[s];
+      float reach = collisions->radius[s] + collisions->radius[t];
+      if (dx * dx + dy * dy + dz * dz >= reach * reach) {
+        continue;
+      }
+
+      if (chunk->count == chunk->capacity) {
+        Uint64 capacity = SDL_max(64, chunk->capacity * 2);
+        Uint32* pairs =
+            SDL_realloc(chunk->pairs, sizeof(Uint32) * 2 * capacity);
+        if (pairs == NULL) {
+          SDL_Log("Couldn't grow collision pairs");
+          return;
+        }
+        chunk->pairs = pairs;
+        chunk->capacity = capacity;
+      }
+
+      chunk->pairs[chunk->count * 2] = collisions->order[s];
+      chunk->pairs[chunk->count * 2 + 1] = collisions->order[t];
+      chunk->count++;
+    }
+  }
+}
@@ -0,0 +1,74 @@
+#ifndef SPS_COLLISION_H
+#define SPS_COLLISION_H
+
+#include <SDL3/SDL_stdinc.h>
+#include "particles.h"
+#include "thread_pool.h"
+
+// Response of the particle to particle contacts.
+typedef struct {
+  float restitution;   // 0 is fully inelastic, 1 fully elastic
+  Uint32 iterations;   // passes over the contacts, piles need a few
+} SPS_CollisionParams;
+
+// Overlapping pairs found by one chunk of the sweep.
+typedef struct {
+  Uint32* pairs;  // two particle indices per pair
+  Uint64 count;
+  Uint64 capacity;
+} SPS_CollisionPairs;
+
+// Sweep and prune over spheres of radius scale, the sorted order is kept
+// between steps so nearly sorted data re-sorts with an insertion sort.
+// Particles appended since the last step are sorted apart and merged in.
+typedef struct {
+  SPS_CollisionParams params;
+  bool enabled;
+  Sint32 axis;  // -1 until the first sort
+
+  // Particles sorted by the lower bound of their interval on axis
+  Uint32* order;
+  float* lower;
+  float* x;
+  float* y;
+  float* z;
+  float* radius;
+  Uint32* radix_keys;
+  Uint32* radix_keys_tmp;
+  Uint32* radix_order_tmp;
+  Uint64 count;
+  Uint64 capacity;
+
+  SPS_CollisionPairs* chunks;
+  Uint64 chunks_count;
+
+  // Statistics of the last step
+  Uint64 pairs_count;
+  Uint64 sort_moves;
+  bool full_sort;
+} SPS_Collisions;
+
+// Initializes disabled collisions.
+void SPS_CollisionsLoad(SPS_Collisions* collisions);
+
+// Finds the overlapping spheres and pushes them apart with mass weighted
+// impulses, updating positions and velocities in place.
+bool SPS_CollisionsResolve(SPS_Collisions* collisions,
+                           SPS_Particles* particles,
+                           SPS_ThreadPool* pool);
+
+// Follows a reordering or a compaction of the count particles, particle i
+// moved to index[i] or was removed when that is SPS_PARTICLES_REMOVED, so the
+// order kept for the next step stays nearly sorted. Particles appended after
+// the survivors join the order on the next resolve.
+void SPS_CollisionsRemap(SPS_Collisions* collisions,
+                         const Uint32* index,
+                         Uint64 count);
+
+// Bytes allocated by the broadphase.
+Uint64 SPS_CollisionsMemorySize(const SPS_Collisions* collisions);
+
+// Releases the broadphase buffers.
+void SPS_CollisionsDestroy(SPS_Collisions* collisions);
+
+#endif /* SPS_COLLISION_H */
@@ -0,0 +1,436 @@
+#include "emitters.h"
+#include "random.h"
+#include "xmath.h"
+
+#include <SDL3/SDL_log.h>
+#include <SDL3/SDL_stdinc.h>
+
+// Shared by the passes of one compaction
+typedef struct {
+  SPS_Emitters* emitters;
+  SPS_Particles* particles;
+  float* age;
+  const float* lifetime;
+  float dt;
+  Uint64 live;  // particles left once the holes are filled
+} CompactContext;
+
+bool emitters_reserve(SPS_Emitters* emitters, Uint64 count);
+bool emitters_compact(SPS_Emitters* emitters,
+                      SPS_Particles* particles,
+                      SPS_ThreadPool* pool,
+                      float dt);
+void emitters_emit(const SPS_Emitters* emitters,
+                   Uint32 index,
+                   SPS_Particles* particles,
+                   Uint64 first,
+                   Uint64 count,
+                   float dt);
+void emitters_random(Uint64 seed,
+                     Uint32 stream,
+                     Uint64 counter,
+                     float units[4]);
+void emitters_position(const SPS_Emitter* emitter,
+                       const float units[4],
+                       float position[3]);
+void emitters_velocity(const SPS_Emitter* emitter,
+                       const float units[4],
+                       float jitter,
+                       float velocity[3]);
+float emitters_jitter(float value, float amount, float unit);
+bool particle_expired(const float* age, const float* lifetime, Uint64 i);
+void emitters_age_task(void* userdata,
+                       Uint64 first,
+                       Uint64 last,
+                       Uint32 worker);
+void emitters_collect_task(void* userdata,
+                           Uint64 first,
+                           Uint64 last,
+                           Uint32 worker);
+void emitters_fill_task(void* userdata,
+                        Uint64 first,
+                        Uint64 last,
+                        Uint32 worker);
+
+void SPS_EmitterLoad(SPS_Emitter* emitter) {
+  *emitter = (SPS_Emitter){
+      .shape = SPS_EMITTER_POINT,
+      .rate = 1000.0f,
+      .velocity = {0.0f, 12.0f, 0.0f},
+      .spread = 0.25f,
+      .speed_jitter = 0.2f,
+      .lifetime = 3.0f,
+      .lifetime_jitter = 0.2f,
+      .mass = 1.0f,
+      .scale = 0.1f,
+  };
+}
+
+void SPS_EmittersLoad(SPS_Emitters* emitters) {
+  SDL_memset(emitters, 0, sizeof(SPS_Emitters));
+}
+
+bool SPS_EmittersAdd(SPS_Emitters* emitters, SPS_Emitter emitter) {
+  if (emitters->count == emitters->capacity) {
+    Uint32 capacity = SDL_max(4, emitters->capacity * 2);
+    SPS_Emitter* data =
+        SDL_realloc(emitters->emitters, sizeof(SPS_Emitter) * capacity);
+    if (data == NULL) {
+      SDL_Log("Couldn't allocate %u emitters", capacity);
+      return false;
+    }
+    emitters->emitters = data;
+    emitters->capacity = capacity;
+  }
+
+  emitters->emitters[emitters->count++] = emitter;
+  return true;
+}
+
+bool SPS_EmittersUpdate(SPS_Emitters* emitters,
+                        SPS_Particles* particles,
+                        SPS_ThreadPool* pool,
+                        float dt) {
+  emitters->spawned = 0;
+  emitters->expired = 0;
+  emitters->dropped = 0;
+  if (!emitters_compact(emitters, particles, pool, dt)) {
+    return false;
+  }
+
+  // Whole particles only, the remainder accumulates over the next updates
+  for (Uint32 e = 0; e < emitters->count; e++) {
+    SPS_Emitter* emitter = &emitters->emitters[e];
+    emitter->pending += emitter->rate * dt;
+    Uint64 wanted = (Uint64)emitter->pending;
+    emitter->pending -= (float)wanted;
+
+    Uint64 first = particles->count;
+    Uint64 spawned = SPS_ParticlesSpawn(particles, wanted);
+    emitters_emit(emitters, e, particles, first, spawned, dt);
+    emitter->emitted += spawned;
+    emitters->spawned += spawned;
+    emitters->dropped += wanted - spawned;
+  }
+
+  return true;
+}
+
+Uint64 SPS_EmittersMemorySize(const SPS_Emitters* emitters) {
+  return sizeof(SPS_Emitter) * emitters->capacity +
+         sizeof(Uint64) * 2 * emitters->chunks_capacity +
+         sizeof(Uint32) * 2 * emitters->movers_capacity;
+}
+
+void SPS_EmittersDestroy(SPS_Emitters* emitters) {
+  SDL_free(emitters->emitters);
+  SDL_free(emitters->chunk_offsets);
+  SDL_free(emitters->movers);
+  SDL_free(emitters->moved);
+  SPS_EmittersLoad(emitters);
+}
+
+bool emitters_reserve(SPS_Emitters* emitters, Uint64 count) {
+  Uint64 chunks =
+      (count + SPS_PARTICLES_CHUNK_SIZE - 1) / SPS_PARTICLES_CHUNK_SIZE;
+  if (chunks > emitters->chunks_capacity) {
+    Uint64 capacity = emitters->chunks_capacity + emitters->chunks_capacity / 2;
+    capacity = SDL_max(capacity, chunks);
+    Uint64* data =
+        SDL_realloc(emitters->chunk_offsets, sizeof(Uint64) * 2 * capacity);
+    if (data == NULL) {
+      return false;
+    }
+    emitters->chunk_offsets = data;
+    emitters->chunks_capacity = capacity;
+  }
+
+  if (count > emitters->movers_capacity) {
+    Uint64 capacity = emitters->movers_capacity + emitters->movers_capacity / 2;
+    capacity = SDL_max(capacity, count);
+    Uint32** arrays[2] = {&emitters->movers, &emitters->moved};
+    for (int a = 0; a < 2; a++) {
+      Uint32* data = SDL_realloc(*arrays[a], sizeof(Uint32) * capacity);
+      if (data == NULL) {
+        return false;
+      }
+      *arrays[a] = data;
+    }
+    emitters->movers_capacity = capacity;
+  }
+
+  return true;
+}
+
+bool emitters_compact(SPS_Emitters* emitters,
+                      SPS_Particles* particles,
+                      SPS_ThreadPool* pool,
+                      float dt) {
+  const Uint64 count = particles->count;
+  if (count == 0) {
+    return true;
+  }
+  if (count > SDL_MAX_UINT32 || !emitters_reserve(emitters, count)) {
+    SDL_Log("Couldn't compact %" SDL_PRIu64 " particles", count);
+    return false;
+  }
+
+  CompactContext context = {
+      .emitters = emitters,
+      .particles = particles,
+      .age = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_AGE),
+      .lifetime = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_LIFETIME),
+      .dt = dt,
+  };
+
+  // Ages and counts the survivors of every chunk in one pass
+  SPS_ThreadPoolParallelFor(pool, 0, count, SPS_PARTICLES_CHUNK_SIZE,
+                            emitters_age_task, &context);
+  const Uint64 chunks =
+      (count + SPS_PARTICLES_CHUNK_SIZE - 1) / SPS_PARTICLES_CHUNK_SIZE;
+  Uint64* offsets = emitters->chunk_offsets;
+  for (Uint64 c = 0; c < chunks; c++) {
+    context.live += offsets[2 * c];
+  }
+  if (context.live == count) {
+    return true;
+  }
+
+  // Holes below the new end pair up in order with the live particles past
+  // it, only the chunk straddling the end needs a second look
+  const Uint64 live = context.live;
+  Uint64 holes = 0;
+  Uint64 movers = 0;
+  for (Uint64 c = 0; c < chunks; c++) {
+    Uint64 start = c * SPS_PARTICLES_CHUNK_SIZE;
+    Uint64 end = SDL_min(start + SPS_PARTICLES_CHUNK_SIZE, count);
+    Uint64 chunk_live = offsets[2 * c];
+    Uint64 head_live = chunk_live;
+    if (start >= live) {
+      head_live = 0;
+    } else if (end > live) {
+      head_live = 0;
+      for (Uint64 i = start; i < live; i++) {
+        head_live += !particle_expired(context.age, context.lifetime, i);
+      }
+    }
+
+    offsets[2 * c] = holes;
+    offsets[2 * c + 1] = movers;
+    holes += SDL_min(end, live) - SDL_min(start, live) - head_live;
+    movers += chunk_live - head_live;
+  }
+
+  SPS_ThreadPoolParallelFor(pool, 0, count, SPS_PARTICLES_CHUNK_SIZE,
+                            emitters_collect_task, &context);
+  SPS_ThreadPoolParallelFor(pool, 0, live, SPS_PARTICLES_CHUNK_SIZE,
+                            emitters_fill_task, &context);
+
+  emitters->expired = count - live;
+  particles->count = live;
+  particles->reindexed++;
+  return true;
+}
+
+void emitters_emit(const SPS_Emitters* emitters,
+                   Uint32 index,
+                   SPS_Particles* particles,
+                   Uint64 first,
+                   Uint64 count,
+                   float dt) {
+  const SPS_Emitter* emitter = &emitters->emitters[index];
+  float* p[3] = {SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_X),
+                 SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_Y),
+                 SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_Z)};
+  float* v[3] = {SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_VELOCITY_X),
+                 SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_VELOCITY_Y),
+                 SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_VELOCITY_Z)};
+  float* mass = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_MASS);
+  float* scale = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_SCALE);
+  float* age = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_AGE);
+  float* lifetime = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_LIFETIME);
+
+  // Emitters draw from streams of their own, counted by what they emitted
+  // so a particle's numbers don't depend on the others spawned with it
+  const Uint32 streams = SPS_RANDOM_STREAMS * index;
+  for (Uint64 i = first; i < first + count; i++) {
+    const Uint64 counter = emitter->emitted + (i - first);
+    float born_units[4];
+    float position_units[4];
+    float velocity_units[4];
+    float jitter_units[4];
+    emitters_random(emitters->seed, SPS_RANDOM_EMITTER_BORN + streams,
+                    counter, born_units);
+    emitters_random(emitters->seed, SPS_RANDOM_EMITTER_POSITION + streams,
+                    counter, position_units);
+    emitters_random(emitters->seed, SPS_RANDOM_EMITTER_VELOCITY + streams,
+                    counter, velocity_units);
+    emitters_random(emitters->seed, SPS_RANDOM_EMITTER_JITTER + streams,
+                    counter, jitter_units);
+
+    float position[3];
+    float velocity[3];
+    emitters_position(emitter, position_units, position);
+    emitters_velocity(emitter, velocity_units, jitter_units[0], velocity);
+
+    // A jittered lifetime must not reach 0, that would make it immortal
+    lifetime[i] = 0.0f;
+    if (emitter->lifetime > 0.0f) {
+      lifetime[i] = SDL_max(emitters_jitter(emitter->lifetime,
+                                            emitter->lifetime_jitter,
+                                            jitter_units[1]),
+                            SDL_FLT_EPSILON);
+    }
+
+    // Births are spread over the step so fast emitters don't pulse, without
+    // starting past the lifetime
+    float window = dt;
+    if (lifetime[i] > 0.0f) {
+      window = SDL_min(window, 0.5f * lifetime[i]);
+    }
+    float born = born_units[0] * window;
+    for (int a = 0; a < 3; a++) {
+      p[a][i] = position[a] + velocity[a] * born;
+      v[a][i] = velocity[a];
+    }
+    age[i] = born;
+    mass[i] = emitter->mass;
+    scale[i] = emitter->scale;
+  }
+}
+
+void emitters_random(Uint64 seed,
+                     Uint32 stream,
+                     Uint64 counter,
+                     float units[4]) {
+  Uint32 bits[4];
+  SPS_RandomPhilox(seed, counter, stream, bits);
+  for (int w = 0; w < 4; w++) {
+    units[w] = SPS_RandomUnit(bits[w]);
+  }
+}
+
+void emitters_position(const SPS_Emitter* emitter,
+                       const float units[4],
+                       float position[3]) {
+  float offset[3] = {0.0f, 0.0f, 0.0f};
+  switch (emitter->shape) {
+    case SPS_EMITTER_POINT:
+      break;
+    case SPS_EMITTER_SPHERE: {
+      // Uniform direction, the cube root of the radius keeps the ball
+      // uniform with a fixed number of draws
+      float y = 2.0f * units[0] - 1.0f;
+      float ring = SDL_sqrtf(SDL_max(1.0f - y * y, 0.0f));
+      float phi = 2.0f * SDL_PI_F * units[1];
+      float radius = emitter->extent[0] * SDL_powf(units[2], 1.0f / 3.0f);
+      SPS_Vec3Make(radius * ring * SDL_cosf(phi), radius * y,
+                   radius * ring * SDL_sinf(phi), offset);
+    } break;
+    case SPS_EMITTER_BOX:
+      for (int a = 0; a < 3; a++) {
+        offset[a] = (2.0f * units[a] - 1.0f) * emitter->extent[a];
+      }
+      break;
+  }
+
+  SPS_Vec3Add(emitter->position, offset, position);
+}
+
+void emitters_velocity(const SPS_Emitter* emitter,
+                       const float units[4],
+                       float jitter,
+                       float velocity[3]) {
+  float speed = SPS_Vec3Len(emitter->velocity);
+  if (speed <= 0.0f) {
+    SPS_Vec3Make(0.0f, 0.0f, 0.0f, velocity);
+    return;
+  }
+
+  // Orthonormal frame around the mean direction
+  float dir[3];
+  float helper[3] = {1.0f, 0.0f, 0.0f};
+  float side[3];
+  float up[3];
+  SPS_Vec3Scale(emitter->velocity, 1.0f / speed, dir);
+  if (SDL_fabsf(dir[0]) > 0.9f) {
+    SPS_Vec3Make(0.0f, 1.0f, 0.0f, helper);
+  }
+  SPS_Vec3Cross(dir, helper, side);
+  SPS_Vec3Normalize(side, side);
+  SPS_Vec3Cross(dir, side, up);
+
+  // Uniform over the spherical cap of the spread
+  float cos_theta = 1.0f - units[0] * (1.0f - SDL_cosf(emitter->spread));
+  float sin_theta = SDL_sqrtf(SDL_max(1.0f - cos_theta * cos_theta, 0.0f));
+  float phi = 2.0f * SDL_PI_F * units[1];
+  float a = sin_theta * SDL_cosf(phi);
+  float b = sin_theta * SDL_sinf(phi);
+  speed = emitters_jitter(speed, emitter->speed_jitter, jitter);
+  for (int i = 0; i < 3; i++) {
+    velocity[i] = (dir[i] * cos_theta + side[i] * a + up[i] * b) * speed;
+  }
+}
+
+float emitters_jitter(float value, float amount, float unit) {
+  return value * (1.0f + amount * (2.0f * unit - 1.0f));
+}
+
+bool particle_expired(const float* age, const float* lifetime, Uint64 i) {
+  return lifetime[i] > 0.0f && age[i] >= lifetime[i];
+}
+
+void emitters_age_task(void* userdata,
+                       Uint64 first,
+                       Uint64 last,
+                       Uint32 worker) {
+  (void)worker;
+  CompactContext* context = userdata;
+  Uint32* moved = context->emitters->moved;
+  Uint64 live = 0;
+  for (Uint64 i = first; i < last; i++) {
+    context->age[i] += context->dt;
+    bool expired = particle_expired(context->age, context->lifetime, i);
+    live += !expired;
+
+    // Survivors stay unless the fill moves them into a hole
+    moved[i] = expired ? SPS_PARTICLES_REMOVED : (Uint32)i;
+  }
+
+  Uint64 chunk = first / SPS_PARTICLES_CHUNK_SIZE;
+  context->emitters->chunk_offsets[2 * chunk] = live;
+}
+
+void emitters_collect_task(void* userdata,
+                           Uint64 first,
+                           Uint64 last,
+                           Uint32 worker) {
+  (void)worker;
+  CompactContext* context = userdata;
+  Uint64 chunk = first / SPS_PARTICLES_CHUNK_SIZE;
+  Uint64 mover = context->emitters->chunk_offsets[2 * chunk + 1];
+  Uint32* movers = context->emitters->movers;
+  for (Uint64 i = SDL_max(first, context->live); i < last; i++) {
+    if (!particle_expired(context->age, context->lifetime, i)) {
+      movers[mover++] = (Uint32)i;
+    }
+  }
+}
+
+void emitters_fill_task(void* userdata,
+                        Uint64 first,
+                        Uint64 last,
+                        Uint32 worker) {
+  (void)worker;
+  CompactContext* context = userdata;
+  Uint64 chunk = first / SPS_PARTICLES_CHUNK_SIZE;
+  Uint64 hole = context->emitters->chunk_offsets[2 * chunk];
+  const Uint32* movers = context->emitters->movers;
+  Uint32* moved = context->emitters->moved;
+  for (Uint64 i = first; i < last; i++) {
+    if (particle_expired(context->age, context->lifetime, i)) {
+      moved[movers[hole]] = (Uint32)i;
+      SPS_ParticlesCopy(context->particles, i, movers[hole++]);
+    }
+  }
+}
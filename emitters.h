@@ -0,0 +1,81 @@
+#ifndef SPS_EMITTERS_H
+#define SPS_EMITTERS_H
+
+#include <SDL3/SDL_stdinc.h>
+#include "particles.h"
+#include "thread_pool.h"
+
+// Volumes new particles are placed in.
+typedef enum {
+  SPS_EMITTER_POINT,
+  SPS_EMITTER_SPHERE,
+  SPS_EMITTER_BOX,
+} SPS_EmitterShape;
+
+// A continuous particle source, speeds and lifetimes vary uniformly by their
+// relative jitter around the mean.
+typedef struct {
+  SPS_EmitterShape shape;
+  float position[3];
+  float extent[3];  // box half extents, the sphere radius is extent[0]
+  float rate;       // particles per second
+  float velocity[3];
+  float spread;  // half angle in radians of the cone around velocity
+  float speed_jitter;
+  float lifetime;
+  float lifetime_jitter;
+  float mass;
+  float scale;
+  float pending;   // fraction of a particle carried to the next update
+  Uint64 emitted;  // particles spawned so far, counter of the next draws
+} SPS_Emitter;
+
+// Emitters of a system and the scratch of the expiry compaction.
+typedef struct {
+  SPS_Emitter* emitters;
+  Uint32 count;
+  Uint32 capacity;
+  Uint64 seed;  // key of the random draws, every emitter has its own streams
+
+  // Hole and mover offsets of every chunk, then the live particles past the
+  // new end that move into the holes
+  Uint64* chunk_offsets;
+  Uint64 chunks_capacity;
+  Uint32* movers;
+  Uint64 movers_capacity;
+
+  // New index of every particle of the last compaction, SPS_PARTICLES_REMOVED
+  // for the expired ones, valid when it expired any
+  Uint32* moved;
+
+  // Statistics of the last update
+  Uint64 spawned;
+  Uint64 expired;
+  Uint64 dropped;  // spawns the particle store couldn't grow for
+} SPS_Emitters;
+
+// Initializes a point fountain shooting up, ready to be customized.
+void SPS_EmitterLoad(SPS_Emitter* emitter);
+
+// Initializes an empty emitter set.
+void SPS_EmittersLoad(SPS_Emitters* emitters);
+
+// Appends an emitter.
+bool SPS_EmittersAdd(SPS_Emitters* emitters, SPS_Emitter emitter);
+
+// Ages every particle by dt, removes the ones past their lifetime with a
+// parallel compaction that keeps the live range dense, then spawns what the
+// emitters produced during dt. moved tells where the survivors went, the
+// spawned particles are appended after them.
+bool SPS_EmittersUpdate(SPS_Emitters* emitters,
+                        SPS_Particles* particles,
+                        SPS_ThreadPool* pool,
+                        float dt);
+
+// Bytes allocated by the emitters.
+Uint64 SPS_EmittersMemorySize(const SPS_Emitters* emitters);
+
+// Releases the emitters.
+void SPS_EmittersDestroy(SPS_Emitters* emitters);
+
+#endif /* SPS_EMITTERS_H */
@@ -0,0 +1,225 @@
+#include "forces.h"
+
+#include <SDL3/SDL_log.h>
+#include <SDL3/SDL_stdinc.h>
+
+// Particle arrays shared by every stage loop of a batch
+typedef struct {
+  const float* restrict px;
+  const float* restrict py;
+  const float* restrict pz;
+  const float* restrict vx;
+  const float* restrict vy;
+  const float* restrict vz;
+  const float* restrict mass;
+  float* restrict fx;
+  float* restrict fy;
+  float* restrict fz;
+} ForceBatch;
+
+void force_gravity(const SPS_ForceStage* stage,
+                   const ForceBatch* b,
+                   Uint64 first,
+                   Uint64 last);
+void force_drag(const SPS_ForceStage* stage,
+                const ForceBatch* b,
+                Uint64 first,
+                Uint64 last);
+void force_point(const SPS_ForceStage* stage,
+                 const ForceBatch* b,
+                 Uint64 first,
+                 Uint64 last);
+void force_vortex(const SPS_ForceStage* stage,
+                  const ForceBatch* b,
+                  Uint64 first,
+                  Uint64 last);
+void force_wind(const SPS_ForceStage* stage,
+                const ForceBatch* b,
+                Uint64 first,
+                Uint64 last);
+
+bool SPS_ForcePipelineAdd(SPS_ForcePipeline* pipeline, SPS_ForceStage stage) {
+  if (pipeline->stages_count >= SPS_FORCES_MAX_STAGES) {
+    SDL_Log("Couldn't add force stage, pipeline is full");
+    return false;
+  }
+
+  pipeline->stages[pipeline->stages_count++] = stage;
+  return true;
+}
+
+void SPS_ForcePipelineClear(SPS_ForcePipeline* pipeline) {
+  pipeline->stages_count = 0;
+}
+
+void SPS_ForcePipelinePrepare(const SPS_ForcePipeline* pipeline,
+                              SPS_Particles* particles,
+                              SPS_ThreadPool* pool) {
+  // A failed prepare leaves the stage empty, it then adds nothing
+  for (Uint32 s = 0; s < pipeline->stages_count; s++) {
+    const SPS_ForceStage* stage = &pipeline->stages[s];
+    switch (stage->type) {
+      case SPS_FORCE_GRAVITATION:
+        if (!SPS_OctreeBuild(stage->gravitation.octree, particles, pool)) {
+          SDL_Log("Couldn't build gravitation octree");
+        }
+        break;
+      case SPS_FORCE_SPH:
+        if (!SPS_SphPrepare(stage->sph.solver, particles, pool)) {
+          SDL_Log("Couldn't prepare SPH forces");
+        }
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+void SPS_ForcePipelineApply(const SPS_ForcePipeline* pipeline,
+                            const SPS_Particles* particles,
+                            float* const force[3],
+                            Uint64 first,
+                            Uint64 last) {
+  ForceBatch b = {
+      .px = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_X),
+      .py = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_Y),
+      .pz = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_Z),
+      .vx = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_VELOCITY_X),
+      .vy = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_VELOCITY_Y),
+      .vz = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_VELOCITY_Z),
+      .mass = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_MASS),
+      .fx = force[0],
+      .fy = force[1],
+      .fz = force[2],
+  };
+
+  for (Uint64 i = first; i < last; i++) {
+    b.fx[i] = 0.0f;
+    b.fy[i] = 0.0f;
+    b.fz[i] = 0.0f;
+  }
+
+  // One tight loop per stage, the batch stays in cache between them
+  for (Uint32 s = 0; s < pipeline->stages_count; s++) {
+    const SPS_ForceStage* stage = &pipeline->stages[s];
+    switch (stage->type) {
+      case SPS_FORCE_GRAVITY:
+        force_gravity(stage, &b, first, last);
+        break;
+      case SPS_FORCE_DRAG:
+        force_drag(stage, &b, first, last);
+        break;
+      case SPS_FORCE_POINT:
+        force_point(stage, &b, first, last);
+        break;
+      case SPS_FORCE_VORTEX:
+        force_vortex(stage, &b, first, last);
+        break;
+      case SPS_FORCE_WIND:
+        force_wind(stage, &b, first, last);
+        break;
+      case SPS_FORCE_GRAVITATION:
+        SPS_OctreeForces(stage->gravitation.octree, &stage->gravitation.params,
+                         particles, force, first, last);
+        break;
+      case SPS_FORCE_SPH:
+        SPS_SphForces(stage->sph.solver, force, first, last);
+        break;
+    }
+  }
+}
+
+void force_gravity(const SPS_ForceStage* stage,
+                   const ForceBatch* b,
+                   Uint64 first,
+                   Uint64 last) {
+  const float gx = stage->gravity.acceleration[0];
+  const float gy = stage->gravity.acceleration[1];
+  const float gz = stage->gravity.acceleration[2];
+  for (Uint64 i = first; i < last; i++) {
+    b->fx[i] += b->mass[i] * gx;
+    b->fy[i] += b->mass[i] * gy;
+    b->fz[i] += b->mass[i] * gz;
+  }
+}
+
+void force_drag(const SPS_ForceStage* stage,
+                const ForceBatch* b,
+                Uint64 first,
+                Uint64 last) {
+  const float linear = stage->drag.linear;
+  const float quadratic = stage->drag.quadratic;
+  for (Uint64 i = first; i < last; i++) {
+    float speed =
+        SDL_sqrtf(b->vx[i] * b->vx[i] + b->vy[i] * b->vy[i] +
+                  b->vz[i] * b->vz[i]);
+    float k = linear + quadratic * speed;
+    b->fx[i] -= k * b->vx[i];
+    b->fy[i] -= k * b->vy[i];
+    b->fz[i] -= k * b->vz[i];
+  }
+}
+
+void force_point(const SPS_ForceStage* stage,
+                 const ForceBatch* b,
+                 Uint64 first,
+                 Uint64 last) {
+  const float cx = stage->point.center[0];
+  const float cy = stage->point.center[1];
+  const float cz = stage->point.center[2];
+  const float strength = stage->point.strength;
+  const float eps2 = stage->point.softening * stage->point.softening;
+  for (Uint64 i = first; i < last; i++) {
+    float dx = cx - b->px[i];
+    float dy = cy - b->py[i];
+    float dz = cz - b->pz[i];
+    float r2 = dx * dx + dy * dy + dz * dz + eps2;
+    float k = strength * b->mass[i] / (r2 * SDL_sqrtf(r2));
+    b->fx[i] += k * dx;
+    b->fy[i] += k * dy;
+    b->fz[i] += k * dz;
+  }
+}
+
+void force_vortex(const SPS_ForceStage* stage,
+                  const ForceBatch* b,
+                  Uint64 first,
+                  Uint64 last) {
+  const float cx = stage->vortex.center[0];
+  const float cy = stage->vortex.center[1];
+  const float cz = stage->vortex.center[2];
+  const float ax = stage->vortex.axis[0];
+  const float ay = stage->vortex.axis[1];
+  const float az = stage->vortex.axis[2];
+  const float strength = stage->vortex.strength;
+  const float eps2 = stage->vortex.softening * stage->vortex.softening;
+  for (Uint64 i = first; i < last; i++) {
+    // Tangent is axis x r, falling off with the distance to the axis
+    float rx = b->px[i] - cx;
+    float ry = b->py[i] - cy;
+    float rz = b->pz[i] - cz;
+    float along = rx * ax + ry * ay + rz * az;
+    rx -= along * ax;
+    ry -= along * ay;
+    rz -= along * az;
+    float k = strength * b->mass[i] / (rx * rx + ry * ry + rz * rz + eps2);
+    b->fx[i] += k * (ay * rz - az * ry);
+    b->fy[i] += k * (az * rx - ax * rz);
+    b->fz[i] += k * (ax * ry - ay * rx);
+  }
+}
+
+void force_wind(const SPS_ForceStage* stage,
+                const ForceBatch* b,
+                Uint64 first,
+                Uint64 last) {
+  const float wx = stage->wind.velocity[0];
+  const float wy = stage->wind.velocity[1];
+  const float wz = stage->wind.velocity[2];
+  const float k = stage->wind.coefficient;
+  for (Uint64 i = first; i < last; i++) {
+    b->fx[i] += k * (wx - b->vx[i]);
+    b->fy[i] += k * (wy - b->vy[i]);
+    b->fz[i] += k * (wz - b->vz[i]);
+  }
+}
@@ -0,0 +1,92 @@
+#ifndef SPS_FORCES_H
+#define SPS_FORCES_H
+
+#include <SDL3/SDL_stdinc.h>
+#include "octree.h"
+#include "particles.h"
+#include "sph.h"
+#include "thread_pool.h"
+#include "xmath.h"
+
+// Maximum number of stages a force pipeline can stack.
+#define SPS_FORCES_MAX_STAGES (16)
+
+// Kinds of force stages.
+typedef enum {
+  SPS_FORCE_GRAVITY,
+  SPS_FORCE_DRAG,
+  SPS_FORCE_POINT,
+  SPS_FORCE_VORTEX,
+  SPS_FORCE_WIND,
+  SPS_FORCE_GRAVITATION,
+  SPS_FORCE_SPH,
+} SPS_ForceType;
+
+// A single force applied to every particle of a batch.
+typedef struct {
+  SPS_ForceType type;
+  union {
+    // F = m * acceleration
+    struct {
+      SPS_Vec3 acceleration;
+    } gravity;
+    // F = -(linear + quadratic * |v|) * v
+    struct {
+      float linear;
+      float quadratic;
+    } drag;
+    // Inverse square pull towards center, repels when strength < 0
+    struct {
+      SPS_Vec3 center;
+      float strength;
+      float softening;
+    } point;
+    // Swirl around the line through center along a normalized axis
+    struct {
+      SPS_Vec3 center;
+      SPS_Vec3 axis;
+      float strength;
+      float softening;
+    } vortex;
+    // F = coefficient * (velocity - v)
+    struct {
+      SPS_Vec3 velocity;
+      float coefficient;
+    } wind;
+    // Mutual attraction through a Barnes-Hut tree owned by the caller
+    struct {
+      SPS_Octree* octree;
+      SPS_OctreeGravity params;
+    } gravitation;
+    // Pressure and viscosity of a fluid solver owned by the caller
+    struct {
+      SPS_Sph* solver;
+    } sph;
+  };
+} SPS_ForceStage;
+
+// Ordered list of forces accumulated into the force channels.
+typedef struct {
+  SPS_ForceStage stages[SPS_FORCES_MAX_STAGES];
+  Uint32 stages_count;
+} SPS_ForcePipeline;
+
+// Appends a stage, returns false when the pipeline is full.
+bool SPS_ForcePipelineAdd(SPS_ForcePipeline* pipeline, SPS_ForceStage stage);
+
+// Removes every stage.
+void SPS_ForcePipelineClear(SPS_ForcePipeline* pipeline);
+
+// Builds the acceleration structures and per step state of the stages.
+void SPS_ForcePipelinePrepare(const SPS_ForcePipeline* pipeline,
+                              SPS_Particles* particles,
+                              SPS_ThreadPool* pool);
+
+// Overwrites force[0..2] in [first, last) with the sum of every stage.
+void SPS_ForcePipelineApply(const SPS_ForcePipeline* pipeline,
+                            const SPS_Particles* particles,
+                            float* const force[3],
+                            Uint64 first,
+                            Uint64 last);
+
+#endif /* SPS_FORCES_H */
@@ -0,0 +1,202 @@
+#include "integrator.h"
+
+#include <SDL3/SDL_cpuinfo.h>
+#include <SDL3/SDL_log.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SPS_INTEGRATOR_X86 1
+#include <immintrin.h>
+#endif
+
+// Smallest mass used to compute the acceleration, avoids division by zero
+#define MIN_MASS (0.00001f)
+
+static const char* isa_names[SPS_ISA_COUNT] = {"scalar", "sse4.2", "avx2",
+                                               "avx512"};
+
+void integrate_scalar(const SPS_IntegrateBatch* batch,
+                      Uint64 first,
+                      Uint64 last);
+#ifdef SPS_INTEGRATOR_X86
+void integrate_sse42(const SPS_IntegrateBatch* batch, Uint64 first, Uint64 last);
+void integrate_avx2(const SPS_IntegrateBatch* batch, Uint64 first, Uint64 last);
+void integrate_avx512(const SPS_IntegrateBatch* batch,
+                      Uint64 first,
+                      Uint64 last);
+#endif
+
+static SPS_Isa integrate_isa = SPS_ISA_SCALAR;
+static SPS_IntegrateFunc integrate_kernel = integrate_scalar;
+
+void SPS_IntegratorInit(void) {
+  // Widest first, the scalar kernel is always available
+  for (int isa = SPS_ISA_COUNT - 1; isa >= SPS_ISA_SCALAR; isa--) {
+    if (SPS_IntegratorSetIsa((SPS_Isa)isa)) {
+      break;
+    }
+  }
+
+  SDL_Log("Particle integrator using %s kernel", SPS_IsaName(integrate_isa));
+}
+
+bool SPS_IntegratorSetIsa(SPS_Isa isa) {
+  SPS_IntegrateFunc kernel = SPS_IntegratorGetKernel(isa);
+  if (kernel == NULL) {
+    return false;
+  }
+
+  integrate_isa = isa;
+  integrate_kernel = kernel;
+  return true;
+}
+
+SPS_Isa SPS_IntegratorGetIsa(void) {
+  return integrate_isa;
+}
+
+SPS_IntegrateFunc SPS_IntegratorGetKernel(SPS_Isa isa) {
+  switch (isa) {
+    case SPS_ISA_SCALAR:
+      return integrate_scalar;
+#ifdef SPS_INTEGRATOR_X86
+    case SPS_ISA_SSE42:
+      return SDL_HasSSE42() ? integrate_sse42 : NULL;
+    case SPS_ISA_AVX2:
+      return SDL_HasAVX2() ? integrate_avx2 : NULL;
+    case SPS_ISA_AVX512:
+      return SDL_HasAVX512F() ? integrate_avx512 : NULL;
+#endif
+    default:
+      return NULL;
+  }
+}
+
+const char* SPS_IsaName(SPS_Isa isa) {
+  return isa < SPS_ISA_COUNT ? isa_names[isa] : "unknown";
+}
+
+void SPS_Integrate(const SPS_IntegrateBatch* batch, Uint64 first, Uint64 last) {
+  integrate_kernel(batch, first, last);
+}
+
+void integrate_scalar(const SPS_IntegrateBatch* batch,
+                      Uint64 first,
+                      Uint64 last) {
+  float* px = batch->position[0];
+  float* py = batch->position[1];
+  float* pz = batch->position[2];
+  float* vx = batch->velocity[0];
+  float* vy = batch->velocity[1];
+  float* vz = batch->velocity[2];
+  const float* fx = batch->force[0];
+  const float* fy = batch->force[1];
+  const float* fz = batch->force[2];
+  const float* mass = batch->mass;
+  const float dt = batch->dt;
+
+  for (Uint64 i = first; i < last; i++) {
+    float inv_mass = 1.0f / SDL_max(mass[i], MIN_MASS);
+
+    // p.velocity = p.velocity + (force / p.mass) * dt
+    vx[i] += fx[i] * inv_mass * dt;
+    vy[i] += fy[i] * inv_mass * dt;
+    vz[i] += fz[i] * inv_mass * dt;
+
+    // p.position = p.position + p.velocity * dt
+    px[i] += vx[i] * dt;
+    py[i] += vy[i] * dt;
+    pz[i] += vz[i] * dt;
+  }
+}
+
+#ifdef SPS_INTEGRATOR_X86
+__attribute__((target("sse4.2"))) void integrate_sse42(
+    const SPS_IntegrateBatch* batch,
+    Uint64 first,
+    Uint64 last) {
+  float* p[3] = {batch->position[0], batch->position[1], batch->position[2]};
+  float* v[3] = {batch->velocity[0], batch->velocity[1], batch->velocity[2]};
+  const __m128 dt = _mm_set1_ps(batch->dt);
+  const __m128 min_mass = _mm_set1_ps(MIN_MASS);
+  const __m128 one = _mm_set1_ps(1.0f);
+
+  Uint64 i = first;
+  for (; i + 4 <= last; i += 4) {
+    __m128 mass = _mm_loadu_ps(batch->mass + i);
+    __m128 inv_mass = _mm_div_ps(one, _mm_max_ps(mass, min_mass));
+    for (int c = 0; c < 3; c++) {
+      __m128 force = _mm_loadu_ps(batch->force[c] + i);
+      __m128 vel = _mm_loadu_ps(v[c] + i);
+      __m128 pos = _mm_loadu_ps(p[c] + i);
+      vel = _mm_add_ps(vel, _mm_mul_ps(_mm_mul_ps(force, inv_mass), dt));
+      pos = _mm_add_ps(pos, _mm_mul_ps(vel, dt));
+      _mm_storeu_ps(v[c] + i, vel);
+      _mm_storeu_ps(p[c] + i, pos);
+    }
+  }
+
+  integrate_scalar(batch, i, last);
+}
+
+__attribute__((target("avx2"))) void integrate_avx2(
+    const SPS_IntegrateBatch* batch,
+    Uint64 first,
+    Uint64 last) {
+  float* p[3] = {batch->position[0], batch->position[1], batch->position[2]};
+  float* v[3] = {batch->velocity[0], batch->velocity[1], batch->velocity[2]};
+  const __m256 dt = _mm256_set1_ps(batch->dt);
+  const __m256 min_mass = _mm256_set1_ps(MIN_MASS);
+  const __m256 one = _mm256_set1_ps(1.0f);
+
+  Uint64 i = first;
+  for (; i + 8 <= last; i += 8) {
+    __m256 mass = _mm256_loadu_ps(batch->mass + i);
+    __m256 inv_mass = _mm256_div_ps(one, _mm256_max_ps(mass, min_mass));
+    for (int c = 0; c < 3; c++) {
+      __m256 force = _mm256_loadu_ps(batch->force[c] + i);
+      __m256 vel = _mm256_loadu_ps(v[c] + i);
+      __m256 pos = _mm256_loadu_ps(p[c] + i);
+      vel = _mm256_add_ps(vel,
+                          _mm256_mul_ps(_mm256_mul_ps(force, inv_mass), dt));
+      pos = _mm256_add_ps(pos, _mm256_mul_ps(vel, dt));
+      _mm256_storeu_ps(v[c] + i, vel);
+      _mm256_storeu_ps(p[c] + i, pos);
+    }
+  }
+
+  // The tail call skips the implicit vzeroupper, and SSE code after a dirty
+  // upper half runs several times slower
+  _mm256_zeroupper();
+  integrate_scalar(batch, i, last);
+}
+
+__attribute__((target("avx512f"))) void integrate_avx512(
+    const SPS_IntegrateBatch* batch,
+    Uint64 first,
+    Uint64 last) {
+  float* p[3] = {batch->position[0], batch->position[1], batch->position[2]};
+  float* v[3] = {batch->velocity[0], batch->velocity[1], batch->velocity[2]};
+  const __m512 dt = _mm512_set1_ps(batch->dt);
+  const __m512 min_mass = _mm512_set1_ps(MIN_MASS);
+  const __m512 one = _mm512_set1_ps(1.0f);
+
+  Uint64 i = first;
+  for (; i + 16 <= last; i += 16) {
+    __m512 mass = _mm512_loadu_ps(batch->mass + i);
+    __m512 inv_mass = _mm512_div_ps(one, _mm512_max_ps(mass, min_mass));
+    for (int c = 0; c < 3; c++) {
+      __m512 force = _mm512_loadu_ps(batch->force[c] + i);
+      __m512 vel = _mm512_loadu_ps(v[c] + i);
+      __m512 pos = _mm512_loadu_ps(p[c] + i);
+      vel = _mm512_add_ps(vel,
+                          _mm512_mul_ps(_mm512_mul_ps(force, inv_mass), dt));
+      pos = _mm512_add_ps(pos, _mm512_mul_ps(vel, dt));
+      _mm512_storeu_ps(v[c] + i, vel);
+      _mm512_storeu_ps(p[c] + i, pos);
+    }
+  }
+
+  _mm256_zeroupper();
+  integrate_scalar(batch, i, last);
+}
+#endif
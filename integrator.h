@@ -0,0 +1,47 @@
+#ifndef SPS_INTEGRATOR_H
+#define SPS_INTEGRATOR_H
+
+#include <SDL3/SDL_stdinc.h>
+
+// Instruction sets the integration kernels are built for.
+typedef enum {
+  SPS_ISA_SCALAR,
+  SPS_ISA_SSE42,
+  SPS_ISA_AVX2,
+  SPS_ISA_AVX512,
+  SPS_ISA_COUNT,
+} SPS_Isa;
+
+// Particle arrays and constants of a single integration pass.
+typedef struct {
+  float* position[3];
+  float* velocity[3];
+  const float* force[3];
+  const float* mass;
+  float dt;
+} SPS_IntegrateBatch;
+
+// Integrates particles in [first, last) with semi-implicit Euler.
+typedef void (*SPS_IntegrateFunc)(const SPS_IntegrateBatch* batch,
+                                  Uint64 first,
+                                  Uint64 last);
+
+// Selects the widest kernel the CPU supports, call once at startup.
+void SPS_IntegratorInit(void);
+
+// Forces a kernel, returns false when the CPU doesn't support it.
+bool SPS_IntegratorSetIsa(SPS_Isa isa);
+
+// Gets the instruction set of the selected kernel.
+SPS_Isa SPS_IntegratorGetIsa(void);
+
+// Gets the kernel of an instruction set, NULL when unsupported.
+SPS_IntegrateFunc SPS_IntegratorGetKernel(SPS_Isa isa);
+
+// Printable name of an instruction set.
+const char* SPS_IsaName(SPS_Isa isa);
+
+// Integrates particles in [first, last) with the selected kernel.
+void SPS_Integrate(const SPS_IntegrateBatch* batch, Uint64 first, Uint64 last);
+
+#endif /* SPS_INTEGRATOR_H */
@@ -16,15 +16,11 @@
 #define WINDOW_TITLE ("SimpleParticleSim")
 #define WINDOW_WIDTH (800)
 #define WINDOW_HEIGHT (800)
-#define FIXED_UPDATE_TIME (0.0333333333333f)
 #define FIXED_FRAME_TIME (0.0166666666667f)
 
 GAME_CALLBACK SDL_AppResult SDL_AppInit(void** appstate,
                                         int argc,
                                         char** argv) {
-  (void)argc;
-  (void)argv;
-
   // Initialize SDL
   if (!SDL_Init(SDL_INIT_VIDEO)) {
     return SDL_APP_FAILURE;
@@ -38,6 +34,53 @@ GAME_CALLBACK SDL_AppResult SDL_AppInit(void** appstate,
   }
   SDL_memset(state, 0, sizeof(SPS_Simulation));
 
+  for (int i = 1; i < argc; i++) {
+    if (SDL_strcmp(argv[i], "--sph") == 0) {
+      state->mode = SPS_SIMULATION_SPH;
+    } else if (SDL_strcmp(argv[i], "--fountain") == 0) {
+      state->mode = SPS_SIMULATION_FOUNTAIN;
+    } else if (SDL_strcmp(argv[i], "--colliders") == 0 && i + 1 < argc) {
+      state->colliders_path = argv[++i];
+    } else if (SDL_strcmp(argv[i], "--state") == 0 && i + 1 < argc) {
+      state->state_path = argv[++i];
+    } else if (SDL_strcmp(argv[i], "--save") == 0 && i + 1 < argc) {
+      state->save_path = argv[++i];
+    } else if (SDL_strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+      state->record_path = argv[++i];
+    } else if (SDL_strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+      state->replay_path = argv[++i];
+    } else if (SDL_strcmp(argv[i], "--depth-sort") == 0) {
+      state->depth_sort = true;
+    } else if (SDL_strcmp(argv[i], "--reorder-interval") == 0 &&
+               i + 1 < argc) {
+      state->reorder_interval = (Uint32)SDL_strtoul(argv[++i], NULL, 10);
+    } else if (SDL_strcmp(argv[i], "--shape") == 0 && i + 1 < argc) {
+      if (!SPS_ScatterShapeFromName(argv[++i], &state->shape)) {
+        SDL_Log("Unknown shape %s", argv[i]);
+        return SDL_APP_FAILURE;
+      }
+    } else if (SDL_strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      state->seed = SDL_strtoull(argv[++i], NULL, 10);
+    } else if (SDL_strcmp(argv[i], "--particles") == 0 && i + 1 < argc) {
+      state->particles_count = SDL_strtoull(argv[++i], NULL, 10);
+    } else if (SDL_strcmp(argv[i], "--step") == 0 && i + 1 < argc) {
+      state->update_step = (float)SDL_strtod(argv[++i], NULL);
+    } else if (SDL_strcmp(argv[i], "--max-steps") == 0 && i + 1 < argc) {
+      state->max_update_steps = (Uint32)SDL_strtoul(argv[++i], NULL, 10);
+    } else if (SDL_strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+      state->workers_count = (Uint32)SDL_strtoul(argv[++i], NULL, 10);
+    } else if (SDL_strcmp(argv[i], "--config") == 0 && i + 1 < argc) {
+      // Settings after the config on the command line override it
+      if (!SPS_SimulationLoadConfig(state, argv[++i])) {
+        return SDL_APP_FAILURE;
+      }
+    } else {
+      // Flags expecting a value land here when it is missing
+      SDL_Log("Unknown argument %s or it is missing its value", argv[i]);
+      return SDL_APP_FAILURE;
+    }
+  }
+
   // Initialize SDL-specific attributes of game state
   state->device =
       SDL_CreateGPUDevice(SDL_GPU_SHADERFORMAT_SPIRV, true, "vulkan");
@@ -74,6 +117,8 @@ GAME_CALLBACK SDL_AppResult SDL_AppInit(void** appstate,
     return SDL_APP_FAILURE;
   }
 
+  // The first frame measures from here, not from the counter origin
+  state->last_tick = SDL_GetPerformanceCounter();
   *appstate = state;
   return SDL_APP_CONTINUE;
 }
@@ -85,13 +130,8 @@ GAME_CALLBACK SDL_AppResult SDL_AppIterate(void* appstate) {
                            (float)SDL_GetPerformanceFrequency();
   state->last_tick = current_tick;
   {
-    state->cur_update_time += state->iter_delta_time;
+    // The simulation thread steps on its own, frames only draw its states
     state->cur_frame_time += state->iter_delta_time;
-    if (state->cur_update_time >= FIXED_UPDATE_TIME) {
-      // should probably use state->cur_update_time
-      SPS_SimulationUpdate(state, FIXED_UPDATE_TIME);
-      state->cur_update_time = 0.0f;
-    }
 
     if (state->cur_frame_time >= FIXED_FRAME_TIME) {
       if (!SPS_SimulationRender(state, state->cur_frame_time)) {
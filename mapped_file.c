@@ -0,0 +1,67 @@
+#if defined(__unix__) || defined(__APPLE__)
+#define SPS_MAPPED_FILE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "mapped_file.h"
+
+#include <SDL3/SDL_iostream.h>
+#include <SDL3/SDL_log.h>
+
+bool SPS_MappedFileOpen(SPS_MappedFile* file, const char* path) {
+  SDL_memset(file, 0, sizeof(SPS_MappedFile));
+#ifdef SPS_MAPPED_FILE_MMAP
+  // A private mapping reads pages on first use straight from the page cache
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    SDL_Log("Couldn't open %s", path);
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+    SDL_Log("Couldn't get the size of %s", path);
+    close(fd);
+    return false;
+  }
+  void* data =
+      mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    SDL_Log("Couldn't map %s", path);
+    return false;
+  }
+  file->data = data;
+  file->size = (Uint64)info.st_size;
+  file->mapped = true;
+  return true;
+#else
+  // Without mappings the whole file is read, SDL allocations are aligned
+  // enough for float arrays
+  size_t size = 0;
+  file->data = SDL_LoadFile(path, &size);
+  if (file->data == NULL) {
+    SDL_Log("Couldn't read %s: %s", path, SDL_GetError());
+    return false;
+  }
+  file->size = size;
+  file->mapped = false;
+  return true;
+#endif
+}
+
+void SPS_MappedFileClose(SPS_MappedFile* file) {
+  if (file->data != NULL) {
+#ifdef SPS_MAPPED_FILE_MMAP
+    if (file->mapped) {
+      munmap((void*)file->data, file->size);
+    }
+#endif
+    if (!file->mapped) {
+      SDL_free((void*)file->data);
+    }
+  }
+  SDL_memset(file, 0, sizeof(SPS_MappedFile));
+}
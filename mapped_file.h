@@ -0,0 +1,19 @@
+#ifndef SPS_MAPPED_FILE_H
+#define SPS_MAPPED_FILE_H
+
+#include <SDL3/SDL_stdinc.h>
+
+// A whole file readable in memory, mapped where the platform can.
+typedef struct {
+  const Uint8* data;
+  Uint64 size;
+  bool mapped;  // false when the platform can't map and it was read instead
+} SPS_MappedFile;
+
+// Maps a file read only, its pages are only read once they are used.
+bool SPS_MappedFileOpen(SPS_MappedFile* file, const char* path);
+
+// Unmaps the file, nothing pointing into it can be used anymore.
+void SPS_MappedFileClose(SPS_MappedFile* file);
+
+#endif /* SPS_MAPPED_FILE_H */
@@ -0,0 +1,147 @@
+#include "morton.h"
+
+#include <SDL3/SDL_log.h>
+#include <SDL3/SDL_stdinc.h>
+
+#define MORTON_CELLS (1u << SPS_MORTON_BITS)
+
+// Per chunk bounds, merged once every chunk ran
+typedef struct {
+  const SPS_Particles* particles;
+  float* chunk_bounds;
+} BoundsContext;
+
+// Quantization of a key pass
+typedef struct {
+  const SPS_Particles* particles;
+  SPS_Vec3 min;
+  float scale;
+  Uint32* keys;
+  Uint32* order;
+} KeysContext;
+
+Uint32 morton_spread(Uint32 v);
+Uint32 morton_compact(Uint32 v);
+void bounds_task(void* userdata, Uint64 first, Uint64 last, Uint32 worker);
+void keys_task(void* userdata, Uint64 first, Uint64 last, Uint32 worker);
+
+Uint32 SPS_MortonEncode3(Uint32 x, Uint32 y, Uint32 z) {
+  return morton_spread(x) | (morton_spread(y) << 1) | (morton_spread(z) << 2);
+}
+
+void SPS_MortonDecode3(Uint32 key, Uint32* x, Uint32* y, Uint32* z) {
+  *x = morton_compact(key);
+  *y = morton_compact(key >> 1);
+  *z = morton_compact(key >> 2);
+}
+
+void SPS_MortonBounds(SPS_ThreadPool* pool,
+                      const SPS_Particles* particles,
+                      SPS_Vec3 min,
+                      SPS_Vec3 max) {
+  Uint64 chunks_count =
+      (particles->count + SPS_PARTICLES_CHUNK_SIZE - 1) /
+      SPS_PARTICLES_CHUNK_SIZE;
+  SPS_Vec3Make(0.0f, 0.0f, 0.0f, min);
+  SPS_Vec3Make(0.0f, 0.0f, 0.0f, max);
+  if (chunks_count == 0) {
+    return;
+  }
+
+  BoundsContext context = {
+      .particles = particles,
+      .chunk_bounds = SDL_malloc(sizeof(float) * 6 * chunks_count),
+  };
+  if (context.chunk_bounds == NULL) {
+    SDL_Log("Couldn't allocate particle bounds");
+    return;
+  }
+
+  SPS_ThreadPoolParallelFor(pool, 0, particles->count, SPS_PARTICLES_CHUNK_SIZE,
+                            bounds_task, &context);
+
+  SPS_Vec3Copy(context.chunk_bounds, min);
+  SPS_Vec3Copy(context.chunk_bounds + 3, max);
+  for (Uint64 c = 1; c < chunks_count; c++) {
+    const float* bounds = context.chunk_bounds + c * 6;
+    for (int a = 0; a < 3; a++) {
+      min[a] = SDL_min(min[a], bounds[a]);
+      max[a] = SDL_max(max[a], bounds[3 + a]);
+    }
+  }
+
+  SDL_free(context.chunk_bounds);
+}
+
+void SPS_MortonKeys(SPS_ThreadPool* pool,
+                    const SPS_Particles* particles,
+                    const SPS_Vec3 min,
+                    float size,
+                    Uint32* keys,
+                    Uint32* order) {
+  KeysContext context = {
+      .particles = particles,
+      .scale = size > 0.0f ? (float)MORTON_CELLS / size : 0.0f,
+      .keys = keys,
+      .order = order,
+  };
+  SPS_Vec3Copy(min, context.min);
+
+  SPS_ThreadPoolParallelFor(pool, 0, particles->count, SPS_PARTICLES_CHUNK_SIZE,
+                            keys_task, &context);
+}
+
+Uint32 morton_spread(Uint32 v) {
+  v &= 0x000003ff;
+  v = (v | (v << 16)) & 0xff0000ff;
+  v = (v | (v << 8)) & 0x0300f00f;
+  v = (v | (v << 4)) & 0x030c30c3;
+  v = (v | (v << 2)) & 0x09249249;
+  return v;
+}
+
+Uint32 morton_compact(Uint32 v) {
+  v &= 0x09249249;
+  v = (v | (v >> 2)) & 0x030c30c3;
+  v = (v | (v >> 4)) & 0x0300f00f;
+  v = (v | (v >> 8)) & 0xff0000ff;
+  v = (v | (v >> 16)) & 0x000003ff;
+  return v;
+}
+
+void bounds_task(void* userdata, Uint64 first, Uint64 last, Uint32 worker) {
+  (void)worker;
+  BoundsContext* context = userdata;
+  const SPS_Particles* particles = context->particles;
+  float* bounds =
+      context->chunk_bounds + (first / SPS_PARTICLES_CHUNK_SIZE) * 6;
+  for (int a = 0; a < 3; a++) {
+    const float* p =
+        SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_X + a);
+    float lo = p[first];
+    float hi = p[first];
+    for (Uint64 i = first + 1; i < last; i++) {
+      lo = SDL_min(lo, p[i]);
+      hi = SDL_max(hi, p[i]);
+    }
+    bounds[a] = lo;
+    bounds[3 + a] = hi;
+  }
+}
+
+void keys_task(void* userdata, Uint64 first, Uint64 last, Uint32 worker) {
+  (void)worker;
+  KeysContext* context = userdata;
+  const SPS_Particles* particles = context->particles;
+  const float* px = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_X);
+  const float* py = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_Y);
+  const float* pz = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_Z);
+  const float hi = (float)(MORTON_CELLS - 1);
+  for (Uint64 i = first; i < last; i++) {
+    float x = SDL_clamp((px[i] - context->min[0]) * context->scale, 0.0f, hi);
+    float y = SDL_clamp((py[i] - context->min[1]) * context->scale, 0.0f, hi);
+    float z = SDL_clamp((pz[i] - context->min[2]) * context->scale, 0.0f, hi);
+    context->keys[i] = SPS_MortonEncode3((Uint32)x, (Uint32)y, (Uint32)z);
+    context->order[i] = (Uint32)i;
+  }
+}
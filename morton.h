@@ -0,0 +1,33 @@
+#ifndef SPS_MORTON_H
+#define SPS_MORTON_H
+
+#include <SDL3/SDL_stdinc.h>
+#include "particles.h"
+#include "thread_pool.h"
+#include "xmath.h"
+
+// Bits per axis of a Morton key, keys fit in 30 bits.
+#define SPS_MORTON_BITS (10)
+
+// Interleaves the low 10 bits of x, y and z as ...z1y1x1z0y0x0.
+Uint32 SPS_MortonEncode3(Uint32 x, Uint32 y, Uint32 z);
+
+// Splits a key back into its 10-bit x, y and z cells.
+void SPS_MortonDecode3(Uint32 key, Uint32* x, Uint32* y, Uint32* z);
+
+// Axis aligned bounds of the live particle positions, computed in parallel.
+void SPS_MortonBounds(SPS_ThreadPool* pool,
+                      const SPS_Particles* particles,
+                      SPS_Vec3 min,
+                      SPS_Vec3 max);
+
+// Keys of every live particle over the cube at min with edge size, order
+// gets the identity permutation ready for SPS_RadixSort.
+void SPS_MortonKeys(SPS_ThreadPool* pool,
+                    const SPS_Particles* particles,
+                    const SPS_Vec3 min,
+                    float size,
+                    Uint32* keys,
+                    Uint32* order);
+
+#endif /* SPS_MORTON_H */
@@ -0,0 +1,434 @@
+#include "octree.h"
+#include "radix_sort.h"
+
+#include <SDL3/SDL_log.h>
+#include <SDL3/SDL_stdinc.h>
+
+#define OCTREE_KEY_BITS (3 * SPS_MORTON_BITS)
+#define OCTREE_STACK_SIZE (8 * (SPS_OCTREE_MAX_DEPTH + 2))
+#define OCTREE_NODE_CHUNK (256)
+
+// A single level pass of the build
+typedef struct {
+  SPS_Octree* tree;
+  const SPS_Particles* particles;
+  Uint32 depth;
+} LevelContext;
+
+bool octree_reserve(SPS_Octree* tree, Uint64 count);
+bool octree_reserve_nodes(SPS_Octree* tree, Uint64 nodes_count);
+Uint32 octree_split(const Uint32* keys,
+                    Uint32 begin,
+                    Uint32 end,
+                    Uint32 shift);
+void gather_task(void* userdata, Uint64 first, Uint64 last, Uint32 worker);
+void count_children_task(void* userdata,
+                         Uint64 first,
+                         Uint64 last,
+                         Uint32 worker);
+void fill_children_task(void* userdata,
+                        Uint64 first,
+                        Uint64 last,
+                        Uint32 worker);
+void moments_task(void* userdata, Uint64 first, Uint64 last, Uint32 worker);
+
+void SPS_OctreeLoad(SPS_Octree* tree, Uint32 leaf_size) {
+  SDL_memset(tree, 0, sizeof(SPS_Octree));
+  tree->leaf_size = leaf_size > 0 ? leaf_size : SPS_OCTREE_DEFAULT_LEAF_SIZE;
+}
+
+bool SPS_OctreeBuild(SPS_Octree* tree,
+                     const SPS_Particles* particles,
+                     SPS_ThreadPool* pool) {
+  tree->nodes_count = 0;
+  tree->count = 0;
+  if (particles->count == 0) {
+    return true;
+  }
+
+  if (particles->count > SDL_MAX_UINT32 ||
+      !octree_reserve(tree, particles->count)) {
+    SDL_Log("Couldn't reserve octree for %" SDL_PRIu64 " particles",
+            particles->count);
+    return false;
+  }
+  tree->count = particles->count;
+
+  // Sort the particles along the Morton curve of their bounding cube
+  SPS_ALIGN_VEC3 SPS_Vec3 max = {0};
+  SPS_MortonBounds(pool, particles, tree->min, max);
+  tree->size = SDL_max(max[0] - tree->min[0], max[1] - tree->min[1]);
+  tree->size = SDL_max(tree->size, max[2] - tree->min[2]);
+  tree->size = tree->size > 0.0f ? tree->size : 1.0f;
+  SPS_MortonKeys(pool, particles, tree->min, tree->size, tree->keys,
+                 tree->order);
+  if (!SPS_RadixSort(pool, tree->keys, tree->order, tree->keys_tmp,
+                     tree->order_tmp, tree->count, OCTREE_KEY_BITS)) {
+    return false;
+  }
+
+  LevelContext context = {.tree = tree, .particles = particles};
+  SPS_ThreadPoolParallelFor(pool, 0, tree->count, SPS_PARTICLES_CHUNK_SIZE,
+                            gather_task, &context);
+
+  // Top-down, one level at a time: count children, scan, then fill them
+  if (!octree_reserve_nodes(tree, 1)) {
+    return false;
+  }
+  tree->nodes[0] = (SPS_OctreeNode){.first = 0, .count = (Uint32)tree->count};
+  tree->nodes_count = 1;
+  tree->levels[0] = 0;
+  tree->levels[1] = 1;
+  Uint32 depth = 0;
+  for (; depth < SPS_OCTREE_MAX_DEPTH; depth++) {
+    Uint64 level_first = tree->levels[depth];
+    Uint64 level_last = tree->levels[depth + 1];
+    context.depth = depth;
+    SPS_ThreadPoolParallelFor(pool, level_first, level_last, OCTREE_NODE_CHUNK,
+                              count_children_task, &context);
+
+    Uint64 next = level_last;
+    for (Uint64 n = level_first; n < level_last; n++) {
+      tree->nodes[n].first_child = (Uint32)next;
+      next += tree->nodes[n].children_count;
+    }
+
+    if (next == level_last) {
+      break;
+    }
+
+    if (!octree_reserve_nodes(tree, next)) {
+      tree->nodes_count = 0;
+      return false;
+    }
+
+    SPS_ThreadPoolParallelFor(pool, level_first, level_last, OCTREE_NODE_CHUNK,
+                              fill_children_task, &context);
+    tree->nodes_count = next;
+    tree->levels[depth + 2] = next;
+  }
+
+  // Bottom-up moments, children are always one level below their parent
+  for (Sint32 d = (Sint32)SDL_min(depth, SPS_OCTREE_MAX_DEPTH); d >= 0; d--) {
+    context.depth = (Uint32)d;
+    SPS_ThreadPoolParallelFor(pool, tree->levels[d], tree->levels[d + 1],
+                              OCTREE_NODE_CHUNK, moments_task, &context);
+  }
+
+  return true;
+}
+
+void SPS_OctreeForces(const SPS_Octree* tree,
+                      const SPS_OctreeGravity* gravity,
+                      const SPS_Particles* particles,
+                      float* const force[3],
+                      Uint64 first,
+                      Uint64 last) {
+  if (tree->nodes_count == 0) {
+    return;
+  }
+
+  const float* px = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_X);
+  const float* py = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_Y);
+  const float* pz = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_Z);
+  const float* mass = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_MASS);
+  const float inv_theta = 1.0f / SDL_max(gravity->theta, 0.001f);
+  const float eps2 = gravity->softening * gravity->softening;
+  Uint32 stack[OCTREE_STACK_SIZE];
+
+  for (Uint64 i = first; i < last; i++) {
+    float ax = 0.0f;
+    float ay = 0.0f;
+    float az = 0.0f;
+    Uint32 stack_size = 0;
+    stack[stack_size++] = 0;
+
+    while (stack_size > 0) {
+      const SPS_OctreeNode* node = &tree->nodes[stack[--stack_size]];
+      if (node->mass <= 0.0f) {
+        continue;
+      }
+
+      // x points from the node center of mass to the particle
+      float x = px[i] - node->com[0];
+      float y = py[i] - node->com[1];
+      float z = pz[i] - node->com[2];
+      float r2 = x * x + y * y + z * z + eps2;
+      float open = node->size * inv_theta + node->com_offset;
+
+      if (open * open < r2) {
+        // a = -M x / r^3 + Q x / r^5 - 5/2 (x'Qx) x / r^7
+        const float* q = node->quadrupole;
+        float qx = q[0] * x + q[1] * y + q[2] * z;
+        float qy = q[1] * x + q[3] * y + q[4] * z;
+        float qz = q[2] * x + q[4] * y + q[5] * z;
+        float xqx = x * qx + y * qy + z * qz;
+        float inv_r2 = 1.0f / r2;
+        float inv_r3 = inv_r2 / SDL_sqrtf(r2);
+        float inv_r5 = inv_r3 * inv_r2;
+        float k = -node->mass * inv_r3 - 2.5f * xqx * inv_r5 * inv_r2;
+        ax += k * x + qx * inv_r5;
+        ay += k * y + qy * inv_r5;
+        az += k * z + qz * inv_r5;
+      } else if (node->children_count == 0) {
+        for (Uint32 s = node->first; s < node->first + node->count; s++) {
+          if (tree->order[s] == i) {
+            continue;
+          }
+
+          float dx = tree->x[s] - px[i];
+          float dy = tree->y[s] - py[i];
+          float dz = tree->z[s] - pz[i];
+          float d2 = dx * dx + dy * dy + dz * dz + eps2;
+          float k = tree->mass[s] / (d2 * SDL_sqrtf(d2));
+          ax += k * dx;
+          ay += k * dy;
+          az += k * dz;
+        }
+      } else if (stack_size + node->children_count <= OCTREE_STACK_SIZE) {
+        for (Uint32 c = 0; c < node->children_count; c++) {
+          stack[stack_size++] = node->first_child + c;
+        }
+      }
+    }
+
+    float k = gravity->gravity_constant * mass[i];
+    force[0][i] += k * ax;
+    force[1][i] += k * ay;
+    force[2][i] += k * az;
+  }
+}
+
+Uint64 SPS_OctreeMemorySize(const SPS_Octree* tree) {
+  return sizeof(SPS_OctreeNode) * tree->nodes_capacity +
+         (sizeof(Uint32) * 4 + sizeof(float) * 4) * tree->capacity;
+}
+
+void SPS_OctreeDestroy(SPS_Octree* tree) {
+  SDL_free(tree->nodes);
+  SDL_free(tree->keys);
+  SDL_free(tree->order);
+  SDL_free(tree->keys_tmp);
+  SDL_free(tree->order_tmp);
+  SDL_free(tree->x);
+  SDL_free(tree->y);
+  SDL_free(tree->z);
+  SDL_free(tree->mass);
+  SPS_OctreeLoad(tree, tree->leaf_size);
+}
+
+bool octree_reserve(SPS_Octree* tree, Uint64 count) {
+  if (count <= tree->capacity) {
+    return true;
+  }
+
+  Uint64 capacity = SDL_max(count, tree->capacity + tree->capacity / 2);
+  Uint32** indices[] = {&tree->keys, &tree->order, &tree->keys_tmp,
+                        &tree->order_tmp};
+  for (size_t i = 0; i < SDL_arraysize(indices); i++) {
+    Uint32* data = SDL_realloc(*indices[i], sizeof(Uint32) * capacity);
+    if (data == NULL) {
+      return false;
+    }
+    *indices[i] = data;
+  }
+
+  float** values[] = {&tree->x, &tree->y, &tree->z, &tree->mass};
+  for (size_t i = 0; i < SDL_arraysize(values); i++) {
+    float* data = SDL_realloc(*values[i], sizeof(float) * capacity);
+    if (data == NULL) {
+      return false;
+    }
+    *values[i] = data;
+  }
+
+  tree->capacity = capacity;
+  return true;
+}
+
+bool octree_reserve_nodes(SPS_Octree* tree, Uint64 nodes_count) {
+  if (nodes_count <= tree->nodes_capacity) {
+    return true;
+  }
+
+  Uint64 capacity =
+      SDL_max(nodes_count, tree->nodes_capacity + tree->nodes_capacity / 2);
+  SPS_OctreeNode* nodes =
+      SDL_realloc(tree->nodes, sizeof(SPS_OctreeNode) * capacity);
+  if (nodes == NULL) {
+    SDL_Log("Couldn't allocate %" SDL_PRIu64 " octree nodes", capacity);
+    return false;
+  }
+
+  tree->nodes = nodes;
+  tree->nodes_capacity = capacity;
+  return true;
+}
+
+Uint32 octree_split(const Uint32* keys,
+                    Uint32 begin,
+                    Uint32 end,
+                    Uint32 shift) {
+  // First index past the octant of keys[begin] at this shift
+  Uint64 bound = ((Uint64)(keys[begin] >> shift) + 1) << shift;
+  while (begin < end) {
+    Uint32 mid = begin + (end - begin) / 2;
+    if (keys[mid] < bound) {
+      begin = mid + 1;
+    } else {
+      end = mid;
+    }
+  }
+  return begin;
+}
+
+void gather_task(void* userdata, Uint64 first, Uint64 last, Uint32 worker) {
+  (void)worker;
+  LevelContext* context = userdata;
+  SPS_Octree* tree = context->tree;
+  const SPS_Particles* particles = context->particles;
+  const float* px = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_X);
+  const float* py = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_Y);
+  const float* pz = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_Z);
+  const float* mass = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_MASS);
+  for (Uint64 s = first; s < last; s++) {
+    Uint32 i = tree->order[s];
+    tree->x[s] = px[i];
+    tree->y[s] = py[i];
+    tree->z[s] = pz[i];
+    tree->mass[s] = mass[i];
+  }
+}
+
+void count_children_task(void* userdata,
+                         Uint64 first,
+                         Uint64 last,
+                         Uint32 worker) {
+  (void)worker;
+  LevelContext* context = userdata;
+  SPS_Octree* tree = context->tree;
+  Uint32 shift = OCTREE_KEY_BITS - 3 * (context->depth + 1);
+  for (Uint64 n = first; n < last; n++) {
+    SPS_OctreeNode* node = &tree->nodes[n];
+    node->children_count = 0;
+    if (node->count <= tree->leaf_size) {
+      continue;
+    }
+
+    Uint32 end = node->first + node->count;
+    for (Uint32 b = node->first; b < end;) {
+      b = octree_split(tree->keys, b, end, shift);
+      node->children_count++;
+    }
+  }
+}
+
+void fill_children_task(void* userdata,
+                        Uint64 first,
+                        Uint64 last,
+                        Uint32 worker) {
+  (void)worker;
+  LevelContext* context = userdata;
+  SPS_Octree* tree = context->tree;
+  Uint32 shift = OCTREE_KEY_BITS - 3 * (context->depth + 1);
+  for (Uint64 n = first; n < last; n++) {
+    const SPS_OctreeNode* node = &tree->nodes[n];
+    Uint32 end = node->first + node->count;
+    Uint32 child = node->first_child;
+    for (Uint32 b = node->first; b < end && node->children_count > 0;) {
+      Uint32 split = octree_split(tree->keys, b, end, shift);
+      tree->nodes[child++] = (SPS_OctreeNode){.first = b, .count = split - b};
+      b = split;
+    }
+  }
+}
+
+void moments_task(void* userdata, Uint64 first, Uint64 last, Uint32 worker) {
+  (void)worker;
+  LevelContext* context = userdata;
+  SPS_Octree* tree = context->tree;
+  Uint32 cell_bits = SPS_MORTON_BITS - context->depth;
+  float cell_unit = tree->size / (float)(1u << SPS_MORTON_BITS);
+  float size = tree->size / (float)(1u << context->depth);
+
+  for (Uint64 n = first; n < last; n++) {
+    SPS_OctreeNode* node = &tree->nodes[n];
+    node->size = size;
+
+    // Geometric center of the cell from the Morton prefix of its particles
+    Uint32 cell[3] = {0};
+    SPS_MortonDecode3(tree->keys[node->first], &cell[0], &cell[1], &cell[2]);
+    float center[3];
+    for (int a = 0; a < 3; a++) {
+      float origin = (float)((cell[a] >> cell_bits) << cell_bits);
+      center[a] = tree->min[a] +
+                  (origin + 0.5f * (float)(1u << cell_bits)) * cell_unit;
+    }
+
+    double m = 0.0;
+    double com[3] = {0.0, 0.0, 0.0};
+    if (node->children_count == 0) {
+      for (Uint32 s = node->first; s < node->first + node->count; s++) {
+        m += tree->mass[s];
+        com[0] += tree->mass[s] * tree->x[s];
+        com[1] += tree->mass[s] * tree->y[s];
+        com[2] += tree->mass[s] * tree->z[s];
+      }
+    } else {
+      for (Uint32 c = 0; c < node->children_count; c++) {
+        const SPS_OctreeNode* child = &tree->nodes[node->first_child + c];
+        m += child->mass;
+        com[0] += child->mass * child->com[0];
+        com[1] += child->mass * child->com[1];
+        com[2] += child->mass * child->com[2];
+      }
+    }
+
+    node->mass = (float)m;
+    for (int a = 0; a < 3; a++) {
+      node->com[a] = m > 0.0 ? (float)(com[a] / m) : center[a];
+    }
+
+    // Q = sum m (3 d d' - |d|^2 I), children shifted by the parallel axis rule
+    double q[6] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+    Uint32 items =
+        node->children_count > 0 ? node->children_count : node->count;
+    for (Uint32 k = 0; k < items; k++) {
+      double w = 0.0;
+      double d[3];
+      if (node->children_count > 0) {
+        const SPS_OctreeNode* child = &tree->nodes[node->first_child + k];
+        w = child->mass;
+        for (int a = 0; a < 3; a++) {
+          d[a] = child->com[a] - node->com[a];
+        }
+        for (int j = 0; j < 6; j++) {
+          q[j] += child->quadrupole[j];
+        }
+      } else {
+        Uint32 s = node->first + k;
+        w = tree->mass[s];
+        d[0] = tree->x[s] - node->com[0];
+        d[1] = tree->y[s] - node->com[1];
+        d[2] = tree->z[s] - node->com[2];
+      }
+
+      double d2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+      q[0] += w * (3.0 * d[0] * d[0] - d2);
+      q[1] += w * 3.0 * d[0] * d[1];
+      q[2] += w * 3.0 * d[0] * d[2];
+      q[3] += w * (3.0 * d[1] * d[1] - d2);
+      q[4] += w * 3.0 * d[1] * d[2];
+      q[5] += w * (3.0 * d[2] * d[2] - d2);
+    }
+
+    for (int j = 0; j < 6; j++) {
+      node->quadrupole[j] = (float)q[j];
+    }
+
+    float ox = node->com[0] - center[0];
+    float oy = node->com[1] - center[1];
+    float oz = node->com[2] - center[2];
+    node->com_offset = SDL_sqrtf(ox * ox + oy * oy + oz * oz);
+  }
+}
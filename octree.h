@@ -0,0 +1,82 @@
+#ifndef SPS_OCTREE_H
+#define SPS_OCTREE_H
+
+#include <SDL3/SDL_stdinc.h>
+#include "morton.h"
+#include "particles.h"
+#include "thread_pool.h"
+#include "xmath.h"
+
+// Deepest level of the tree, one level per Morton key bit triplet.
+#define SPS_OCTREE_MAX_DEPTH (SPS_MORTON_BITS)
+
+// Default number of particles below which a node is not split.
+#define SPS_OCTREE_DEFAULT_LEAF_SIZE (16)
+
+// Cell of the tree with its monopole and traceless quadrupole moments.
+typedef struct {
+  float com[3];
+  float mass;
+  float quadrupole[6];  // xx, xy, xz, yy, yz, zz
+  float size;
+  float com_offset;  // distance from com to the cell center
+  Uint32 first;      // first particle in sorted order
+  Uint32 count;
+  Uint32 first_child;
+  Uint32 children_count;
+} SPS_OctreeNode;
+
+// Barnes-Hut octree over the particle positions, rebuilt every step.
+typedef struct {
+  SPS_OctreeNode* nodes;
+  Uint64 nodes_count;
+  Uint64 nodes_capacity;
+  Uint64 levels[SPS_OCTREE_MAX_DEPTH + 2];
+  Uint32 leaf_size;
+
+  // Particles in Morton order, order maps back to the store index
+  Uint32* keys;
+  Uint32* order;
+  Uint32* keys_tmp;
+  Uint32* order_tmp;
+  float* x;
+  float* y;
+  float* z;
+  float* mass;
+  Uint64 count;
+  Uint64 capacity;
+
+  SPS_ALIGN_VEC3 SPS_Vec3 min;
+  float size;
+} SPS_Octree;
+
+// Parameters of the gravitational field of the tree.
+typedef struct {
+  float gravity_constant;
+  float theta;
+  float softening;
+} SPS_OctreeGravity;
+
+// Initializes an empty tree, zero leaf size uses the default.
+void SPS_OctreeLoad(SPS_Octree* tree, Uint32 leaf_size);
+
+// Rebuilds the tree from the live particles, sorting and moments in parallel.
+bool SPS_OctreeBuild(SPS_Octree* tree,
+                     const SPS_Particles* particles,
+                     SPS_ThreadPool* pool);
+
+// Adds the gravitational force of the tree on [first, last) into force.
+void SPS_OctreeForces(const SPS_Octree* tree,
+                      const SPS_OctreeGravity* gravity,
+                      const SPS_Particles* particles,
+                      float* const force[3],
+                      Uint64 first,
+                      Uint64 last);
+
+// Bytes allocated by the tree.
+Uint64 SPS_OctreeMemorySize(const SPS_Octree* tree);
+
+// Releases the tree buffers.
+void SPS_OctreeDestroy(SPS_Octree* tree);
+
+#endif /* SPS_OCTREE_H */
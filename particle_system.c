@@ -1,236 +1,547 @@
 #include "particle_system.h"
-#include "shader.h"
+#include "integrator.h"
+#include "morton.h"
+#include "radix_sort.h"
+#include "state_file.h"
 #include "xmath.h"
 
 #include <SDL3/SDL_log.h>
 #include <SDL3/SDL_stdinc.h>
 
+// Upper bound on the substeps of a single update
+#define MAX_SUBSTEPS (64)
+
+void update_step(SPS_ParticleSystem* ps, float dt);
+void update_task(void* userdata, Uint64 first, Uint64 last, Uint32 worker);
+void snapshot_bounds_task(void* userdata,
+                          Uint64 first,
+                          Uint64 last,
+                          Uint32 worker);
+void snapshot_task(void* userdata, Uint64 first, Uint64 last, Uint32 worker);
+void restore_task(void* userdata, Uint64 first, Uint64 last, Uint32 worker);
+bool reserve_sort_scratch(SPS_ParticleSystem* ps, Uint64 count);
+bool reorder_particles(SPS_ParticleSystem* ps);
+bool sort_snapshot(SPS_ParticleSystem* ps, SPS_ParticleSnapshot* snapshot);
+void sort_keys_task(void* userdata, Uint64 first, Uint64 last, Uint32 worker);
+
+// Shared by every chunk of a single update
+typedef struct {
+  SPS_ParticleSystem* ps;
+  float* force[3];
+  SPS_IntegrateBatch batch;
+} UpdateContext;
+
+// Shared by every chunk of a snapshot
 typedef struct {
-  SPS_ALIGN_MAT4 SPS_Mat4 pv;
-  SPS_ALIGN_VEC3 SPS_Vec3 view_pos;
-} ParticleSystemUniforms;
-
-void particle_compute_force(const SPS_Particle* particle, SPS_Vec3 dest);
-float remap_value(float value,
-                  float start1,
-                  float stop1,
-                  float start2,
-                  float stop2);
-
-bool SPS_ParticleSystemLoad(SPS_ParticleSystem* ps,
-                            Uint64 count,
-                            SDL_GPUDevice* device,
-                            SDL_Window* window) {
-  size_t instances_buffer_size = sizeof(SPS_Particle) * count;
-  ps->device = device;
-  ps->instances_count = count;
-  ps->instances = SDL_aligned_alloc(16, instances_buffer_size);
-  if (ps->instances == NULL) {
+  const SPS_ParticleSystem* ps;
+  SPS_ParticleSnapshot* snapshot;
+  const SPS_ParticleSnapshot* previous;
+} SnapshotContext;
+
+// Shared by every chunk of a restore, NULL sources take the default
+typedef struct {
+  SPS_Particles* particles;
+  const float* sources[SPS_PARTICLES_MAX_CHANNELS];
+} RestoreContext;
+
+static const char* force_channel_names[3] = {"force_x", "force_y", "force_z"};
+
+bool SPS_ParticleSystemInit(SPS_ParticleSystem* ps, Uint64 count) {
+  if (!SPS_ParticlesLoad(&ps->particles, count)) {
+    SDL_Log("Couldn't allocate particle storage");
     return false;
   }
 
-  // Initialize particle positions to random places
-  SDL_memset(ps->instances, 0, instances_buffer_size);
-  for (Uint64 i = 0; i < count; i++) {
-    float rx = remap_value(SDL_randf(), 0.0f, 1.0f, -10.0f, 10.0f);
-    float ry = remap_value(SDL_randf(), 0.0f, 1.0f, 0.0f, 40.0f);
-    float rz = remap_value(SDL_randf(), 0.0f, 1.0f, -10.0f, 10.0f);
-    ps->instances[i].position[0] = rx;
-    ps->instances[i].position[1] = ry;
-    ps->instances[i].position[2] = rz;
-    ps->instances[i].scale = 0.1f;
-    ps->instances[i].velocity[0] = 0.0f;
-    ps->instances[i].velocity[0] = 0.0f;
-    ps->instances[i].velocity[0] = 0.0f;
-    ps->instances[i].mass = 1.0f;
-  }
-
-  SPS_ShaderOptions vert_options = (SPS_ShaderOptions){
-      .filename = "particle_system.vert",
-      .stage = SDL_GPU_SHADERSTAGE_VERTEX,
-      .sampler_count = 0,
-      .uniform_buffer_count = 1,
-      .storage_buffer_count = 1,
-      .storage_texture_count = 0,
-  };
-  SDL_GPUShader* vert_shader = SPS_ShaderLoad(device, vert_options);
-  if (vert_shader == NULL) {
-    return false;
+  // Scratch channels the force pipeline accumulates into every step
+  for (int c = 0; c < 3; c++) {
+    ps->force_channels[c] = SPS_ParticlesRegisterChannel(
+        &ps->particles, force_channel_names[c], 0.0f);
+    if (ps->force_channels[c] < 0) {
+      SPS_ParticlesDestroy(&ps->particles);
+      return false;
+    }
   }
 
-  SPS_ShaderOptions frag_options = (SPS_ShaderOptions){
-      .filename = "particle_system.frag",
-      .stage = SDL_GPU_SHADERSTAGE_FRAGMENT,
-      .sampler_count = 0,
-      .uniform_buffer_count = 0,
-      .storage_buffer_count = 0,
-      .storage_texture_count = 0,
-  };
-  SDL_GPUShader* frag_shader = SPS_ShaderLoad(device, frag_options);
-  if (frag_shader == NULL) {
+  SPS_OctreeLoad(&ps->octree, 0);
+  SPS_CollisionsLoad(&ps->collisions);
+
+  // The ground under the debug grid stops whatever falls on it
+  SPS_CollidersLoad(&ps->colliders);
+  SPS_ALIGN_VEC3 SPS_Vec3 up = {0.0f, 1.0f, 0.0f};
+  SPS_CollidersAddPlane(&ps->colliders, up, 0.0f);
+  SPS_SphLoad(&ps->sph);
+  SPS_EmittersLoad(&ps->emitters);
+  ps->emitters.seed = ps->scatter.seed;
+  ps->max_timestep = 0.0f;
+  ps->steps = 0;
+  SPS_ForcePipelineClear(&ps->forces);
+  SPS_ForcePipelineAdd(&ps->forces, (SPS_ForceStage){
+                                        .type = SPS_FORCE_GRAVITY,
+                                        .gravity = {{0.0f, -9.81f, 0.0f}},
+                                    });
+
+  SPS_ScatterParticles(&ps->scatter, &ps->particles, ps->pool, 0, count, 0);
+  ps->scattered = count;
+  return true;
+}
+
+bool SPS_ParticleSystemSpawn(SPS_ParticleSystem* ps, Uint64 count) {
+  Uint64 first = ps->particles.count;
+  if (SPS_ParticlesSpawn(&ps->particles, count) < count) {
     return false;
   }
 
-  SDL_GPUGraphicsPipelineTargetInfo color_target_info = {
-      .num_color_targets = 1,
-      .color_target_descriptions = (SDL_GPUColorTargetDescription[]){{
-          .format = SDL_GetGPUSwapchainTextureFormat(device, window),
-          .blend_state =
-              (SDL_GPUColorTargetBlendState){
-                  .enable_blend = true,
-                  .src_color_blendfactor = SDL_GPU_BLENDFACTOR_ONE,
-                  .dst_color_blendfactor =
-                      SDL_GPU_BLENDFACTOR_ONE_MINUS_SRC_ALPHA,
-                  .color_blend_op = SDL_GPU_BLENDOP_ADD,
-                  .src_alpha_blendfactor = SDL_GPU_BLENDFACTOR_ONE,
-                  .dst_alpha_blendfactor =
-                      SDL_GPU_BLENDFACTOR_ONE_MINUS_SRC_ALPHA,
-                  .alpha_blend_op = SDL_GPU_BLENDOP_ADD,
-              },
-      }},
-  };
+  SPS_ScatterParticles(&ps->scatter, &ps->particles, ps->pool, first,
+                       first + count, ps->scattered);
+  ps->scattered += count;
+  return true;
+}
 
-  SDL_GPUGraphicsPipelineCreateInfo pipeline_create_info = {
-      .target_info = color_target_info,
-      .primitive_type = SDL_GPU_PRIMITIVETYPE_TRIANGLELIST,
-      .vertex_shader = vert_shader,
-      .fragment_shader = frag_shader,
-  };
-  ps->pipeline = SDL_CreateGPUGraphicsPipeline(device, &pipeline_create_info);
+void SPS_ParticleSystemClear(SPS_ParticleSystem* ps) {
+  ps->particles.count = 0;
+  ps->particles.reindexed++;
+}
+
+bool SPS_ParticleSystemAddEmitter(SPS_ParticleSystem* ps, SPS_Emitter emitter) {
+  return SPS_EmittersAdd(&ps->emitters, emitter);
+}
 
-  SDL_ReleaseGPUShader(device, vert_shader);
-  SDL_ReleaseGPUShader(device, frag_shader);
+bool SPS_ParticleSystemAddGravitation(SPS_ParticleSystem* ps,
+                                      SPS_OctreeGravity params) {
+  SPS_ForceStage stage = {.type = SPS_FORCE_GRAVITATION};
+  stage.gravitation.octree = &ps->octree;
+  stage.gravitation.params = params;
+  return SPS_ForcePipelineAdd(&ps->forces, stage);
+}
 
-  if (ps->pipeline == NULL) {
-    SDL_Log("Couldn't create graphics pipeline for billboard");
+void SPS_ParticleSystemEnableCollisions(SPS_ParticleSystem* ps,
+                                        SPS_CollisionParams params) {
+  ps->collisions.params = params;
+  ps->collisions.enabled = true;
+}
+
+bool SPS_ParticleSystemEnableSph(SPS_ParticleSystem* ps, SPS_SphParams params) {
+  ps->sph.params = params;
+  if (!SPS_SphAttach(&ps->sph, &ps->particles)) {
     return false;
   }
 
-  // Create buffer location for transform
-  SDL_GPUBufferCreateInfo buffer_create_info = {
-      .usage = SDL_GPU_BUFFERUSAGE_GRAPHICS_STORAGE_READ,
-      .size = instances_buffer_size,
-  };
-  ps->buffer = SDL_CreateGPUBuffer(device, &buffer_create_info);
-  if (ps->buffer == NULL) {
-    SDL_Log("Couldn't create buffer to store the params of debug grid");
+  // Square base block centered over the origin
+  float spacing = 0.5f * params.smoothing_length;
+  float side = spacing * SDL_ceilf(SDL_powf((float)ps->particles.count,
+                                            1.0f / 3.0f));
+  SPS_ALIGN_VEC3 SPS_Vec3 min = {-0.5f * side, spacing, -0.5f * side};
+  SPS_SphLayoutBlock(&ps->sph, &ps->particles, min, ps->scatter.seed);
+
+  SPS_ForceStage fluid = {.type = SPS_FORCE_SPH};
+  fluid.sph.solver = &ps->sph;
+  SPS_ForcePipelineClear(&ps->forces);
+  SPS_ForcePipelineAdd(&ps->forces, (SPS_ForceStage){
+                                        .type = SPS_FORCE_GRAVITY,
+                                        .gravity = {{0.0f, -9.81f, 0.0f}},
+                                    });
+  SPS_ForcePipelineAdd(&ps->forces, fluid);
+  ps->max_timestep = SPS_SphMaxTimestep(&ps->sph);
+  return true;
+}
+
+bool SPS_ParticleSystemLoadColliders(SPS_ParticleSystem* ps, const char* path) {
+  return SPS_CollidersLoadFile(&ps->colliders, path) &&
+         SPS_CollidersBuild(&ps->colliders);
+}
+
+bool SPS_ParticleSystemSave(const SPS_ParticleSystem* ps, const char* path) {
+  return SPS_StateFileWrite(path, &ps->particles, ps->steps);
+}
+
+bool SPS_ParticleSystemRestore(SPS_ParticleSystem* ps, const char* path) {
+  SPS_StateFile file;
+  if (!SPS_StateFileOpen(&file, path)) {
     return false;
   }
 
-  // Create transfer buffer handle
-  SDL_GPUTransferBufferCreateInfo upload_transfer_buffer_create_info = {
-      .usage = SDL_GPU_TRANSFERBUFFERUSAGE_UPLOAD,
-      .size = instances_buffer_size,
-  };
-  ps->upload_transfer_buffer =
-      SDL_CreateGPUTransferBuffer(device, &upload_transfer_buffer_create_info);
-  if (ps->upload_transfer_buffer == NULL) {
-    SDL_Log("Couldn't create transfer buffer of debug grid");
+  SPS_Particles* particles = &ps->particles;
+  const Uint64 count = file.header->count;
+  if (!SPS_ParticlesReserve(particles, count)) {
+    SPS_StateFileClose(&file);
     return false;
   }
 
+  // Copied in parallel straight from the mapping, the workers fault its
+  // pages in together
+  RestoreContext context = {.particles = particles};
+  for (Uint32 c = 0; c < particles->channels_count; c++) {
+    context.sources[c] =
+        SPS_StateFileFindChannel(&file, particles->channels[c].name);
+  }
+  particles->count = count;
+  SPS_ThreadPoolParallelFor(ps->pool, 0, count, SPS_PARTICLES_CHUNK_SIZE,
+                            restore_task, &context);
+
+  // New particles go on from the largest id, states without ids number
+  // theirs from 0
+  particles->next_id = 0;
+  if (context.sources[SPS_CHANNEL_ID] == NULL) {
+    SPS_ParticlesNewIds(particles, 0, count);
+  }
+  const float* ids = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_ID);
+  for (Uint64 i = 0; i < count; i++) {
+    Uint32 id;
+    SDL_memcpy(&id, &ids[i], sizeof(id));
+    particles->next_id = SDL_max(particles->next_id, id + 1);
+  }
+  particles->reindexed++;
+  ps->steps = file.header->steps;
+  SPS_StateFileClose(&file);
   return true;
 }
 
 void SPS_ParticleSystemDebug(SPS_ParticleSystem* ps) {
-  for (Uint64 i = 0; i < ps->instances_count; i++) {
-    SPS_Particle p = ps->instances[i];
-    SDL_Log("particle[%ld] = (%+.2f, %+.2f, %+.2f) mass = %+.2f\n", i,
-            p.position[0], p.position[1], p.position[2], p.mass);
-  }
-}
-
-bool SPS_ParticleSystemDraw(SPS_ParticleSystem* ps,
-                            const SPS_Mat4 proj,
-                            const SPS_Mat4 view,
-                            const SPS_Vec3 view_pos,
-                            SDL_GPUCommandBuffer* cmd_buf,
-                            SDL_GPURenderPass* render_pass) {
-  ParticleSystemUniforms uniforms = {0};
-  SPS_Mat4Mul(proj, view, uniforms.pv);
-  SPS_Vec3Copy(view_pos, uniforms.view_pos);
-
-  SDL_BindGPUGraphicsPipeline(render_pass, ps->pipeline);
-  {
-    // Copy data to the staging of the GPU
-    void* transfer_point =
-        SDL_MapGPUTransferBuffer(ps->device, ps->upload_transfer_buffer, 0);
-    SDL_memcpy(transfer_point, ps->instances,
-               sizeof(SPS_Vec4) * ps->instances_count);
-    SDL_UnmapGPUTransferBuffer(ps->device, ps->upload_transfer_buffer);
-
-    // Create a copy pass
-    SDL_GPUCommandBuffer* upload_cmd_buf =
-        SDL_AcquireGPUCommandBuffer(ps->device);
-    SDL_GPUCopyPass* copy_pass = SDL_BeginGPUCopyPass(upload_cmd_buf);
-    {
-      SDL_GPUTransferBufferLocation source = {
-          .transfer_buffer = ps->upload_transfer_buffer,
-          .offset = 0,
-      };
-      SDL_GPUBufferRegion destination = {
-          .buffer = ps->buffer,
-          .offset = 0,
-          .size = sizeof(SPS_Vec4) * ps->instances_count,
-      };
-
-      SDL_UploadToGPUBuffer(copy_pass, &source, &destination, false);
-      SDL_EndGPUCopyPass(copy_pass);
-      SDL_SubmitGPUCommandBuffer(upload_cmd_buf);
+  SPS_Particles* particles = &ps->particles;
+  const float* px = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_X);
+  const float* py = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_Y);
+  const float* pz = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_Z);
+  const float* mass = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_MASS);
+  for (Uint64 i = 0; i < particles->count; i++) {
+    SDL_Log("particle[%" SDL_PRIu64 "] = (%+.2f, %+.2f, %+.2f) mass = %+.2f\n",
+            i, px[i], py[i], pz[i], mass[i]);
+  }
+}
+
+void SPS_ParticleSystemUpdate(SPS_ParticleSystem* ps, float dt) {
+  if (ps->reorder_interval > 0 && ps->steps % ps->reorder_interval == 0) {
+    reorder_particles(ps);
+  }
+
+  // Stiff stages bound the step, longer updates run as equal substeps
+  Uint32 substeps = 1;
+  if (ps->max_timestep > 0.0f && dt > ps->max_timestep) {
+    substeps = (Uint32)SDL_ceilf(dt / ps->max_timestep);
+    substeps = SDL_min(substeps, MAX_SUBSTEPS);
+  }
+
+  for (Uint32 s = 0; s < substeps; s++) {
+    update_step(ps, dt / substeps);
+  }
+  ps->steps++;
+}
+
+bool SPS_ParticleSystemSnapshot(SPS_ParticleSystem* ps,
+                                SPS_ParticleSnapshot* snapshot,
+                                const SPS_ParticleSnapshot* previous) {
+  const Uint64 count = ps->particles.count;
+  if (count > snapshot->capacity) {
+    Uint64 capacity = SDL_max(count, snapshot->capacity * 2);
+    Uint64 chunks =
+        (capacity + SPS_PARTICLES_CHUNK_SIZE - 1) / SPS_PARTICLES_CHUNK_SIZE;
+    SPS_QuantizedInstance* instances = SDL_realloc(
+        snapshot->instances, sizeof(SPS_QuantizedInstance) * capacity);
+    if (instances != NULL) {
+      snapshot->instances = instances;
+    }
+    Uint64* chunk_steps =
+        SDL_realloc(snapshot->chunk_steps, sizeof(Uint64) * chunks);
+    if (chunk_steps != NULL) {
+      snapshot->chunk_steps = chunk_steps;
+    }
+    SPS_ChunkBounds* chunk_bounds =
+        SDL_realloc(snapshot->chunk_bounds, sizeof(SPS_ChunkBounds) * chunks);
+    if (chunk_bounds != NULL) {
+      snapshot->chunk_bounds = chunk_bounds;
+    }
+    Uint32* order = SDL_realloc(snapshot->order, sizeof(Uint32) * capacity);
+    if (order != NULL) {
+      snapshot->order = order;
+    }
+    if (instances == NULL || chunk_steps == NULL || chunk_bounds == NULL ||
+        order == NULL) {
+      SDL_Log("Couldn't allocate a snapshot of %" SDL_PRIu64 " particles",
+              capacity);
+      return false;
     }
+    snapshot->capacity = capacity;
   }
 
-  SDL_PushGPUVertexUniformData(cmd_buf, 0, &uniforms,
-                               sizeof(ParticleSystemUniforms));
-  SDL_BindGPUVertexStorageBuffers(render_pass, 0, &ps->buffer, 1);
-  SDL_DrawGPUPrimitives(render_pass, 6, ps->instances_count, 0, 0);
+  SnapshotContext context = {
+      .ps = ps,
+      .snapshot = snapshot,
+      .previous = previous,
+  };
+  SPS_ThreadPoolParallelFor(ps->pool, 0, count, SPS_PARTICLES_CHUNK_SIZE,
+                            snapshot_bounds_task, &context);
+
+  // Every chunk is quantized inside the box of them all
+  float min[3] = {0.0f, 0.0f, 0.0f};
+  float max[3] = {0.0f, 0.0f, 0.0f};
+  const Uint64 chunks =
+      (count + SPS_PARTICLES_CHUNK_SIZE - 1) / SPS_PARTICLES_CHUNK_SIZE;
+  for (Uint64 chunk = 0; chunk < chunks; chunk++) {
+    const SPS_ChunkBounds* bounds = &snapshot->chunk_bounds[chunk];
+    for (int c = 0; c < 3; c++) {
+      min[c] = chunk == 0 ? bounds->min[c] : SDL_min(min[c], bounds->min[c]);
+      max[c] = chunk == 0 ? bounds->max[c] : SDL_max(max[c], bounds->max[c]);
+    }
+  }
+  SPS_QuantizeBoundsLoad(&snapshot->bounds, min, max);
 
+  SPS_ThreadPoolParallelFor(ps->pool, 0, count, SPS_PARTICLES_CHUNK_SIZE,
+                            snapshot_task, &context);
+  snapshot->count = count;
+  snapshot->step = ps->steps;
+  snapshot->sorted = false;
+  if (ps->depth_sort && !sort_snapshot(ps, snapshot)) {
+    return false;
+  }
   return true;
 }
 
-void SPS_ParticleSystemUpdate(SPS_ParticleSystem* ps, float dt) {
-  SPS_ALIGN_VEC3 SPS_Vec3 force = {0};
-  SPS_ALIGN_VEC3 SPS_Vec3 acceleration = {0};
-  SPS_ALIGN_VEC3 SPS_Vec3 aux = {0};
+void SPS_ParticleSnapshotDestroy(SPS_ParticleSnapshot* snapshot) {
+  SDL_free(snapshot->instances);
+  SDL_free(snapshot->chunk_steps);
+  SDL_free(snapshot->chunk_bounds);
+  SDL_free(snapshot->order);
+  SDL_memset(snapshot, 0, sizeof(SPS_ParticleSnapshot));
+}
 
-  for (Uint64 i = 0; i < ps->instances_count; i++) {
-    SPS_Particle* p = &ps->instances[i];
-    particle_compute_force(p, force);
-    SPS_Vec3Scale(force, 1.0f / SDL_max(p->mass, 0.00001f), acceleration);
+Uint64 SPS_ParticleSystemMemorySize(const SPS_ParticleSystem* ps) {
+  return SPS_ParticlesMemorySize(&ps->particles) +
+         SPS_OctreeMemorySize(&ps->octree) +
+         SPS_CollisionsMemorySize(&ps->collisions) +
+         SPS_SphMemorySize(&ps->sph) +
+         SPS_EmittersMemorySize(&ps->emitters) +
+         SPS_CollidersMemorySize(&ps->colliders) +
+         sizeof(Uint32) * 4 * ps->sort_capacity;
+}
+
+void SPS_ParticleSystemQuit(SPS_ParticleSystem* ps) {
+  SPS_OctreeDestroy(&ps->octree);
+  SPS_SphDestroy(&ps->sph);
+  SPS_EmittersDestroy(&ps->emitters);
+  SPS_CollidersDestroy(&ps->colliders);
+  SPS_CollisionsDestroy(&ps->collisions);
+  SPS_ParticlesDestroy(&ps->particles);
+  SDL_free(ps->sort_keys);
+  SDL_free(ps->sort_order);
+  SDL_free(ps->sort_keys_tmp);
+  SDL_free(ps->sort_order_tmp);
+  ps->sort_keys = NULL;
+  ps->sort_order = NULL;
+  ps->sort_keys_tmp = NULL;
+  ps->sort_order_tmp = NULL;
+  ps->sort_capacity = 0;
+}
+
+void update_step(SPS_ParticleSystem* ps, float dt) {
+  SPS_Particles* particles = &ps->particles;
+  UpdateContext context = {.ps = ps};
+  for (int c = 0; c < 3; c++) {
+    context.force[c] = SPS_PARTICLES_CHANNEL(particles, ps->force_channels[c]);
+  }
+
+  context.batch = (SPS_IntegrateBatch){
+      .position = {SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_X),
+                   SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_Y),
+                   SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_Z)},
+      .velocity = {SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_VELOCITY_X),
+                   SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_VELOCITY_Y),
+                   SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_VELOCITY_Z)},
+      .force = {context.force[0], context.force[1], context.force[2]},
+      .mass = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_MASS),
+      .dt = dt,
+  };
 
-    // p.velocity = p.velocity + acceleration * dt
-    SPS_Vec3Scale(acceleration, dt, aux);
-    SPS_Vec3Add(p->velocity, aux, p->velocity);
+  // Stages reading other particles prepare before any chunk moves
+  SPS_ForcePipelinePrepare(&ps->forces, particles, ps->pool);
+  SPS_ThreadPoolParallelFor(ps->pool, 0, particles->count,
+                            SPS_PARTICLES_CHUNK_SIZE, update_task, &context);
 
-    // p.position = p.position + p.velocity * dt
-    SPS_Vec3Scale(p->velocity, dt, aux);
-    SPS_Vec3Add(p->position, aux, p->position);
+  if (ps->collisions.enabled) {
+    SPS_CollisionsResolve(&ps->collisions, particles, ps->pool);
+  }
+
+  // Expired particles leave before the new ones are appended, the sweep
+  // order follows the survivors to where they moved
+  if (ps->emitters.count > 0) {
+    const Uint64 count = particles->count;
+    SPS_EmittersUpdate(&ps->emitters, particles, ps->pool, dt);
+    if (ps->emitters.expired > 0) {
+      SPS_CollisionsRemap(&ps->collisions, ps->emitters.moved, count);
+    }
   }
 }
 
-void SPS_ParticleSystemDestroy(SPS_ParticleSystem* ps) {
-  SDL_ReleaseGPUGraphicsPipeline(ps->device, ps->pipeline);
-  SDL_ReleaseGPUTransferBuffer(ps->device, ps->upload_transfer_buffer);
-  SDL_ReleaseGPUBuffer(ps->device, ps->buffer);
+void update_task(void* userdata, Uint64 first, Uint64 last, Uint32 worker) {
+  (void)worker;
+  UpdateContext* context = userdata;
+  SPS_ParticleSystem* ps = context->ps;
+
+  // Forces, integration and colliders back to back while the chunk is in cache
+  SPS_ForcePipelineApply(&ps->forces, &ps->particles, context->force, first,
+                         last);
+  SPS_Integrate(&context->batch, first, last);
+  SPS_CollidersResolve(&ps->colliders, &ps->particles, context->batch.dt,
+                       first, last);
+}
+
+void snapshot_bounds_task(void* userdata,
+                          Uint64 first,
+                          Uint64 last,
+                          Uint32 worker) {
+  (void)worker;
+  SnapshotContext* context = userdata;
+  const SPS_Particles* particles = &context->ps->particles;
+  const float* const position[3] = {
+      SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_X),
+      SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_Y),
+      SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_Z),
+  };
+  SPS_ChunkBounds* bounds =
+      &context->snapshot->chunk_bounds[first / SPS_PARTICLES_CHUNK_SIZE];
+  for (int c = 0; c < 3; c++) {
+    bounds->min[c] = position[c][first];
+    bounds->max[c] = position[c][first];
+  }
+  SPS_QuantizeGrowBounds(position, first + 1, last, bounds->min,
+                         bounds->max);
 
-  if (ps->instances != NULL) {
-    SDL_aligned_free(ps->instances);
-    ps->instances = NULL;
-    ps->instances_count = 0;
+  const float* scale = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_SCALE);
+  float radius = 0.0f;
+  for (Uint64 i = first; i < last; i++) {
+    radius = SDL_max(radius, scale[i]);
   }
+  bounds->radius = radius;
 }
 
-void particle_compute_force(const SPS_Particle* particle, SPS_Vec3 dest) {
-  // F = ma (gravity)
-  dest[0] = 0.0f;
-  dest[1] = particle->mass * -9.81;
-  dest[2] = 0.0f;
+void snapshot_task(void* userdata, Uint64 first, Uint64 last, Uint32 worker) {
+  (void)worker;
+  SnapshotContext* context = userdata;
+  const SPS_Particles* particles = &context->ps->particles;
+  const SPS_ParticleSnapshot* previous = context->previous;
+  const float* const position[3] = {
+      SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_X),
+      SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_Y),
+      SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_Z),
+  };
+  SPS_QuantizedInstance* instances = context->snapshot->instances + first;
+  SPS_QuantizePack(&context->snapshot->bounds, position,
+                   SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_SCALE), first,
+                   last, instances);
+
+  // Comparing costs a read of memory, resending costs bus bandwidth
+  const Uint64 chunk = first / SPS_PARTICLES_CHUNK_SIZE;
+  bool same = previous != NULL && last <= previous->count &&
+              SDL_memcmp(instances, previous->instances + first,
+                         sizeof(SPS_QuantizedInstance) * (last - first)) == 0;
+  context->snapshot->chunk_steps[chunk] =
+      same ? previous->chunk_steps[chunk] : context->ps->steps;
 }
 
-float remap_value(float value,
-                  float start1,
-                  float stop1,
-                  float start2,
-                  float stop2) {
-  return start2 + (stop2 - start2) * ((value - start1) / (stop1 - start1));
+void restore_task(void* userdata, Uint64 first, Uint64 last, Uint32 worker) {
+  (void)worker;
+  RestoreContext* context = userdata;
+  const SPS_Particles* particles = context->particles;
+  for (Uint32 c = 0; c < particles->channels_count; c++) {
+    float* dest = particles->channels[c].data;
+    const float* src = context->sources[c];
+    if (src != NULL) {
+      SDL_memcpy(dest + first, src + first, sizeof(float) * (last - first));
+      continue;
+    }
+    for (Uint64 i = first; i < last; i++) {
+      dest[i] = particles->channels[c].default_value;
+    }
+  }
+}
+
+bool reserve_sort_scratch(SPS_ParticleSystem* ps, Uint64 count) {
+  if (count <= ps->sort_capacity) {
+    return true;
+  }
+
+  Uint64 capacity = SDL_max(count, ps->sort_capacity * 2);
+  Uint32** arrays[4] = {&ps->sort_keys, &ps->sort_order, &ps->sort_keys_tmp,
+                        &ps->sort_order_tmp};
+  for (int a = 0; a < 4; a++) {
+    Uint32* data = SDL_realloc(*arrays[a], sizeof(Uint32) * capacity);
+    if (data == NULL) {
+      SDL_Log("Couldn't allocate the sort of %" SDL_PRIu64 " particles",
+              capacity);
+      return false;
+    }
+    *arrays[a] = data;
+  }
+  ps->sort_capacity = capacity;
+  return true;
+}
+
+bool reorder_particles(SPS_ParticleSystem* ps) {
+  SPS_Particles* particles = &ps->particles;
+  const Uint64 count = particles->count;
+  if (count == 0 || count > SDL_MAX_UINT32 ||
+      !reserve_sort_scratch(ps, count)) {
+    return false;
+  }
+
+  // Same keys as the octree build, over the cube around the particles
+  SPS_ALIGN_VEC3 SPS_Vec3 min = {0};
+  SPS_ALIGN_VEC3 SPS_Vec3 max = {0};
+  SPS_MortonBounds(ps->pool, particles, min, max);
+  float size = SDL_max(max[0] - min[0], max[1] - min[1]);
+  size = SDL_max(size, max[2] - min[2]);
+  SPS_MortonKeys(ps->pool, particles, min, size > 0.0f ? size : 1.0f,
+                 ps->sort_keys, ps->sort_order);
+  if (!SPS_RadixSort(ps->pool, ps->sort_keys, ps->sort_order,
+                     ps->sort_keys_tmp, ps->sort_order_tmp, count,
+                     3 * SPS_MORTON_BITS) ||
+      !SPS_ParticlesPermute(particles, ps->pool, ps->sort_order)) {
+    return false;
+  }
+
+  // The keys are free again, they take where every particle went
+  for (Uint64 i = 0; i < count; i++) {
+    ps->sort_keys[ps->sort_order[i]] = (Uint32)i;
+  }
+  SPS_CollisionsRemap(&ps->collisions, ps->sort_keys, count);
+  return true;
+}
+
+bool sort_snapshot(SPS_ParticleSystem* ps, SPS_ParticleSnapshot* snapshot) {
+  const Uint64 count = snapshot->count;
+  if (!reserve_sort_scratch(ps, count)) {
+    return false;
+  }
+
+  SnapshotContext context = {.ps = ps, .snapshot = snapshot};
+  SPS_ThreadPoolParallelFor(ps->pool, 0, count, SPS_PARTICLES_CHUNK_SIZE,
+                            sort_keys_task, &context);
+  if (!SPS_RadixSort(ps->pool, ps->sort_keys, snapshot->order,
+                     ps->sort_keys_tmp, ps->sort_order_tmp, count, 32)) {
+    return false;
+  }
+  snapshot->sorted = true;
+  return true;
+}
+
+void sort_keys_task(void* userdata, Uint64 first, Uint64 last, Uint32 worker) {
+  (void)worker;
+  SnapshotContext* context = userdata;
+  const SPS_ParticleSystem* ps = context->ps;
+  const SPS_Particles* particles = &ps->particles;
+  const float* px = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_X);
+  const float* py = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_Y);
+  const float* pz = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_Z);
+  const float* view_pos = ps->sort_view_pos;
+  Uint32* order = context->snapshot->order;
+  for (Uint64 i = first; i < last; i++) {
+    // Bits of positive floats sort like the floats, inverted they put the
+    // furthest particle first
+    float dx = px[i] - view_pos[0];
+    float dy = py[i] - view_pos[1];
+    float dz = pz[i] - view_pos[2];
+    float distance2 = dx * dx + dy * dy + dz * dz;
+    Uint32 bits;
+    SDL_memcpy(&bits, &distance2, sizeof(bits));
+    ps->sort_keys[i] = ~bits;
+    order[i] = (Uint32)i;
+  }
 }
@@ -2,46 +2,196 @@
 #define SPS_PARTICLE_SYSTEM_H
 
 #include <SDL3/SDL_gpu.h>
+#include "colliders.h"
+#include "collision.h"
+#include "emitters.h"
+#include "forces.h"
+#include "octree.h"
+#include "particles.h"
+#include "quantize.h"
+#include "random.h"
+#include "sph.h"
+#include "thread_pool.h"
 #include "xmath.h"
 
-// Single simulated particle.
+// Frames the GPU may still be reading while a new one is recorded.
+#define SPS_FRAMES_IN_FLIGHT (3)
+
+// Most GPU buffer pairs waiting for their last frame to finish.
+#define SPS_MAX_RETIRED_BUFFERS (8)
+
+// Instance buffers replaced by bigger ones, released once no frame in flight
+// can read them anymore.
+typedef struct {
+  SDL_GPUBuffer* buffer;
+  SDL_GPUBuffer* order_buffer;
+  SDL_GPUTransferBuffer* upload_transfer_buffers[SPS_FRAMES_IN_FLIGHT];
+  Uint64 frame;  // last frame that could use them
+} SPS_RetiredGPUBuffers;
+
+// Box around the centers of a chunk of particles and their largest scale.
+typedef struct {
+  float min[3];
+  float max[3];
+  float radius;
+} SPS_ChunkBounds;
+
+// Quantized instances of one simulated state, all the renderer reads.
 typedef struct {
-  SPS_ALIGN_VEC4 SPS_Vec3 position;
-  float scale;
-  SPS_ALIGN_VEC4 SPS_Vec3 velocity;
-  float mass;
-} SPS_Particle;
+  SPS_QuantizedInstance* instances;
+  Uint64* chunk_steps;  // step every chunk of particles last changed at
+  SPS_ChunkBounds* chunk_bounds;
+  SPS_QuantizeBounds bounds;
+  Uint32* order;  // back to front particles, only valid when sorted
+  bool sorted;
+  Uint64 count;
+  Uint64 capacity;
+  Uint64 step;  // updates simulated when it was taken
+} SPS_ParticleSnapshot;
 
 // Particle simulation, it can also render the partciles.
 typedef struct {
   SDL_GPUDevice* device;
   SDL_GPUGraphicsPipeline* pipeline;
   SDL_GPUBuffer* buffer;
-  SDL_GPUTransferBuffer* upload_transfer_buffer;
-  SPS_Particle* instances;
-  Uint64 instances_count;
+  SDL_GPUBuffer* order_buffer;  // back to front instances of sorted snapshots
+
+  // One staging buffer per frame in flight, a frame only maps its own
+  SDL_GPUTransferBuffer* upload_transfer_buffers[SPS_FRAMES_IN_FLIGHT];
+  Uint64 gpu_capacity;  // instances the GPU buffers hold
+  Uint64 gpu_count;     // instances of the last uploaded snapshot
+  Uint64 frame;         // uploads so far
+  SPS_QuantizeBounds gpu_bounds;
+
+  // Chunks in view of the last upload, only they are sent and drawn, and
+  // 1 + the step every chunk of the GPU buffer was sent at, 0 when never
+  bool* visible_chunks;
+  Uint64* gpu_chunk_steps;
+  Uint64 visible_count;   // instances in visible chunks
+  Uint64 gpu_order_step;  // 1 + the step of the order buffer, 0 when never
+  bool gpu_sorted;        // draws go through the order buffer
+  SPS_RetiredGPUBuffers retired[SPS_MAX_RETIRED_BUFFERS];
+  Uint32 retired_count;
+  SPS_ThreadPool* pool;
+  SPS_Particles particles;
+  SPS_ForcePipeline forces;
+  SPS_Octree octree;
+  SPS_Collisions collisions;
+  SPS_Colliders colliders;
+  SPS_Sph sph;
+  SPS_Emitters emitters;
+  float max_timestep;  // longer updates are split, 0 when unbounded
+
+  // New particles are scattered by their index in the particles scattered
+  // so far, the same seed always gives the same places
+  SPS_Scatter scatter;
+  Uint64 scattered;
+
+  // Snapshots get a back to front order around sort_view_pos when enabled,
+  // and every reorder_interval steps the particles are stored along the
+  // Morton curve, both sort in the same scratch
+  bool depth_sort;
+  SPS_Vec3 sort_view_pos;
+  Uint32 reorder_interval;  // 0 never reorders
+  Uint32* sort_keys;
+  Uint32* sort_order;
+  Uint32* sort_keys_tmp;
+  Uint32* sort_order_tmp;
+  Uint64 sort_capacity;
+  Uint64 steps;
+  Sint32 force_channels[3];
 } SPS_ParticleSystem;
 
-// Initializes the particle system with a fixed count of partciles.
+// Initializes only the CPU simulation state, no GPU device needed. The
+// particles are placed by scatter and pool if they were set before, a zeroed
+// scatter fills the box over the grid.
+bool SPS_ParticleSystemInit(SPS_ParticleSystem* ps, Uint64 count);
+
+// Initializes the particle system with count partciles, the CPU and GPU
+// storage grow geometrically when more are spawned later.
 bool SPS_ParticleSystemLoad(SPS_ParticleSystem* ps,
                             Uint64 count,
                             SDL_GPUDevice* device,
                             SDL_Window* window);
 
+// Adds count particles at random places of the scatter shape.
+bool SPS_ParticleSystemSpawn(SPS_ParticleSystem* ps, Uint64 count);
+
+// Removes every particle, emitters can then fill the store from scratch.
+void SPS_ParticleSystemClear(SPS_ParticleSystem* ps);
+
+// Adds a particle source, from then on particles age every step and the
+// expired ones are removed.
+bool SPS_ParticleSystemAddEmitter(SPS_ParticleSystem* ps, SPS_Emitter emitter);
+
+// Adds mutual gravitation between the particles through the system octree.
+bool SPS_ParticleSystemAddGravitation(SPS_ParticleSystem* ps,
+                                      SPS_OctreeGravity params);
+
+// Makes the particles collide as spheres of radius scale after every step.
+void SPS_ParticleSystemEnableCollisions(SPS_ParticleSystem* ps,
+                                        SPS_CollisionParams params);
+
+// Turns the particles into a fluid block above the origin, replacing the
+// force pipeline with gravity and the SPH pressure and viscosity forces.
+bool SPS_ParticleSystemEnableSph(SPS_ParticleSystem* ps, SPS_SphParams params);
+
+// Adds the static colliders of a file to the ground plane and rebuilds the
+// collider BVH.
+bool SPS_ParticleSystemLoadColliders(SPS_ParticleSystem* ps, const char* path);
+
+// Writes the live particles and the steps simulated so far to a state file.
+bool SPS_ParticleSystemSave(const SPS_ParticleSystem* ps, const char* path);
+
+// Resumes from a state file, the particles take its count and steps. Channels
+// the file lacks get their defaults and the ones the store lacks are dropped.
+// Meant for startup, snapshots taken before may miss changed chunks.
+bool SPS_ParticleSystemRestore(SPS_ParticleSystem* ps, const char* path);
+
 // Prints to logs the particle positions and mass.
 void SPS_ParticleSystemDebug(SPS_ParticleSystem* ps);
 
-// Draws the partcile system entirely.
+// Quantizes the live particles into snapshot inside their bounds. Chunks
+// packed the same as in previous, the snapshot taken before, keep its change
+// step so the renderer skips them, a NULL previous changes them all. With
+// depth_sort the snapshot also gets the particles from the furthest to the
+// nearest to sort_view_pos.
+bool SPS_ParticleSystemSnapshot(SPS_ParticleSystem* ps,
+                                SPS_ParticleSnapshot* snapshot,
+                                const SPS_ParticleSnapshot* previous);
+
+// Releases the instances of a snapshot.
+void SPS_ParticleSnapshotDestroy(SPS_ParticleSnapshot* snapshot);
+
+// Culls the chunks of a snapshot against the camera frustum and records in
+// cmd_buf, before its render pass, the copy of the visible ones that changed
+// since they were last sent, the simulation may keep running. A sorted
+// snapshot keeps every chunk and also sends its order.
+bool SPS_ParticleSystemUpload(SPS_ParticleSystem* ps,
+                              const SPS_ParticleSnapshot* snapshot,
+                              const SPS_Mat4 proj,
+                              const SPS_Mat4 view,
+                              SDL_GPUCommandBuffer* cmd_buf);
+
+// Draws the visible chunks of the last upload as quads facing the view
+// plane, one draw per run of chunks, or a sorted upload back to front in a
+// single draw.
 bool SPS_ParticleSystemDraw(SPS_ParticleSystem* ps,
                             const SPS_Mat4 proj,
                             const SPS_Mat4 view,
-                            const SPS_Vec3 view_pos,
                             SDL_GPUCommandBuffer* cmd_buf,
                             SDL_GPURenderPass* render_pass);
 
-// Updates the particle system simulation.
+// Updates the particle system simulation, first storing the particles along
+// the Morton curve of their bounds when a reorder is due.
 void SPS_ParticleSystemUpdate(SPS_ParticleSystem* ps, float dt);
 
+// Bytes of CPU memory used by the simulation state.
+Uint64 SPS_ParticleSystemMemorySize(const SPS_ParticleSystem* ps);
+
+// Releases only the CPU simulation state.
+void SPS_ParticleSystemQuit(SPS_ParticleSystem* ps);
+
 // Releases the resources used by the particle system simulation.
 void SPS_ParticleSystemDestroy(SPS_ParticleSystem* ps);
 
@@ -0,0 +1,472 @@
+#include "particle_system.h"
+#include "shader.h"
+#include "xmath.h"
+
+#include <SDL3/SDL_log.h>
+#include <SDL3/SDL_stdinc.h>
+
+// float3 members start on 16 bytes in the shader constant buffer
+typedef struct {
+  SPS_ALIGN_MAT4 SPS_Mat4 pv;
+  SPS_ALIGN_AS(16) SPS_Vec3 right;
+  SPS_ALIGN_AS(16) SPS_Vec3 up;
+  SPS_ALIGN_AS(16) SPS_Vec3 origin;
+  SPS_ALIGN_AS(16) SPS_Vec3 step;
+} ParticleSystemUniforms;
+
+// Pushed before every draw, SV_InstanceID doesn't count the first instance
+// of a draw on every backend
+typedef struct {
+  Uint32 first_instance;
+  Uint32 sorted;  // instances are read through the order buffer
+  Uint32 padding[2];
+} ParticleDrawUniforms;
+
+bool reserve_gpu_buffers(SPS_ParticleSystem* ps, Uint64 count);
+void release_gpu_buffers(SDL_GPUDevice* device,
+                         SDL_GPUBuffer* buffer,
+                         SDL_GPUBuffer* order_buffer,
+                         SDL_GPUTransferBuffer* const* transfer_buffers);
+void release_retired_buffers(SPS_ParticleSystem* ps, bool all);
+bool next_dirty_range(const SPS_ParticleSystem* ps,
+                      const SPS_ParticleSnapshot* snapshot,
+                      Uint64* first,
+                      Uint64* last);
+bool chunk_needs_upload(const SPS_ParticleSystem* ps,
+                        const SPS_ParticleSnapshot* snapshot,
+                        Uint64 chunk);
+bool order_needs_upload(const SPS_ParticleSystem* ps,
+                        const SPS_ParticleSnapshot* snapshot);
+
+bool SPS_ParticleSystemLoad(SPS_ParticleSystem* ps,
+                            Uint64 count,
+                            SDL_GPUDevice* device,
+                            SDL_Window* window) {
+  ps->device = device;
+  if (!SPS_ParticleSystemInit(ps, count)) {
+    return false;
+  }
+
+  SPS_ShaderOptions vert_options = (SPS_ShaderOptions){
+      .filename = "particle_system.vert",
+      .stage = SDL_GPU_SHADERSTAGE_VERTEX,
+      .sampler_count = 0,
+      .uniform_buffer_count = 2,
+      .storage_buffer_count = 2,
+      .storage_texture_count = 0,
+  };
+  SDL_GPUShader* vert_shader = SPS_ShaderLoad(device, vert_options);
+  if (vert_shader == NULL) {
+    return false;
+  }
+
+  SPS_ShaderOptions frag_options = (SPS_ShaderOptions){
+      .filename = "particle_system.frag",
+      .stage = SDL_GPU_SHADERSTAGE_FRAGMENT,
+      .sampler_count = 0,
+      .uniform_buffer_count = 0,
+      .storage_buffer_count = 0,
+      .storage_texture_count = 0,
+  };
+  SDL_GPUShader* frag_shader = SPS_ShaderLoad(device, frag_options);
+  if (frag_shader == NULL) {
+    return false;
+  }
+
+  SDL_GPUGraphicsPipelineTargetInfo color_target_info = {
+      .num_color_targets = 1,
+      .color_target_descriptions = (SDL_GPUColorTargetDescription[]){{
+          .format = SDL_GetGPUSwapchainTextureFormat(device, window),
+          .blend_state =
+              (SDL_GPUColorTargetBlendState){
+                  .enable_blend = true,
+                  .src_color_blendfactor = SDL_GPU_BLENDFACTOR_ONE,
+                  .dst_color_blendfactor =
+                      SDL_GPU_BLENDFACTOR_ONE_MINUS_SRC_ALPHA,
+                  .color_blend_op = SDL_GPU_BLENDOP_ADD,
+                  .src_alpha_blendfactor = SDL_GPU_BLENDFACTOR_ONE,
+                  .dst_alpha_blendfactor =
+                      SDL_GPU_BLENDFACTOR_ONE_MINUS_SRC_ALPHA,
+                  .alpha_blend_op = SDL_GPU_BLENDOP_ADD,
+              },
+      }},
+  };
+
+  SDL_GPUGraphicsPipelineCreateInfo pipeline_create_info = {
+      .target_info = color_target_info,
+      .primitive_type = SDL_GPU_PRIMITIVETYPE_TRIANGLESTRIP,
+      .vertex_shader = vert_shader,
+      .fragment_shader = frag_shader,
+  };
+  ps->pipeline = SDL_CreateGPUGraphicsPipeline(device, &pipeline_create_info);
+
+  SDL_ReleaseGPUShader(device, vert_shader);
+  SDL_ReleaseGPUShader(device, frag_shader);
+
+  if (ps->pipeline == NULL) {
+    SDL_Log("Couldn't create graphics pipeline for billboard");
+    return false;
+  }
+
+  return reserve_gpu_buffers(ps, SDL_max(count, 1));
+}
+
+bool SPS_ParticleSystemUpload(SPS_ParticleSystem* ps,
+                              const SPS_ParticleSnapshot* snapshot,
+                              const SPS_Mat4 proj,
+                              const SPS_Mat4 view,
+                              SDL_GPUCommandBuffer* cmd_buf) {
+  // Buffers retired by a growth are free once their frames are done
+  ps->frame++;
+  release_retired_buffers(ps, false);
+
+  // Only the dense live range is uploaded and drawn
+  if (snapshot->count == 0) {
+    ps->gpu_count = 0;
+    ps->visible_count = 0;
+    ps->gpu_sorted = false;
+    return true;
+  }
+  if (!reserve_gpu_buffers(ps, snapshot->count)) {
+    return false;
+  }
+
+  // Quads reach scale * sqrt(2) away from their center. A sorted snapshot
+  // is drawn whole in its order, a chunk out of view would be drawn stale
+  SPS_Mat4 pv;
+  SPS_Vec4 planes[6];
+  SPS_Mat4Mul(proj, view, pv);
+  SPS_Mat4FrustumPlanes(pv, planes);
+  const Uint64 chunks =
+      (snapshot->count + SPS_PARTICLES_CHUNK_SIZE - 1) /
+      SPS_PARTICLES_CHUNK_SIZE;
+  ps->visible_count = 0;
+  for (Uint64 chunk = 0; chunk < chunks; chunk++) {
+    const SPS_ChunkBounds* bounds = &snapshot->chunk_bounds[chunk];
+    const float pad = bounds->radius * SDL_sqrtf(2.0f);
+    SPS_Vec3 min;
+    SPS_Vec3 max;
+    for (int c = 0; c < 3; c++) {
+      min[c] = bounds->min[c] - pad;
+      max[c] = bounds->max[c] + pad;
+    }
+    ps->visible_chunks[chunk] =
+        snapshot->sorted || SPS_FrustumTestBox(planes, min, max);
+    if (ps->visible_chunks[chunk]) {
+      Uint64 first = chunk * SPS_PARTICLES_CHUNK_SIZE;
+      ps->visible_count +=
+          SDL_min(snapshot->count - first, SPS_PARTICLES_CHUNK_SIZE);
+    }
+  }
+
+  // Nothing to send when the visible chunks and the order are up to date
+  Uint64 first = 0;
+  Uint64 last = 0;
+  const bool dirty = next_dirty_range(ps, snapshot, &first, &last);
+  const bool send_order = order_needs_upload(ps, snapshot);
+  ps->gpu_count = snapshot->count;
+  ps->gpu_bounds = snapshot->bounds;
+  ps->gpu_sorted = snapshot->sorted;
+  if (!dirty && !send_order) {
+    return true;
+  }
+
+  // The simulation waited on the fence of the frame that last used this
+  // staging buffer, so it is free without cycling. The order goes after the
+  // instances of the whole capacity
+  const bool whole = dirty && first == 0 && last == snapshot->count;
+  const Uint64 stride = sizeof(SPS_QuantizedInstance);
+  const Uint64 order_offset = stride * ps->gpu_capacity;
+  const Uint64 order_size = sizeof(Uint32) * snapshot->count;
+  SDL_GPUTransferBuffer* upload_transfer_buffer =
+      ps->upload_transfer_buffers[ps->frame % SPS_FRAMES_IN_FLIGHT];
+  Uint8* transfer_point =
+      SDL_MapGPUTransferBuffer(ps->device, upload_transfer_buffer, false);
+  if (transfer_point == NULL) {
+    SDL_Log("Couldn't map the particle instances transfer buffer: %s",
+            SDL_GetError());
+    return false;
+  }
+  if (dirty) {
+    do {
+      SDL_memcpy(transfer_point + first * stride,
+                 (const Uint8*)snapshot->instances + first * stride,
+                 (last - first) * stride);
+      first = last;
+    } while (next_dirty_range(ps, snapshot, &first, &last));
+  }
+  if (send_order) {
+    SDL_memcpy(transfer_point + order_offset, snapshot->order, order_size);
+  }
+  SDL_UnmapGPUTransferBuffer(ps->device, upload_transfer_buffer);
+
+  // Recorded in the frame command buffer, ordered before its render pass
+  // and after the draws of earlier frames
+  SDL_GPUCopyPass* copy_pass = SDL_BeginGPUCopyPass(cmd_buf);
+  first = 0;
+  while (next_dirty_range(ps, snapshot, &first, &last)) {
+    SDL_GPUTransferBufferLocation source = {
+        .transfer_buffer = upload_transfer_buffer,
+        .offset = (Uint32)(first * stride),
+    };
+    SDL_GPUBufferRegion destination = {
+        .buffer = ps->buffer,
+        .offset = (Uint32)(first * stride),
+        .size = (Uint32)((last - first) * stride),
+    };
+
+    // Only a whole upload may cycle, a partial one keeps the chunks it
+    // skips in the current contents
+    SDL_UploadToGPUBuffer(copy_pass, &source, &destination, whole);
+    for (Uint64 i = first; i < last; i += SPS_PARTICLES_CHUNK_SIZE) {
+      ps->gpu_chunk_steps[i / SPS_PARTICLES_CHUNK_SIZE] = snapshot->step + 1;
+    }
+    first = last;
+  }
+
+  // The order is always sent whole, every frame drawing it can cycle it
+  if (send_order) {
+    SDL_GPUTransferBufferLocation source = {
+        .transfer_buffer = upload_transfer_buffer,
+        .offset = (Uint32)order_offset,
+    };
+    SDL_GPUBufferRegion destination = {
+        .buffer = ps->order_buffer,
+        .offset = 0,
+        .size = (Uint32)order_size,
+    };
+    SDL_UploadToGPUBuffer(copy_pass, &source, &destination, true);
+    ps->gpu_order_step = snapshot->step + 1;
+  }
+  SDL_EndGPUCopyPass(copy_pass);
+  return true;
+}
+
+bool SPS_ParticleSystemDraw(SPS_ParticleSystem* ps,
+                            const SPS_Mat4 proj,
+                            const SPS_Mat4 view,
+                            SDL_GPUCommandBuffer* cmd_buf,
+                            SDL_GPURenderPass* render_pass) {
+  if (ps->gpu_count == 0 || ps->visible_count == 0) {
+    return true;
+  }
+
+  ParticleSystemUniforms uniforms = {0};
+  SPS_Mat4Mul(proj, view, uniforms.pv);
+
+  // Rows of the view rotation are the camera axes, the same for every quad
+  SPS_Vec3Make(view[0], view[4], view[8], uniforms.right);
+  SPS_Vec3Make(view[1], view[5], view[9], uniforms.up);
+  SPS_Vec3Copy(ps->gpu_bounds.origin, uniforms.origin);
+  SPS_Vec3Copy(ps->gpu_bounds.step, uniforms.step);
+
+  SDL_BindGPUGraphicsPipeline(render_pass, ps->pipeline);
+  SDL_PushGPUVertexUniformData(cmd_buf, 0, &uniforms,
+                               sizeof(ParticleSystemUniforms));
+  SDL_GPUBuffer* buffers[2] = {ps->buffer, ps->order_buffer};
+  SDL_BindGPUVertexStorageBuffers(render_pass, 0, buffers, 2);
+
+  // Blending needs the sorted order across the whole system in one draw
+  if (ps->gpu_sorted) {
+    ParticleDrawUniforms draw = {.first_instance = 0, .sorted = 1};
+    SDL_PushGPUVertexUniformData(cmd_buf, 1, &draw,
+                                 sizeof(ParticleDrawUniforms));
+    SDL_DrawGPUPrimitives(render_pass, 4, (Uint32)ps->gpu_count, 0, 0);
+    return true;
+  }
+
+  // Neighboring visible chunks share a draw, chunks never sent are skipped
+  const Uint64 chunks =
+      (ps->gpu_count + SPS_PARTICLES_CHUNK_SIZE - 1) / SPS_PARTICLES_CHUNK_SIZE;
+  Uint64 chunk = 0;
+  while (chunk < chunks) {
+    Uint64 end = chunk;
+    while (end < chunks && ps->visible_chunks[end] &&
+           ps->gpu_chunk_steps[end] != 0) {
+      end++;
+    }
+    if (end == chunk) {
+      chunk++;
+      continue;
+    }
+
+    Uint64 first = chunk * SPS_PARTICLES_CHUNK_SIZE;
+    Uint64 last = SDL_min(end * SPS_PARTICLES_CHUNK_SIZE, ps->gpu_count);
+    ParticleDrawUniforms draw = {.first_instance = (Uint32)first};
+    SDL_PushGPUVertexUniformData(cmd_buf, 1, &draw,
+                                 sizeof(ParticleDrawUniforms));
+    SDL_DrawGPUPrimitives(render_pass, 4, (Uint32)(last - first), 0, 0);
+    chunk = end;
+  }
+
+  return true;
+}
+
+void SPS_ParticleSystemDestroy(SPS_ParticleSystem* ps) {
+  release_retired_buffers(ps, true);
+  SDL_ReleaseGPUGraphicsPipeline(ps->device, ps->pipeline);
+  release_gpu_buffers(ps->device, ps->buffer, ps->order_buffer,
+                      ps->upload_transfer_buffers);
+  SDL_free(ps->visible_chunks);
+  SDL_free(ps->gpu_chunk_steps);
+
+  SPS_ParticleSystemQuit(ps);
+}
+
+bool reserve_gpu_buffers(SPS_ParticleSystem* ps, Uint64 count) {
+  if (count <= ps->gpu_capacity) {
+    return true;
+  }
+
+  // Doubling like the CPU channels, resizes stay rare while the count grows
+  Uint64 capacity = SDL_max(count, ps->gpu_capacity * 2);
+  Uint64 size = sizeof(SPS_QuantizedInstance) * capacity;
+  Uint64 order_size = sizeof(Uint32) * capacity;
+  if (size + order_size > SDL_MAX_UINT32) {
+    SDL_Log("Couldn't size GPU buffers for %" SDL_PRIu64 " particles",
+            capacity);
+    return false;
+  }
+
+  // Per chunk state follows the capacity, a new buffer starts empty
+  const Uint64 chunks =
+      (capacity + SPS_PARTICLES_CHUNK_SIZE - 1) / SPS_PARTICLES_CHUNK_SIZE;
+  bool* visible_chunks =
+      SDL_realloc(ps->visible_chunks, sizeof(bool) * chunks);
+  if (visible_chunks != NULL) {
+    ps->visible_chunks = visible_chunks;
+  }
+  Uint64* gpu_chunk_steps =
+      SDL_realloc(ps->gpu_chunk_steps, sizeof(Uint64) * chunks);
+  if (gpu_chunk_steps != NULL) {
+    ps->gpu_chunk_steps = gpu_chunk_steps;
+  }
+  if (visible_chunks == NULL || gpu_chunk_steps == NULL) {
+    SDL_Log("Couldn't allocate the chunk state of %" SDL_PRIu64 " particles",
+            capacity);
+    return false;
+  }
+
+  SDL_GPUBufferCreateInfo buffer_create_info = {
+      .usage = SDL_GPU_BUFFERUSAGE_GRAPHICS_STORAGE_READ,
+      .size = (Uint32)size,
+  };
+  SDL_GPUBuffer* buffer = SDL_CreateGPUBuffer(ps->device, &buffer_create_info);
+  if (buffer == NULL) {
+    SDL_Log("Couldn't create buffer to store the particle instances");
+    return false;
+  }
+  buffer_create_info.size = (Uint32)order_size;
+  SDL_GPUBuffer* order_buffer =
+      SDL_CreateGPUBuffer(ps->device, &buffer_create_info);
+  if (order_buffer == NULL) {
+    SDL_Log("Couldn't create buffer to store the particle order");
+    SDL_ReleaseGPUBuffer(ps->device, buffer);
+    return false;
+  }
+
+  // Staging holds the instances then the order
+  SDL_GPUTransferBufferCreateInfo upload_transfer_buffer_create_info = {
+      .usage = SDL_GPU_TRANSFERBUFFERUSAGE_UPLOAD,
+      .size = (Uint32)(size + order_size),
+  };
+  SDL_GPUTransferBuffer* upload_transfer_buffers[SPS_FRAMES_IN_FLIGHT] = {0};
+  for (int i = 0; i < SPS_FRAMES_IN_FLIGHT; i++) {
+    upload_transfer_buffers[i] = SDL_CreateGPUTransferBuffer(
+        ps->device, &upload_transfer_buffer_create_info);
+    if (upload_transfer_buffers[i] == NULL) {
+      SDL_Log("Couldn't create transfer buffer of the particle instances");
+      release_gpu_buffers(ps->device, buffer, order_buffer,
+                          upload_transfer_buffers);
+      return false;
+    }
+  }
+
+  // Frames still in flight may read the old pair, it waits for them
+  if (ps->buffer != NULL) {
+    if (ps->retired_count == SPS_MAX_RETIRED_BUFFERS) {
+      SDL_WaitForGPUIdle(ps->device);
+      release_retired_buffers(ps, true);
+    }
+    SPS_RetiredGPUBuffers* retired = &ps->retired[ps->retired_count++];
+    retired->buffer = ps->buffer;
+    retired->order_buffer = ps->order_buffer;
+    retired->frame = ps->frame;
+    SDL_memcpy(retired->upload_transfer_buffers, ps->upload_transfer_buffers,
+               sizeof(ps->upload_transfer_buffers));
+  }
+
+  ps->buffer = buffer;
+  ps->order_buffer = order_buffer;
+  ps->gpu_order_step = 0;
+  SDL_memcpy(ps->upload_transfer_buffers, upload_transfer_buffers,
+             sizeof(upload_transfer_buffers));
+  ps->gpu_capacity = capacity;
+  SDL_memset(ps->visible_chunks, 0, sizeof(bool) * chunks);
+  SDL_memset(ps->gpu_chunk_steps, 0, sizeof(Uint64) * chunks);
+  return true;
+}
+
+void release_gpu_buffers(SDL_GPUDevice* device,
+                         SDL_GPUBuffer* buffer,
+                         SDL_GPUBuffer* order_buffer,
+                         SDL_GPUTransferBuffer* const* transfer_buffers) {
+  for (int i = 0; i < SPS_FRAMES_IN_FLIGHT; i++) {
+    SDL_ReleaseGPUTransferBuffer(device, transfer_buffers[i]);
+  }
+  SDL_ReleaseGPUBuffer(device, order_buffer);
+  SDL_ReleaseGPUBuffer(device, buffer);
+}
+
+void release_retired_buffers(SPS_ParticleSystem* ps, bool all) {
+  Uint32 kept = 0;
+  for (Uint32 i = 0; i < ps->retired_count; i++) {
+    SPS_RetiredGPUBuffers* retired = &ps->retired[i];
+    if (all || retired->frame + SPS_FRAMES_IN_FLIGHT <= ps->frame) {
+      release_gpu_buffers(ps->device, retired->buffer, retired->order_buffer,
+                          retired->upload_transfer_buffers);
+    } else {
+      ps->retired[kept++] = *retired;
+    }
+  }
+  ps->retired_count = kept;
+}
+
+bool next_dirty_range(const SPS_ParticleSystem* ps,
+                      const SPS_ParticleSnapshot* snapshot,
+                      Uint64* first,
+                      Uint64* last) {
+  // Visible chunks changed after the step the GPU buffer got them at
+  const Uint64 chunks =
+      (snapshot->count + SPS_PARTICLES_CHUNK_SIZE - 1) /
+      SPS_PARTICLES_CHUNK_SIZE;
+  Uint64 chunk =
+      (*first + SPS_PARTICLES_CHUNK_SIZE - 1) / SPS_PARTICLES_CHUNK_SIZE;
+  while (chunk < chunks && !chunk_needs_upload(ps, snapshot, chunk)) {
+    chunk++;
+  }
+  if (chunk == chunks) {
+    return false;
+  }
+
+  // Neighboring chunks to send are sent as one region
+  Uint64 end = chunk + 1;
+  while (end < chunks && chunk_needs_upload(ps, snapshot, end)) {
+    end++;
+  }
+  *first = chunk * SPS_PARTICLES_CHUNK_SIZE;
+  *last = SDL_min(end * SPS_PARTICLES_CHUNK_SIZE, snapshot->count);
+  return true;
+}
+
+bool chunk_needs_upload(const SPS_ParticleSystem* ps,
+                        const SPS_ParticleSnapshot* snapshot,
+                        Uint64 chunk) {
+  return ps->visible_chunks[chunk] &&
+         snapshot->chunk_steps[chunk] + 1 > ps->gpu_chunk_steps[chunk];
+}
+
+bool order_needs_upload(const SPS_ParticleSystem* ps,
+                        const SPS_ParticleSnapshot* snapshot) {
+  return snapshot->sorted && snapshot->step + 1 != ps->gpu_order_step;
+}
@@ -0,0 +1,249 @@
+#include "particles.h"
+
+#include <SDL3/SDL_log.h>
+#include <SDL3/SDL_stdinc.h>
+
+static const char* builtin_channel_names[SPS_CHANNEL_BUILTIN_COUNT] = {
+    "position_x", "position_y", "position_z", "velocity_x", "velocity_y",
+    "velocity_z", "mass",       "scale",      "age",        "lifetime",
+    "id",
+};
+
+static const float builtin_channel_defaults[SPS_CHANNEL_BUILTIN_COUNT] =
+    {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.1f, 0.0f, 0.0f, 0.0f};
+
+// A single channel of a permutation
+typedef struct {
+  const float* src;
+  float* dst;
+  const Uint32* order;
+} PermuteContext;
+
+size_t channel_size(Uint64 capacity);
+float* channel_alloc(Uint64 capacity, float default_value);
+void permute_task(void* userdata, Uint64 first, Uint64 last, Uint32 worker);
+
+bool SPS_ParticlesLoad(SPS_Particles* particles, Uint64 capacity) {
+  SDL_memset(particles, 0, sizeof(SPS_Particles));
+  particles->capacity = capacity;
+  particles->count = capacity;
+
+  for (Uint32 i = 0; i < SPS_CHANNEL_BUILTIN_COUNT; i++) {
+    if (SPS_ParticlesRegisterChannel(particles, builtin_channel_names[i],
+                                     builtin_channel_defaults[i]) < 0) {
+      SPS_ParticlesDestroy(particles);
+      return false;
+    }
+  }
+
+  SPS_ParticlesNewIds(particles, 0, capacity);
+  return true;
+}
+
+Sint32 SPS_ParticlesRegisterChannel(SPS_Particles* particles,
+                                    const char* name,
+                                    float default_value) {
+  if (SPS_ParticlesFindChannel(particles, name) >= 0) {
+    SDL_Log("Particle channel %s is already registered", name);
+    return -1;
+  }
+
+  if (particles->channels_count >= SPS_PARTICLES_MAX_CHANNELS) {
+    SDL_Log("Couldn't register particle channel %s, too many channels", name);
+    return -1;
+  }
+
+  float* data = channel_alloc(particles->capacity, default_value);
+  if (data == NULL) {
+    SDL_Log("Couldn't allocate particle channel %s", name);
+    return -1;
+  }
+
+  Uint32 id = particles->channels_count++;
+  particles->channels[id] = (SPS_ParticleChannel){
+      .name = name,
+      .data = data,
+      .default_value = default_value,
+  };
+  return (Sint32)id;
+}
+
+Sint32 SPS_ParticlesFindChannel(const SPS_Particles* particles,
+                                const char* name) {
+  for (Uint32 i = 0; i < particles->channels_count; i++) {
+    if (SDL_strcmp(particles->channels[i].name, name) == 0) {
+      return (Sint32)i;
+    }
+  }
+
+  return -1;
+}
+
+bool SPS_ParticlesReserve(SPS_Particles* particles, Uint64 capacity) {
+  if (capacity <= particles->capacity) {
+    return true;
+  }
+
+  capacity = SDL_max(capacity, particles->capacity * 2);
+  float* data[SPS_PARTICLES_MAX_CHANNELS];
+  for (Uint32 c = 0; c < particles->channels_count; c++) {
+    const SPS_ParticleChannel* channel = &particles->channels[c];
+    data[c] = channel_alloc(capacity, channel->default_value);
+    if (data[c] == NULL) {
+      SDL_Log("Couldn't grow particle channel %s to %" SDL_PRIu64,
+              channel->name, capacity);
+      for (Uint32 k = 0; k < c; k++) {
+        SDL_aligned_free(data[k]);
+      }
+      return false;
+    }
+    SDL_memcpy(data[c], channel->data, sizeof(float) * particles->count);
+  }
+
+  // Only swapped in once every channel could grow
+  for (Uint32 c = 0; c < particles->channels_count; c++) {
+    SDL_aligned_free(particles->channels[c].data);
+    particles->channels[c].data = data[c];
+  }
+  SDL_aligned_free(particles->spare);
+  particles->spare = NULL;
+  particles->capacity = capacity;
+  return true;
+}
+
+Uint64 SPS_ParticlesSpawn(SPS_Particles* particles, Uint64 count) {
+  Uint64 first = particles->count;
+  if (!SPS_ParticlesReserve(particles, first + count)) {
+    count = particles->capacity - first;
+  }
+  for (Uint32 c = 0; c < particles->channels_count; c++) {
+    float* data = particles->channels[c].data;
+    const float value = particles->channels[c].default_value;
+    for (Uint64 i = first; i < first + count; i++) {
+      data[i] = value;
+    }
+  }
+  SPS_ParticlesNewIds(particles, first, first + count);
+
+  particles->count += count;
+  particles->reindexed++;
+  return count;
+}
+
+void SPS_ParticlesKill(SPS_Particles* particles, Uint64 index) {
+  if (index >= particles->count) {
+    return;
+  }
+
+  particles->count--;
+  particles->reindexed++;
+  if (index != particles->count) {
+    SPS_ParticlesCopy(particles, index, particles->count);
+  }
+}
+
+void SPS_ParticlesCopy(SPS_Particles* particles, Uint64 dst, Uint64 src) {
+  for (Uint32 c = 0; c < particles->channels_count; c++) {
+    float* data = particles->channels[c].data;
+    data[dst] = data[src];
+  }
+}
+
+bool SPS_ParticlesPermute(SPS_Particles* particles,
+                          SPS_ThreadPool* pool,
+                          const Uint32* order) {
+  if (particles->spare == NULL) {
+    particles->spare = channel_alloc(particles->capacity, 0.0f);
+    if (particles->spare == NULL) {
+      SDL_Log("Couldn't allocate the spare particle channel");
+      return false;
+    }
+  }
+
+  // The gathered array becomes the channel, the old one the next spare
+  for (Uint32 c = 0; c < particles->channels_count; c++) {
+    PermuteContext context = {
+        .src = particles->channels[c].data,
+        .dst = particles->spare,
+        .order = order,
+    };
+    SPS_ThreadPoolParallelFor(pool, 0, particles->count,
+                              SPS_PARTICLES_CHUNK_SIZE, permute_task,
+                              &context);
+    particles->spare = particles->channels[c].data;
+    particles->channels[c].data = context.dst;
+  }
+  particles->reindexed++;
+  return true;
+}
+
+void SPS_ParticlesNewIds(SPS_Particles* particles, Uint64 first, Uint64 last) {
+  // Stored bit for bit, ids past 2^24 have no exact float
+  float* ids = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_ID);
+  for (Uint64 i = first; i < last; i++) {
+    Uint32 id = particles->next_id++;
+    SDL_memcpy(&ids[i], &id, sizeof(id));
+  }
+}
+
+void SPS_ParticlesPack(const SPS_Particles* particles,
+                       const Uint32* layout,
+                       Uint32 layout_count,
+                       Uint64 first,
+                       Uint64 count,
+                       float* dest) {
+  // One pass per channel keeps every source read sequential
+  for (Uint32 c = 0; c < layout_count; c++) {
+    const float* src = particles->channels[layout[c]].data + first;
+    float* dst = dest + c;
+    for (Uint64 i = 0; i < count; i++) {
+      dst[i * layout_count] = src[i];
+    }
+  }
+}
+
+Uint64 SPS_ParticlesMemorySize(const SPS_Particles* particles) {
+  Uint64 arrays = particles->channels_count + (particles->spare != NULL);
+  return (Uint64)channel_size(particles->capacity) * arrays;
+}
+
+void SPS_ParticlesDestroy(SPS_Particles* particles) {
+  for (Uint32 i = 0; i < particles->channels_count; i++) {
+    SDL_aligned_free(particles->channels[i].data);
+    particles->channels[i].data = NULL;
+  }
+  SDL_aligned_free(particles->spare);
+  particles->spare = NULL;
+
+  particles->channels_count = 0;
+  particles->count = 0;
+  particles->capacity = 0;
+}
+
+size_t channel_size(Uint64 capacity) {
+  // Round up so SIMD loops can always run on whole cache lines
+  size_t size = sizeof(float) * SDL_max(capacity, 1);
+  return (size + SPS_PARTICLES_ALIGNMENT - 1) & ~(SPS_PARTICLES_ALIGNMENT - 1);
+}
+
+float* channel_alloc(Uint64 capacity, float default_value) {
+  size_t size = channel_size(capacity);
+  float* data = SDL_aligned_alloc(SPS_PARTICLES_ALIGNMENT, size);
+  if (data == NULL) {
+    return NULL;
+  }
+
+  for (Uint64 i = 0; i < size / sizeof(float); i++) {
+    data[i] = default_value;
+  }
+
+  return data;
+}
+
+void permute_task(void* userdata, Uint64 first, Uint64 last, Uint32 worker) {
+  (void)worker;
+  const PermuteContext* context = userdata;
+  for (Uint64 i = first; i < last; i++) {
+    context->dst[i] = context->src[context->order[i]];
+  }
+}
@@ -0,0 +1,110 @@
+#ifndef SPS_PARTICLES_H
+#define SPS_PARTICLES_H
+
+#include <SDL3/SDL_stdinc.h>
+#include "thread_pool.h"
+
+// Alignment of every channel array, a cache line so vector loads never split.
+#define SPS_PARTICLES_ALIGNMENT (64)
+
+// Maximum number of channels (builtin plus registered) a store can hold.
+#define SPS_PARTICLES_MAX_CHANNELS (16)
+
+// Particles per work chunk, ~128KiB of builtin channels so a chunk stays in L2.
+#define SPS_PARTICLES_CHUNK_SIZE (4096)
+
+// New index of a removed particle in the maps compactions leave.
+#define SPS_PARTICLES_REMOVED (0xffffffffu)
+
+// Gets the float array of a channel.
+#define SPS_PARTICLES_CHANNEL(particles, id) ((particles)->channels[(id)].data)
+
+// Channels every particle store has, in registration order.
+typedef enum {
+  SPS_CHANNEL_POSITION_X,
+  SPS_CHANNEL_POSITION_Y,
+  SPS_CHANNEL_POSITION_Z,
+  SPS_CHANNEL_VELOCITY_X,
+  SPS_CHANNEL_VELOCITY_Y,
+  SPS_CHANNEL_VELOCITY_Z,
+  SPS_CHANNEL_MASS,
+  SPS_CHANNEL_SCALE,
+  SPS_CHANNEL_AGE,
+  SPS_CHANNEL_LIFETIME,  // 0 for particles that never expire
+  SPS_CHANNEL_ID,        // Uint32 bits of the particle identity, not a float
+  SPS_CHANNEL_BUILTIN_COUNT,
+} SPS_ParticleChannelId;
+
+// A single per-particle float attribute.
+typedef struct {
+  const char* name;
+  float* data;
+  float default_value;
+} SPS_ParticleChannel;
+
+// Structure-of-arrays particle storage, one aligned array per channel.
+typedef struct {
+  SPS_ParticleChannel channels[SPS_PARTICLES_MAX_CHANNELS];
+  Uint32 channels_count;
+  Uint64 count;
+  Uint64 capacity;
+  float* spare;  // channel sized array permutations gather into
+
+  // Ids only grow, a particle keeps its id wherever it moves
+  Uint32 next_id;
+  Uint64 reindexed;  // bumped whenever particles are moved or replaced
+} SPS_Particles;
+
+// Allocates the builtin channels for a fixed capacity, all of them live
+// with ids from 0.
+bool SPS_ParticlesLoad(SPS_Particles* particles, Uint64 capacity);
+
+// Registers an extra channel filled with default_value, returns its id or -1.
+Sint32 SPS_ParticlesRegisterChannel(SPS_Particles* particles,
+                                    const char* name,
+                                    float default_value);
+
+// Finds a channel by name, returns its id or -1.
+Sint32 SPS_ParticlesFindChannel(const SPS_Particles* particles,
+                                const char* name);
+
+// Grows every channel to hold at least capacity particles, at least doubling
+// the current capacity so repeated growth stays amortized O(1) per particle.
+bool SPS_ParticlesReserve(SPS_Particles* particles, Uint64 capacity);
+
+// Appends count particles set to the channel defaults and new ids after the
+// live ones, growing the store when needed. Returns how many were appended,
+// fewer only when the growth fails.
+Uint64 SPS_ParticlesSpawn(SPS_Particles* particles, Uint64 count);
+
+// Removes a particle in O(1) by moving the last live one into its slot.
+void SPS_ParticlesKill(SPS_Particles* particles, Uint64 index);
+
+// Copies every channel of particle src over particle dst. Callers moving
+// particles this way bump reindexed once they are done.
+void SPS_ParticlesCopy(SPS_Particles* particles, Uint64 dst, Uint64 src);
+
+// Reorders the live particles so particle i gets the channels particle
+// order[i] had, gathering one channel at a time in parallel.
+bool SPS_ParticlesPermute(SPS_Particles* particles,
+                          SPS_ThreadPool* pool,
+                          const Uint32* order);
+
+// Gives the particles [first, last) new ids from next_id.
+void SPS_ParticlesNewIds(SPS_Particles* particles, Uint64 first, Uint64 last);
+
+// Interleaves the layout channels of [first, first + count) into dest.
+void SPS_ParticlesPack(const SPS_Particles* particles,
+                       const Uint32* layout,
+                       Uint32 layout_count,
+                       Uint64 first,
+                       Uint64 count,
+                       float* dest);
+
+// Bytes allocated by every channel array.
+Uint64 SPS_ParticlesMemorySize(const SPS_Particles* particles);
+
+// Releases every channel array.
+void SPS_ParticlesDestroy(SPS_Particles* particles);
+
+#endif /* SPS_PARTICLES_H */
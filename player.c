@@ -0,0 +1,332 @@
+#include "player.h"
+
+#include <SDL3/SDL_log.h>
+
+// Copies the live range of a decoded frame into the particle channels
+typedef struct {
+  SPS_Particles* particles;
+  const float* data;
+  Uint64 stride;
+} PlayerCopyContext;
+
+// Channels of the trajectory streams, in stream order
+static const SPS_ParticleChannelId player_channels[SPS_TRAJECTORY_STREAMS] = {
+    SPS_CHANNEL_POSITION_X, SPS_CHANNEL_POSITION_Y, SPS_CHANNEL_POSITION_Z,
+    SPS_CHANNEL_VELOCITY_X, SPS_CHANNEL_VELOCITY_Y, SPS_CHANNEL_VELOCITY_Z,
+    SPS_CHANNEL_ID};
+
+int player_thread(void* data);
+bool player_decode(SPS_Player* player, Uint64 frame, float* data);
+void player_move(SPS_Player* player, double step);
+SPS_PlayerSlot* player_find_slot(SPS_Player* player, Uint64 frame);
+SPS_PlayerSlot* player_ready_slot(SPS_Player* player);
+bool player_showable(const SPS_Player* player, Uint64 frame);
+SPS_PlayerSlot* player_free_slot(SPS_Player* player);
+void player_copy_task(void* userdata, Uint64 first, Uint64 last, Uint32 worker);
+
+bool SPS_PlayerOpen(SPS_Player* player, const char* path) {
+  SDL_memset(player, 0, sizeof(SPS_Player));
+  if (!SPS_TrajectoryFileOpen(&player->file, path)) {
+    return false;
+  }
+
+  // Every buffer fits the largest frame, decoding never allocates
+  const Uint64 values = SPS_TRAJECTORY_STREAMS * player->file.max_count;
+  bool allocated = true;
+  for (Uint32 i = 0; i < SPS_PLAYER_SLOTS; i++) {
+    player->slots[i].data =
+        SDL_aligned_alloc(SPS_PARTICLES_ALIGNMENT, sizeof(float) * values);
+    player->slots[i].frame = SPS_PLAYER_NO_FRAME;
+    allocated = allocated && player->slots[i].data != NULL;
+  }
+  player->codes = SDL_malloc(sizeof(Sint32) * values);
+  player->skipped =
+      SDL_aligned_alloc(SPS_PARTICLES_ALIGNMENT, sizeof(float) * values);
+  if (!allocated || player->codes == NULL || player->skipped == NULL) {
+    SDL_Log("Couldn't allocate the frames of trajectory %s", path);
+    SPS_PlayerClose(player);
+    return false;
+  }
+
+  // The first frame is there before anything asks for it
+  player->cursor = SPS_PLAYER_NO_FRAME;
+  if (!player_decode(player, 0, player->slots[0].data)) {
+    SDL_Log("Couldn't decode the first frame of trajectory %s", path);
+    SPS_PlayerClose(player);
+    return false;
+  }
+  player->slots[0].frame = 0;
+  player->playhead = (double)player->file.frames[0].step;
+  player->speed = 1.0f;
+  player->target = 0;
+  player->shown = SPS_PLAYER_NO_FRAME;
+
+  player->mutex = SDL_CreateMutex();
+  player->wake = SDL_CreateCondition();
+  if (player->mutex == NULL || player->wake == NULL) {
+    SDL_Log("Couldn't create the player locks: %s", SDL_GetError());
+    SPS_PlayerClose(player);
+    return false;
+  }
+  player->thread = SDL_CreateThread(player_thread, "player", player);
+  if (player->thread == NULL) {
+    SDL_Log("Couldn't start the player thread: %s", SDL_GetError());
+    SPS_PlayerClose(player);
+    return false;
+  }
+
+  const SPS_TrajectoryFrame* last =
+      &player->file.frames[player->file.frames_count - 1];
+  SDL_Log("Replaying %" SDL_PRIu64 " frames of up to %" SDL_PRIu64
+          " particles from %s, steps %" SDL_PRIu64 " to %" SDL_PRIu64,
+          player->file.frames_count, player->file.max_count, path,
+          player->file.frames[0].step, last->step);
+  return true;
+}
+
+bool SPS_PlayerAdvance(SPS_Player* player,
+                       double steps,
+                       SPS_Particles* particles,
+                       SPS_ThreadPool* pool) {
+  SDL_LockMutex(player->mutex);
+  if (!player->paused) {
+    player_move(player, player->playhead + steps * player->speed);
+  }
+  SPS_PlayerSlot* slot = player_ready_slot(player);
+  if (slot != NULL) {
+    slot->reading = true;
+  }
+  SDL_UnlockMutex(player->mutex);
+
+  // Not decoded yet, the frame shown stays
+  if (slot == NULL) {
+    return false;
+  }
+
+  // Frames of other counts grow the store or drop the particles past it
+  const Uint64 count = player->file.frames[slot->frame].count;
+  if (count > particles->count &&
+      SPS_ParticlesSpawn(particles, count - particles->count) <
+          count - particles->count) {
+    SDL_Log("Couldn't grow the particles to %" SDL_PRIu64, count);
+  }
+  particles->count = SDL_min(particles->count, count);
+
+  PlayerCopyContext context = {
+      .particles = particles,
+      .data = slot->data,
+      .stride = player->file.max_count,
+  };
+  SPS_ThreadPoolParallelFor(pool, 0, particles->count,
+                            SPS_PARTICLES_CHUNK_SIZE, player_copy_task,
+                            &context);
+
+  SDL_LockMutex(player->mutex);
+  slot->reading = false;
+  player->shown = slot->frame;
+  SDL_SignalCondition(player->wake);
+  SDL_UnlockMutex(player->mutex);
+  return true;
+}
+
+void SPS_PlayerSeek(SPS_Player* player, double step) {
+  SDL_LockMutex(player->mutex);
+  player_move(player, step);
+  SDL_UnlockMutex(player->mutex);
+}
+
+void SPS_PlayerSkip(SPS_Player* player, double steps) {
+  SDL_LockMutex(player->mutex);
+  player_move(player, player->playhead + steps);
+  SDL_UnlockMutex(player->mutex);
+}
+
+void SPS_PlayerScrub(SPS_Player* player, float fraction) {
+  const SPS_TrajectoryFile* file = &player->file;
+  const double first = (double)file->frames[0].step;
+  const double last = (double)file->frames[file->frames_count - 1].step;
+  SPS_PlayerSeek(player, first + (last - first) * SDL_clamp(fraction, 0, 1));
+}
+
+void SPS_PlayerScaleSpeed(SPS_Player* player, float factor) {
+  SDL_LockMutex(player->mutex);
+  player->speed = SDL_clamp(player->speed * factor, SPS_PLAYER_MIN_SPEED,
+                            SPS_PLAYER_MAX_SPEED);
+  SDL_Log("Replaying at %gx", player->speed);
+  SDL_UnlockMutex(player->mutex);
+}
+
+void SPS_PlayerTogglePause(SPS_Player* player) {
+  SDL_LockMutex(player->mutex);
+  player->paused = !player->paused;
+
+  // Playing again from the end starts over
+  const SPS_TrajectoryFile* file = &player->file;
+  if (!player->paused &&
+      player->playhead >= (double)file->frames[file->frames_count - 1].step) {
+    player_move(player, (double)file->frames[0].step);
+  }
+  SDL_UnlockMutex(player->mutex);
+}
+
+void SPS_PlayerClose(SPS_Player* player) {
+  if (player->thread != NULL) {
+    SDL_LockMutex(player->mutex);
+    player->quit = true;
+    SDL_SignalCondition(player->wake);
+    SDL_UnlockMutex(player->mutex);
+    SDL_WaitThread(player->thread, NULL);
+  }
+
+  for (Uint32 i = 0; i < SPS_PLAYER_SLOTS; i++) {
+    SDL_aligned_free(player->slots[i].data);
+  }
+  SDL_free(player->codes);
+  SDL_aligned_free(player->skipped);
+  SDL_DestroyCondition(player->wake);
+  SDL_DestroyMutex(player->mutex);
+  SPS_TrajectoryFileClose(&player->file);
+  SDL_memset(player, 0, sizeof(SPS_Player));
+}
+
+int player_thread(void* data) {
+  SPS_Player* player = data;
+  SDL_LockMutex(player->mutex);
+  while (!player->quit) {
+    // The nearest frame from the playhead on that isn't decoded yet
+    const Uint64 end = SDL_min(player->target + SPS_PLAYER_SLOTS,
+                               player->file.frames_count);
+    Uint64 frame = SPS_PLAYER_NO_FRAME;
+    for (Uint64 f = player->target; f < end; f++) {
+      if (player_find_slot(player, f) == NULL) {
+        frame = f;
+        break;
+      }
+    }
+    SPS_PlayerSlot* slot = frame != SPS_PLAYER_NO_FRAME && !player->failed
+                               ? player_free_slot(player)
+                               : NULL;
+    if (slot == NULL) {
+      SDL_WaitCondition(player->wake, player->mutex);
+      continue;
+    }
+
+    // Decoding runs unlocked, the playhead keeps moving meanwhile
+    slot->frame = SPS_PLAYER_NO_FRAME;
+    SDL_UnlockMutex(player->mutex);
+    bool decoded = player_decode(player, frame, slot->data);
+    SDL_LockMutex(player->mutex);
+    if (decoded) {
+      slot->frame = frame;
+    } else {
+      SDL_Log("Trajectory frame %" SDL_PRIu64 " is broken, replay stops",
+              frame);
+      player->failed = true;
+    }
+  }
+  SDL_UnlockMutex(player->mutex);
+  return 0;
+}
+
+bool player_decode(SPS_Player* player, Uint64 frame, float* data) {
+  // Differences chain from the keyframe, or from the last frame decoded
+  // when it is on the way
+  const SPS_TrajectoryFile* file = &player->file;
+  const Uint64 keyframe = file->frames[frame].keyframe;
+  Uint64 first = keyframe;
+  if (player->cursor != SPS_PLAYER_NO_FRAME && player->cursor >= keyframe &&
+      player->cursor < frame) {
+    first = player->cursor + 1;
+  }
+
+  for (Uint64 f = first; f <= frame; f++) {
+    float* dest = f == frame ? data : player->skipped;
+    float* values[SPS_TRAJECTORY_STREAMS];
+    for (Uint32 s = 0; s < SPS_TRAJECTORY_STREAMS; s++) {
+      values[s] = dest + file->max_count * s;
+    }
+    if (!SPS_TrajectoryFileDecode(file, f, player->codes, values)) {
+      player->cursor = SPS_PLAYER_NO_FRAME;
+      return false;
+    }
+    player->cursor = f;
+  }
+  return true;
+}
+
+void player_move(SPS_Player* player, double step) {
+  // Playing stops on the last frame
+  const SPS_TrajectoryFile* file = &player->file;
+  const double first = (double)file->frames[0].step;
+  const double last = (double)file->frames[file->frames_count - 1].step;
+  if (step >= last) {
+    player->paused = true;
+  }
+  player->playhead = SDL_clamp(step, first, last);
+
+  Uint64 target = SPS_TrajectoryFileFindFrame(file, player->playhead);
+  if (target != player->target) {
+    player->target = target;
+    SDL_SignalCondition(player->wake);
+  }
+}
+
+SPS_PlayerSlot* player_find_slot(SPS_Player* player, Uint64 frame) {
+  for (Uint32 i = 0; i < SPS_PLAYER_SLOTS; i++) {
+    if (player->slots[i].frame == frame) {
+      return &player->slots[i];
+    }
+  }
+  return NULL;
+}
+
+SPS_PlayerSlot* player_ready_slot(SPS_Player* player) {
+  SPS_PlayerSlot* ready = NULL;
+  for (Uint32 i = 0; i < SPS_PLAYER_SLOTS; i++) {
+    SPS_PlayerSlot* slot = &player->slots[i];
+    if (player_showable(player, slot->frame) &&
+        (ready == NULL || slot->frame > ready->frame)) {
+      ready = slot;
+    }
+  }
+  return ready;
+}
+
+bool player_showable(const SPS_Player* player, Uint64 frame) {
+  // A decoder falling behind the playhead still moves the frame shown
+  // forwards, the frames decoded between the two stand in
+  if (frame > player->target || frame == player->shown) {
+    return false;
+  }
+  return frame == player->target || player->shown == SPS_PLAYER_NO_FRAME ||
+         frame > player->shown;
+}
+
+SPS_PlayerSlot* player_free_slot(SPS_Player* player) {
+  // Frames behind the playhead that won't be shown or too far ahead of it
+  // are reused
+  for (Uint32 i = 0; i < SPS_PLAYER_SLOTS; i++) {
+    SPS_PlayerSlot* slot = &player->slots[i];
+    const bool behind =
+        slot->frame < player->target && !player_showable(player, slot->frame);
+    if (!slot->reading &&
+        (slot->frame == SPS_PLAYER_NO_FRAME || behind ||
+         slot->frame >= player->target + SPS_PLAYER_SLOTS)) {
+      return slot;
+    }
+  }
+  return NULL;
+}
+
+void player_copy_task(void* userdata,
+                      Uint64 first,
+                      Uint64 last,
+                      Uint32 worker) {
+  (void)worker;
+  const PlayerCopyContext* context = userdata;
+  for (Uint32 s = 0; s < SPS_TRAJECTORY_STREAMS; s++) {
+    float* dest = SPS_PARTICLES_CHANNEL(context->particles, player_channels[s]);
+    SDL_memcpy(dest + first, context->data + context->stride * s + first,
+               sizeof(float) * (last - first));
+  }
+}
@@ -0,0 +1,85 @@
+#ifndef SPS_PLAYER_H
+#define SPS_PLAYER_H
+
+#include <SDL3/SDL_mutex.h>
+#include <SDL3/SDL_stdinc.h>
+#include <SDL3/SDL_thread.h>
+#include "particles.h"
+#include "thread_pool.h"
+#include "trajectory.h"
+
+// Decoded frames kept ahead of the playhead.
+#define SPS_PLAYER_SLOTS (4)
+
+// Marks a slot without a frame and a player that showed none yet.
+#define SPS_PLAYER_NO_FRAME (~(Uint64)0)
+
+// Slowest and fastest playback, in recorded steps per played step.
+#define SPS_PLAYER_MIN_SPEED (1.0f / 16.0f)
+#define SPS_PLAYER_MAX_SPEED (16.0f)
+
+// A decoded frame, the positions, velocities and ids of its particles.
+typedef struct {
+  float* data;   // every stream back to back, max_count floats apart
+  Uint64 frame;  // SPS_PLAYER_NO_FRAME while free or being decoded
+  bool reading;  // being copied out, the decoder leaves it alone
+} SPS_PlayerSlot;
+
+// Plays a recorded trajectory back. A decoder thread fills the slots with
+// the frames at and after the playhead, the thread that owns the particles
+// moves the playhead and copies the frame under it into them.
+typedef struct {
+  SPS_TrajectoryFile file;
+  SDL_Thread* thread;
+
+  // Guards the frames and flags of the slots and everything below, the
+  // playhead is moved from any thread
+  SDL_Mutex* mutex;
+  SPS_PlayerSlot slots[SPS_PLAYER_SLOTS];
+  SDL_Condition* wake;  // the decoder waits on it for work
+  double playhead;      // recorded step being shown
+  float speed;
+  bool paused;
+  Uint64 target;  // frame under the playhead, decoded first
+  Uint64 shown;   // frame last copied into the particles
+  bool quit;
+  bool failed;  // the decoder hit a broken frame and stopped
+
+  // Decoder thread only, codes of the frame it decoded last
+  Sint32* codes;
+  float* skipped;  // values of frames decoded only for their codes
+  Uint64 cursor;
+} SPS_Player;
+
+// Opens a trajectory, decodes its first frame and starts the decoder.
+bool SPS_PlayerOpen(SPS_Player* player, const char* path);
+
+// Moves the playhead by steps played at the current speed. Copies the
+// frame under it into the particles once it is decoded, or the latest
+// decoded one on the way while the decoder catches up, returns whether it
+// copied one. Never waits on the decoder.
+bool SPS_PlayerAdvance(SPS_Player* player,
+                       double steps,
+                       SPS_Particles* particles,
+                       SPS_ThreadPool* pool);
+
+// Moves the playhead to a recorded step, clamped to the recording.
+void SPS_PlayerSeek(SPS_Player* player, double step);
+
+// Moves the playhead by recorded steps, backwards when negative.
+void SPS_PlayerSkip(SPS_Player* player, double steps);
+
+// Moves the playhead to a fraction of the recording, 0 the first frame and
+// 1 the last.
+void SPS_PlayerScrub(SPS_Player* player, float fraction);
+
+// Multiplies the speed, clamped to the supported range.
+void SPS_PlayerScaleSpeed(SPS_Player* player, float factor);
+
+// Pauses a playing player and plays a paused one.
+void SPS_PlayerTogglePause(SPS_Player* player);
+
+// Stops the decoder and closes the trajectory.
+void SPS_PlayerClose(SPS_Player* player);
+
+#endif /* SPS_PLAYER_H */
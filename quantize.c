@@ -0,0 +1,203 @@
+#include "quantize.h"
+
+#include <SDL3/SDL_cpuinfo.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SPS_QUANTIZE_X86 1
+#include <immintrin.h>
+#endif
+
+// Smallest snapped cell, keeps a box of identical positions codable
+#define QUANTIZE_MIN_CELL (0.0009765625f)
+
+void quantize_scalar(const SPS_QuantizeBounds* bounds,
+                     const float* const position[3],
+                     const float* scale,
+                     Uint64 first,
+                     Uint64 last,
+                     SPS_QuantizedInstance* dest);
+#ifdef SPS_QUANTIZE_X86
+void quantize_avx2(const SPS_QuantizeBounds* bounds,
+                   const float* const position[3],
+                   const float* scale,
+                   Uint64 first,
+                   Uint64 last,
+                   SPS_QuantizedInstance* dest);
+#endif
+
+void SPS_QuantizeGrowBounds(const float* const position[3],
+                            Uint64 first,
+                            Uint64 last,
+                            float min[3],
+                            float max[3]) {
+  for (int c = 0; c < 3; c++) {
+    const float* src = position[c];
+    float lo = min[c];
+    float hi = max[c];
+    for (Uint64 i = first; i < last; i++) {
+      lo = SDL_min(lo, src[i]);
+      hi = SDL_max(hi, src[i]);
+    }
+    min[c] = lo;
+    max[c] = hi;
+  }
+}
+
+void SPS_QuantizeBoundsLoad(SPS_QuantizeBounds* bounds,
+                            const float min[3],
+                            const float max[3]) {
+  for (int c = 0; c < 3; c++) {
+    // The origin sits on the cell below min and the range spans two cells,
+    // so max always fits and every step is a power of two
+    float cell = QUANTIZE_MIN_CELL;
+    while (cell < max[c] - min[c]) {
+      cell *= 2.0f;
+    }
+    bounds->origin[c] = SDL_floorf(min[c] / cell) * cell;
+    bounds->step[c] = 2.0f * cell / SPS_QUANTIZE_LEVELS;
+    bounds->inv_step[c] = SPS_QUANTIZE_LEVELS / (2.0f * cell);
+  }
+}
+
+SPS_QuantizeFunc SPS_QuantizeGetKernel(SPS_Isa isa) {
+#ifdef SPS_QUANTIZE_X86
+  // Every AVX2 CPU also has the F16C half conversions
+  if (isa >= SPS_ISA_AVX2 && isa < SPS_ISA_COUNT && SDL_HasAVX2()) {
+    return quantize_avx2;
+  }
+#endif
+  return isa < SPS_ISA_COUNT ? quantize_scalar : NULL;
+}
+
+void SPS_QuantizePack(const SPS_QuantizeBounds* bounds,
+                      const float* const position[3],
+                      const float* scale,
+                      Uint64 first,
+                      Uint64 last,
+                      SPS_QuantizedInstance* dest) {
+  SPS_QuantizeGetKernel(SPS_IntegratorGetIsa())(bounds, position, scale, first,
+                                                last, dest);
+}
+
+Uint16 SPS_FloatToHalf(float value) {
+  Uint32 bits;
+  SDL_memcpy(&bits, &value, sizeof(bits));
+  const Uint16 sign = (Uint16)((bits >> 16) & 0x8000);
+  const Uint32 magnitude = bits & 0x7fffffff;
+  if (magnitude > 0x7f800000) {
+    return sign | 0x7e00;
+  }
+
+  // 65520 and above round to infinity
+  if (magnitude >= 0x477ff000) {
+    return sign | 0x7c00;
+  }
+
+  // Rebiased exponent, subnormal halves shift the implicit bit in
+  Sint32 exponent = (Sint32)(magnitude >> 23) - 112;
+  Uint32 mantissa = magnitude & 0x7fffff;
+  Uint32 shift = 13;
+  if (exponent <= 0) {
+    if (exponent < -10) {
+      return sign;
+    }
+    mantissa |= 0x800000;
+    shift = (Uint32)(14 - exponent);
+    exponent = 0;
+  }
+
+  Uint32 half = ((Uint32)exponent << 10) + (mantissa >> shift);
+  const Uint32 rest = mantissa & ((1u << shift) - 1);
+  const Uint32 halfway = 1u << (shift - 1);
+  if (rest > halfway || (rest == halfway && (half & 1))) {
+    half++;
+  }
+  return sign | (Uint16)half;
+}
+
+float SPS_HalfToFloat(Uint16 half) {
+  const Uint32 sign = (Uint32)(half & 0x8000) << 16;
+  const Uint32 exponent = (half >> 10) & 0x1f;
+  const Uint32 mantissa = half & 0x3ff;
+  float value;
+  if (exponent == 0) {
+    value = (float)mantissa * (1.0f / 16777216.0f);
+  } else {
+    Uint32 bits = exponent == 31 ? 0x7f800000 | (mantissa << 13)
+                                 : ((exponent + 112) << 23) | (mantissa << 13);
+    SDL_memcpy(&value, &bits, sizeof(value));
+  }
+  return sign ? -value : value;
+}
+
+void quantize_scalar(const SPS_QuantizeBounds* bounds,
+                     const float* const position[3],
+                     const float* scale,
+                     Uint64 first,
+                     Uint64 last,
+                     SPS_QuantizedInstance* dest) {
+  for (Uint64 i = first; i < last; i++) {
+    SPS_QuantizedInstance* instance = &dest[i - first];
+    for (int c = 0; c < 3; c++) {
+      // NaN ends up at 0 like with the SIMD max
+      float code =
+          (position[c][i] - bounds->origin[c]) * bounds->inv_step[c] + 0.5f;
+      code = SDL_max(code, 0.0f);
+      code = SDL_min(code, SPS_QUANTIZE_LEVELS - 1.0f);
+      instance->position[c] = (Uint16)code;
+    }
+    instance->scale = SPS_FloatToHalf(scale[i]);
+  }
+}
+
+#ifdef SPS_QUANTIZE_X86
+__attribute__((target("avx2,f16c"))) void quantize_avx2(
+    const SPS_QuantizeBounds* bounds,
+    const float* const position[3],
+    const float* scale,
+    Uint64 first,
+    Uint64 last,
+    SPS_QuantizedInstance* dest) {
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 half = _mm256_set1_ps(0.5f);
+  const __m256 top = _mm256_set1_ps(SPS_QUANTIZE_LEVELS - 1.0f);
+  __m256 origin[3];
+  __m256 inv_step[3];
+  for (int c = 0; c < 3; c++) {
+    origin[c] = _mm256_set1_ps(bounds->origin[c]);
+    inv_step[c] = _mm256_set1_ps(bounds->inv_step[c]);
+  }
+
+  Uint64 i = first;
+  for (; i + 8 <= last; i += 8) {
+    __m256i codes[3];
+    for (int c = 0; c < 3; c++) {
+      __m256 pos = _mm256_loadu_ps(position[c] + i);
+      __m256 code = _mm256_add_ps(
+          _mm256_mul_ps(_mm256_sub_ps(pos, origin[c]), inv_step[c]), half);
+      code = _mm256_min_ps(_mm256_max_ps(code, zero), top);
+      codes[c] = _mm256_cvttps_epi32(code);
+    }
+    __m128i halves = _mm256_cvtps_ph(_mm256_loadu_ps(scale + i),
+                                     _MM_FROUND_TO_NEAREST_INT);
+
+    // 32-bit lanes x | y << 16 and z | scale << 16, interleaved into
+    // instances then put back in order across the 128-bit halves
+    __m256i xy = _mm256_or_si256(codes[0], _mm256_slli_epi32(codes[1], 16));
+    __m256i zs = _mm256_or_si256(
+        codes[2], _mm256_slli_epi32(_mm256_cvtepu16_epi32(halves), 16));
+    __m256i low = _mm256_unpacklo_epi32(xy, zs);
+    __m256i high = _mm256_unpackhi_epi32(xy, zs);
+    SPS_QuantizedInstance* out = &dest[i - first];
+    _mm256_storeu_si256((__m256i*)out,
+                        _mm256_permute2x128_si256(low, high, 0x20));
+    _mm256_storeu_si256((__m256i*)(out + 4),
+                        _mm256_permute2x128_si256(low, high, 0x31));
+  }
+
+  // The tail call skips the implicit vzeroupper, and SSE code after a dirty
+  // upper half runs several times slower
+  _mm256_zeroupper();
+  quantize_scalar(bounds, position, scale, i, last, dest + (i - first));
+}
+#endif
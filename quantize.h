@@ -0,0 +1,61 @@
+#ifndef SPS_QUANTIZE_H
+#define SPS_QUANTIZE_H
+
+#include <SDL3/SDL_stdinc.h>
+#include "integrator.h"
+
+// Codes of a quantized position axis.
+#define SPS_QUANTIZE_LEVELS (65536.0f)
+
+// Render instance of a particle, 8 bytes: the position as 16-bit codes inside
+// the snapshot bounds then the scale as a half float.
+typedef struct {
+  Uint16 position[3];
+  Uint16 scale;
+} SPS_QuantizedInstance;
+
+// Mapping between positions and codes, a code decodes to origin + code * step.
+typedef struct {
+  float origin[3];
+  float step[3];
+  float inv_step[3];
+} SPS_QuantizeBounds;
+
+// Quantizes the particles of [first, last) into dest, dest[0] is first.
+typedef void (*SPS_QuantizeFunc)(const SPS_QuantizeBounds* bounds,
+                                 const float* const position[3],
+                                 const float* scale,
+                                 Uint64 first,
+                                 Uint64 last,
+                                 SPS_QuantizedInstance* dest);
+
+// Grows the box min max to contain the positions of [first, last).
+void SPS_QuantizeGrowBounds(const float* const position[3],
+                            Uint64 first,
+                            Uint64 last,
+                            float min[3],
+                            float max[3]);
+
+// Maps the box min max to codes. The box snaps outward to power of two cells,
+// it only changes once particles leave them so still particles keep their
+// codes from one snapshot to the next.
+void SPS_QuantizeBoundsLoad(SPS_QuantizeBounds* bounds,
+                            const float min[3],
+                            const float max[3]);
+
+// Gets the kernel an instruction set runs, the widest one it includes.
+SPS_QuantizeFunc SPS_QuantizeGetKernel(SPS_Isa isa);
+
+// Quantizes [first, last) with the kernel of the integrator instruction set.
+void SPS_QuantizePack(const SPS_QuantizeBounds* bounds,
+                      const float* const position[3],
+                      const float* scale,
+                      Uint64 first,
+                      Uint64 last,
+                      SPS_QuantizedInstance* dest);
+
+// Converts between floats and halves, rounding to the nearest even half.
+Uint16 SPS_FloatToHalf(float value);
+float SPS_HalfToFloat(Uint16 half);
+
+#endif /* SPS_QUANTIZE_H */
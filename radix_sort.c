@@ -0,0 +1,133 @@
+#include "radix_sort.h"
+
+#include <SDL3/SDL_log.h>
+#include <SDL3/SDL_stdinc.h>
+
+#define RADIX_BITS (8)
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+#define RADIX_MIN_BLOCK (16384)
+
+// State of a single pass shared by every block
+typedef struct {
+  const Uint32* src_keys;
+  const Uint32* src_values;
+  Uint32* dst_keys;
+  Uint32* dst_values;
+  Uint32* histograms;
+  Uint64 block_size;
+  Uint32 shift;
+} RadixPass;
+
+void radix_histogram_task(void* userdata,
+                          Uint64 first,
+                          Uint64 last,
+                          Uint32 worker);
+void radix_scatter_task(void* userdata,
+                        Uint64 first,
+                        Uint64 last,
+                        Uint32 worker);
+
+bool SPS_RadixSort(SPS_ThreadPool* pool,
+                   Uint32* keys,
+                   Uint32* values,
+                   Uint32* keys_tmp,
+                   Uint32* values_tmp,
+                   Uint64 count,
+                   Uint32 key_bits) {
+  if (count < 2) {
+    return true;
+  }
+
+  if (count > SDL_MAX_UINT32) {
+    SDL_Log("Couldn't radix sort %" SDL_PRIu64 " items", count);
+    return false;
+  }
+
+  // A few blocks per worker so stealing can balance uneven chunks
+  Uint64 blocks_count = SPS_ThreadPoolWorkers(pool) * 4;
+  Uint64 block_size = (count + blocks_count - 1) / blocks_count;
+  block_size = SDL_max(block_size, RADIX_MIN_BLOCK);
+  blocks_count = (count + block_size - 1) / block_size;
+
+  Uint32* histograms =
+      SDL_malloc(sizeof(Uint32) * RADIX_BUCKETS * blocks_count);
+  if (histograms == NULL) {
+    SDL_Log("Couldn't allocate radix sort histograms");
+    return false;
+  }
+
+  RadixPass pass = {
+      .src_keys = keys,
+      .src_values = values,
+      .dst_keys = keys_tmp,
+      .dst_values = values_tmp,
+      .histograms = histograms,
+      .block_size = block_size,
+  };
+
+  Uint32 passes_count = (SDL_min(key_bits, 32) + RADIX_BITS - 1) / RADIX_BITS;
+  for (Uint32 p = 0; p < passes_count; p++) {
+    pass.shift = p * RADIX_BITS;
+    SDL_memset(histograms, 0, sizeof(Uint32) * RADIX_BUCKETS * blocks_count);
+    SPS_ThreadPoolParallelFor(pool, 0, count, block_size, radix_histogram_task,
+                              &pass);
+
+    // Exclusive scan in digit-major, block-minor order keeps the sort stable
+    Uint32 offset = 0;
+    for (Uint32 d = 0; d < RADIX_BUCKETS; d++) {
+      for (Uint64 b = 0; b < blocks_count; b++) {
+        Uint32 digit_count = histograms[b * RADIX_BUCKETS + d];
+        histograms[b * RADIX_BUCKETS + d] = offset;
+        offset += digit_count;
+      }
+    }
+
+    SPS_ThreadPoolParallelFor(pool, 0, count, block_size, radix_scatter_task,
+                              &pass);
+
+    const Uint32* sorted_keys = pass.dst_keys;
+    const Uint32* sorted_values = pass.dst_values;
+    pass.dst_keys = (Uint32*)pass.src_keys;
+    pass.dst_values = (Uint32*)pass.src_values;
+    pass.src_keys = sorted_keys;
+    pass.src_values = sorted_values;
+  }
+
+  // An odd number of passes leaves the result in the scratch buffers
+  if (pass.src_keys != keys) {
+    SDL_memcpy(keys, pass.src_keys, sizeof(Uint32) * count);
+    SDL_memcpy(values, pass.src_values, sizeof(Uint32) * count);
+  }
+
+  SDL_free(histograms);
+  return true;
+}
+
+void radix_histogram_task(void* userdata,
+                          Uint64 first,
+                          Uint64 last,
+                          Uint32 worker) {
+  (void)worker;
+  RadixPass* pass = userdata;
+  Uint32* histogram =
+      pass->histograms + (first / pass->block_size) * RADIX_BUCKETS;
+  for (Uint64 i = first; i < last; i++) {
+    histogram[(pass->src_keys[i] >> pass->shift) & (RADIX_BUCKETS - 1)]++;
+  }
+}
+
+void radix_scatter_task(void* userdata,
+                        Uint64 first,
+                        Uint64 last,
+                        Uint32 worker) {
+  (void)worker;
+  RadixPass* pass = userdata;
+  Uint32* offsets =
+      pass->histograms + (first / pass->block_size) * RADIX_BUCKETS;
+  for (Uint64 i = first; i < last; i++) {
+    Uint32 key = pass->src_keys[i];
+    Uint32 dst = offsets[(key >> pass->shift) & (RADIX_BUCKETS - 1)]++;
+    pass->dst_keys[dst] = key;
+    pass->dst_values[dst] = pass->src_values[i];
+  }
+}
@@ -0,0 +1,18 @@
+#ifndef SPS_RADIX_SORT_H
+#define SPS_RADIX_SORT_H
+
+#include <SDL3/SDL_stdinc.h>
+#include "thread_pool.h"
+
+// Stable parallel LSD radix sort of 32-bit keys carrying 32-bit values, eight
+// bits per pass and only as many passes as key_bits needs. keys_tmp and
+// values_tmp must hold count items, the sorted result ends in keys/values.
+bool SPS_RadixSort(SPS_ThreadPool* pool,
+                   Uint32* keys,
+                   Uint32* values,
+                   Uint32* keys_tmp,
+                   Uint32* values_tmp,
+                   Uint64 count,
+                   Uint32 key_bits);
+
+#endif /* SPS_RADIX_SORT_H */
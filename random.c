@@ -0,0 +1,222 @@
+#include "random.h"
+
+// Particles drawn together, the generator rounds run across the whole block
+// so they vectorize before the shape is applied
+#define SCATTER_BLOCK_SIZE (256)
+
+// Multipliers and key increments of Philox4x32
+#define PHILOX_M0 (0xD2511F53u)
+#define PHILOX_M1 (0xCD9E8D57u)
+#define PHILOX_W0 (0x9E3779B9u)
+#define PHILOX_W1 (0xBB67AE85u)
+#define PHILOX_ROUNDS (10)
+
+// Shared by every chunk of a scatter
+typedef struct {
+  SPS_Scatter scatter;  // grids already turned into their box
+  float* position[3];
+  Uint64 first;
+  Uint64 index;
+} ScatterContext;
+
+static const char* scatter_shape_names[SPS_SCATTER_COUNT] = {
+    "grid", "box", "shell", "ball", "disc", "gaussian"};
+
+void random_philox_block(Uint64 key,
+                         Uint64 counter,
+                         Uint32 stream,
+                         Uint32 count,
+                         float units[4][SCATTER_BLOCK_SIZE]);
+void random_scatter_task(void* userdata,
+                         Uint64 first,
+                         Uint64 last,
+                         Uint32 worker);
+void random_scatter_block(const SPS_Scatter* scatter,
+                          float units[4][SCATTER_BLOCK_SIZE],
+                          Uint32 count,
+                          float* const position[3]);
+
+void SPS_RandomPhilox(Uint64 key,
+                      Uint64 counter,
+                      Uint32 stream,
+                      Uint32 out[4]) {
+  Uint32 c[4] = {(Uint32)counter, (Uint32)(counter >> 32), stream, 0};
+  Uint32 k[2] = {(Uint32)key, (Uint32)(key >> 32)};
+  for (int round = 0; round < PHILOX_ROUNDS; round++) {
+    Uint64 p0 = (Uint64)PHILOX_M0 * c[0];
+    Uint64 p1 = (Uint64)PHILOX_M1 * c[2];
+    c[0] = (Uint32)(p1 >> 32) ^ c[1] ^ k[0];
+    c[1] = (Uint32)p1;
+    c[2] = (Uint32)(p0 >> 32) ^ c[3] ^ k[1];
+    c[3] = (Uint32)p0;
+    k[0] += PHILOX_W0;
+    k[1] += PHILOX_W1;
+  }
+  SDL_memcpy(out, c, sizeof(c));
+}
+
+float SPS_RandomUnit(Uint32 bits) {
+  return (float)(bits >> 8) * (1.0f / 16777216.0f);
+}
+
+void SPS_ScatterLoad(SPS_Scatter* scatter, SPS_ScatterShape shape) {
+  // Everything fits over the grid, under the 40 units tall grid box
+  static const float extents[SPS_SCATTER_COUNT][3] = {
+      {10.0f, 20.0f, 10.0f}, {10.0f, 20.0f, 10.0f}, {10.0f, 10.0f, 10.0f},
+      {10.0f, 10.0f, 10.0f}, {10.0f, 0.5f, 10.0f},  {4.0f, 4.0f, 4.0f},
+  };
+  SDL_memset(scatter, 0, sizeof(SPS_Scatter));
+  scatter->shape = shape;
+  scatter->center[1] = 20.0f;
+  SDL_memcpy(scatter->extent, extents[shape], sizeof(scatter->extent));
+}
+
+bool SPS_ScatterShapeFromName(const char* name, SPS_ScatterShape* shape) {
+  for (int s = 0; s < SPS_SCATTER_COUNT; s++) {
+    if (SDL_strcmp(name, scatter_shape_names[s]) == 0) {
+      *shape = (SPS_ScatterShape)s;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char* SPS_ScatterShapeName(SPS_ScatterShape shape) {
+  return scatter_shape_names[shape];
+}
+
+void SPS_ScatterParticles(const SPS_Scatter* scatter,
+                          SPS_Particles* particles,
+                          SPS_ThreadPool* pool,
+                          Uint64 first,
+                          Uint64 last,
+                          Uint64 index) {
+  ScatterContext context = {
+      .scatter = *scatter,
+      .position = {SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_X),
+                   SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_Y),
+                   SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_Z)},
+      .first = first,
+      .index = index,
+  };
+  if (scatter->shape == SPS_SCATTER_GRID) {
+    SPS_ScatterLoad(&context.scatter, SPS_SCATTER_BOX);
+    context.scatter.seed = scatter->seed;
+  }
+  SPS_ThreadPoolParallelFor(pool, first, last, SPS_PARTICLES_CHUNK_SIZE,
+                            random_scatter_task, &context);
+}
+
+void random_philox_block(Uint64 key,
+                         Uint64 counter,
+                         Uint32 stream,
+                         Uint32 count,
+                         float units[4][SCATTER_BLOCK_SIZE]) {
+  // Same rounds as SPS_RandomPhilox, one lane per counter
+  Uint32 c[4][SCATTER_BLOCK_SIZE];
+  for (Uint32 j = 0; j < count; j++) {
+    c[0][j] = (Uint32)(counter + j);
+    c[1][j] = (Uint32)((counter + j) >> 32);
+    c[2][j] = stream;
+    c[3][j] = 0;
+  }
+
+  Uint32 k0 = (Uint32)key;
+  Uint32 k1 = (Uint32)(key >> 32);
+  for (int round = 0; round < PHILOX_ROUNDS; round++) {
+    for (Uint32 j = 0; j < count; j++) {
+      Uint64 p0 = (Uint64)PHILOX_M0 * c[0][j];
+      Uint64 p1 = (Uint64)PHILOX_M1 * c[2][j];
+      c[0][j] = (Uint32)(p1 >> 32) ^ c[1][j] ^ k0;
+      c[1][j] = (Uint32)p1;
+      c[2][j] = (Uint32)(p0 >> 32) ^ c[3][j] ^ k1;
+      c[3][j] = (Uint32)p0;
+    }
+    k0 += PHILOX_W0;
+    k1 += PHILOX_W1;
+  }
+
+  for (int w = 0; w < 4; w++) {
+    for (Uint32 j = 0; j < count; j++) {
+      units[w][j] = SPS_RandomUnit(c[w][j]);
+    }
+  }
+}
+
+void random_scatter_task(void* userdata,
+                         Uint64 first,
+                         Uint64 last,
+                         Uint32 worker) {
+  (void)worker;
+  const ScatterContext* context = userdata;
+  float units[4][SCATTER_BLOCK_SIZE];
+  for (Uint64 begin = first; begin < last; begin += SCATTER_BLOCK_SIZE) {
+    Uint32 count = (Uint32)SDL_min(last - begin, SCATTER_BLOCK_SIZE);
+    random_philox_block(context->scatter.seed,
+                        context->index + (begin - context->first),
+                        SPS_RANDOM_SCATTER, count, units);
+    float* const position[3] = {context->position[0] + begin,
+                                context->position[1] + begin,
+                                context->position[2] + begin};
+    random_scatter_block(&context->scatter, units, count, position);
+  }
+}
+
+void random_scatter_block(const SPS_Scatter* scatter,
+                          float units[4][SCATTER_BLOCK_SIZE],
+                          Uint32 count,
+                          float* const position[3]) {
+  const float* c = scatter->center;
+  const float* e = scatter->extent;
+  const float tau = 2.0f * SDL_PI_F;
+  switch (scatter->shape) {
+    case SPS_SCATTER_BOX:
+    default:
+      for (int a = 0; a < 3; a++) {
+        for (Uint32 j = 0; j < count; j++) {
+          position[a][j] = c[a] + e[a] * (2.0f * units[a][j] - 1.0f);
+        }
+      }
+      break;
+    case SPS_SCATTER_SHELL:
+    case SPS_SCATTER_BALL:
+      // Uniform height and angle make a uniform direction, the cube root
+      // of the radius fills the ball evenly without rejection
+      for (Uint32 j = 0; j < count; j++) {
+        float y = 2.0f * units[0][j] - 1.0f;
+        float ring = SDL_sqrtf(SDL_max(1.0f - y * y, 0.0f));
+        float phi = tau * units[1][j];
+        float radius = e[0];
+        if (scatter->shape == SPS_SCATTER_BALL) {
+          radius *= SDL_powf(units[2][j], 1.0f / 3.0f);
+        }
+        position[0][j] = c[0] + radius * ring * SDL_cosf(phi);
+        position[1][j] = c[1] + radius * y;
+        position[2][j] = c[2] + radius * ring * SDL_sinf(phi);
+      }
+      break;
+    case SPS_SCATTER_DISC:
+      // Flat in the ground plane, the square root keeps the area density
+      // even
+      for (Uint32 j = 0; j < count; j++) {
+        float radius = e[0] * SDL_sqrtf(units[0][j]);
+        float phi = tau * units[1][j];
+        position[0][j] = c[0] + radius * SDL_cosf(phi);
+        position[1][j] = c[1] + e[1] * (2.0f * units[2][j] - 1.0f);
+        position[2][j] = c[2] + radius * SDL_sinf(phi);
+      }
+      break;
+    case SPS_SCATTER_GAUSSIAN:
+      // Box-Muller on both pairs of words, 1 - u keeps the logarithm finite
+      for (Uint32 j = 0; j < count; j++) {
+        float r0 = SDL_sqrtf(-2.0f * SDL_logf(1.0f - units[0][j]));
+        float r1 = SDL_sqrtf(-2.0f * SDL_logf(1.0f - units[2][j]));
+        float phi0 = tau * units[1][j];
+        float phi1 = tau * units[3][j];
+        position[0][j] = c[0] + e[0] * r0 * SDL_cosf(phi0);
+        position[1][j] = c[1] + e[1] * r0 * SDL_sinf(phi0);
+        position[2][j] = c[2] + e[2] * r1 * SDL_cosf(phi1);
+      }
+      break;
+  }
+}
@@ -0,0 +1,69 @@
+#ifndef SPS_RANDOM_H
+#define SPS_RANDOM_H
+
+#include <SDL3/SDL_stdinc.h>
+#include "particles.h"
+#include "thread_pool.h"
+
+// Volumes particles are scattered in when the store is initialized.
+typedef enum {
+  SPS_SCATTER_GRID,  // the box over the debug grid, center and extent unused
+  SPS_SCATTER_BOX,
+  SPS_SCATTER_SHELL,
+  SPS_SCATTER_BALL,
+  SPS_SCATTER_DISC,
+  SPS_SCATTER_GAUSSIAN,
+  SPS_SCATTER_COUNT,
+} SPS_ScatterShape;
+
+// Streams of SPS_RandomPhilox. Every use of a seed draws from its own, so
+// one never repeats the numbers of another.
+typedef enum {
+  SPS_RANDOM_SCATTER,
+  SPS_RANDOM_SPH_JITTER,
+  SPS_RANDOM_EMITTER_BORN,
+  SPS_RANDOM_EMITTER_POSITION,
+  SPS_RANDOM_EMITTER_VELOCITY,
+  SPS_RANDOM_EMITTER_JITTER,
+  SPS_RANDOM_STREAMS,
+} SPS_RandomStream;
+
+// A distribution of positions, every particle gets its own from the seed and
+// its index alone.
+typedef struct {
+  SPS_ScatterShape shape;
+  float center[3];
+  float extent[3];  // box half extents, shell and ball radius extent[0], disc
+                    // radius extent[0] and half thickness extent[1], gaussian
+                    // standard deviation per axis
+  Uint64 seed;
+} SPS_Scatter;
+
+// Counter based generator, Philox4x32-10. Maps a key and a counter to four
+// random words without any state, so any index can be drawn in any order on
+// any thread.
+void SPS_RandomPhilox(Uint64 key, Uint64 counter, Uint32 stream, Uint32 out[4]);
+
+// Maps the top 24 bits of a random word to [0, 1).
+float SPS_RandomUnit(Uint32 bits);
+
+// Initializes a shape of its default size, centered above the debug grid.
+void SPS_ScatterLoad(SPS_Scatter* scatter, SPS_ScatterShape shape);
+
+// Finds a shape by its name, grid, box, shell, ball, disc or gaussian.
+bool SPS_ScatterShapeFromName(const char* name, SPS_ScatterShape* shape);
+
+// Name of a shape, as SPS_ScatterShapeFromName takes it.
+const char* SPS_ScatterShapeName(SPS_ScatterShape shape);
+
+// Places the particles in [first, last) in parallel, the one at first taking
+// the counter index. Only the positions change. The result doesn't depend on
+// the workers or the chunking.
+void SPS_ScatterParticles(const SPS_Scatter* scatter,
+                          SPS_Particles* particles,
+                          SPS_ThreadPool* pool,
+                          Uint64 first,
+                          Uint64 last,
+                          Uint64 index);
+
+#endif /* SPS_RANDOM_H */
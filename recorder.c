@@ -0,0 +1,344 @@
+#include "recorder.h"
+
+#include <SDL3/SDL_endian.h>
+#include <SDL3/SDL_log.h>
+#include <SDL3/SDL_timer.h>
+
+// Copies the live range of every recorded channel into a frame
+typedef struct {
+  const SPS_Particles* particles;
+  SPS_RecorderFrame* frame;
+} CaptureContext;
+
+// Channels of the trajectory streams, in stream order
+static const SPS_ParticleChannelId recorder_channels[SPS_TRAJECTORY_STREAMS] =
+    {SPS_CHANNEL_POSITION_X, SPS_CHANNEL_POSITION_Y, SPS_CHANNEL_POSITION_Z,
+     SPS_CHANNEL_VELOCITY_X, SPS_CHANNEL_VELOCITY_Y, SPS_CHANNEL_VELOCITY_Z,
+     SPS_CHANNEL_ID};
+
+void capture_task(void* userdata, Uint64 first, Uint64 last, Uint32 worker);
+int recorder_thread(void* data);
+bool recorder_write(SPS_Recorder* recorder, const void* data, Uint64 size);
+bool recorder_write_frame(SPS_Recorder* recorder,
+                          const SPS_RecorderFrame* frame);
+bool recorder_write_index(SPS_Recorder* recorder);
+
+void SPS_RecorderLoad(SPS_Recorder* recorder) {
+  SDL_memset(recorder, 0, sizeof(SPS_Recorder));
+  recorder->keyframe_interval = SPS_RECORDER_DEFAULT_KEYFRAME_INTERVAL;
+  recorder->position_precision = SPS_RECORDER_DEFAULT_POSITION_PRECISION;
+  recorder->velocity_precision = SPS_RECORDER_DEFAULT_VELOCITY_PRECISION;
+  atomic_init(&recorder->head, 0);
+  atomic_init(&recorder->tail, 0);
+}
+
+bool SPS_RecorderStart(SPS_Recorder* recorder, const char* path) {
+  // Streams hold the codes as they are in memory
+  if (SDL_BYTEORDER != SDL_LIL_ENDIAN) {
+    SDL_Log("Trajectories are little-endian, this platform can't write them");
+    return false;
+  }
+  if (recorder->position_precision <= 0.0f ||
+      recorder->velocity_precision <= 0.0f) {
+    SDL_Log("Trajectory precisions have to be positive");
+    return false;
+  }
+  if (recorder->keyframe_interval == 0) {
+    recorder->keyframe_interval = 1;
+  }
+
+  // The ring and the writer state start over, the settings stay
+  atomic_store(&recorder->head, 0);
+  atomic_store(&recorder->tail, 0);
+  recorder->path = path;
+  recorder->offset = 0;
+  recorder->last_count = 0;
+  recorder->last_reindexed = 0;
+  recorder->since_keyframe = 0;
+  recorder->failed = false;
+  SDL_memset(&recorder->stats, 0, sizeof(SPS_RecorderStats));
+  recorder->stream = SDL_IOFromFile(path, "wb");
+  if (recorder->stream == NULL) {
+    SDL_Log("Couldn't create trajectory %s: %s", path, SDL_GetError());
+    return false;
+  }
+
+  SPS_TrajectoryHeader header = {0};
+  SDL_memcpy(header.magic, SPS_TRAJECTORY_MAGIC, sizeof(header.magic));
+  header.version = SPS_TRAJECTORY_VERSION;
+  header.keyframe_interval = recorder->keyframe_interval;
+  header.position_precision = recorder->position_precision;
+  header.velocity_precision = recorder->velocity_precision;
+  if (!recorder_write(recorder, &header, sizeof(header))) {
+    SDL_Log("Couldn't write trajectory %s: %s", path, SDL_GetError());
+    SDL_CloseIO(recorder->stream);
+    recorder->stream = NULL;
+    return false;
+  }
+
+  recorder->ready = SDL_CreateSemaphore(0);
+  if (recorder->ready == NULL) {
+    SDL_Log("Couldn't create the recorder semaphore: %s", SDL_GetError());
+    SDL_CloseIO(recorder->stream);
+    recorder->stream = NULL;
+    return false;
+  }
+
+  SDL_SetAtomicInt(&recorder->running, 1);
+  recorder->thread = SDL_CreateThread(recorder_thread, "recorder", recorder);
+  if (recorder->thread == NULL) {
+    SDL_Log("Couldn't start the recorder thread: %s", SDL_GetError());
+    SDL_DestroySemaphore(recorder->ready);
+    recorder->ready = NULL;
+    SDL_CloseIO(recorder->stream);
+    recorder->stream = NULL;
+    return false;
+  }
+  return true;
+}
+
+bool SPS_RecorderCapture(SPS_Recorder* recorder,
+                         const SPS_Particles* particles,
+                         SPS_ThreadPool* pool,
+                         Uint64 step) {
+  if (recorder->thread == NULL) {
+    return false;
+  }
+
+  // Acquire pairs with the writer releasing a slot it is done reading
+  const Uint64 head = atomic_load_explicit(&recorder->head,
+                                           memory_order_relaxed);
+  const Uint64 tail = atomic_load_explicit(&recorder->tail,
+                                           memory_order_acquire);
+  if (head - tail >= SPS_RECORDER_SLOTS) {
+    recorder->stats.dropped++;
+    return false;
+  }
+
+  // Slots only grow, steady recording never allocates
+  SPS_RecorderFrame* frame = &recorder->frames[head % SPS_RECORDER_SLOTS];
+  if (frame->capacity < particles->count) {
+    Uint64 capacity = SDL_max(particles->count, 2 * frame->capacity);
+    float* data = SDL_aligned_alloc(
+        SPS_PARTICLES_ALIGNMENT,
+        sizeof(float) * SPS_TRAJECTORY_STREAMS * capacity);
+    if (data == NULL) {
+      SDL_Log("Couldn't allocate a recorder frame of %" SDL_PRIu64
+              " particles", capacity);
+      recorder->stats.dropped++;
+      return false;
+    }
+    SDL_aligned_free(frame->data);
+    frame->data = data;
+    frame->capacity = capacity;
+  }
+  frame->count = particles->count;
+  frame->step = step;
+  frame->reindexed = particles->reindexed;
+
+  CaptureContext context = {.particles = particles, .frame = frame};
+  SPS_ThreadPoolParallelFor(pool, 0, particles->count,
+                            SPS_PARTICLES_CHUNK_SIZE, capture_task, &context);
+
+  // Release publishes the copied frame before the writer can see it
+  atomic_store_explicit(&recorder->head, head + 1, memory_order_release);
+  SDL_SignalSemaphore(recorder->ready);
+  recorder->stats.captured++;
+  return true;
+}
+
+void SPS_RecorderStop(SPS_Recorder* recorder) {
+  if (recorder->thread == NULL) {
+    return;
+  }
+
+  // The writer drains the ring before it sees running cleared
+  SDL_SetAtomicInt(&recorder->running, 0);
+  SDL_SignalSemaphore(recorder->ready);
+  SDL_WaitThread(recorder->thread, NULL);
+  recorder->thread = NULL;
+
+  bool closed = !recorder->failed && recorder_write_index(recorder);
+  closed = SDL_CloseIO(recorder->stream) && closed;
+  if (!closed && !recorder->failed) {
+    SDL_Log("Couldn't finish trajectory %s: %s", recorder->path,
+            SDL_GetError());
+  }
+  recorder->stream = NULL;
+
+  SPS_RecorderStats* stats = &recorder->stats;
+  stats->bytes = recorder->offset;
+  SDL_Log("Recorded %" SDL_PRIu64 " of %" SDL_PRIu64 " steps to %s, "
+          "%" SDL_PRIu64 " dropped, %.2f bytes per particle and step, "
+          "writer busy %.2fs",
+          stats->written, stats->captured + stats->dropped, recorder->path,
+          stats->dropped,
+          stats->values > 0 ? (double)stats->bytes / stats->values : 0.0,
+          stats->busy_seconds);
+
+  for (Uint32 i = 0; i < SPS_RECORDER_SLOTS; i++) {
+    SDL_aligned_free(recorder->frames[i].data);
+    SDL_memset(&recorder->frames[i], 0, sizeof(SPS_RecorderFrame));
+  }
+  SDL_free(recorder->codes);
+  recorder->codes = NULL;
+  recorder->codes_capacity = 0;
+  SDL_free(recorder->payload);
+  recorder->payload = NULL;
+  recorder->payload_capacity = 0;
+  SDL_free(recorder->index);
+  recorder->index = NULL;
+  recorder->index_capacity = 0;
+  SDL_DestroySemaphore(recorder->ready);
+  recorder->ready = NULL;
+}
+
+void capture_task(void* userdata, Uint64 first, Uint64 last, Uint32 worker) {
+  (void)worker;
+  const CaptureContext* context = userdata;
+  const Uint64 capacity = context->frame->capacity;
+  for (Uint32 s = 0; s < SPS_TRAJECTORY_STREAMS; s++) {
+    const float* src =
+        SPS_PARTICLES_CHANNEL(context->particles, recorder_channels[s]);
+    SDL_memcpy(context->frame->data + capacity * s + first, src + first,
+               sizeof(float) * (last - first));
+  }
+}
+
+int recorder_thread(void* data) {
+  SPS_Recorder* recorder = data;
+  const double frequency = (double)SDL_GetPerformanceFrequency();
+  for (;;) {
+    SDL_WaitSemaphore(recorder->ready);
+    const bool running = SDL_GetAtomicInt(&recorder->running) != 0;
+
+    // Every signal may stand for several frames, all published ones go
+    Uint64 tail = atomic_load_explicit(&recorder->tail, memory_order_relaxed);
+    while (tail !=
+           atomic_load_explicit(&recorder->head, memory_order_acquire)) {
+      const SPS_RecorderFrame* frame =
+          &recorder->frames[tail % SPS_RECORDER_SLOTS];
+      Uint64 start = SDL_GetPerformanceCounter();
+      if (!recorder->failed && !recorder_write_frame(recorder, frame)) {
+        // Later frames are thrown away so captures keep finding free slots
+        SDL_Log("Couldn't write trajectory %s, recording stops: %s",
+                recorder->path, SDL_GetError());
+        recorder->failed = true;
+      }
+      recorder->stats.busy_seconds +=
+          (double)(SDL_GetPerformanceCounter() - start) / frequency;
+
+      tail++;
+      atomic_store_explicit(&recorder->tail, tail, memory_order_release);
+    }
+
+    if (!running) {
+      return 0;
+    }
+  }
+}
+
+bool recorder_write(SPS_Recorder* recorder, const void* data, Uint64 size) {
+  if (SDL_WriteIO(recorder->stream, data, size) != size) {
+    return false;
+  }
+  recorder->offset += size;
+  return true;
+}
+
+bool recorder_write_frame(SPS_Recorder* recorder,
+                          const SPS_RecorderFrame* frame) {
+  const Uint64 count = frame->count;
+  const Uint64 codes_size = SPS_TRAJECTORY_STREAMS * count;
+  const Uint64 payload_size =
+      SPS_TRAJECTORY_STREAMS * SPS_TRAJECTORY_MAX_STREAM_SIZE(count);
+  if (recorder->payload_capacity < payload_size) {
+    SDL_free(recorder->payload);
+    recorder->payload = SDL_malloc(payload_size);
+    recorder->payload_capacity = recorder->payload ? payload_size : 0;
+    if (recorder->payload == NULL) {
+      return false;
+    }
+  }
+
+  // Differences only hold between the same particles, a new count or
+  // particles moved to other indices start over from a keyframe
+  bool keyframe = recorder->stats.written == 0 ||
+                  count != recorder->last_count ||
+                  frame->reindexed != recorder->last_reindexed ||
+                  recorder->since_keyframe >= recorder->keyframe_interval;
+  if (recorder->codes_capacity < codes_size) {
+    SDL_free(recorder->codes);
+    recorder->codes = SDL_malloc(sizeof(Sint32) * codes_size);
+    recorder->codes_capacity = recorder->codes ? codes_size : 0;
+    if (recorder->codes == NULL) {
+      return false;
+    }
+    keyframe = true;
+  }
+
+  SPS_TrajectoryFrameHeader header = {0};
+  SDL_memcpy(header.magic, SPS_TRAJECTORY_FRAME_MAGIC, sizeof(header.magic));
+  header.keyframe = keyframe;
+  header.step = frame->step;
+  header.count = count;
+  Uint64 size = 0;
+  for (Uint32 s = 0; s < SPS_TRAJECTORY_ID_STREAM; s++) {
+    const float precision = s < 3 ? recorder->position_precision
+                                  : recorder->velocity_precision;
+    header.sizes[s] = SPS_TrajectoryEncodeStream(
+        frame->data + frame->capacity * s, count, precision, keyframe,
+        recorder->codes + count * s, recorder->payload + size);
+    size += header.sizes[s];
+  }
+
+  // Delta frames hold the particles of their keyframe, only it stores ids
+  const Uint32 ids = SPS_TRAJECTORY_ID_STREAM;
+  if (keyframe) {
+    header.sizes[ids] = SPS_TrajectoryEncodeIds(
+        frame->data + frame->capacity * ids, count,
+        recorder->codes + count * ids, recorder->payload + size);
+    size += header.sizes[ids];
+  }
+
+  // Readers open the file from the index, it grows with the recording
+  const Uint64 written = recorder->stats.written;
+  if (written == recorder->index_capacity) {
+    Uint64 capacity = SDL_max(64, 2 * recorder->index_capacity);
+    SPS_TrajectoryFrame* index =
+        SDL_realloc(recorder->index, sizeof(SPS_TrajectoryFrame) * capacity);
+    if (index == NULL) {
+      return false;
+    }
+    recorder->index = index;
+    recorder->index_capacity = capacity;
+  }
+  recorder->index[written] = (SPS_TrajectoryFrame){
+      .step = frame->step,
+      .offset = recorder->offset,
+      .count = count,
+      .keyframe = keyframe ? written : recorder->index[written - 1].keyframe,
+  };
+
+  if (!recorder_write(recorder, &header, sizeof(header)) ||
+      !recorder_write(recorder, recorder->payload, size)) {
+    return false;
+  }
+  recorder->since_keyframe = keyframe ? 1 : recorder->since_keyframe + 1;
+  recorder->last_count = count;
+  recorder->last_reindexed = frame->reindexed;
+  recorder->stats.written++;
+  recorder->stats.values += count;
+  return true;
+}
+
+bool recorder_write_index(SPS_Recorder* recorder) {
+  SPS_TrajectoryFooter footer = {
+      .index_offset = recorder->offset,
+      .frames_count = recorder->stats.written,
+  };
+  SDL_memcpy(footer.magic, SPS_TRAJECTORY_INDEX_MAGIC, sizeof(footer.magic));
+  return recorder_write(recorder, recorder->index,
+                        sizeof(SPS_TrajectoryFrame) * footer.frames_count) &&
+         recorder_write(recorder, &footer, sizeof(footer));
+}
@@ -0,0 +1,96 @@
+#ifndef SPS_RECORDER_H
+#define SPS_RECORDER_H
+
+#include <SDL3/SDL_atomic.h>
+#include <SDL3/SDL_iostream.h>
+#include <SDL3/SDL_mutex.h>
+#include <SDL3/SDL_stdinc.h>
+#include <SDL3/SDL_thread.h>
+#include <stdatomic.h>
+#include "particles.h"
+#include "thread_pool.h"
+#include "trajectory.h"
+
+// Captured frames waiting for the writer, a capture finding them all taken
+// drops its frame instead of waiting.
+#define SPS_RECORDER_SLOTS (4)
+
+// Frames between keyframes and quantization steps when nothing sets them.
+#define SPS_RECORDER_DEFAULT_KEYFRAME_INTERVAL (30)
+#define SPS_RECORDER_DEFAULT_POSITION_PRECISION (1e-4f)
+#define SPS_RECORDER_DEFAULT_VELOCITY_PRECISION (1e-4f)
+
+// Counters of a recording, kept after it stops until the next one starts.
+typedef struct {
+  Uint64 captured;
+  Uint64 dropped;  // captures that found no free slot
+  Uint64 written;
+  Uint64 values;  // particles times frames written
+  Uint64 bytes;
+  double busy_seconds;  // writer time spent encoding and writing
+} SPS_RecorderStats;
+
+// Positions, velocities and ids of a step, one array per trajectory stream.
+typedef struct {
+  float* data;  // every stream back to back, capacity floats apart
+  Uint64 capacity;
+  Uint64 count;
+  Uint64 step;
+  Uint64 reindexed;  // of the particles when it was captured
+} SPS_RecorderFrame;
+
+// Writes the positions, velocities and ids of every captured step to a
+// trajectory file. The simulation thread only copies a step into a free
+// slot, a writer thread encodes and writes it.
+typedef struct {
+  Uint32 keyframe_interval;
+  float position_precision;
+  float velocity_precision;
+
+  // Single producer single consumer ring, both counters only grow
+  SPS_RecorderFrame frames[SPS_RECORDER_SLOTS];
+  _Atomic Uint64 head;  // frames captured, written by the simulation thread
+  _Atomic Uint64 tail;  // frames written, written by the writer thread
+  SDL_Semaphore* ready;
+  SDL_Thread* thread;
+  SDL_AtomicInt running;
+
+  // Writer thread only
+  const char* path;
+  SDL_IOStream* stream;
+  Uint64 offset;  // bytes written so far
+  Sint32* codes;  // codes of the last frame, count per stream
+  Uint64 codes_capacity;
+  Uint8* payload;
+  Uint64 payload_capacity;
+  Uint64 last_count;
+  Uint64 last_reindexed;
+  Uint32 since_keyframe;
+  SPS_TrajectoryFrame* index;  // every frame written, stats.written of them
+  Uint64 index_capacity;
+  bool failed;  // frames are discarded after a write error
+
+  // Captures are counted by the simulation thread, the rest by the writer
+  SPS_RecorderStats stats;
+} SPS_Recorder;
+
+// Sets the defaults, the recorder does nothing until it is started.
+void SPS_RecorderLoad(SPS_Recorder* recorder);
+
+// Creates the trajectory file and starts the writer thread.
+bool SPS_RecorderStart(SPS_Recorder* recorder, const char* path);
+
+// Copies the positions, velocities and ids of the live particles into a
+// free slot and wakes the writer. Particles moved since the last frame start
+// a keyframe. Never waits, returns false when the frame was
+// dropped because the writer is behind or the recorder isn't started.
+bool SPS_RecorderCapture(SPS_Recorder* recorder,
+                         const SPS_Particles* particles,
+                         SPS_ThreadPool* pool,
+                         Uint64 step);
+
+// Writes the frames still queued, the frame index and the footer, then
+// joins the writer thread and releases everything but the stats.
+void SPS_RecorderStop(SPS_Recorder* recorder);
+
+#endif /* SPS_RECORDER_H */
@@ -1,22 +1,207 @@
 #include <SDL3/SDL_log.h>
 #include <SDL3/SDL_timer.h>
 
+#include "integrator.h"
 #include "particle_system.h"
 #include "simulation.h"
 
+int simulation_thread(void* data);
+void simulation_replay_key(SPS_Simulation* state,
+                           const SDL_KeyboardEvent* key);
+bool simulation_view_moved(SPS_Simulation* state);
+
+bool SPS_SimulationLoadConfig(SPS_Simulation* state, const char* path) {
+  char* text = SDL_LoadFile(path, NULL);
+  if (text == NULL) {
+    SDL_Log("Could not read config %s: %s", path, SDL_GetError());
+    return false;
+  }
+
+  // Values point into the text, it lives as long as the simulation
+  SDL_free(state->config_text);
+  state->config_text = text;
+
+  char* line_state = NULL;
+  Uint32 line_number = 0;
+  for (char* line = SDL_strtok_r(text, "\r\n", &line_state); line != NULL;
+       line = SDL_strtok_r(NULL, "\r\n", &line_state)) {
+    line_number++;
+    char* field_state = NULL;
+    const char* key = SDL_strtok_r(line, " \t", &field_state);
+    const char* value = SDL_strtok_r(NULL, " \t", &field_state);
+    if (key == NULL || key[0] == '#') {
+      continue;
+    }
+    if (value == NULL) {
+      SDL_Log("Config %s:%u: %s has no value", path, line_number, key);
+      return false;
+    }
+
+    if (SDL_strcmp(key, "particles") == 0) {
+      state->particles_count = SDL_strtoull(value, NULL, 10);
+    } else if (SDL_strcmp(key, "step") == 0) {
+      state->update_step = (float)SDL_strtod(value, NULL);
+    } else if (SDL_strcmp(key, "max_steps") == 0) {
+      state->max_update_steps = (Uint32)SDL_strtoul(value, NULL, 10);
+    } else if (SDL_strcmp(key, "workers") == 0) {
+      state->workers_count = (Uint32)SDL_strtoul(value, NULL, 10);
+    } else if (SDL_strcmp(key, "pin_workers") == 0) {
+      state->pin_workers = SDL_strcmp(value, "0") != 0;
+    } else if (SDL_strcmp(key, "colliders") == 0) {
+      state->colliders_path = value;
+    } else if (SDL_strcmp(key, "state") == 0) {
+      state->state_path = value;
+    } else if (SDL_strcmp(key, "save") == 0) {
+      state->save_path = value;
+    } else if (SDL_strcmp(key, "record") == 0) {
+      state->record_path = value;
+    } else if (SDL_strcmp(key, "replay") == 0) {
+      state->replay_path = value;
+    } else if (SDL_strcmp(key, "depth_sort") == 0) {
+      state->depth_sort = SDL_strcmp(value, "0") != 0;
+    } else if (SDL_strcmp(key, "reorder_interval") == 0) {
+      state->reorder_interval = (Uint32)SDL_strtoul(value, NULL, 10);
+    } else if (SDL_strcmp(key, "shape") == 0) {
+      if (!SPS_ScatterShapeFromName(value, &state->shape)) {
+        SDL_Log("Config %s:%u: unknown shape %s", path, line_number, value);
+        return false;
+      }
+    } else if (SDL_strcmp(key, "seed") == 0) {
+      state->seed = SDL_strtoull(value, NULL, 10);
+    } else if (SDL_strcmp(key, "mode") == 0 &&
+               SDL_strcmp(value, "particles") == 0) {
+      state->mode = SPS_SIMULATION_PARTICLES;
+    } else if (SDL_strcmp(key, "mode") == 0 &&
+               SDL_strcmp(value, "sph") == 0) {
+      state->mode = SPS_SIMULATION_SPH;
+    } else if (SDL_strcmp(key, "mode") == 0 &&
+               SDL_strcmp(value, "fountain") == 0) {
+      state->mode = SPS_SIMULATION_FOUNTAIN;
+    } else {
+      SDL_Log("Config %s:%u: unknown setting %s %s", path, line_number, key,
+              value);
+      return false;
+    }
+  }
+
+  return true;
+}
+
 bool SPS_SimulationLoad(SPS_Simulation* state) {
+  SPS_IntegratorInit();
+  if (!SPS_ThreadPoolLoad(&state->thread_pool, state->workers_count,
+                          state->pin_workers)) {
+    return false;
+  }
+
+  if (state->update_step <= 0.0f) {
+    state->update_step = SPS_SIMULATION_DEFAULT_STEP;
+  }
+  if (state->max_update_steps == 0) {
+    state->max_update_steps = SPS_SIMULATION_DEFAULT_MAX_STEPS;
+  }
+  SPS_TimestepLoad(&state->timestep, state->update_step,
+                   state->max_update_steps);
+
   SPS_CameraLoad(&state->camera, state->viewport.w / state->viewport.h);
   if (!SPS_GridLoad(&state->grid, state->device, state->window)) {
     return false;
   }
 
-  if (!SPS_ParticleSystemLoad(&state->particle_system, MAX_PARTICLES,
+  // A replay draws as many particles as its first frame holds
+  if (state->replay_path != NULL) {
+    if (!SPS_PlayerOpen(&state->player, state->replay_path)) {
+      SDL_Log("Could not replay %s!", state->replay_path);
+      return false;
+    }
+    state->particles_count = state->player.file.frames[0].count;
+  }
+  if (state->particles_count == 0) {
+    state->particles_count = SPS_SIMULATION_DEFAULT_PARTICLES;
+  }
+
+  // Set before loading, the particles are scattered in parallel
+  state->particle_system.pool = &state->thread_pool;
+  SPS_ScatterLoad(&state->particle_system.scatter, state->shape);
+  state->particle_system.scatter.seed = state->seed;
+  if (!SPS_ParticleSystemLoad(&state->particle_system, state->particles_count,
                               state->device, state->window)) {
-    SDL_Log("Could not initialize particle system for %d particles!",
-            MAX_PARTICLES);
+    SDL_Log("Could not initialize particle system for %" SDL_PRIu64
+            " particles!", state->particles_count);
+    return false;
+  }
+  state->particle_system.depth_sort = state->depth_sort;
+  state->particle_system.reorder_interval = state->reorder_interval;
+
+  if (state->colliders_path != NULL &&
+      !SPS_ParticleSystemLoadColliders(&state->particle_system,
+                                       state->colliders_path)) {
+    SDL_Log("Could not load colliders from %s!", state->colliders_path);
+    return false;
+  }
+
+  if (state->mode == SPS_SIMULATION_SPH &&
+      !SPS_ParticleSystemEnableSph(&state->particle_system,
+                                   state->particle_system.sph.params)) {
+    SDL_Log("Could not enable the SPH fluid solver!");
+    return false;
+  }
+
+  // Steady state of rate * lifetime particles
+  if (state->mode == SPS_SIMULATION_FOUNTAIN) {
+    SPS_Emitter fountain;
+    SPS_EmitterLoad(&fountain);
+    fountain.rate = 0.25f * state->particles_count;
+    SPS_ParticleSystemClear(&state->particle_system);
+    if (!SPS_ParticleSystemAddEmitter(&state->particle_system, fountain)) {
+      SDL_Log("Could not add the fountain emitter!");
+      return false;
+    }
+  }
+
+  // A saved state replaces the generated one
+  if (state->state_path != NULL &&
+      !SPS_ParticleSystemRestore(&state->particle_system, state->state_path)) {
+    SDL_Log("Could not restore the state from %s!", state->state_path);
     return false;
   }
 
+  // The loaded state is the first recorded frame
+  SPS_RecorderLoad(&state->recorder);
+  if (state->record_path != NULL) {
+    if (!SPS_RecorderStart(&state->recorder, state->record_path)) {
+      SDL_Log("Could not record to %s!", state->record_path);
+      return false;
+    }
+    SPS_RecorderCapture(&state->recorder, &state->particle_system.particles,
+                        &state->thread_pool, state->particle_system.steps);
+  }
+
+  // The first recorded frame replaces the generated particles, scales keep
+  // their defaults since trajectories don't record them
+  if (state->replay_path != NULL) {
+    SPS_PlayerAdvance(&state->player, 0.0, &state->particle_system.particles,
+                      &state->thread_pool);
+  }
+
+  // The first state is published before the simulation thread starts
+  SPS_XFormGetPosition(state->camera.xform, state->view_pos);
+  SPS_Vec3Copy(state->view_pos, state->particle_system.sort_view_pos);
+  SPS_TripleBufferLoad(&state->snapshot_buffer);
+  SPS_ParticleSnapshot* first =
+      &state->snapshots[state->snapshot_buffer.back];
+  if (!SPS_ParticleSystemSnapshot(&state->particle_system, first, NULL)) {
+    return false;
+  }
+  state->published_slot = state->snapshot_buffer.back;
+  SPS_TripleBufferPublish(&state->snapshot_buffer);
+
+  SDL_SetAtomicInt(&state->sim_running, 1);
+  state->sim_thread = SDL_CreateThread(simulation_thread, "simulation", state);
+  if (state->sim_thread == NULL) {
+    SDL_Log("Could not start the simulation thread: %s", SDL_GetError());
+    return false;
+  }
   return true;
 }
 
@@ -28,6 +213,26 @@ void SPS_SimulationEvent(SPS_Simulation* state, SDL_Event* event) {
       SPS_CameraViewportResize(&state->camera,
                                state->viewport.w / state->viewport.h);
       break;
+    case SDL_EVENT_KEY_DOWN:
+      if (event->key.scancode == SDL_SCANCODE_F5 && !event->key.repeat) {
+        SDL_SetAtomicInt(&state->save_requested, 1);
+      }
+      if (state->replay_path != NULL) {
+        simulation_replay_key(state, &event->key);
+      }
+      break;
+    case SDL_EVENT_MOUSE_BUTTON_DOWN:
+      if (state->replay_path != NULL &&
+          event->button.button == SDL_BUTTON_LEFT) {
+        SPS_PlayerScrub(&state->player, event->button.x / state->viewport.w);
+      }
+      break;
+    case SDL_EVENT_MOUSE_MOTION:
+      if (state->replay_path != NULL &&
+          (event->motion.state & SDL_BUTTON_LMASK) != 0) {
+        SPS_PlayerScrub(&state->player, event->motion.x / state->viewport.w);
+      }
+      break;
     case SDL_EVENT_MOUSE_WHEEL:
       state->relative_mouse_wheel = -event->wheel.y;
     default:
@@ -36,23 +241,53 @@ void SPS_SimulationEvent(SPS_Simulation* state, SDL_Event* event) {
 }
 
 void SPS_SimulationUpdate(SPS_Simulation* state, float dt) {
-  {
-    SPS_CameraUpdate(&state->camera, state->window, state->relative_mouse_wheel,
-                     dt);
+  SPS_ParticleSystemUpdate(&state->particle_system, dt);
 
-    SPS_ParticleSystemUpdate(&state->particle_system, dt);
-    // SPS_ParticleSystemDebug(&state->particle_system);
-  }
-  state->relative_mouse_wheel = 0.0f;
+  // Only copies the step, a writer behind drops it instead of waiting
+  SPS_RecorderCapture(&state->recorder, &state->particle_system.particles,
+                      &state->thread_pool, state->particle_system.steps);
+  // SPS_ParticleSystemDebug(&state->particle_system);
 }
 
 bool SPS_SimulationRender(SPS_Simulation* state, float dt) {
+  // Only the frame that last used this slot has to be done, the others
+  // keep the GPU busy while this one is recorded
+  SDL_GPUFence** fence = &state->frame_fences[state->frame_slot];
+  if (*fence != NULL) {
+    SDL_WaitForGPUFences(state->device, true, fence, 1);
+    SDL_ReleaseGPUFence(state->device, *fence);
+    *fence = NULL;
+  }
+
+  // The camera follows the input at the frame rate on the main thread
+  SPS_CameraUpdate(&state->camera, state->window, state->relative_mouse_wheel,
+                   dt);
+  state->relative_mouse_wheel = 0.0f;
+
+  // The next snapshot is depth sorted from where the camera is now
+  SDL_LockSpinlock(&state->view_lock);
+  SPS_XFormGetPosition(state->camera.xform, state->view_pos);
+  SDL_UnlockSpinlock(&state->view_lock);
+
+  // Newest published state, the last one again when none came since
+  SPS_TripleBufferAcquire(&state->snapshot_buffer);
+  const SPS_ParticleSnapshot* snapshot =
+      &state->snapshots[state->snapshot_buffer.front];
+
   SDL_GPUCommandBuffer* cmd_buf = SDL_AcquireGPUCommandBuffer(state->device);
   if (cmd_buf == NULL) {
     SDL_Log("Could not acquire GPU command buffer: %s", SDL_GetError());
     return false;
   }
 
+  // The changed particles in view are copied in this same submission,
+  // before any render pass reads them
+  if (!SPS_ParticleSystemUpload(&state->particle_system, snapshot,
+                                state->camera.proj, state->camera.view,
+                                cmd_buf)) {
+    SDL_Log("Could not upload the particles, drawing the previous ones");
+  }
+
   // Get window swap chain texture
   SDL_GPUTexture* swapchain_texture = NULL;
   if (!SDL_WaitAndAcquireGPUSwapchainTexture(cmd_buf, state->window,
@@ -82,21 +317,143 @@ bool SPS_SimulationRender(SPS_Simulation* state, float dt) {
                    render_pass);
 
       // Draw the particles
-      SPS_ALIGN_VEC3 SPS_Vec3 view_pos = {0};
-      SPS_XFormGetPosition(camera->xform, view_pos);
       SPS_ParticleSystemDraw(&state->particle_system, camera->proj,
-                             camera->view, view_pos, cmd_buf, render_pass);
+                             camera->view, cmd_buf, render_pass);
     }
     SDL_EndGPURenderPass(render_pass);
   }
 
-  SDL_GPUFence* fence = SDL_SubmitGPUCommandBufferAndAcquireFence(cmd_buf);
-  SDL_WaitForGPUFences(state->device, true, &fence, 1);
-  SDL_ReleaseGPUFence(state->device, fence);
+  *fence = SDL_SubmitGPUCommandBufferAndAcquireFence(cmd_buf);
+  state->frame_slot = (state->frame_slot + 1) % SPS_FRAMES_IN_FLIGHT;
   return true;
 }
 
 void SPS_SimulationDestroy(SPS_Simulation* state) {
+  if (state->sim_thread != NULL) {
+    SDL_SetAtomicInt(&state->sim_running, 0);
+    SDL_WaitThread(state->sim_thread, NULL);
+    state->sim_thread = NULL;
+    SPS_TimestepLogStats(&state->timestep);
+  }
+  SPS_RecorderStop(&state->recorder);
+  SPS_PlayerClose(&state->player);
+
+  // Frames in flight may still read what is about to be released
+  for (int i = 0; i < SPS_FRAMES_IN_FLIGHT; i++) {
+    if (state->frame_fences[i] != NULL) {
+      SDL_WaitForGPUFences(state->device, true, &state->frame_fences[i], 1);
+      SDL_ReleaseGPUFence(state->device, state->frame_fences[i]);
+      state->frame_fences[i] = NULL;
+    }
+  }
+
   SPS_GridDestroy(&state->grid);
   SPS_ParticleSystemDestroy(&state->particle_system);
+  for (int i = 0; i < 3; i++) {
+    SPS_ParticleSnapshotDestroy(&state->snapshots[i]);
+  }
+  SPS_ThreadPoolDestroy(&state->thread_pool);
+  SDL_free(state->config_text);
+  state->config_text = NULL;
+}
+
+int simulation_thread(void* data) {
+  SPS_Simulation* state = data;
+  SPS_Timestep* timestep = &state->timestep;
+  const double frequency = (double)SDL_GetPerformanceFrequency();
+  Uint64 last_tick = SDL_GetPerformanceCounter();
+  while (SDL_GetAtomicInt(&state->sim_running)) {
+    Uint64 tick = SDL_GetPerformanceCounter();
+    Uint32 steps =
+        SPS_TimestepAdvance(timestep, (double)(tick - last_tick) / frequency);
+    last_tick = tick;
+    if (state->replay_path != NULL) {
+      // Only new frames are published, snapshots find changed chunks by the
+      // step so it counts publishes and grows when the playhead goes back
+      steps = steps > 0 && SPS_PlayerAdvance(&state->player, steps,
+                                             &state->particle_system.particles,
+                                             &state->thread_pool);
+
+      // Without a new frame a moved camera still needs a new back to front
+      // order, the step changes too so the order gets uploaded again
+      if (steps == 0 && state->depth_sort && simulation_view_moved(state)) {
+        steps = 1;
+      }
+      state->particle_system.steps += steps;
+    } else {
+      for (Uint32 step = 0; step < steps; step++) {
+        SPS_SimulationUpdate(state, timestep->step);
+      }
+    }
+
+    // Only this thread touches the particles, saves wait for a step boundary
+    if (state->save_path != NULL &&
+        SDL_CompareAndSwapAtomicInt(&state->save_requested, 1, 0) &&
+        SPS_ParticleSystemSave(&state->particle_system, state->save_path)) {
+      SDL_Log("Saved the state to %s", state->save_path);
+    }
+
+    // Only the last state of a catch-up burst is worth drawing
+    if (steps > 0) {
+      // The render thread never writes a published snapshot, it stays
+      // readable to find the unchanged chunks
+      const Uint32 back = state->snapshot_buffer.back;
+      SDL_LockSpinlock(&state->view_lock);
+      SPS_Vec3Copy(state->view_pos, state->particle_system.sort_view_pos);
+      SDL_UnlockSpinlock(&state->view_lock);
+      if (SPS_ParticleSystemSnapshot(
+              &state->particle_system, &state->snapshots[back],
+              &state->snapshots[state->published_slot])) {
+        state->published_slot = back;
+        SPS_TripleBufferPublish(&state->snapshot_buffer);
+      }
+      continue;
+    }
+
+    // Sleeps until the next step is due instead of spinning
+    double wait = timestep->step - timestep->accumulator;
+    SDL_DelayNS((Uint64)(SDL_max(wait, 0.0) * 1e9));
+  }
+
+  return 0;
+}
+
+void simulation_replay_key(SPS_Simulation* state,
+                           const SDL_KeyboardEvent* key) {
+  // Skips a second of recorded steps, ten with shift
+  const double skip = ((key->mod & SDL_KMOD_SHIFT) != 0 ? 10.0 : 1.0) /
+                      (double)state->update_step;
+  switch (key->scancode) {
+    case SDL_SCANCODE_SPACE:
+      if (!key->repeat) {
+        SPS_PlayerTogglePause(&state->player);
+      }
+      break;
+    case SDL_SCANCODE_LEFT:
+      SPS_PlayerSkip(&state->player, -skip);
+      break;
+    case SDL_SCANCODE_RIGHT:
+      SPS_PlayerSkip(&state->player, skip);
+      break;
+    case SDL_SCANCODE_UP:
+      SPS_PlayerScaleSpeed(&state->player, 2.0f);
+      break;
+    case SDL_SCANCODE_DOWN:
+      SPS_PlayerScaleSpeed(&state->player, 0.5f);
+      break;
+    case SDL_SCANCODE_HOME:
+      SPS_PlayerSeek(&state->player, 0.0);
+      break;
+    default:
+      break;
+  }
+}
+
+bool simulation_view_moved(SPS_Simulation* state) {
+  SDL_LockSpinlock(&state->view_lock);
+  bool moved = SDL_memcmp(state->view_pos,
+                          state->particle_system.sort_view_pos,
+                          sizeof(SPS_Vec3)) != 0;
+  SDL_UnlockSpinlock(&state->view_lock);
+  return moved;
 }
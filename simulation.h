@@ -1,46 +1,119 @@
 #ifndef SPS_SIMULATION_H
 #define SPS_SIMULATION_H
 // clang-format off
+#include <SDL3/SDL_atomic.h>
 #include <SDL3/SDL_events.h>
 #include <SDL3/SDL_video.h>
 #include <SDL3/SDL_gpu.h>
+#include <SDL3/SDL_thread.h>
 // clang-format on
 
 #include "camera.h"
 #include "grid.h"
 #include "particle_system.h"
+#include "player.h"
+#include "recorder.h"
 #include "shader.h"
+#include "thread_pool.h"
+#include "timestep.h"
+#include "triple_buffer.h"
 
-#define MAX_PARTICLES (10000)
+// Particles simulated when neither the command line nor a config sets it.
+#define SPS_SIMULATION_DEFAULT_PARTICLES (10000)
+
+// Simulated seconds per update and catch-up updates per frame by default.
+#define SPS_SIMULATION_DEFAULT_STEP (0.0333333333333f)
+#define SPS_SIMULATION_DEFAULT_MAX_STEPS (4)
+
+// Kinds of simulation, selected before loading.
+typedef enum {
+  SPS_SIMULATION_PARTICLES,
+  SPS_SIMULATION_SPH,
+  SPS_SIMULATION_FOUNTAIN,
+} SPS_SimulationMode;
 
 // Global values for the simulation
 typedef struct {
   SDL_Window* window;
   SDL_GPUDevice* device;
   SDL_GPUViewport viewport;
+  SPS_ThreadPool thread_pool;
+  Uint32 workers_count;
+  bool pin_workers;
+  SPS_SimulationMode mode;
+  Uint64 particles_count;
+  SPS_ScatterShape shape;  // where the particles start
+  Uint64 seed;
+  float update_step;
+  Uint32 max_update_steps;
+  const char* colliders_path;
+  const char* state_path;   // saved state to resume from
+  const char* save_path;    // where F5 saves the running state
+  const char* record_path;  // trajectory every step is recorded to
+  const char* replay_path;  // trajectory drawn instead of simulating
+  bool depth_sort;
+  Uint32 reorder_interval;
+  char* config_text;  // keeps the strings read from the config alive
   SPS_ParticleSystem particle_system;
+  SPS_Recorder recorder;
+  SPS_Player player;
+
+  // The simulation thread publishes states the render thread draws
+  SDL_Thread* sim_thread;
+  SDL_AtomicInt sim_running;
+  SDL_AtomicInt save_requested;
+  SPS_TripleBuffer snapshot_buffer;
+  SPS_ParticleSnapshot snapshots[3];
+  Uint32 published_slot;  // snapshot last published, simulation thread only
+  SDL_SpinLock view_lock;  // guards the camera position the depth sort reads
+  SPS_Vec3 view_pos;
   SPS_Camera camera;
   SPS_Grid grid;
+  SPS_Timestep timestep;
+
+  // Fence of the last frame recorded in every in-flight slot
+  SDL_GPUFence* frame_fences[SPS_FRAMES_IN_FLIGHT];
+  Uint32 frame_slot;
   Uint64 last_tick;
   float iter_delta_time;
   float cur_frame_time;
-  float cur_update_time;
   float relative_mouse_wheel;
 } SPS_Simulation;
 
-// Load the simulation.
+// Applies the settings of a config file, one "key value" per line:
+//   particles N
+//   step seconds
+//   max_steps N
+//   workers N
+//   pin_workers 0|1
+//   mode particles|sph|fountain
+//   shape grid|box|shell|ball|disc|gaussian
+//   seed N
+//   colliders path
+//   state path
+//   save path
+//   record path
+//   replay path
+//   depth_sort 0|1
+//   reorder_interval steps
+// Lines starting with # are ignored.
+bool SPS_SimulationLoadConfig(SPS_Simulation* state, const char* path);
+
+// Load the simulation and start its thread.
 bool SPS_SimulationLoad(SPS_Simulation* state);
 
 // Let simulation handle an event from SDL.
 void SPS_SimulationEvent(SPS_Simulation* state, SDL_Event* event);
 
-// Update the simulation (fixed rate).
+// Update the simulation (fixed rate), runs on the simulation thread.
 void SPS_SimulationUpdate(SPS_Simulation* state, float dt);
 
-// Render the simulation (fixed rate).
+// Render the latest published state (fixed rate), never waits on the
+// simulation thread.
 bool SPS_SimulationRender(SPS_Simulation* state, float dt);
 
-// Release the resources creates by the simulation.
+// Stop the simulation thread and release the resources creates by the
+// simulation.
 void SPS_SimulationDestroy(SPS_Simulation* state);
 
 #endif /* SPS_SIMULATION_H */
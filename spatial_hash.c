@@ -0,0 +1,377 @@
+#include "spatial_hash.h"
+
+#include <SDL3/SDL_log.h>
+#include <SDL3/SDL_stdinc.h>
+
+#define SPATIAL_HASH_MIN_CELLS (1024)
+#define SPATIAL_HASH_CELLS_CHUNK (4096)
+#define SPATIAL_HASH_SCAN_BLOCK (65536)
+
+// State of a single rebuild shared by every pass
+typedef struct {
+  SPS_SpatialHash* hash;
+  const SPS_Particles* particles;
+  float inv_cell_size;
+  Uint32* block_sums;
+} BuildContext;
+
+// State of a parallel neighbor query
+typedef struct {
+  const SPS_SpatialHash* hash;
+  float radius2;
+  SPS_NeighborsFunc func;
+  void* userdata;
+} QueryContext;
+
+// Neighbors collected for the particle being queried
+typedef struct {
+  Uint32 indices[SPS_SPATIAL_HASH_BATCH];
+  float dx[SPS_SPATIAL_HASH_BATCH];
+  float dy[SPS_SPATIAL_HASH_BATCH];
+  float dz[SPS_SPATIAL_HASH_BATCH];
+  float r2[SPS_SPATIAL_HASH_BATCH];
+} NeighborsBatch;
+
+bool spatial_hash_reserve(SPS_SpatialHash* hash, Uint64 count, Uint32 cells);
+Uint32 spatial_hash_bucket(Sint32 x, Sint32 y, Sint32 z, Uint32 cells_count);
+void clear_task(void* userdata, Uint64 first, Uint64 last, Uint32 worker);
+void count_task(void* userdata, Uint64 first, Uint64 last, Uint32 worker);
+void block_sum_task(void* userdata, Uint64 first, Uint64 last, Uint32 worker);
+void offsets_task(void* userdata, Uint64 first, Uint64 last, Uint32 worker);
+void scatter_task(void* userdata, Uint64 first, Uint64 last, Uint32 worker);
+void finalize_task(void* userdata, Uint64 first, Uint64 last, Uint32 worker);
+void query_task(void* userdata, Uint64 first, Uint64 last, Uint32 worker);
+
+void SPS_SpatialHashLoad(SPS_SpatialHash* hash) {
+  SDL_memset(hash, 0, sizeof(SPS_SpatialHash));
+}
+
+bool SPS_SpatialHashBuild(SPS_SpatialHash* hash,
+                          const SPS_Particles* particles,
+                          SPS_ThreadPool* pool,
+                          float cell_size) {
+  hash->count = 0;
+  hash->cells_count = 0;
+  if (cell_size <= 0.0f) {
+    SDL_Log("Couldn't build spatial hash with cell size %f", cell_size);
+    return false;
+  }
+
+  if (particles->count == 0) {
+    return true;
+  }
+
+  // About two buckets per particle keeps unrelated cells rarely sharing one
+  Uint64 cells = SPATIAL_HASH_MIN_CELLS;
+  while (cells < particles->count * 2 && cells < (1u << 31)) {
+    cells *= 2;
+  }
+
+  if (particles->count > SDL_MAX_UINT32 ||
+      !spatial_hash_reserve(hash, particles->count, (Uint32)cells)) {
+    SDL_Log("Couldn't reserve spatial hash for %" SDL_PRIu64 " particles",
+            particles->count);
+    return false;
+  }
+
+  Uint64 blocks_count =
+      (cells + SPATIAL_HASH_SCAN_BLOCK - 1) / SPATIAL_HASH_SCAN_BLOCK;
+  BuildContext context = {
+      .hash = hash,
+      .particles = particles,
+      .inv_cell_size = 1.0f / cell_size,
+      .block_sums = SDL_malloc(sizeof(Uint32) * blocks_count),
+  };
+  if (context.block_sums == NULL) {
+    SDL_Log("Couldn't allocate spatial hash scan");
+    return false;
+  }
+
+  hash->count = particles->count;
+  hash->cells_count = (Uint32)cells;
+  hash->cell_size = cell_size;
+
+  // Counting sort: histogram, exclusive scan, scatter
+  SPS_ThreadPoolParallelFor(pool, 0, cells, SPATIAL_HASH_CELLS_CHUNK,
+                            clear_task, &context);
+  SPS_ThreadPoolParallelFor(pool, 0, hash->count, SPS_PARTICLES_CHUNK_SIZE,
+                            count_task, &context);
+  SPS_ThreadPoolParallelFor(pool, 0, cells, SPATIAL_HASH_SCAN_BLOCK,
+                            block_sum_task, &context);
+
+  Uint32 offset = 0;
+  for (Uint64 b = 0; b < blocks_count; b++) {
+    Uint32 sum = context.block_sums[b];
+    context.block_sums[b] = offset;
+    offset += sum;
+  }
+  hash->cell_start[cells] = offset;
+
+  SPS_ThreadPoolParallelFor(pool, 0, cells, SPATIAL_HASH_SCAN_BLOCK,
+                            offsets_task, &context);
+  SPS_ThreadPoolParallelFor(pool, 0, hash->count, SPS_PARTICLES_CHUNK_SIZE,
+                            scatter_task, &context);
+
+  // Scatter order inside a bucket depends on timing, sort it back
+  SPS_ThreadPoolParallelFor(pool, 0, cells, SPATIAL_HASH_CELLS_CHUNK,
+                            finalize_task, &context);
+
+  SDL_free(context.block_sums);
+  return true;
+}
+
+bool SPS_SpatialHashForEach(const SPS_SpatialHash* hash,
+                            SPS_ThreadPool* pool,
+                            float radius,
+                            SPS_NeighborsFunc func,
+                            void* userdata) {
+  if (radius > hash->cell_size) {
+    SDL_Log("Couldn't query radius %f over cells of %f", radius,
+            hash->cell_size);
+    return false;
+  }
+
+  QueryContext context = {
+      .hash = hash,
+      .radius2 = radius * radius,
+      .func = func,
+      .userdata = userdata,
+  };
+
+  // Walking the buckets keeps neighboring particles close in memory
+  SPS_ThreadPoolParallelFor(pool, 0, hash->count, SPS_PARTICLES_CHUNK_SIZE,
+                            query_task, &context);
+  return true;
+}
+
+Uint64 SPS_SpatialHashMemorySize(const SPS_SpatialHash* hash) {
+  return (sizeof(Uint32) * 2 + sizeof(float) * 3) * hash->capacity +
+         sizeof(Uint32) * (2 * (Uint64)hash->cells_capacity + 1);
+}
+
+void SPS_SpatialHashDestroy(SPS_SpatialHash* hash) {
+  SDL_free(hash->cell_start);
+  SDL_free((void*)hash->cell_cursor);
+  SDL_free(hash->cells);
+  SDL_free(hash->order);
+  SDL_free(hash->x);
+  SDL_free(hash->y);
+  SDL_free(hash->z);
+  SPS_SpatialHashLoad(hash);
+}
+
+bool spatial_hash_reserve(SPS_SpatialHash* hash, Uint64 count, Uint32 cells) {
+  if (cells > hash->cells_capacity) {
+    Uint32* start = SDL_realloc(hash->cell_start, sizeof(Uint32) * (cells + 1));
+    if (start == NULL) {
+      return false;
+    }
+    hash->cell_start = start;
+
+    _Atomic Uint32* cursor =
+        SDL_realloc((void*)hash->cell_cursor, sizeof(Uint32) * cells);
+    if (cursor == NULL) {
+      return false;
+    }
+    hash->cell_cursor = cursor;
+    hash->cells_capacity = cells;
+  }
+
+  if (count <= hash->capacity) {
+    return true;
+  }
+
+  Uint64 capacity = SDL_max(count, hash->capacity + hash->capacity / 2);
+  Uint32** indices[] = {&hash->cells, &hash->order};
+  for (size_t i = 0; i < SDL_arraysize(indices); i++) {
+    Uint32* data = SDL_realloc(*indices[i], sizeof(Uint32) * capacity);
+    if (data == NULL) {
+      return false;
+    }
+    *indices[i] = data;
+  }
+
+  float** values[] = {&hash->x, &hash->y, &hash->z};
+  for (size_t i = 0; i < SDL_arraysize(values); i++) {
+    float* data = SDL_realloc(*values[i], sizeof(float) * capacity);
+    if (data == NULL) {
+      return false;
+    }
+    *values[i] = data;
+  }
+
+  hash->capacity = capacity;
+  return true;
+}
+
+Uint32 spatial_hash_bucket(Sint32 x, Sint32 y, Sint32 z, Uint32 cells_count) {
+  Uint32 h = ((Uint32)x * 73856093u) ^ ((Uint32)y * 19349663u) ^
+             ((Uint32)z * 83492791u);
+  return h & (cells_count - 1);
+}
+
+void clear_task(void* userdata, Uint64 first, Uint64 last, Uint32 worker) {
+  (void)worker;
+  BuildContext* context = userdata;
+  for (Uint64 c = first; c < last; c++) {
+    atomic_store_explicit(&context->hash->cell_cursor[c], 0,
+                          memory_order_relaxed);
+  }
+}
+
+void count_task(void* userdata, Uint64 first, Uint64 last, Uint32 worker) {
+  (void)worker;
+  BuildContext* context = userdata;
+  SPS_SpatialHash* hash = context->hash;
+  const SPS_Particles* particles = context->particles;
+  const float* px = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_X);
+  const float* py = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_Y);
+  const float* pz = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_Z);
+  const float inv = context->inv_cell_size;
+  for (Uint64 i = first; i < last; i++) {
+    Uint32 bucket = spatial_hash_bucket(
+        (Sint32)SDL_floorf(px[i] * inv), (Sint32)SDL_floorf(py[i] * inv),
+        (Sint32)SDL_floorf(pz[i] * inv), hash->cells_count);
+    hash->cells[i] = bucket;
+    atomic_fetch_add_explicit(&hash->cell_cursor[bucket], 1,
+                              memory_order_relaxed);
+  }
+}
+
+void block_sum_task(void* userdata, Uint64 first, Uint64 last, Uint32 worker) {
+  (void)worker;
+  BuildContext* context = userdata;
+  Uint32 sum = 0;
+  for (Uint64 c = first; c < last; c++) {
+    sum += atomic_load_explicit(&context->hash->cell_cursor[c],
+                                memory_order_relaxed);
+  }
+  context->block_sums[first / SPATIAL_HASH_SCAN_BLOCK] = sum;
+}
+
+void offsets_task(void* userdata, Uint64 first, Uint64 last, Uint32 worker) {
+  (void)worker;
+  BuildContext* context = userdata;
+  SPS_SpatialHash* hash = context->hash;
+  Uint32 offset = context->block_sums[first / SPATIAL_HASH_SCAN_BLOCK];
+  for (Uint64 c = first; c < last; c++) {
+    Uint32 count =
+        atomic_load_explicit(&hash->cell_cursor[c], memory_order_relaxed);
+    hash->cell_start[c] = offset;
+    atomic_store_explicit(&hash->cell_cursor[c], offset, memory_order_relaxed);
+    offset += count;
+  }
+}
+
+void scatter_task(void* userdata, Uint64 first, Uint64 last, Uint32 worker) {
+  (void)worker;
+  BuildContext* context = userdata;
+  SPS_SpatialHash* hash = context->hash;
+  for (Uint64 i = first; i < last; i++) {
+    Uint32 slot = atomic_fetch_add_explicit(&hash->cell_cursor[hash->cells[i]],
+                                            1, memory_order_relaxed);
+    hash->order[slot] = (Uint32)i;
+  }
+}
+
+void finalize_task(void* userdata, Uint64 first, Uint64 last, Uint32 worker) {
+  (void)worker;
+  BuildContext* context = userdata;
+  SPS_SpatialHash* hash = context->hash;
+  const SPS_Particles* particles = context->particles;
+  const float* px = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_X);
+  const float* py = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_Y);
+  const float* pz = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_Z);
+  for (Uint64 c = first; c < last; c++) {
+    Uint32 begin = hash->cell_start[c];
+    Uint32 end = hash->cell_start[c + 1];
+
+    // Buckets hold a handful of particles, insertion sort is enough
+    for (Uint32 s = begin + 1; s < end; s++) {
+      Uint32 value = hash->order[s];
+      Uint32 t = s;
+      for (; t > begin && hash->order[t - 1] > value; t--) {
+        hash->order[t] = hash->order[t - 1];
+      }
+      hash->order[t] = value;
+    }
+
+    for (Uint32 s = begin; s < end; s++) {
+      Uint32 i = hash->order[s];
+      hash->x[s] = px[i];
+      hash->y[s] = py[i];
+      hash->z[s] = pz[i];
+    }
+  }
+}
+
+void query_task(void* userdata, Uint64 first, Uint64 last, Uint32 worker) {
+  QueryContext* context = userdata;
+  const SPS_SpatialHash* hash = context->hash;
+  const float inv = 1.0f / hash->cell_size;
+  NeighborsBatch batch;
+  SPS_Neighbors neighbors = {
+      .indices = batch.indices,
+      .dx = batch.dx,
+      .dy = batch.dy,
+      .dz = batch.dz,
+      .r2 = batch.r2,
+  };
+
+  for (Uint64 s = first; s < last; s++) {
+    const float x = hash->x[s];
+    const float y = hash->y[s];
+    const float z = hash->z[s];
+    const Sint32 cx = (Sint32)SDL_floorf(x * inv);
+    const Sint32 cy = (Sint32)SDL_floorf(y * inv);
+    const Sint32 cz = (Sint32)SDL_floorf(z * inv);
+    neighbors.particle = hash->order[s];
+    neighbors.count = 0;
+
+    // Distinct cells can share a bucket, visit each bucket only once
+    Uint32 visited[27];
+    Uint32 visited_count = 0;
+    for (Sint32 dz = -1; dz <= 1; dz++) {
+      for (Sint32 dy = -1; dy <= 1; dy++) {
+        for (Sint32 dx = -1; dx <= 1; dx++) {
+          Uint32 bucket = spatial_hash_bucket(cx + dx, cy + dy, cz + dz,
+                                              hash->cells_count);
+          bool seen = false;
+          for (Uint32 v = 0; v < visited_count && !seen; v++) {
+            seen = visited[v] == bucket;
+          }
+          if (seen) {
+            continue;
+          }
+          visited[visited_count++] = bucket;
+
+          Uint32 end = hash->cell_start[bucket + 1];
+          for (Uint32 t = hash->cell_start[bucket]; t < end; t++) {
+            float ox = hash->x[t] - x;
+            float oy = hash->y[t] - y;
+            float oz = hash->z[t] - z;
+            float r2 = ox * ox + oy * oy + oz * oz;
+            if (r2 >= context->radius2 || t == s) {
+              continue;
+            }
+
+            Uint32 n = neighbors.count++;
+            batch.indices[n] = hash->order[t];
+            batch.dx[n] = ox;
+            batch.dy[n] = oy;
+            batch.dz[n] = oz;
+            batch.r2[n] = r2;
+            if (neighbors.count == SPS_SPATIAL_HASH_BATCH) {
+              context->func(context->userdata, &neighbors, worker);
+              neighbors.count = 0;
+            }
+          }
+        }
+      }
+    }
+
+    if (neighbors.count > 0) {
+      context->func(context->userdata, &neighbors, worker);
+    }
+  }
+}
@@ -0,0 +1,72 @@
+#ifndef SPS_SPATIAL_HASH_H
+#define SPS_SPATIAL_HASH_H
+
+#include <SDL3/SDL_stdinc.h>
+#include <stdatomic.h>
+#include "particles.h"
+#include "thread_pool.h"
+
+// Maximum number of neighbors handed to a callback at once.
+#define SPS_SPATIAL_HASH_BATCH (256)
+
+// A batch of neighbors of one particle, offsets point from it to them. A
+// particle with more neighbors than a batch holds gets several batches.
+typedef struct {
+  Uint32 particle;
+  Uint32 count;
+  const Uint32* indices;
+  const float* dx;
+  const float* dy;
+  const float* dz;
+  const float* r2;
+} SPS_Neighbors;
+
+// Receives the neighbor batches of a query, worker is the pool worker index.
+typedef void (*SPS_NeighborsFunc)(void* userdata,
+                                  const SPS_Neighbors* neighbors,
+                                  Uint32 worker);
+
+// Uniform grid hashed into a power of two table of buckets, rebuilt with a
+// counting sort every step.
+typedef struct {
+  Uint32* cell_start;            // cells_count + 1 offsets into order
+  _Atomic Uint32* cell_cursor;  // scratch counters of the counting sort
+  Uint32 cells_count;
+  Uint32 cells_capacity;
+  float cell_size;
+
+  // Particles grouped by bucket, order maps back to the store index
+  Uint32* cells;
+  Uint32* order;
+  float* x;
+  float* y;
+  float* z;
+  Uint64 count;
+  Uint64 capacity;
+} SPS_SpatialHash;
+
+// Initializes an empty hash.
+void SPS_SpatialHashLoad(SPS_SpatialHash* hash);
+
+// Rebuilds the buckets from the particle positions with cells of cell_size.
+bool SPS_SpatialHashBuild(SPS_SpatialHash* hash,
+                          const SPS_Particles* particles,
+                          SPS_ThreadPool* pool,
+                          float cell_size);
+
+// Calls func with the neighbors closer than radius of every particle, in
+// parallel over the buckets. Particles without neighbors get no call, radius
+// can't exceed the cell size of the build.
+bool SPS_SpatialHashForEach(const SPS_SpatialHash* hash,
+                            SPS_ThreadPool* pool,
+                            float radius,
+                            SPS_NeighborsFunc func,
+                            void* userdata);
+
+// Bytes allocated by the hash.
+Uint64 SPS_SpatialHashMemorySize(const SPS_SpatialHash* hash);
+
+// Releases the hash buffers.
+void SPS_SpatialHashDestroy(SPS_SpatialHash* hash);
+
+#endif /* SPS_SPATIAL_HASH_H */
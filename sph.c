@@ -0,0 +1,294 @@
+#include "sph.h"
+#include "random.h"
+
+#include <SDL3/SDL_log.h>
+#include <SDL3/SDL_stdinc.h>
+
+#define SPH_GAMMA (7.0f)
+#define SPH_CFL (0.4f)
+
+// Kernel constants and particle arrays shared by the passes of a step
+typedef struct {
+  SPS_Sph* sph;
+  const float* px;
+  const float* py;
+  const float* pz;
+  const float* vx;
+  const float* vy;
+  const float* vz;
+  const float* mass;
+  float* density;
+  float* pressure;
+  float h;
+  float h2;
+  float poly6;
+  float spiky;
+} SphContext;
+
+bool sph_reserve(SPS_Sph* sph, Uint64 count);
+void sph_clear_task(void* userdata, Uint64 first, Uint64 last, Uint32 worker);
+void sph_pressure_task(void* userdata,
+                       Uint64 first,
+                       Uint64 last,
+                       Uint32 worker);
+void sph_density_func(void* userdata,
+                      const SPS_Neighbors* neighbors,
+                      Uint32 worker);
+void sph_force_func(void* userdata,
+                    const SPS_Neighbors* neighbors,
+                    Uint32 worker);
+
+void SPS_SphLoad(SPS_Sph* sph) {
+  SDL_memset(sph, 0, sizeof(SPS_Sph));
+  sph->params = (SPS_SphParams){
+      .smoothing_length = 0.2f,
+      .rest_density = 1000.0f,
+      .stiffness = 50000.0f,
+      .viscosity = 1.0f,
+  };
+  sph->density_channel = -1;
+  sph->pressure_channel = -1;
+  SPS_SpatialHashLoad(&sph->hash);
+}
+
+bool SPS_SphAttach(SPS_Sph* sph, SPS_Particles* particles) {
+  sph->density_channel = SPS_ParticlesFindChannel(particles, "density");
+  if (sph->density_channel < 0) {
+    sph->density_channel = SPS_ParticlesRegisterChannel(
+        particles, "density", sph->params.rest_density);
+  }
+
+  sph->pressure_channel = SPS_ParticlesFindChannel(particles, "pressure");
+  if (sph->pressure_channel < 0) {
+    sph->pressure_channel =
+        SPS_ParticlesRegisterChannel(particles, "pressure", 0.0f);
+  }
+
+  return sph->density_channel >= 0 && sph->pressure_channel >= 0;
+}
+
+void SPS_SphLayoutBlock(const SPS_Sph* sph,
+                        SPS_Particles* particles,
+                        const SPS_Vec3 min,
+                        Uint64 seed) {
+  float* px = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_X);
+  float* py = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_Y);
+  float* pz = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_Z);
+  float* mass = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_MASS);
+  float* scale = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_SCALE);
+
+  // Two particles per smoothing length gives a few dozen neighbors
+  const float spacing = 0.5f * sph->params.smoothing_length;
+  const float particle_mass =
+      sph->params.rest_density * spacing * spacing * spacing;
+  Uint64 side = (Uint64)SDL_ceil(SDL_pow((double)particles->count, 1.0 / 3.0));
+  side = SDL_max(side, 1);
+
+  // Layers fill from the bottom, a tiny jitter breaks the lattice symmetry
+  for (Uint64 i = 0; i < particles->count; i++) {
+    Uint64 x = i % side;
+    Uint64 z = (i / side) % side;
+    Uint64 y = i / (side * side);
+    Uint32 bits[4];
+    SPS_RandomPhilox(seed, i, SPS_RANDOM_SPH_JITTER, bits);
+    px[i] = min[0] + spacing * (x + 0.01f * SPS_RandomUnit(bits[0]));
+    py[i] = min[1] + spacing * (y + 0.01f * SPS_RandomUnit(bits[1]));
+    pz[i] = min[2] + spacing * (z + 0.01f * SPS_RandomUnit(bits[2]));
+    mass[i] = particle_mass;
+    scale[i] = 0.5f * spacing;
+  }
+
+  for (int c = SPS_CHANNEL_VELOCITY_X; c <= SPS_CHANNEL_VELOCITY_Z; c++) {
+    SDL_memset(SPS_PARTICLES_CHANNEL(particles, c), 0,
+               sizeof(float) * particles->count);
+  }
+}
+
+float SPS_SphMaxTimestep(const SPS_Sph* sph) {
+  // Speed of sound of the Tait equation around the rest density
+  float sound_speed = SDL_sqrtf(SPH_GAMMA * sph->params.stiffness /
+                                sph->params.rest_density);
+  return SPH_CFL * sph->params.smoothing_length / sound_speed;
+}
+
+bool SPS_SphPrepare(SPS_Sph* sph,
+                    SPS_Particles* particles,
+                    SPS_ThreadPool* pool) {
+  sph->prepared = false;
+  if (sph->density_channel < 0 || !sph_reserve(sph, particles->count)) {
+    SDL_Log("Couldn't prepare SPH for %" SDL_PRIu64 " particles",
+            particles->count);
+    return false;
+  }
+
+  const float h = sph->params.smoothing_length;
+  const float h3 = h * h * h;
+  SphContext context = {
+      .sph = sph,
+      .px = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_X),
+      .py = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_Y),
+      .pz = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_POSITION_Z),
+      .vx = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_VELOCITY_X),
+      .vy = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_VELOCITY_Y),
+      .vz = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_VELOCITY_Z),
+      .mass = SPS_PARTICLES_CHANNEL(particles, SPS_CHANNEL_MASS),
+      .density = SPS_PARTICLES_CHANNEL(particles, sph->density_channel),
+      .pressure = SPS_PARTICLES_CHANNEL(particles, sph->pressure_channel),
+      .h = h,
+      .h2 = h * h,
+      .poly6 = 315.0f / (64.0f * SDL_PI_F * h3 * h3 * h3),
+      .spiky = 45.0f / (SDL_PI_F * h3 * h3),
+  };
+
+  // Neighbors are walked bucket by bucket, close in space and in memory
+  if (!SPS_SpatialHashBuild(&sph->hash, particles, pool, h)) {
+    return false;
+  }
+
+  SPS_ThreadPoolParallelFor(pool, 0, particles->count,
+                            SPS_PARTICLES_CHUNK_SIZE, sph_clear_task, &context);
+  SPS_SpatialHashForEach(&sph->hash, pool, h, sph_density_func, &context);
+  SPS_ThreadPoolParallelFor(pool, 0, particles->count,
+                            SPS_PARTICLES_CHUNK_SIZE, sph_pressure_task,
+                            &context);
+  SPS_SpatialHashForEach(&sph->hash, pool, h, sph_force_func, &context);
+  sph->prepared = true;
+  return true;
+}
+
+void SPS_SphForces(const SPS_Sph* sph,
+                   float* const force[3],
+                   Uint64 first,
+                   Uint64 last) {
+  // A failed prepare left the forces of an earlier step
+  if (!sph->prepared || last > sph->capacity) {
+    return;
+  }
+
+  for (int c = 0; c < 3; c++) {
+    float* restrict dst = force[c];
+    const float* restrict src = sph->force[c];
+    for (Uint64 i = first; i < last; i++) {
+      dst[i] += src[i];
+    }
+  }
+}
+
+Uint64 SPS_SphMemorySize(const SPS_Sph* sph) {
+  return sizeof(float) * 3 * sph->capacity +
+         SPS_SpatialHashMemorySize(&sph->hash);
+}
+
+void SPS_SphDestroy(SPS_Sph* sph) {
+  for (int c = 0; c < 3; c++) {
+    SDL_free(sph->force[c]);
+  }
+  SPS_SpatialHashDestroy(&sph->hash);
+
+  SPS_SphParams params = sph->params;
+  SPS_SphLoad(sph);
+  sph->params = params;
+}
+
+bool sph_reserve(SPS_Sph* sph, Uint64 count) {
+  if (count <= sph->capacity) {
+    return true;
+  }
+
+  Uint64 capacity = SDL_max(count, sph->capacity + sph->capacity / 2);
+  for (int c = 0; c < 3; c++) {
+    float* data = SDL_realloc(sph->force[c], sizeof(float) * capacity);
+    if (data == NULL) {
+      return false;
+    }
+    sph->force[c] = data;
+  }
+
+  sph->capacity = capacity;
+  return true;
+}
+
+void sph_clear_task(void* userdata, Uint64 first, Uint64 last, Uint32 worker) {
+  (void)worker;
+  SphContext* context = userdata;
+  SPS_Sph* sph = context->sph;
+
+  // Every particle is its own neighbor at distance zero
+  const float self = context->poly6 * context->h2 * context->h2 * context->h2;
+  for (Uint64 i = first; i < last; i++) {
+    context->density[i] = context->mass[i] * self;
+    sph->force[0][i] = 0.0f;
+    sph->force[1][i] = 0.0f;
+    sph->force[2][i] = 0.0f;
+  }
+}
+
+void sph_pressure_task(void* userdata,
+                       Uint64 first,
+                       Uint64 last,
+                       Uint32 worker) {
+  (void)worker;
+  SphContext* context = userdata;
+  const SPS_SphParams* params = &context->sph->params;
+  const float inv_rest = 1.0f / params->rest_density;
+  for (Uint64 i = first; i < last; i++) {
+    // Clamped at zero, negative pressure makes particles clump
+    float ratio = context->density[i] * inv_rest;
+    float ratio2 = ratio * ratio;
+    float ratio7 = ratio2 * ratio2 * ratio2 * ratio;
+    context->pressure[i] = SDL_max(params->stiffness * (ratio7 - 1.0f), 0.0f);
+  }
+}
+
+void sph_density_func(void* userdata,
+                      const SPS_Neighbors* neighbors,
+                      Uint32 worker) {
+  (void)worker;
+  SphContext* context = userdata;
+  float sum = 0.0f;
+  for (Uint32 k = 0; k < neighbors->count; k++) {
+    float q = context->h2 - neighbors->r2[k];
+    sum += context->mass[neighbors->indices[k]] * q * q * q;
+  }
+  context->density[neighbors->particle] += context->poly6 * sum;
+}
+
+void sph_force_func(void* userdata,
+                    const SPS_Neighbors* neighbors,
+                    Uint32 worker) {
+  (void)worker;
+  SphContext* context = userdata;
+  SPS_Sph* sph = context->sph;
+  const Uint32 i = neighbors->particle;
+  const float rho_i = context->density[i];
+  const float pressure_i = context->pressure[i] / (rho_i * rho_i);
+  const float viscosity = sph->params.viscosity / rho_i;
+  float ax = 0.0f;
+  float ay = 0.0f;
+  float az = 0.0f;
+
+  for (Uint32 k = 0; k < neighbors->count; k++) {
+    const Uint32 j = neighbors->indices[k];
+    const float r = SDL_sqrtf(neighbors->r2[k]);
+    if (r <= 0.0f) {
+      continue;
+    }
+
+    // Spiky gradient for the pressure, viscosity kernel laplacian for drag
+    const float rho_j = context->density[j];
+    const float hr = context->h - r;
+    const float m_j = context->mass[j];
+    const float pressure =
+        m_j * (pressure_i + context->pressure[j] / (rho_j * rho_j));
+    const float push = -pressure * context->spiky * hr * hr / r;
+    const float drag = viscosity * m_j / rho_j * context->spiky * hr;
+    ax += push * neighbors->dx[k] + drag * (context->vx[j] - context->vx[i]);
+    ay += push * neighbors->dy[k] + drag * (context->vy[j] - context->vy[i]);
+    az += push * neighbors->dz[k] + drag * (context->vz[j] - context->vz[i]);
+  }
+
+  const float mass = context->mass[i];
+  sph->force[0][i] += mass * ax;
+  sph->force[1][i] += mass * ay;
+  sph->force[2][i] += mass * az;
+}
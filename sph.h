@@ -0,0 +1,67 @@
+#ifndef SPS_SPH_H
+#define SPS_SPH_H
+
+#include <SDL3/SDL_stdinc.h>
+#include "particles.h"
+#include "spatial_hash.h"
+#include "thread_pool.h"
+#include "xmath.h"
+
+// Weakly compressible fluid parameters.
+typedef struct {
+  float smoothing_length;  // kernel support h, also the neighbor radius
+  float rest_density;
+  float stiffness;  // B of the Tait equation p = B ((rho / rho0)^7 - 1)
+  float viscosity;
+} SPS_SphParams;
+
+// Weakly compressible SPH solver, density and pressure live in particle
+// channels so they can be drawn or recorded like any other attribute.
+typedef struct {
+  SPS_SphParams params;
+  SPS_SpatialHash hash;
+  Sint32 density_channel;
+  Sint32 pressure_channel;
+
+  // Pressure and viscosity forces of the current step
+  float* force[3];
+  Uint64 capacity;
+  bool prepared;  // false after a failed prepare, the forces are stale
+} SPS_Sph;
+
+// Initializes the solver with default parameters for water.
+void SPS_SphLoad(SPS_Sph* sph);
+
+// Registers the density and pressure channels on the particles.
+bool SPS_SphAttach(SPS_Sph* sph, SPS_Particles* particles);
+
+// Lays the particles out on a cubic lattice from min with the rest spacing
+// of the parameters, setting their mass to match the rest density. The
+// jitter of every particle comes from the seed and its index.
+void SPS_SphLayoutBlock(const SPS_Sph* sph,
+                        SPS_Particles* particles,
+                        const SPS_Vec3 min,
+                        Uint64 seed);
+
+// Largest step the sound speed of the parameters keeps stable.
+float SPS_SphMaxTimestep(const SPS_Sph* sph);
+
+// Computes density, pressure and the fluid forces of every particle.
+bool SPS_SphPrepare(SPS_Sph* sph,
+                    SPS_Particles* particles,
+                    SPS_ThreadPool* pool);
+
+// Adds the fluid forces computed by the last prepare on [first, last),
+// nothing when it failed.
+void SPS_SphForces(const SPS_Sph* sph,
+                   float* const force[3],
+                   Uint64 first,
+                   Uint64 last);
+
+// Bytes allocated by the solver.
+Uint64 SPS_SphMemorySize(const SPS_Sph* sph);
+
+// Releases the solver buffers.
+void SPS_SphDestroy(SPS_Sph* sph);
+
+#endif /* SPS_SPH_H */
@@ -0,0 +1,155 @@
+#include "state_file.h"
+
+#include <SDL3/SDL_endian.h>
+#include <SDL3/SDL_iostream.h>
+#include <SDL3/SDL_log.h>
+
+#define STATE_FILE_MAGIC "SPSSTATE"
+
+Uint64 state_file_align(Uint64 size);
+bool state_file_check(const SPS_StateFile* file, const char* path);
+
+bool SPS_StateFileWrite(const char* path,
+                        const SPS_Particles* particles,
+                        Uint64 steps) {
+  // Arrays are written as they are in memory
+  if (SDL_BYTEORDER != SDL_LIL_ENDIAN) {
+    SDL_Log("State files are little-endian, this platform can't write them");
+    return false;
+  }
+
+  // The header and the table are built in memory, the arrays follow them
+  const Uint32 channels_count = particles->channels_count;
+  const Uint64 table_size = sizeof(SPS_StateFileHeader) +
+                            sizeof(SPS_StateFileChannel) * channels_count;
+  const Uint64 data_offset = state_file_align(table_size);
+  const Uint64 array_size = sizeof(float) * particles->count;
+  Uint8* table = SDL_calloc(1, data_offset);
+  if (table == NULL) {
+    SDL_Log("Couldn't allocate the state file header");
+    return false;
+  }
+
+  SPS_StateFileHeader* header = (SPS_StateFileHeader*)table;
+  SDL_memcpy(header->magic, STATE_FILE_MAGIC, sizeof(header->magic));
+  header->version = SPS_STATE_FILE_VERSION;
+  header->channels_count = channels_count;
+  header->count = particles->count;
+  header->steps = steps;
+  SPS_StateFileChannel* channels = (SPS_StateFileChannel*)(header + 1);
+  for (Uint32 c = 0; c < channels_count; c++) {
+    const SPS_ParticleChannel* channel = &particles->channels[c];
+    if (SDL_strlcpy(channels[c].name, channel->name,
+                    SPS_STATE_FILE_NAME_SIZE) >= SPS_STATE_FILE_NAME_SIZE) {
+      SDL_Log("Particle channel %s is too long for a state file",
+              channel->name);
+      SDL_free(table);
+      return false;
+    }
+    channels[c].default_value = channel->default_value;
+    channels[c].offset = data_offset + state_file_align(array_size) * c;
+  }
+
+  SDL_IOStream* stream = SDL_IOFromFile(path, "wb");
+  if (stream == NULL) {
+    SDL_Log("Couldn't create state file %s: %s", path, SDL_GetError());
+    SDL_free(table);
+    return false;
+  }
+
+  // Zeros pad every array up to where the next one starts
+  static const Uint8 zeros[SPS_PARTICLES_ALIGNMENT] = {0};
+  const Uint64 padding = state_file_align(array_size) - array_size;
+  bool written = SDL_WriteIO(stream, table, data_offset) == data_offset;
+  for (Uint32 c = 0; c < channels_count && written; c++) {
+    written = SDL_WriteIO(stream, particles->channels[c].data, array_size) ==
+                  array_size &&
+              SDL_WriteIO(stream, zeros, padding) == padding;
+  }
+  SDL_free(table);
+
+  // Closing flushes, a full disk may only show up here
+  if (!SDL_CloseIO(stream) || !written) {
+    SDL_Log("Couldn't write state file %s: %s", path, SDL_GetError());
+    return false;
+  }
+  return true;
+}
+
+bool SPS_StateFileOpen(SPS_StateFile* file, const char* path) {
+  SDL_memset(file, 0, sizeof(SPS_StateFile));
+  if (SDL_BYTEORDER != SDL_LIL_ENDIAN) {
+    SDL_Log("State files are little-endian, this platform can't read them");
+    return false;
+  }
+
+  if (!SPS_MappedFileOpen(&file->map, path)) {
+    return false;
+  }
+  file->header = (const SPS_StateFileHeader*)file->map.data;
+  file->channels = (const SPS_StateFileChannel*)(file->header + 1);
+  if (!state_file_check(file, path)) {
+    SPS_StateFileClose(file);
+    return false;
+  }
+  return true;
+}
+
+const float* SPS_StateFileFindChannel(const SPS_StateFile* file,
+                                      const char* name) {
+  for (Uint32 c = 0; c < file->header->channels_count; c++) {
+    if (SDL_strcmp(file->channels[c].name, name) == 0) {
+      return (const float*)(file->map.data + file->channels[c].offset);
+    }
+  }
+
+  return NULL;
+}
+
+void SPS_StateFileClose(SPS_StateFile* file) {
+  SPS_MappedFileClose(&file->map);
+  SDL_memset(file, 0, sizeof(SPS_StateFile));
+}
+
+Uint64 state_file_align(Uint64 size) {
+  return (size + SPS_PARTICLES_ALIGNMENT - 1) &
+         ~(Uint64)(SPS_PARTICLES_ALIGNMENT - 1);
+}
+
+bool state_file_check(const SPS_StateFile* file, const char* path) {
+  const SPS_StateFileHeader* header = file->header;
+  if (file->map.size < sizeof(SPS_StateFileHeader) ||
+      SDL_memcmp(header->magic, STATE_FILE_MAGIC, sizeof(header->magic)) !=
+          0) {
+    SDL_Log("%s is not a state file", path);
+    return false;
+  }
+  if (header->version != SPS_STATE_FILE_VERSION) {
+    SDL_Log("State file %s has version %u, expected %u", path,
+            header->version, SPS_STATE_FILE_VERSION);
+    return false;
+  }
+
+  // Every array has to be aligned and fit, a truncated file is refused
+  // here instead of faulting when it is read
+  const Uint64 table_size =
+      sizeof(SPS_StateFileHeader) +
+      sizeof(SPS_StateFileChannel) * (Uint64)header->channels_count;
+  if (header->channels_count > SPS_PARTICLES_MAX_CHANNELS ||
+      table_size > file->map.size || header->count > SDL_MAX_UINT32) {
+    SDL_Log("State file %s has a broken header", path);
+    return false;
+  }
+  const Uint64 array_size = sizeof(float) * header->count;
+  for (Uint32 c = 0; c < header->channels_count; c++) {
+    const SPS_StateFileChannel* channel = &file->channels[c];
+    if (channel->name[SPS_STATE_FILE_NAME_SIZE - 1] != '\0' ||
+        channel->offset % SPS_PARTICLES_ALIGNMENT != 0 ||
+        channel->offset < table_size || channel->offset > file->map.size ||
+        file->map.size - channel->offset < array_size) {
+      SDL_Log("State file %s has a broken channel %u", path, c);
+      return false;
+    }
+  }
+  return true;
+}
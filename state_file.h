@@ -0,0 +1,57 @@
+#ifndef SPS_STATE_FILE_H
+#define SPS_STATE_FILE_H
+
+#include <SDL3/SDL_stdinc.h>
+#include "mapped_file.h"
+#include "particles.h"
+
+// Bumped whenever the layout below changes, older files are refused.
+#define SPS_STATE_FILE_VERSION (1)
+
+// Longest channel name a state file holds, with its terminator.
+#define SPS_STATE_FILE_NAME_SIZE (48)
+
+// First 64 bytes of a state file, every field little-endian. The channel
+// table follows, then one array of count floats per channel, each starting
+// on SPS_PARTICLES_ALIGNMENT bytes so it can be used in place.
+typedef struct {
+  char magic[8];  // "SPSSTATE"
+  Uint32 version;
+  Uint32 channels_count;
+  Uint64 count;  // live particles
+  Uint64 steps;  // updates simulated when it was written
+  Uint8 padding[32];
+} SPS_StateFileHeader;
+
+// A channel of the table, where its array starts in the file.
+typedef struct {
+  char name[SPS_STATE_FILE_NAME_SIZE];
+  float default_value;
+  Uint32 padding;
+  Uint64 offset;
+} SPS_StateFileChannel;
+
+// A state file opened read only, its arrays are used where they are mapped.
+typedef struct {
+  SPS_MappedFile map;
+  const SPS_StateFileHeader* header;
+  const SPS_StateFileChannel* channels;
+} SPS_StateFile;
+
+// Writes the live particles of every channel in a single pass.
+bool SPS_StateFileWrite(const char* path,
+                        const SPS_Particles* particles,
+                        Uint64 steps);
+
+// Maps a state file read only and checks its layout, the pages of an array
+// are only read once it is used.
+bool SPS_StateFileOpen(SPS_StateFile* file, const char* path);
+
+// Finds the array of a channel by name, NULL when the file doesn't have it.
+const float* SPS_StateFileFindChannel(const SPS_StateFile* file,
+                                      const char* name);
+
+// Unmaps the file, its channel arrays can't be used anymore.
+void SPS_StateFileClose(SPS_StateFile* file);
+
+#endif /* SPS_STATE_FILE_H */
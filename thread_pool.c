@@ -0,0 +1,240 @@
+#if defined(__linux__)
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "thread_pool.h"
+
+#include <SDL3/SDL_cpuinfo.h>
+#include <SDL3/SDL_log.h>
+
+#define RANGE_PACK(begin, end) (((Uint64)(begin) << 32) | (Uint64)(end))
+#define RANGE_BEGIN(range) ((Uint32)((range) >> 32))
+#define RANGE_END(range) ((Uint32)(range))
+
+int worker_main(void* data);
+void worker_pin(Uint32 cpu);
+void worker_run(SPS_ThreadPool* pool, Uint32 worker);
+bool queue_pop(SPS_ThreadPoolQueue* queue, Uint32* chunk);
+bool queue_steal(SPS_ThreadPool* pool, Uint32 thief);
+
+bool SPS_ThreadPoolLoad(SPS_ThreadPool* pool,
+                        Uint32 workers_count,
+                        bool pin_workers) {
+  SDL_memset(pool, 0, sizeof(SPS_ThreadPool));
+  if (workers_count == 0) {
+    workers_count = (Uint32)SDL_max(SDL_GetNumLogicalCPUCores(), 1);
+  }
+
+  pool->workers_count = SDL_min(workers_count, SPS_THREAD_POOL_MAX_WORKERS);
+  pool->pin_workers = pin_workers;
+  pool->mutex = SDL_CreateMutex();
+  pool->wake = SDL_CreateCondition();
+  pool->done = SDL_CreateCondition();
+  if (pool->mutex == NULL || pool->wake == NULL || pool->done == NULL) {
+    SDL_Log("Couldn't create thread pool primitives: %s", SDL_GetError());
+    SPS_ThreadPoolDestroy(pool);
+    return false;
+  }
+
+  // Worker 0 is whoever calls SPS_ThreadPoolParallelFor
+  for (Uint32 i = 1; i < pool->workers_count; i++) {
+    SPS_ThreadPoolWorker* worker = &pool->workers[i];
+    worker->pool = pool;
+    worker->index = i;
+    worker->thread = SDL_CreateThread(worker_main, "sps_worker", worker);
+    if (worker->thread == NULL) {
+      SDL_Log("Couldn't create worker thread: %s", SDL_GetError());
+      SPS_ThreadPoolDestroy(pool);
+      return false;
+    }
+  }
+
+  SDL_Log("Thread pool running %u workers", pool->workers_count);
+  return true;
+}
+
+Uint32 SPS_ThreadPoolWorkers(const SPS_ThreadPool* pool) {
+  return pool != NULL ? pool->workers_count : 1;
+}
+
+void SPS_ThreadPoolParallelFor(SPS_ThreadPool* pool,
+                               Uint64 first,
+                               Uint64 last,
+                               Uint64 chunk_size,
+                               SPS_ThreadPoolTaskFunc func,
+                               void* userdata) {
+  if (last <= first) {
+    return;
+  }
+
+  chunk_size = SDL_max(chunk_size, 1);
+  Uint64 chunks_count = (last - first + chunk_size - 1) / chunk_size;
+  if (pool == NULL || pool->workers_count < 2 || chunks_count < 2) {
+    for (Uint64 begin = first; begin < last; begin += chunk_size) {
+      func(userdata, begin, SDL_min(begin + chunk_size, last), 0);
+    }
+    return;
+  }
+
+  // Queues hold 32-bit chunk indices, grow the chunks for huge ranges
+  if (chunks_count > SDL_MAX_UINT32) {
+    chunk_size = (last - first + SDL_MAX_UINT32 - 1) / SDL_MAX_UINT32;
+    chunks_count = (last - first + chunk_size - 1) / chunk_size;
+  }
+
+  SDL_LockMutex(pool->mutex);
+  {
+    // Late workers of the previous loop may still be scanning the queues
+    while (pool->active > 0) {
+      SDL_WaitCondition(pool->done, pool->mutex);
+    }
+
+    pool->func = func;
+    pool->userdata = userdata;
+    pool->first = first;
+    pool->last = last;
+    pool->chunk_size = chunk_size;
+
+    // Contiguous slices keep each worker on neighbouring particles
+    Uint32 n = pool->workers_count;
+    for (Uint32 i = 0; i < n; i++) {
+      Uint64 begin = chunks_count * i / n;
+      Uint64 end = chunks_count * (i + 1) / n;
+      atomic_store(&pool->queues[i].range, RANGE_PACK(begin, end));
+    }
+
+    pool->generation++;
+    SDL_BroadcastCondition(pool->wake);
+  }
+  SDL_UnlockMutex(pool->mutex);
+
+  worker_run(pool, 0);
+
+  // Every chunk is claimed now, wait for the ones still running
+  SDL_LockMutex(pool->mutex);
+  while (pool->active > 0) {
+    SDL_WaitCondition(pool->done, pool->mutex);
+  }
+  SDL_UnlockMutex(pool->mutex);
+}
+
+void SPS_ThreadPoolDestroy(SPS_ThreadPool* pool) {
+  if (pool->mutex != NULL) {
+    SDL_LockMutex(pool->mutex);
+    pool->quit = true;
+    if (pool->wake != NULL) {
+      SDL_BroadcastCondition(pool->wake);
+    }
+    SDL_UnlockMutex(pool->mutex);
+  }
+
+  for (Uint32 i = 1; i < pool->workers_count; i++) {
+    if (pool->workers[i].thread != NULL) {
+      SDL_WaitThread(pool->workers[i].thread, NULL);
+      pool->workers[i].thread = NULL;
+    }
+  }
+
+  SDL_DestroyCondition(pool->done);
+  SDL_DestroyCondition(pool->wake);
+  SDL_DestroyMutex(pool->mutex);
+  pool->done = NULL;
+  pool->wake = NULL;
+  pool->mutex = NULL;
+  pool->workers_count = 0;
+}
+
+int worker_main(void* data) {
+  SPS_ThreadPoolWorker* worker = data;
+  SPS_ThreadPool* pool = worker->pool;
+  if (pool->pin_workers) {
+    worker_pin(worker->index);
+  }
+
+  SDL_LockMutex(pool->mutex);
+  Uint64 seen_generation = pool->generation;
+  for (;;) {
+    while (!pool->quit && pool->generation == seen_generation) {
+      SDL_WaitCondition(pool->wake, pool->mutex);
+    }
+
+    if (pool->quit) {
+      break;
+    }
+
+    seen_generation = pool->generation;
+    pool->active++;
+    SDL_UnlockMutex(pool->mutex);
+
+    worker_run(pool, worker->index);
+
+    SDL_LockMutex(pool->mutex);
+    pool->active--;
+    if (pool->active == 0) {
+      SDL_BroadcastCondition(pool->done);
+    }
+  }
+  SDL_UnlockMutex(pool->mutex);
+  return 0;
+}
+
+void worker_pin(Uint32 cpu) {
+#if defined(__linux__)
+  int cpus_count = SDL_max(SDL_GetNumLogicalCPUCores(), 1);
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu % (Uint32)cpus_count, &set);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+    SDL_Log("Couldn't pin worker to core %u", cpu);
+  }
+#else
+  (void)cpu;
+#endif
+}
+
+void worker_run(SPS_ThreadPool* pool, Uint32 worker) {
+  Uint32 chunk = 0;
+  do {
+    while (queue_pop(&pool->queues[worker], &chunk)) {
+      Uint64 begin = pool->first + chunk * pool->chunk_size;
+      Uint64 end = SDL_min(begin + pool->chunk_size, pool->last);
+      pool->func(pool->userdata, begin, end, worker);
+    }
+  } while (queue_steal(pool, worker));
+}
+
+bool queue_pop(SPS_ThreadPoolQueue* queue, Uint32* chunk) {
+  Uint64 range = atomic_load(&queue->range);
+  while (RANGE_BEGIN(range) < RANGE_END(range)) {
+    Uint64 next = RANGE_PACK(RANGE_BEGIN(range) + 1, RANGE_END(range));
+    if (atomic_compare_exchange_weak(&queue->range, &range, next)) {
+      *chunk = RANGE_BEGIN(range);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool queue_steal(SPS_ThreadPool* pool, Uint32 thief) {
+  // Take the back half of the first busy victim, its owner keeps the front
+  Uint32 n = pool->workers_count;
+  for (Uint32 k = 1; k < n; k++) {
+    SPS_ThreadPoolQueue* victim = &pool->queues[(thief + k) % n];
+    Uint64 range = atomic_load(&victim->range);
+    while (RANGE_BEGIN(range) < RANGE_END(range)) {
+      Uint32 begin = RANGE_BEGIN(range);
+      Uint32 end = RANGE_END(range);
+      Uint32 mid = end - (end - begin + 1) / 2;
+      if (atomic_compare_exchange_weak(&victim->range, &range,
+                                       RANGE_PACK(begin, mid))) {
+        atomic_store(&pool->queues[thief].range, RANGE_PACK(mid, end));
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
@@ -0,0 +1,74 @@
+#ifndef SPS_THREAD_POOL_H
+#define SPS_THREAD_POOL_H
+
+#include <SDL3/SDL_mutex.h>
+#include <SDL3/SDL_stdinc.h>
+#include <SDL3/SDL_thread.h>
+#include <stdatomic.h>
+
+// Maximum number of workers, including the thread calling the pool.
+#define SPS_THREAD_POOL_MAX_WORKERS (64)
+
+// Runs the items in [first, last) of a parallel loop on a worker.
+typedef void (*SPS_ThreadPoolTaskFunc)(void* userdata,
+                                       Uint64 first,
+                                       Uint64 last,
+                                       Uint32 worker);
+
+// Chunks left to a worker, packed as begin << 32 | end so the owner and the
+// thieves can update it with a single compare and swap.
+typedef struct {
+  _Alignas(64) _Atomic Uint64 range;
+} SPS_ThreadPoolQueue;
+
+typedef struct SPS_ThreadPool SPS_ThreadPool;
+
+// Thread owned by the pool.
+typedef struct {
+  SPS_ThreadPool* pool;
+  SDL_Thread* thread;
+  Uint32 index;
+} SPS_ThreadPoolWorker;
+
+// Persistent work-stealing pool, the calling thread is always worker 0.
+struct SPS_ThreadPool {
+  SPS_ThreadPoolWorker workers[SPS_THREAD_POOL_MAX_WORKERS];
+  SPS_ThreadPoolQueue queues[SPS_THREAD_POOL_MAX_WORKERS];
+  Uint32 workers_count;
+  bool pin_workers;
+
+  SDL_Mutex* mutex;
+  SDL_Condition* wake;
+  SDL_Condition* done;
+  Uint64 generation;
+  Uint32 active;
+  bool quit;
+
+  SPS_ThreadPoolTaskFunc func;
+  void* userdata;
+  Uint64 first;
+  Uint64 last;
+  Uint64 chunk_size;
+};
+
+// Starts the workers, zero uses one per logical core.
+bool SPS_ThreadPoolLoad(SPS_ThreadPool* pool,
+                        Uint32 workers_count,
+                        bool pin_workers);
+
+// Number of workers, one when pool is NULL.
+Uint32 SPS_ThreadPoolWorkers(const SPS_ThreadPool* pool);
+
+// Splits [first, last) in chunks and blocks until all of them ran, runs
+// inline when pool is NULL. Tasks must not call the pool recursively.
+void SPS_ThreadPoolParallelFor(SPS_ThreadPool* pool,
+                               Uint64 first,
+                               Uint64 last,
+                               Uint64 chunk_size,
+                               SPS_ThreadPoolTaskFunc func,
+                               void* userdata);
+
+// Stops and joins every worker.
+void SPS_ThreadPoolDestroy(SPS_ThreadPool* pool);
+
+#endif /* SPS_THREAD_POOL_H */
@@ -0,0 +1,43 @@
+#include "timestep.h"
+
+#include <SDL3/SDL_log.h>
+#include <SDL3/SDL_stdinc.h>
+
+void SPS_TimestepLoad(SPS_Timestep* timestep, float step, Uint32 max_steps) {
+  SDL_memset(timestep, 0, sizeof(SPS_Timestep));
+  timestep->step = step;
+  timestep->max_steps = SDL_max(max_steps, 1);
+}
+
+Uint32 SPS_TimestepAdvance(SPS_Timestep* timestep, double elapsed) {
+  elapsed = SDL_max(elapsed, 0.0);
+  timestep->frames++;
+  timestep->wall_time += elapsed;
+  timestep->accumulator += elapsed;
+
+  // Leftover time stays in the accumulator for the next frame
+  Uint64 due = (Uint64)(timestep->accumulator / timestep->step);
+  Uint32 steps = (Uint32)SDL_min(due, timestep->max_steps);
+
+  // Past the cap the simulation slows down instead of spiraling, the time
+  // it gives up is counted
+  if (due > steps) {
+    double dropped = (double)(due - steps) * timestep->step;
+    timestep->accumulator -= dropped;
+    timestep->dropped_time += dropped;
+    timestep->clamped_frames++;
+  }
+
+  timestep->accumulator -= (double)steps * timestep->step;
+  timestep->simulated_time += (double)steps * timestep->step;
+  timestep->steps += steps;
+  return steps;
+}
+
+void SPS_TimestepLogStats(const SPS_Timestep* timestep) {
+  SDL_Log("Simulated %.3fs of %.3fs wall time in %" SDL_PRIu64
+          " steps over %" SDL_PRIu64 " frames, dropped %.3fs in %" SDL_PRIu64
+          " clamped frames",
+          timestep->simulated_time, timestep->wall_time, timestep->steps,
+          timestep->frames, timestep->dropped_time, timestep->clamped_frames);
+}
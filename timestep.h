@@ -0,0 +1,32 @@
+#ifndef SPS_TIMESTEP_H
+#define SPS_TIMESTEP_H
+
+#include <SDL3/SDL_stdinc.h>
+
+// Fixed step scheduler, wall time accumulates and is consumed in whole steps
+// so the simulated time tracks the wall clock until the catch-up cap drops
+// the excess.
+typedef struct {
+  float step;        // simulated seconds per update
+  Uint32 max_steps;  // updates per frame before the excess is dropped
+  double accumulator;
+
+  // Accounting since the load, wall = simulated + dropped + accumulator
+  double wall_time;
+  double simulated_time;
+  double dropped_time;
+  Uint64 steps;
+  Uint64 frames;
+  Uint64 clamped_frames;  // frames that hit max_steps
+} SPS_Timestep;
+
+// Initializes the scheduler with empty counters.
+void SPS_TimestepLoad(SPS_Timestep* timestep, float step, Uint32 max_steps);
+
+// Adds the elapsed wall time of a frame, returns how many steps to run now.
+Uint32 SPS_TimestepAdvance(SPS_Timestep* timestep, double elapsed);
+
+// Logs the throughput counters.
+void SPS_TimestepLogStats(const SPS_Timestep* timestep);
+
+#endif /* SPS_TIMESTEP_H */
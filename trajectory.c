@@ -0,0 +1,400 @@
+#include "trajectory.h"
+
+#include <SDL3/SDL_endian.h>
+#include <SDL3/SDL_log.h>
+
+// Largest float below 2^31, quantized values saturate there
+#define TRAJECTORY_CODE_LIMIT (2147483520.0f)
+
+// Values quantized at once before they are packed, 1KiB of codes on the stack
+#define TRAJECTORY_BLOCK_SIZE (256)
+
+Sint32 trajectory_quantize(float value, float inv_precision);
+Uint8* trajectory_pack(const Uint32* zigzags, Uint64 count, Uint8* out);
+bool trajectory_read_footer(const SPS_TrajectoryFile* file,
+                            SPS_TrajectoryFooter* footer);
+bool trajectory_load_index(SPS_TrajectoryFile* file, const char* path);
+bool trajectory_walk_frames(SPS_TrajectoryFile* file, const char* path);
+bool trajectory_add_frame(SPS_TrajectoryFile* file,
+                          Uint64* capacity,
+                          SPS_TrajectoryFrame frame);
+
+Uint64 SPS_TrajectoryEncodeStream(const float* values,
+                                  Uint64 count,
+                                  float precision,
+                                  bool keyframe,
+                                  Sint32* codes,
+                                  Uint8* dest) {
+  const float inv_precision = 1.0f / precision;
+  Uint8* out = dest;
+  for (Uint64 first = 0; first < count; first += TRAJECTORY_BLOCK_SIZE) {
+    const Uint64 block_count = SDL_min(count - first, TRAJECTORY_BLOCK_SIZE);
+
+    // Quantizing a block apart from packing it keeps both loops free of
+    // dependencies on the output length
+    Uint32 zigzags[TRAJECTORY_BLOCK_SIZE];
+    for (Uint64 i = 0; i < block_count; i++) {
+      Sint32 code = trajectory_quantize(values[first + i], inv_precision);
+      Uint32 delta = (Uint32)code - (keyframe ? 0u : (Uint32)codes[first + i]);
+      codes[first + i] = code;
+
+      // Zigzag keeps small negative differences short
+      zigzags[i] = (delta << 1) ^ (Uint32)((Sint32)delta >> 31);
+    }
+    out = trajectory_pack(zigzags, block_count, out);
+  }
+  return (Uint64)(out - dest);
+}
+
+Uint64 SPS_TrajectoryEncodeIds(const float* ids,
+                               Uint64 count,
+                               Sint32* codes,
+                               Uint8* dest) {
+  // The bits are the code, zigzagged like a keyframe so one decoder reads
+  // every stream
+  SDL_memcpy(codes, ids, sizeof(Sint32) * count);
+  Uint8* out = dest;
+  for (Uint64 first = 0; first < count; first += TRAJECTORY_BLOCK_SIZE) {
+    const Uint64 block_count = SDL_min(count - first, TRAJECTORY_BLOCK_SIZE);
+    Uint32 zigzags[TRAJECTORY_BLOCK_SIZE];
+    for (Uint64 i = 0; i < block_count; i++) {
+      Uint32 id = (Uint32)codes[first + i];
+      zigzags[i] = (id << 1) ^ (Uint32)((Sint32)id >> 31);
+    }
+    out = trajectory_pack(zigzags, block_count, out);
+  }
+  return (Uint64)(out - dest);
+}
+
+bool SPS_TrajectoryDecodeStream(const Uint8* src,
+                                Uint64 size,
+                                Uint64 count,
+                                float precision,
+                                bool keyframe,
+                                Sint32* codes,
+                                float* values) {
+  const Uint8* end = src + size;
+  for (Uint64 i = 0; i < count; i++) {
+    Uint32 zigzag = 0;
+    if (end - src >= 8) {
+      // Loads a word and keeps the bytes up to the first one without a
+      // continuation bit, a sixth byte never belongs to a varint
+      Uint64 word;
+      SDL_memcpy(&word, src, sizeof(word));
+      Uint64 more = (word >> 7) & 1;
+      Uint64 length = 1 + more;
+      more &= word >> 15;
+      length += more;
+      more &= word >> 23;
+      length += more;
+      more &= word >> 31;
+      length += more;
+      if (more & (word >> 39)) {
+        return false;
+      }
+      word &= ~0ull >> (64 - 8 * length);
+      zigzag = (Uint32)((word & 0x7f) | ((word >> 1) & 0x3f80) |
+                        ((word >> 2) & 0x1fc000) | ((word >> 3) & 0xfe00000) |
+                        ((word >> 4) & 0xf0000000));
+      src += length;
+    } else {
+      Uint32 shift = 0;
+      Uint8 byte = 0;
+      do {
+        if (src == end || shift > 28) {
+          return false;
+        }
+        byte = *src++;
+        zigzag |= (Uint32)(byte & 0x7f) << shift;
+        shift += 7;
+      } while (byte & 0x80);
+    }
+
+    Uint32 delta = (zigzag >> 1) ^ (0u - (zigzag & 1));
+    Sint32 code = (Sint32)(delta + (keyframe ? 0u : (Uint32)codes[i]));
+    codes[i] = code;
+    if (values != NULL) {
+      values[i] = (float)code * precision;
+    }
+  }
+  return src == end;
+}
+
+bool SPS_TrajectoryFileOpen(SPS_TrajectoryFile* file, const char* path) {
+  SDL_memset(file, 0, sizeof(SPS_TrajectoryFile));
+  if (SDL_BYTEORDER != SDL_LIL_ENDIAN) {
+    SDL_Log("Trajectories are little-endian, this platform can't read them");
+    return false;
+  }
+
+  if (!SPS_MappedFileOpen(&file->map, path)) {
+    return false;
+  }
+  file->header = (const SPS_TrajectoryHeader*)file->map.data;
+  const SPS_TrajectoryHeader* header = file->header;
+  if (file->map.size < sizeof(SPS_TrajectoryHeader) ||
+      SDL_memcmp(header->magic, SPS_TRAJECTORY_MAGIC,
+                 sizeof(header->magic)) != 0 ||
+      header->version != SPS_TRAJECTORY_VERSION ||
+      !(header->position_precision > 0.0f) ||
+      !(header->velocity_precision > 0.0f)) {
+    SDL_Log("%s is not a trajectory of version %u", path,
+            SPS_TRAJECTORY_VERSION);
+    SPS_TrajectoryFileClose(file);
+    return false;
+  }
+
+  // A closed recording lists its frames, only one cut short is walked
+  if (!trajectory_load_index(file, path) &&
+      !trajectory_walk_frames(file, path)) {
+    SPS_TrajectoryFileClose(file);
+    return false;
+  }
+
+  if (file->frames_count == 0) {
+    SDL_Log("Trajectory %s has no frames", path);
+    SPS_TrajectoryFileClose(file);
+    return false;
+  }
+  return true;
+}
+
+Uint64 SPS_TrajectoryFileFindFrame(const SPS_TrajectoryFile* file,
+                                   double step) {
+  // Steps only grow through the file, dropped ones leave gaps
+  Uint64 first = 0;
+  Uint64 last = file->frames_count;
+  while (last - first > 1) {
+    Uint64 middle = first + (last - first) / 2;
+    if ((double)file->frames[middle].step <= step) {
+      first = middle;
+    } else {
+      last = middle;
+    }
+  }
+  return first;
+}
+
+bool SPS_TrajectoryFileDecode(const SPS_TrajectoryFile* file,
+                              Uint64 frame,
+                              Sint32* codes,
+                              float* const values[SPS_TRAJECTORY_STREAMS]) {
+  const SPS_TrajectoryFrame* entry = &file->frames[frame];
+  SPS_TrajectoryFrameHeader header;
+  SDL_memcpy(&header, file->map.data + entry->offset, sizeof(header));
+  const Uint8* src = file->map.data + entry->offset + sizeof(header);
+  const Uint64 count = entry->count;
+
+  // Frames from the index were never looked at, their streams have to stay
+  // inside the file
+  Uint64 left = file->map.size - entry->offset - sizeof(header);
+  bool valid = SDL_memcmp(header.magic, SPS_TRAJECTORY_FRAME_MAGIC,
+                          sizeof(header.magic)) == 0 &&
+               header.count == count &&
+               (header.keyframe != 0) == (entry->keyframe == frame) &&
+               (header.keyframe || header.sizes[SPS_TRAJECTORY_ID_STREAM] == 0);
+  for (Uint32 s = 0; s < SPS_TRAJECTORY_STREAMS && valid; s++) {
+    valid = header.sizes[s] <= left;
+    left -= valid ? header.sizes[s] : 0;
+  }
+  if (!valid) {
+    return false;
+  }
+
+  for (Uint32 s = 0; s < SPS_TRAJECTORY_ID_STREAM; s++) {
+    const float precision = s < 3 ? file->header->position_precision
+                                  : file->header->velocity_precision;
+    if (!SPS_TrajectoryDecodeStream(src, header.sizes[s], count, precision,
+                                    header.keyframe, codes + count * s,
+                                    values[s])) {
+      return false;
+    }
+    src += header.sizes[s];
+  }
+
+  // Only keyframes store ids, the frames after them keep their codes
+  Sint32* ids = codes + count * SPS_TRAJECTORY_ID_STREAM;
+  if (header.keyframe &&
+      !SPS_TrajectoryDecodeStream(src, header.sizes[SPS_TRAJECTORY_ID_STREAM],
+                                  count, 1.0f, true, ids, NULL)) {
+    return false;
+  }
+  SDL_memcpy(values[SPS_TRAJECTORY_ID_STREAM], ids, sizeof(float) * count);
+  return true;
+}
+
+void SPS_TrajectoryFileClose(SPS_TrajectoryFile* file) {
+  SPS_MappedFileClose(&file->map);
+  SDL_free(file->frames);
+  SDL_memset(file, 0, sizeof(SPS_TrajectoryFile));
+}
+
+Sint32 trajectory_quantize(float value, float inv_precision) {
+  // Saturates, NaN ends at the lowest code
+  float scaled = value * inv_precision;
+  scaled = scaled > -TRAJECTORY_CODE_LIMIT ? scaled : -TRAJECTORY_CODE_LIMIT;
+  scaled = scaled < TRAJECTORY_CODE_LIMIT ? scaled : TRAJECTORY_CODE_LIMIT;
+
+  // Rounds half away from zero from the truncation, comparisons instead of
+  // a branch on the sign that mispredicts on every other particle
+  Sint32 code = (Sint32)scaled;
+  float fraction = scaled - (float)code;
+  return code + (fraction >= 0.5f) - (fraction <= -0.5f);
+}
+
+Uint8* trajectory_pack(const Uint32* zigzags, Uint64 count, Uint8* out) {
+  // 7 bits per byte, spread and stored as one word so only the length
+  // varies
+  for (Uint64 i = 0; i < count; i++) {
+    const Uint32 zigzag = zigzags[i];
+    Uint64 length = 1 + (zigzag >= 1u << 7) + (zigzag >= 1u << 14) +
+                    (zigzag >= 1u << 21) + (zigzag >= 1u << 28);
+    Uint64 word = (zigzag & 0x7full) | ((zigzag & 0x3f80ull) << 1) |
+                  ((zigzag & 0x1fc000ull) << 2) |
+                  ((zigzag & 0xfe00000ull) << 3) |
+                  ((zigzag & 0xf0000000ull) << 4);
+    word |= 0x8080808080ull & ((1ull << (8 * (length - 1))) - 1);
+    SDL_memcpy(out, &word, sizeof(word));
+    out += length;
+  }
+  return out;
+}
+
+bool trajectory_read_footer(const SPS_TrajectoryFile* file,
+                            SPS_TrajectoryFooter* footer) {
+  const Uint64 size = file->map.size;
+  if (size < sizeof(SPS_TrajectoryHeader) + sizeof(SPS_TrajectoryFooter)) {
+    return false;
+  }
+  SDL_memcpy(footer, file->map.data + size - sizeof(*footer), sizeof(*footer));
+  return SDL_memcmp(footer->magic, SPS_TRAJECTORY_INDEX_MAGIC,
+                    sizeof(footer->magic)) == 0 &&
+         footer->index_offset >= sizeof(SPS_TrajectoryHeader) &&
+         footer->index_offset <= size - sizeof(SPS_TrajectoryFooter);
+}
+
+bool trajectory_load_index(SPS_TrajectoryFile* file, const char* path) {
+  SPS_TrajectoryFooter footer;
+  if (!trajectory_read_footer(file, &footer)) {
+    return false;
+  }
+
+  // The index fills the space up to the footer exactly
+  const Uint64 end = footer.index_offset;
+  const Uint64 index_size =
+      file->map.size - sizeof(SPS_TrajectoryFooter) - end;
+  const Uint64 count = footer.frames_count;
+  if (count == 0 || index_size / sizeof(SPS_TrajectoryFrame) != count ||
+      index_size % sizeof(SPS_TrajectoryFrame) != 0) {
+    SDL_Log("Trajectory %s has a broken index, walking its frames", path);
+    return false;
+  }
+
+  // One copy, the index starts at any byte
+  SPS_TrajectoryFrame* frames = SDL_malloc(index_size);
+  if (frames == NULL) {
+    SDL_Log("Couldn't allocate the table of %" SDL_PRIu64 " frames", count);
+    return false;
+  }
+  SDL_memcpy(frames, file->map.data + end, index_size);
+
+  // A delta frame continues the chain of the frame before it, steps and
+  // offsets only grow
+  Uint64 max_count = 0;
+  for (Uint64 f = 0; f < count; f++) {
+    const SPS_TrajectoryFrame* frame = &frames[f];
+    const SPS_TrajectoryFrame* previous = f > 0 ? &frames[f - 1] : NULL;
+    bool valid =
+        frame->offset >= sizeof(SPS_TrajectoryHeader) && frame->offset <= end &&
+        end - frame->offset >= sizeof(SPS_TrajectoryFrameHeader) &&
+        frame->count <= SDL_MAX_UINT32 &&
+        (frame->keyframe == f ||
+         (previous != NULL && frame->keyframe == previous->keyframe &&
+          frame->count == previous->count));
+    if (valid && previous != NULL) {
+      valid = frame->offset > previous->offset && frame->step >= previous->step;
+    }
+    if (!valid) {
+      SDL_Log("Trajectory %s has a broken index, walking its frames", path);
+      SDL_free(frames);
+      return false;
+    }
+    max_count = SDL_max(max_count, frame->count);
+  }
+
+  file->frames = frames;
+  file->frames_count = count;
+  file->max_count = max_count;
+  return true;
+}
+
+bool trajectory_walk_frames(SPS_TrajectoryFile* file, const char* path) {
+  // Only the headers are read, a page per frame. A closed recording ends its
+  // frames where the index starts
+  SPS_TrajectoryFooter footer;
+  const Uint64 end = trajectory_read_footer(file, &footer)
+                         ? footer.index_offset
+                         : file->map.size;
+  Uint64 capacity = 0;
+  Uint64 offset = sizeof(SPS_TrajectoryHeader);
+  Uint64 keyframe = 0;
+  while (end - offset >= sizeof(SPS_TrajectoryFrameHeader)) {
+    // Payloads leave the headers at any byte, copying avoids unaligned loads
+    SPS_TrajectoryFrameHeader frame;
+    SDL_memcpy(&frame, file->map.data + offset, sizeof(frame));
+    Uint64 size = 0;
+    bool valid = SDL_memcmp(frame.magic, SPS_TRAJECTORY_FRAME_MAGIC,
+                            sizeof(frame.magic)) == 0 &&
+                 frame.count <= SDL_MAX_UINT32;
+    for (Uint32 s = 0; s < SPS_TRAJECTORY_STREAMS && valid; s++) {
+      valid = frame.sizes[s] <= end - offset;
+      size += frame.sizes[s];
+    }
+
+    // A delta frame has to follow a frame of the same count
+    const Uint64 frames_count = file->frames_count;
+    valid = valid &&
+            size <= end - offset - sizeof(SPS_TrajectoryFrameHeader) &&
+            (frame.keyframe ||
+             (frames_count > 0 &&
+              file->frames[frames_count - 1].count == frame.count));
+    if (!valid) {
+      SDL_Log("Trajectory %s is broken after %" SDL_PRIu64 " frames", path,
+              frames_count);
+      break;
+    }
+
+    keyframe = frame.keyframe ? frames_count : keyframe;
+    SPS_TrajectoryFrame entry = {
+        .step = frame.step,
+        .offset = offset,
+        .count = frame.count,
+        .keyframe = keyframe,
+    };
+    if (!trajectory_add_frame(file, &capacity, entry)) {
+      return false;
+    }
+    file->max_count = SDL_max(file->max_count, frame.count);
+    offset += sizeof(SPS_TrajectoryFrameHeader) + size;
+  }
+  return true;
+}
+
+bool trajectory_add_frame(SPS_TrajectoryFile* file,
+                          Uint64* capacity,
+                          SPS_TrajectoryFrame frame) {
+  if (file->frames_count == *capacity) {
+    Uint64 new_capacity = SDL_max(64, *capacity * 2);
+    SPS_TrajectoryFrame* frames = SDL_realloc(
+        file->frames, sizeof(SPS_TrajectoryFrame) * new_capacity);
+    if (frames == NULL) {
+      SDL_Log("Couldn't allocate the table of %" SDL_PRIu64 " frames",
+              new_capacity);
+      return false;
+    }
+    file->frames = frames;
+    *capacity = new_capacity;
+  }
+  file->frames[file->frames_count++] = frame;
+  return true;
+}
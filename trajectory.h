@@ -0,0 +1,123 @@
+#ifndef SPS_TRAJECTORY_H
+#define SPS_TRAJECTORY_H
+
+#include <SDL3/SDL_stdinc.h>
+#include "mapped_file.h"
+
+#define SPS_TRAJECTORY_VERSION (3)
+
+// Magics of the file header, the frame headers and the footer.
+#define SPS_TRAJECTORY_MAGIC "SPSTRACE"
+#define SPS_TRAJECTORY_FRAME_MAGIC "FRAM"
+#define SPS_TRAJECTORY_INDEX_MAGIC "SPSINDEX"
+
+// Channels of a frame: position x, y, z, velocity x, y, z then the ids.
+#define SPS_TRAJECTORY_STREAMS (7)
+#define SPS_TRAJECTORY_ID_STREAM (6)
+
+// Bytes dest needs for an encoded stream of count values, five per varint
+// and the slack the last one is stored with.
+#define SPS_TRAJECTORY_MAX_STREAM_SIZE(count) ((count) * 5 + 8)
+
+// First 64 bytes of a trajectory file, every field little-endian. Frames
+// follow back to back, then the frame index and the footer once the
+// recording is closed.
+typedef struct {
+  char magic[8];  // "SPSTRACE"
+  Uint32 version;
+  Uint32 keyframe_interval;  // frames between keyframes
+  float position_precision;   // world units per position code
+  float velocity_precision;   // units per second per velocity code
+  Uint8 padding[40];
+} SPS_TrajectoryHeader;
+
+// Precedes the streams of a frame. A keyframe holds quantized codes and the
+// particle ids, any other frame the differences to the codes of the frame
+// before it, which always holds the same particles at the same indices. The
+// id stream of those is empty, the ids stay.
+typedef struct {
+  char magic[4];  // "FRAM"
+  Uint32 keyframe;
+  Uint64 step;   // updates simulated when it was captured
+  Uint64 count;  // particles
+
+  // Encoded bytes of every stream, they follow in order
+  Uint64 sizes[SPS_TRAJECTORY_STREAMS];
+} SPS_TrajectoryFrameHeader;
+
+// A frame of a trajectory. A closed file ends with the index, one per frame,
+// readers seek to the keyframe before a step and decode forward from it.
+typedef struct {
+  Uint64 step;
+  Uint64 offset;  // of its frame header from the start of the file
+  Uint64 count;
+  Uint64 keyframe;  // frame its decoding has to start from
+} SPS_TrajectoryFrame;
+
+// Last 24 bytes of a closed file, the index is right before it. A file cut
+// short has none, its frames can still be found by walking the frame headers.
+typedef struct {
+  Uint64 index_offset;
+  Uint64 frames_count;
+  char magic[8];  // "SPSINDEX"
+} SPS_TrajectoryFooter;
+
+// A trajectory mapped read only with the table of its frames.
+typedef struct {
+  SPS_MappedFile map;
+  const SPS_TrajectoryHeader* header;
+  SPS_TrajectoryFrame* frames;
+  Uint64 frames_count;
+  Uint64 max_count;  // most particles of any frame
+} SPS_TrajectoryFile;
+
+// Quantizes count values to codes of precision and writes them to dest as
+// zigzag varints, raw on a keyframe or as differences to the codes already
+// in codes otherwise. codes ends with the codes of this frame. Returns the
+// bytes written, dest has to hold SPS_TRAJECTORY_MAX_STREAM_SIZE(count).
+Uint64 SPS_TrajectoryEncodeStream(const float* values,
+                                  Uint64 count,
+                                  float precision,
+                                  bool keyframe,
+                                  Sint32* codes,
+                                  Uint8* dest);
+
+// Writes count ids to dest as varints of their bits and copies them to codes
+// as they are. Returns the bytes written, dest has to hold
+// SPS_TRAJECTORY_MAX_STREAM_SIZE(count).
+Uint64 SPS_TrajectoryEncodeIds(const float* ids,
+                               Uint64 count,
+                               Sint32* codes,
+                               Uint8* dest);
+
+// Inverse of SPS_TrajectoryEncodeStream, fails when the size bytes of src
+// don't hold exactly count varints. values may be NULL to only get codes.
+bool SPS_TrajectoryDecodeStream(const Uint8* src,
+                                Uint64 size,
+                                Uint64 count,
+                                float precision,
+                                bool keyframe,
+                                Sint32* codes,
+                                float* values);
+
+// Maps a trajectory and reads its frames from the index, or walks the frame
+// headers when the recording was cut short and keeps the frames before the
+// first broken one.
+bool SPS_TrajectoryFileOpen(SPS_TrajectoryFile* file, const char* path);
+
+// Last frame captured at or before step, the first one when all are later.
+Uint64 SPS_TrajectoryFileFindFrame(const SPS_TrajectoryFile* file,
+                                   double step);
+
+// Decodes the streams of a frame into values, codes has to hold the codes
+// of the frame before it unless it is a keyframe and ends with its own.
+// Fails when the frame header doesn't match its entry of the index.
+bool SPS_TrajectoryFileDecode(const SPS_TrajectoryFile* file,
+                              Uint64 frame,
+                              Sint32* codes,
+                              float* const values[SPS_TRAJECTORY_STREAMS]);
+
+// Unmaps the file and frees its frame table.
+void SPS_TrajectoryFileClose(SPS_TrajectoryFile* file);
+
+#endif /* SPS_TRAJECTORY_H */
@@ -0,0 +1,28 @@
+#include "triple_buffer.h"
+
+void SPS_TripleBufferLoad(SPS_TripleBuffer* buffer) {
+  buffer->back = 0;
+  atomic_init(&buffer->middle, 1);
+  buffer->front = 2;
+}
+
+Uint32 SPS_TripleBufferPublish(SPS_TripleBuffer* buffer) {
+  // Release makes the slot contents visible before the reader can take it
+  Uint32 previous = atomic_exchange_explicit(
+      &buffer->middle, buffer->back | SPS_TRIPLE_BUFFER_FRESH,
+      memory_order_acq_rel);
+  buffer->back = previous & ~SPS_TRIPLE_BUFFER_FRESH;
+  return buffer->back;
+}
+
+bool SPS_TripleBufferAcquire(SPS_TripleBuffer* buffer) {
+  if ((atomic_load_explicit(&buffer->middle, memory_order_relaxed) &
+       SPS_TRIPLE_BUFFER_FRESH) == 0) {
+    return false;
+  }
+
+  Uint32 previous = atomic_exchange_explicit(&buffer->middle, buffer->front,
+                                             memory_order_acq_rel);
+  buffer->front = previous & ~SPS_TRIPLE_BUFFER_FRESH;
+  return true;
+}
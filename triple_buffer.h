@@ -0,0 +1,29 @@
+#ifndef SPS_TRIPLE_BUFFER_H
+#define SPS_TRIPLE_BUFFER_H
+
+#include <SDL3/SDL_stdinc.h>
+#include <stdatomic.h>
+
+// Set on the middle slot while the reader hasn't taken it yet.
+#define SPS_TRIPLE_BUFFER_FRESH (4u)
+
+// Lock-free handoff of the latest of three slots from one writer to one
+// reader, neither side ever waits and the reader always gets the newest
+// complete slot.
+typedef struct {
+  _Atomic Uint32 middle;
+  Uint32 back;   // slot the writer fills
+  Uint32 front;  // slot the reader uses
+} SPS_TripleBuffer;
+
+// Gives slot 0 to the writer and slot 2 to the reader.
+void SPS_TripleBufferLoad(SPS_TripleBuffer* buffer);
+
+// Writer side, hands the filled back slot over and returns the next one.
+Uint32 SPS_TripleBufferPublish(SPS_TripleBuffer* buffer);
+
+// Reader side, moves front to the newest published slot if there is one.
+// Returns whether front changed.
+bool SPS_TripleBufferAcquire(SPS_TripleBuffer* buffer);
+
+#endif /* SPS_TRIPLE_BUFFER_H */
@@ -392,6 +392,44 @@ void SPS_Mat4TransformVec4(const SPS_Mat4 m, const SPS_Vec4 v, SPS_Vec4 dest) {
   dest[3] = m[XW] * v[0] + m[YW] * v[1] + m[ZW] * v[2] + m[WW] * v[3];
 }
 
+void SPS_Mat4FrustumPlanes(const SPS_Mat4 m, SPS_Vec4 planes[6]) {
+  // A point p lands in clip space at (row0.p, row1.p, row2.p, row3.p)
+  float rows[4][4];
+  for (int r = 0; r < 4; r++) {
+    rows[r][0] = m[XX + r];
+    rows[r][1] = m[YX + r];
+    rows[r][2] = m[ZX + r];
+    rows[r][3] = m[WX + r];
+  }
+
+  // -w <= x <= w, -w <= y <= w and 0 <= z <= w
+  for (int c = 0; c < 4; c++) {
+    planes[0][c] = rows[3][c] + rows[0][c];
+    planes[1][c] = rows[3][c] - rows[0][c];
+    planes[2][c] = rows[3][c] + rows[1][c];
+    planes[3][c] = rows[3][c] - rows[1][c];
+    planes[4][c] = rows[2][c];
+    planes[5][c] = rows[3][c] - rows[2][c];
+  }
+}
+
+bool SPS_FrustumTestBox(const SPS_Vec4 planes[6],
+                        const SPS_Vec3 min,
+                        const SPS_Vec3 max) {
+  for (int i = 0; i < 6; i++) {
+    // Corner furthest along the plane normal
+    const float* plane = planes[i];
+    float x = plane[0] > 0.0f ? max[0] : min[0];
+    float y = plane[1] > 0.0f ? max[1] : min[1];
+    float z = plane[2] > 0.0f ? max[2] : min[2];
+    if (plane[0] * x + plane[1] * y + plane[2] * z + plane[3] < 0.0f) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
 void SPS_XFormIdentity(SPS_XForm dest) {
   // rotation (quat)
   dest[0] = 0.0f;
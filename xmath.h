@@ -109,6 +109,16 @@ void SPS_Mat4ToQuat(const SPS_Mat4 m, SPS_Quat dest);
 // Transform a Vec4 in the space of mat4 into dest
 void SPS_Mat4TransformVec4(const SPS_Mat4 m, const SPS_Vec4 v, SPS_Vec4 dest);
 
+// Extract the clip planes of a projection (times view) matrix with a 0..1
+// depth range, points inside have dot(plane.xyz, p) + plane.w >= 0
+void SPS_Mat4FrustumPlanes(const SPS_Mat4 m, SPS_Vec4 planes[6]);
+
+// Check if an axis aligned box is at least partly inside frustum planes,
+// boxes near the corners may pass without being visible
+bool SPS_FrustumTestBox(const SPS_Vec4 planes[6],
+                        const SPS_Vec3 min,
+                        const SPS_Vec3 max);
+
 // Initialiaze a transform to identity
 void SPS_XFormIdentity(SPS_XForm dest);
 